@@ -0,0 +1,4 @@
+include(`foreachq3.m4')dnl
+include(`repeat.m4')dnl
+foreachq(`x', repeat(decr(n), `an argument of a few dozen bytes or so,')dnl
+`an argument of a few dozen bytes or so', `x')dnl
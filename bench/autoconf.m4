@@ -0,0 +1,21 @@
+include(`forloop2.m4')dnl
+divert(`-1')
+# A run shaped like Autoconf, without needing Autoconf: every
+# AC_CHECK_n macro requires AC_CHECK_(n/2) once, and writes shell
+# code into two diversions, using translit and patsubst along the way.
+define(`upcase', `translit(`$1', `abcdefghijklmnopqrstuvwxyz',
+  `ABCDEFGHIJKLMNOPQRSTUVWXYZ')')
+define(`shellquote', `patsubst(`$1', `[\\"$]', `\\\&')')
+define(`check', `ifdef(`provided_$1', `',
+`define(`provided_$1')ifelse(`$1', `1', `', `check(eval(`$1 / 2'))')dnl
+divert(`2')ac_var_$1=no
+divert(`3')# Checking for feature $1.
+if test "$ac_var_$1" = yes; then
+  echo "shellquote(`feature $1 is "yes"')"
+  upcase(`have_feature_$1')=1
+fi
+divert(`-1')')')
+forloop(`i', `1', n, `define(`AC_CHECK_'i, `check('i`)')')
+forloop(`i', `1', n, `indir(`AC_CHECK_'i)')
+divert`'dnl
+undivert(`2', `3')dnl
@@ -0,0 +1,527 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* m4-bench runs the benchmarks behind `make bench'.  Each benchmark
+   is an m4 script in the bench directory, run on its own by an m4
+   program given on the command line, possibly on input that another
+   script generated beforehand.  Only the main run is timed; it is
+   repeated, and the fastest run is reported as nanoseconds per
+   operation, megabytes of input per second where that makes sense,
+   and the peak resident set size of m4.  The results can also be
+   written as JSON, to track them from one commit to the next.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "closeout.h"
+#include "error.h"
+#include "gettext.h"
+#include "getopt.h"
+#include "progname.h"
+#include "quotearg.h"
+#include "version-etc.h"
+#include "xalloc.h"
+
+#define _(msgid) gettext (msgid)
+
+#define STREQ(a, b) (strcmp (a, b) == 0)
+
+/* Longest argument list of a benchmark, including the terminating
+   NULL.  */
+#define BENCH_MAX_ARGS 8
+
+/* A benchmark.  In the argument lists, every `@' is replaced by the
+   benchmark directory, and every `#' by the operation count.  */
+typedef struct {
+  const char *name;             /* name on the command line and in output */
+  unsigned long int ops;        /* operations per run, before --scale */
+  const char *prepare[BENCH_MAX_ARGS]; /* untimed m4 arguments, or NULL */
+  const char *prepare_output;   /* file for output of PREPARE, or NULL */
+  const char *run[BENCH_MAX_ARGS]; /* timed m4 arguments */
+  const char *input;            /* file whose size is the input, or NULL */
+  unsigned long int op_bytes;   /* otherwise, bytes handled per op, or 0 */
+} benchmark;
+
+static const benchmark benchmarks[] = {
+  /* Lexer throughput on text with no macro calls, on quoted strings,
+     and on comments.  An operation is a line of input.  */
+  { "lexer-text", 131072,
+    { "-I@", "-Dn=#", "@/gen-text.m4" }, "text.in",
+    { "text.in" }, "text.in", 0 },
+  { "lexer-quoted", 524288,
+    { "-I@", "-Dn=#", "@/gen-quoted.m4" }, "quoted.in",
+    { "quoted.in" }, "quoted.in", 0 },
+  { "lexer-comments", 524288,
+    { "-I@", "-Dn=#", "@/gen-comments.m4" }, "comments.in",
+    { "comments.in" }, "comments.in", 0 },
+
+  /* Symbol table churn; an operation defines, pushes, pops and
+     undefines one name.  */
+  { "symtab", 10000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/symtab.m4" }, NULL, 0 },
+
+  /* Recursion in the looping macros of the manual; an operation is
+     one iteration.  */
+  { "forloop", 100000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/forloop.m4" }, NULL, 0 },
+  { "foreachq", 20000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/foreachq.m4" }, NULL, 0 },
+
+  /* Walking a long argument list with shift($@); an operation is one
+     argument.  */
+  { "shift", 50000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/shift.m4" }, NULL, 0 },
+
+  /* Walking arguments of a few dozen bytes each, too long to be
+     copied when rescanned under the default inlining threshold; an
+     operation is one argument.  */
+  { "arglen", 20000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/arglen.m4" }, NULL, 0 },
+
+  /* Regular expressions cycling through more patterns than the regex
+     cache holds; an operation is one regexp and one patsubst.  */
+  { "regexp", 20000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/regexp.m4" }, NULL, 0 },
+
+  /* Diversions large enough to spill to temporary files; an
+     operation diverts and later undiverts one megabyte.  */
+  { "diversion", 64, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/diversion.m4" }, NULL,
+    1048576 },
+
+  /* Reloading a frozen file; an operation is one definition.  */
+  { "frozen", 100000,
+    { "-I@/../doc/examples", "-Dn=#", "-Fstate.m4f", "@/freeze.m4" }, NULL,
+    { "-Rstate.m4f", "@/reload.m4" }, "state.m4f", 0 },
+
+  /* A run shaped like Autoconf: macros that require each other, text
+     collected in diversions, case conversion and quoting by regex.
+     An operation is one macro.  */
+  { "autoconf", 10000, { NULL }, NULL,
+    { "-I@", "-I@/../doc/examples", "-Dn=#", "@/autoconf.m4" }, NULL, 0 },
+};
+
+#define BENCHMARKS_COUNT (sizeof benchmarks / sizeof *benchmarks)
+
+/* Result of timing one benchmark.  */
+typedef struct {
+  unsigned long int ops;        /* operations per run */
+  double seconds;               /* wall time of the fastest run */
+  double bytes;                 /* bytes of input per run, or 0 */
+  long int max_rss;             /* peak resident set size in KiB, or -1 */
+} result;
+
+/* Settings from the command line.  */
+static const char *m4_program = "m4";
+static const char *bench_dir = ".";
+static unsigned long int repeat = 3;
+static unsigned long int scale = 100;
+static bool json;
+static const char *label;
+static const char **m4_options;
+static size_t m4_options_count;
+
+enum
+{
+  FORMAT_OPTION = CHAR_MAX + 1,
+  LABEL_OPTION,
+  LIST_OPTION,
+  M4_OPTION,
+  M4_OPTION_OPTION,
+  REPEAT_OPTION,
+  SCALE_OPTION,
+  SRCDIR_OPTION,
+  HELP_OPTION
+};
+
+static const struct option long_options[] =
+{
+  {"format", required_argument, NULL, FORMAT_OPTION},
+  {"label", required_argument, NULL, LABEL_OPTION},
+  {"list", no_argument, NULL, LIST_OPTION},
+  {"m4", required_argument, NULL, M4_OPTION},
+  {"m4-option", required_argument, NULL, M4_OPTION_OPTION},
+  {"repeat", required_argument, NULL, REPEAT_OPTION},
+  {"scale", required_argument, NULL, SCALE_OPTION},
+  {"srcdir", required_argument, NULL, SRCDIR_OPTION},
+  {"help", no_argument, NULL, HELP_OPTION},
+  { NULL, 0, NULL, 0 },
+};
+
+/* Print a usage message and exit with STATUS.  */
+static void
+usage (int status)
+{
+  if (status != EXIT_SUCCESS)
+    fprintf (stderr, _("Try `%s --help' for more information.\n"),
+             program_name);
+  else
+    {
+      printf (_("Usage: %s [OPTION]... [BENCHMARK]...\n"), program_name);
+      fputs (_("\
+Time the m4 benchmarks named by BENCHMARKs, or all of them, in the\n\
+current directory, which should be empty.\n\
+"), stdout);
+      puts ("");
+      fputs (_("\
+      --format=FORMAT          write results as `text' or `json' [text]\n\
+      --label=STRING           record STRING, such as a commit, in json\n\
+      --list                   list the benchmarks and exit\n\
+      --m4=PROGRAM             run PROGRAM as m4 [m4]\n\
+      --m4-option=OPTION       pass OPTION to each timed run of m4\n\
+      --repeat=N               time each benchmark N times [3]\n\
+      --scale=PERCENT          scale the size of each benchmark [100]\n\
+      --srcdir=DIR             find the benchmark scripts in DIR [.]\n\
+      --help                   display this help and exit\n\
+"), stdout);
+      emit_bug_reporting_address ();
+    }
+  exit (status);
+}
+
+/* Parse the positive number ARG of the option NAME.  */
+static unsigned long int
+number_arg (const char *name, const char *arg)
+{
+  char *end;
+  unsigned long int value;
+
+  errno = 0;
+  value = strtoul (arg, &end, 10);
+  if (errno || end == arg || *end || !value)
+    error (EXIT_FAILURE, 0, _("invalid argument to --%s: %s"), name,
+           quote (arg));
+  return value;
+}
+
+/* Return the current time in seconds, from an arbitrary origin.  */
+static double
+now (void)
+{
+#if HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+}
+
+/* Return a copy of the benchmark argument ARG, with its placeholders
+   replaced for OPS operations.  */
+static char *
+expand_arg (const char *arg, unsigned long int ops)
+{
+  size_t size = strlen (arg) + 1;
+  const char *p;
+  char *result;
+  char *q;
+
+  for (p = arg; *p; p++)
+    size += *p == '@' ? strlen (bench_dir) : *p == '#' ? 3 * sizeof ops : 0;
+  result = q = xcharalloc (size);
+  for (p = arg; *p; p++)
+    if (*p == '@')
+      {
+        strcpy (q, bench_dir);
+        q += strlen (bench_dir);
+      }
+    else if (*p == '#')
+      q += sprintf (q, "%lu", ops);
+    else
+      *q++ = *p;
+  *q = '\0';
+  return result;
+}
+
+/* Run m4 with the benchmark arguments ARGS for OPS operations, with
+   standard output going to OUTPUT, or discarded if that is NULL.  If
+   TIMED, pass the --m4-option arguments first.  Exit if m4 fails.
+   Store the peak resident set size of the run in MAX_RSS if known, or
+   -1.  */
+static void
+run_m4 (const char *name, const char *const *args, unsigned long int ops,
+        const char *output, bool timed, long int *max_rss)
+{
+  size_t options = timed ? m4_options_count : 0;
+  char **argv = xnmalloc (options + BENCH_MAX_ARGS + 1, sizeof *argv);
+  struct rusage usage;
+  int status;
+  pid_t child;
+  size_t i;
+
+  argv[0] = (char *) m4_program;
+  for (i = 0; i < options; i++)
+    argv[i + 1] = (char *) m4_options[i];
+  for (i = 0; args[i]; i++)
+    argv[options + i + 1] = expand_arg (args[i], ops);
+  argv[options + i + 1] = NULL;
+
+  fflush (stdout);
+  child = fork ();
+  if (child < 0)
+    error (EXIT_FAILURE, errno, _("cannot run %s"), quote (m4_program));
+  if (child == 0)
+    {
+      int fd = open (output ? output : "/dev/null",
+                     O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (fd < 0 || dup2 (fd, STDOUT_FILENO) < 0)
+        _exit (127);
+      close (fd);
+      execvp (m4_program, argv);
+      _exit (127);
+    }
+
+  memset (&usage, 0, sizeof usage);
+#if HAVE_WAIT4
+  while (wait4 (child, &status, 0, &usage) < 0)
+#else
+  while (waitpid (child, &status, 0) < 0)
+#endif
+    if (errno != EINTR)
+      error (EXIT_FAILURE, errno, _("cannot wait for %s"),
+             quote (m4_program));
+#if !HAVE_WAIT4
+  /* Without wait4, the best available is the peak of all children so
+     far, which is only accurate for the largest benchmark.  */
+  getrusage (RUSAGE_CHILDREN, &usage);
+#endif
+  *max_rss = usage.ru_maxrss ? usage.ru_maxrss : -1;
+
+  for (i = options + 1; argv[i]; i++)
+    free (argv[i]);
+  free (argv);
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    error (EXIT_FAILURE, 0, _("benchmark %s: %s failed"), name,
+           quote (m4_program));
+}
+
+/* Run the benchmark BENCH, and store its timing in RES.  */
+static void
+run_benchmark (const benchmark *bench, result *res)
+{
+  unsigned long int ops = bench->ops * scale / 100;
+  long int max_rss;
+  unsigned long int i;
+  struct stat st;
+
+  if (!ops)
+    ops = 1;
+  if (bench->prepare[0])
+    run_m4 (bench->name, bench->prepare, ops, bench->prepare_output, false,
+            &max_rss);
+
+  res->ops = ops;
+  res->seconds = -1;
+  res->max_rss = -1;
+  for (i = 0; i < repeat; i++)
+    {
+      double start = now ();
+      double seconds;
+
+      run_m4 (bench->name, bench->run, ops, NULL, true, &max_rss);
+      seconds = now () - start;
+      if (res->seconds < 0 || seconds < res->seconds)
+        res->seconds = seconds;
+      if (res->max_rss < max_rss)
+        res->max_rss = max_rss;
+    }
+
+  if (bench->input && stat (bench->input, &st) == 0)
+    res->bytes = st.st_size;
+  else
+    res->bytes = (double) bench->op_bytes * ops;
+}
+
+/* Write RES for the benchmark NAME as text.  */
+static void
+print_text (const char *name, const result *res)
+{
+  printf ("%-16s %10lu %12.1f ", name, res->ops,
+          res->seconds * 1e9 / res->ops);
+  if (res->bytes)
+    printf ("%10.1f ", res->bytes / 1e6 / res->seconds);
+  else
+    printf ("%10s ", "-");
+  if (0 <= res->max_rss)
+    printf ("%10ld\n", res->max_rss);
+  else
+    printf ("%10s\n", "-");
+}
+
+/* Write the string STR as a JSON string.  */
+static void
+print_json_string (const char *str)
+{
+  putchar ('"');
+  for (; *str; str++)
+    {
+      unsigned char ch = *str;
+      if (ch == '"' || ch == '\\')
+        printf ("\\%c", ch);
+      else if (ch < ' ')
+        printf ("\\u%04x", ch);
+      else
+        putchar (ch);
+    }
+  putchar ('"');
+}
+
+/* Write RES for the benchmark NAME as a JSON object, preceded by a
+   comma unless it is the FIRST.  */
+static void
+print_json (const char *name, const result *res, bool first)
+{
+  printf ("%s\n    {\"name\": ", first ? "" : ",");
+  print_json_string (name);
+  printf (", \"ops\": %lu, \"seconds\": %.6f, \"ns_per_op\": %.1f",
+          res->ops, res->seconds, res->seconds * 1e9 / res->ops);
+  if (res->bytes)
+    printf (", \"mb_per_s\": %.1f", res->bytes / 1e6 / res->seconds);
+  else
+    fputs (", \"mb_per_s\": null", stdout);
+  if (0 <= res->max_rss)
+    printf (", \"max_rss_kib\": %ld}", res->max_rss);
+  else
+    fputs (", \"max_rss_kib\": null}", stdout);
+}
+
+int
+main (int argc, char *const *argv)
+{
+  bool selected[BENCHMARKS_COUNT];
+  bool first = true;
+  int optchar;
+  size_t i;
+  int j;
+
+  set_program_name (argv[0]);
+  setlocale (LC_ALL, "");
+  atexit (close_stdout);
+
+  while ((optchar = getopt_long (argc, argv, "", long_options, NULL)) != -1)
+    switch (optchar)
+      {
+      case FORMAT_OPTION:
+        if (STREQ (optarg, "json"))
+          json = true;
+        else if (STREQ (optarg, "text"))
+          json = false;
+        else
+          error (EXIT_FAILURE, 0, _("invalid argument to --%s: %s"),
+                 "format", quote (optarg));
+        break;
+
+      case LABEL_OPTION:
+        label = optarg;
+        break;
+
+      case LIST_OPTION:
+        for (i = 0; i < BENCHMARKS_COUNT; i++)
+          puts (benchmarks[i].name);
+        exit (EXIT_SUCCESS);
+
+      case M4_OPTION:
+        m4_program = optarg;
+        break;
+
+      case M4_OPTION_OPTION:
+        m4_options = xnrealloc (m4_options, m4_options_count + 1,
+                                sizeof *m4_options);
+        m4_options[m4_options_count++] = optarg;
+        break;
+
+      case REPEAT_OPTION:
+        repeat = number_arg ("repeat", optarg);
+        break;
+
+      case SCALE_OPTION:
+        scale = number_arg ("scale", optarg);
+        break;
+
+      case SRCDIR_OPTION:
+        bench_dir = optarg;
+        break;
+
+      case HELP_OPTION:
+        usage (EXIT_SUCCESS);
+
+      default:
+        usage (EXIT_FAILURE);
+      }
+
+  memset (selected, optind == argc, sizeof selected);
+  for (j = optind; j < argc; j++)
+    {
+      for (i = 0; i < BENCHMARKS_COUNT; i++)
+        if (STREQ (argv[j], benchmarks[i].name))
+          break;
+      if (i == BENCHMARKS_COUNT)
+        error (EXIT_FAILURE, 0, _("unknown benchmark %s"), quote (argv[j]));
+      selected[i] = true;
+    }
+
+  if (json)
+    {
+      fputs ("{\"label\": ", stdout);
+      if (label)
+        print_json_string (label);
+      else
+        fputs ("null", stdout);
+      printf (", \"repeat\": %lu, \"scale\": %lu,\n  \"benchmarks\": [",
+              repeat, scale);
+    }
+  else
+    printf ("%-16s %10s %12s %10s %10s\n", _("benchmark"), _("ops"),
+            _("ns/op"), _("MB/s"), _("RSS KiB"));
+  for (i = 0; i < BENCHMARKS_COUNT; i++)
+    if (selected[i])
+      {
+        result res;
+
+        run_benchmark (&benchmarks[i], &res);
+        if (json)
+          print_json (benchmarks[i].name, &res, first);
+        else
+          print_text (benchmarks[i].name, &res);
+        first = false;
+      }
+  if (json)
+    puts ("\n  ]}");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+include(`forloop2.m4')dnl
+include(`repeat.m4')dnl
+divert(`-1')
+# Divert a megabyte at a time into eight diversions, so that they
+# spill to temporary files, and undivert them every eighth time.
+define(`big', repeat(`16384',
+  `Text large enough to spill diversions to temporary files.....
+'))
+divert`'dnl
+forloop(`i', `1', n, `divert(eval(i % 8 + 1))defn(`big')divert`'dnl
+ifelse(eval(i % 8), `0', `undivert')')dnl
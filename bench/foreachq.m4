@@ -0,0 +1,3 @@
+include(`foreachq4.m4')dnl
+include(`repeat.m4')dnl
+foreachq(`x', repeat(decr(n), `item,')item, `x')dnl
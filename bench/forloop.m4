@@ -0,0 +1,2 @@
+include(`forloop2.m4')dnl
+forloop(`i', `1', n, `ifelse(i, `0', `zero')')dnl
@@ -0,0 +1,2 @@
+include(`forloop2.m4')dnl
+forloop(`i', `1', n, `define(`macro'i, `the value of macro 'i)')dnl
@@ -0,0 +1,3 @@
+include(`repeat.m4')dnl
+repeat(n, `# A comment, naming define and shift, which stay unexpanded.
+')dnl
@@ -0,0 +1,3 @@
+include(`repeat.m4')dnl
+repeat(n, ``A quoted string, with `nested' quotes and (parentheses).'
+')dnl
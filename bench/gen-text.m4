@@ -0,0 +1,3 @@
+include(`repeat.m4')dnl
+repeat(n, `The quick brown fox jumps over the lazy dog, 0123456789 times.
+')dnl
@@ -0,0 +1,7 @@
+include(`forloop2.m4')dnl
+divert(`-1')
+# Cycle through more distinct patterns than the regex cache holds.
+define(`test', `regexp(`abc$1xyz', `c'eval(`$1 % 32')`\(.\)', `\1')`'dnl
+patsubst(`hello world $1', `o'eval(`$1 % 32 + 1'), `0')')
+divert`'dnl
+forloop(`i', `1', n, `test(i)')dnl
@@ -0,0 +1,2 @@
+ifdef(`macro1', `', `errprint(`frozen state is missing
+')m4exit(`1')')dnl
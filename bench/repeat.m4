@@ -0,0 +1,6 @@
+divert(`-1')
+# repeat(n, text) - expand to n copies of text
+#   doubles text at each step, so large inputs need few expansions
+define(`repeat', `ifelse(`$1', `0', `',
+  `ifelse(eval(`$1 % 2'), `1', ``$2'')$0(eval(`$1 / 2'), `$2$2')')')
+divert`'dnl
@@ -0,0 +1,4 @@
+include(`repeat.m4')dnl
+define(`walk', `ifelse(`$#', `1', `', `$0(shift($@))')')dnl
+define(`args', repeat(decr(n), `arg,')arg)dnl
+walk(args)dnl
@@ -0,0 +1,5 @@
+include(`forloop2.m4')dnl
+forloop(`i', `1', n, `define(`sym'i, i)')dnl
+forloop(`i', `1', n, `pushdef(`sym'i, `x')')dnl
+forloop(`i', `1', n, `popdef(`sym'i)')dnl
+forloop(`i', `1', n, `undefine(`sym'i)')dnl
@@ -25,6 +25,155 @@
 
 #include "m4private.h"
 
+/* Builtins are found by name through a minimal perfect hash over the
+   names in each module, built when the module is loaded, so that a
+   lookup costs two hashes and a single string comparison however
+   many builtins the module has.  The names are first spread over
+   BUILTINS_BUCKETS buckets by builtin_hash with seed 0; each bucket
+   then gets the smallest displacement D, tried from largest bucket to
+   smallest, such that builtin_hash with seed D sends all of its names
+   to distinct free slots.  BUILTINS_INDEX maps each slot back to the
+   builtin's position in the sorted array, which stays sorted for the
+   benefit of anything that lists builtins in order.  */
+
+/* Average number of names per bucket; larger values save space, but
+   take longer to find displacements.  */
+#define BUILTIN_BUCKET_LOAD     2
+
+/* Give up on a bucket after this many displacements, and fall back on
+   bsearch for the module.  This cannot happen with any sensible set
+   of names.  */
+#define BUILTIN_DISPLACE_MAX    (1 << 16)
+
+typedef struct {
+  size_t bucket;                /* Bucket of the builtin.  */
+  size_t builtin;               /* Index of the builtin.  */
+} builtin_key;
+
+/* Hash NAME, varying the result by SEED.  */
+static size_t M4_GNUC_PURE
+builtin_hash (const char *name, size_t seed)
+{
+  size_t hash = 2166136261U ^ (seed * 0x9e3779b9U);
+
+  while (*name)
+    {
+      hash ^= (unsigned char) *name++;
+      hash *= 16777619U;
+    }
+  return hash ^ (hash >> 15);
+}
+
+/* Comparison function, for use in qsort, which orders builtin keys
+   by bucket.  */
+static int
+compare_builtin_key_CB (const void *a, const void *b)
+{
+  const builtin_key *key_a = (const builtin_key *) a;
+  const builtin_key *key_b = (const builtin_key *) b;
+  return (key_a->bucket > key_b->bucket) - (key_a->bucket < key_b->bucket);
+}
+
+/* Build the perfect hash over the names of the sorted builtins of
+   MODULE.  On the off chance that no displacement works for some
+   bucket, leave the module without an index.  */
+void
+m4__builtin_index (m4_module *module)
+{
+  size_t len = module->builtins_len;
+  size_t buckets = len / BUILTIN_BUCKET_LOAD + 1;
+  builtin_key *keys;
+  size_t *order;                /* Start of each bucket, largest first.  */
+  size_t *size;                 /* Number of names in each bucket.  */
+  size_t *index;
+  size_t *displace;
+  size_t *slots;                /* Slots tried for the current bucket.  */
+  char *taken;
+  size_t i, j, k;
+
+  if (!len)
+    return;
+  keys = (builtin_key *) xnmalloc (len, sizeof *keys);
+  order = (size_t *) xnmalloc (buckets, sizeof *order);
+  size = (size_t *) xcalloc (buckets, sizeof *size);
+  index = (size_t *) xnmalloc (len, sizeof *index);
+  displace = (size_t *) xcalloc (buckets, sizeof *displace);
+  slots = (size_t *) xnmalloc (len, sizeof *slots);
+  taken = (char *) xzalloc (len);
+
+  for (i = 0; i < len; i++)
+    {
+      keys[i].bucket = (builtin_hash (module->builtins[i].builtin.name, 0)
+                        % buckets);
+      keys[i].builtin = i;
+      size[keys[i].bucket]++;
+    }
+  qsort (keys, len, sizeof *keys, compare_builtin_key_CB);
+
+  /* Record where each nonempty bucket starts in KEYS, then sort those
+     starts so that the largest buckets are placed first.  */
+  for (i = k = 0; i < len; i += size[keys[i].bucket])
+    order[k++] = i;
+  for (i = 1; i < k; i++)
+    for (j = i; j && (size[keys[order[j - 1]].bucket]
+                      < size[keys[order[j]].bucket]); j--)
+      {
+        size_t tmp = order[j];
+        order[j] = order[j - 1];
+        order[j - 1] = tmp;
+      }
+
+  for (i = 0; i < k; i++)
+    {
+      const builtin_key *first = &keys[order[i]];
+      size_t count = size[first->bucket];
+      size_t d;
+
+      for (d = 1; d < BUILTIN_DISPLACE_MAX; d++)
+        {
+          for (j = 0; j < count; j++)
+            {
+              const m4__builtin *bp = &module->builtins[first[j].builtin];
+              size_t slot = builtin_hash (bp->builtin.name, d) % len;
+              size_t m;
+
+              if (taken[slot])
+                break;
+              for (m = 0; m < j && slots[m] != slot; m++)
+                ;
+              if (m < j)
+                break;
+              slots[j] = slot;
+            }
+          if (j == count)
+            break;
+        }
+      if (d == BUILTIN_DISPLACE_MAX)
+        {
+          free (index);
+          free (displace);
+          index = displace = NULL;
+          buckets = 0;
+          break;
+        }
+      displace[first->bucket] = d;
+      for (j = 0; j < count; j++)
+        {
+          taken[slots[j]] = 1;
+          index[slots[j]] = first[j].builtin;
+        }
+    }
+
+  module->builtins_index = index;
+  module->builtins_displace = displace;
+  module->builtins_buckets = buckets;
+  free (keys);
+  free (order);
+  free (size);
+  free (slots);
+  free (taken);
+}
+
 /* Comparison function, for use in bsearch, which compares NAME
    against the name of BUILTIN.  */
 static int
@@ -37,8 +186,9 @@ compare_builtin_name_CB (const void *name, const void *b)
 /* Find the builtin which has NAME.  If MODULE is not NULL, then
    search only in MODULE's builtin table.  The result is a malloc'd
    symbol value, suitable for use in the symbol table or for an
-   argument to m4_push_builtin.  */
-m4_symbol_value * M4_GNUC_PURE
+   argument to m4_push_builtin.  A module still waiting to be
+   autoloaded is opened first.  */
+m4_symbol_value *
 m4_builtin_find_by_name (m4 *context, m4_module *module, const char *name)
 {
   m4_module *cur = module ? module : m4_module_next (context, NULL);
@@ -46,8 +196,20 @@ m4_builtin_find_by_name (m4 *context, m4_module *module, const char *name)
 
   do
     {
-      bp = (m4__builtin *) bsearch (name, cur->builtins, cur->builtins_len,
-                                    sizeof *bp, compare_builtin_name_CB);
+      if (cur->pending)
+        m4__module_complete (context, cur);
+      if (cur->builtins_index)
+        {
+          size_t d = cur->builtins_displace[builtin_hash (name, 0)
+                                            % cur->builtins_buckets];
+          bp = &cur->builtins[cur->builtins_index[builtin_hash (name, d)
+                                                  % cur->builtins_len]];
+          if (!STREQ (name, bp->builtin.name))
+            bp = NULL;
+        }
+      else
+        bp = (m4__builtin *) bsearch (name, cur->builtins, cur->builtins_len,
+                                      sizeof *bp, compare_builtin_name_CB);
       if (bp)
         {
           m4_symbol_value *token = (m4_symbol_value *) xzalloc (sizeof *token);
@@ -0,0 +1,195 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include "m4private.h"
+
+/*#define DEBUG_CHUNK */
+
+/* This file implements the pool that backs the obstacks which grow
+   and shrink with every macro call: the argument stacks of each
+   expansion level, and the input and token stacks.  An obstack hands
+   a chunk back as soon as the objects in it are freed, and asks for a
+   fresh one the next time it spills over, so without the pool a
+   macro whose arguments do not fit in one chunk costs a malloc and a
+   free per call.  Instead, chunks are rounded up to a power of two
+   size class, and freed chunks are kept on a list per class, ready
+   for the next obstack to grow at any expansion level.  Once the
+   input reaches a steady state, expansion no longer calls malloc at
+   all.  Chunks too big for any class, and chunks freed while the pool
+   already holds CHUNK_RETAIN_MAX bytes, go straight back to free.  */
+
+/* Smallest size class, as a shift count; obstacks ask for a bit less
+   than 4096 bytes by default, which fits in this class along with the
+   chunk header.  */
+#define CHUNK_MIN_SHIFT         12
+
+/* Number of size classes; chunks larger than 1 MiB are not pooled.  */
+#define CHUNK_CLASSES           9
+
+/* Most bytes kept on the free lists; beyond this, freed chunks are
+   released.  */
+#define CHUNK_RETAIN_MAX        (16 * 1024 * 1024)
+
+/* Header in front of each chunk handed out.  */
+typedef union chunk_header chunk_header;
+union chunk_header
+{
+  struct
+  {
+    chunk_header *next;         /* Next free chunk in the same class.  */
+    size_t size;                /* Size of the chunk, header included.  */
+  } u;
+  void *align_ptr;              /* Keep the payload suitably aligned.  */
+  long double align_ld;
+};
+
+struct m4__chunk_pool {
+  chunk_header *free_list[CHUNK_CLASSES]; /* Free chunks, by class.  */
+  size_t held;                  /* Bytes on the free lists.  */
+  size_t in_use;                /* Bytes handed out and not yet freed.  */
+  size_t high_water;            /* Largest value of in_use.  */
+  size_t allocs;                /* Chunks handed out.  */
+  size_t reuses;                /* Chunks served from a free list.  */
+  size_t mallocs;               /* Chunks that needed a malloc.  */
+};
+
+static size_t   chunk_class             (size_t);
+static size_t   chunk_class_size        (size_t);
+static void *   chunk_alloc             (void *, size_t);
+static void     chunk_free              (void *, void *);
+
+
+
+/* Return the class of a chunk of SIZE bytes, header included, or
+   CHUNK_CLASSES if it is too big to pool.  */
+static size_t
+chunk_class (size_t size)
+{
+  size_t i = 0;
+
+  while (i < CHUNK_CLASSES && chunk_class_size (i) < size)
+    i++;
+  return i;
+}
+
+/* Return the size of chunks in class I, header included.  */
+static size_t
+chunk_class_size (size_t i)
+{
+  return (size_t) 1 << (CHUNK_MIN_SHIFT + i);
+}
+
+/* Allocate a chunk of at least SIZE bytes on behalf of an obstack,
+   reusing one from the pool of CONTEXT if possible.  Exits on memory
+   exhaustion, like xmalloc.  */
+static void *
+chunk_alloc (void *context, size_t size)
+{
+  m4__chunk_pool *pool = ((m4 *) context)->chunks;
+  chunk_header *chunk;
+  size_t total;
+  size_t i;
+
+  if (SIZE_MAX - sizeof *chunk < size)
+    xalloc_die ();
+  total = size + sizeof *chunk;
+  i = chunk_class (total);
+  pool->allocs++;
+  if (i < CHUNK_CLASSES && pool->free_list[i])
+    {
+      chunk = pool->free_list[i];
+      pool->free_list[i] = chunk->u.next;
+      total = chunk_class_size (i);
+      pool->held -= total;
+      pool->reuses++;
+    }
+  else
+    {
+      if (i < CHUNK_CLASSES)
+        total = chunk_class_size (i);
+      chunk = (chunk_header *) xmalloc (total);
+      chunk->u.size = total;
+      pool->mallocs++;
+    }
+  pool->in_use += total;
+  if (pool->high_water < pool->in_use)
+    pool->high_water = pool->in_use;
+  return chunk + 1;
+}
+
+/* Give the chunk at PTR, from chunk_alloc, back to the pool of
+   CONTEXT.  */
+static void
+chunk_free (void *context, void *ptr)
+{
+  m4__chunk_pool *pool = ((m4 *) context)->chunks;
+  chunk_header *chunk = (chunk_header *) ptr - 1;
+  size_t total = chunk->u.size;
+  size_t i = chunk_class (total);
+
+  pool->in_use -= total;
+  if (i == CHUNK_CLASSES || CHUNK_RETAIN_MAX - pool->held < total)
+    {
+      free (chunk);
+      return;
+    }
+  chunk->u.next = pool->free_list[i];
+  pool->free_list[i] = chunk;
+  pool->held += total;
+}
+
+/* Prepare OBS, which must not be initialized yet, to draw its chunks
+   from the pool of CONTEXT, creating the pool if needed.  */
+void
+m4__chunk_obstack_init (m4 *context, m4_obstack *obs)
+{
+  if (!context->chunks)
+    context->chunks = (m4__chunk_pool *) xzalloc (sizeof *context->chunks);
+  obstack_specify_allocation_with_arg (obs, 0, 0, chunk_alloc, chunk_free,
+                                       context);
+}
+
+/* Release the chunk pool of CONTEXT.  Every obstack set up by
+   m4__chunk_obstack_init must have been freed already.  */
+void
+m4__chunk_delete (m4 *context)
+{
+  m4__chunk_pool *pool = context->chunks;
+  size_t i;
+
+  if (!pool)
+    return;
+#ifdef DEBUG_CHUNK
+  xfprintf (stderr, "m4debug: chunk pool: %zu allocs, %zu reuses, "
+            "%zu mallocs, %zu bytes high water, %zu bytes held\n",
+            pool->allocs, pool->reuses, pool->mallocs, pool->high_water,
+            pool->held);
+#endif /* DEBUG_CHUNK */
+  for (i = 0; i < CHUNK_CLASSES; i++)
+    while (pool->free_list[i])
+      {
+        chunk_header *chunk = pool->free_list[i];
+        pool->free_list[i] = chunk->u.next;
+        free (chunk);
+      }
+  free (pool);
+  context->chunks = NULL;
+}
@@ -25,6 +25,7 @@
 
 #include "m4private.h"
 #include "close-stream.h"
+#include "trace.h"
 
 static void set_debug_file (m4 *, const m4_call_info *, FILE *);
 
@@ -114,6 +115,10 @@ m4_debug_decode (m4 *context, const char *opts, size_t len)
                level |= M4_DEBUG_TRACE_OUTPUT_DUMPDEF;
                break;
 
+            case 'b':
+              level |= M4_DEBUG_TRACE_BACKTRACE;
+              break;
+
             case 'V':
               level |= M4_DEBUG_TRACE_VERBOSE;
               break;
@@ -158,6 +163,7 @@ set_debug_file (m4 *context, const m4_call_info *caller, FILE *fp)
 
   assert (context);
 
+  m4__trace_flush (context, true);
   debug_file = m4_get_debug_file (context);
   if (debug_file != NULL && debug_file != stderr && debug_file != stdout
       && close_stream (debug_file) != 0)
@@ -207,6 +213,7 @@ m4_debug_set_output (m4 *context, const m4_call_info *caller, const char *name)
       fp = fopen (name, "a");
       if (fp == NULL)
         return false;
+      m4_path_cache_flush (context);
 
       if (set_cloexec_flag (fileno (fp), true) != 0)
         m4_warn (context, errno, caller,
@@ -251,6 +258,20 @@ m4_debug_message (m4 *context, int mode, const char *format, ...)
     {
       va_list args;
 
+      if (m4_get_trace_binary_opt (context))
+        {
+          unsigned int start = m4__trace_begin (context, M4_TRACE_MESSAGE, 1);
+          unsigned int item = m4__trace_item_begin (context);
+          int len;
+
+          va_start (args, format);
+          len = obstack_vprintf (&context->trace_messages, format, args);
+          va_end (args);
+          m4__trace_item_end (context, start, item, 0, M4_TRACE_FORMATTED,
+                              len < 0 ? 0 : len, 0, 0);
+          m4__trace_finish (context, start, NULL);
+          return;
+        }
       m4_debug_message_prefix (context);
       va_start (args, format);
       xvfprintf (m4_get_debug_file (context), format, args);
@@ -459,9 +459,11 @@ bucket_insert (m4_hash *hash, hash_node *bucket)
     {
       hash_node *next = NODE_NEXT (bucket);
 
-      /* Break link to rest of the bucket before reinserting.  */
+      /* Break link to rest of the bucket before reinserting.  The
+         node was already counted in the length of HASH.  */
       NODE_NEXT (bucket) = NULL;
       node_insert (hash, bucket);
+      --HASH_LENGTH (hash);
 
       bucket = next;
     }
@@ -33,8 +33,19 @@
 
 /* Maximum number of bytes where it is more efficient to inline the
    reference as a string than it is to track reference bookkeeping for
-   those bytes.  */
+   those bytes.  Unless fixed with `--inline-threshold', the limit
+   starts here and adapts to the input, up to INPUT_INLINE_MAX; see
+   adapt_inline_threshold ().  */
 #define INPUT_INLINE_THRESHOLD 16
+#define INPUT_INLINE_MAX 256
+
+/* Number of inlining decisions between adjustments of the limit.  */
+#define INPUT_INLINE_WINDOW 4096
+
+/* Average refcount of the argument stacks that new references point
+   into, at or above which references are considered to keep those
+   stacks alive for too long.  */
+#define INPUT_INLINE_PRESSURE 4
 
 /*
    Unread input can be either files that should be read (from the
@@ -110,6 +121,14 @@ static  void            file_print      (m4_input_block *, m4 *, m4_obstack *,
 static  const char *    file_buffer     (m4_input_block *, m4 *, size_t *,
                                          bool);
 static  void            file_consume    (m4_input_block *, m4 *, size_t);
+static  int             cached_peek     (m4_input_block *, m4 *, bool);
+static  int             cached_read     (m4_input_block *, m4 *, bool, bool,
+                                         bool);
+static  void            cached_unget    (m4_input_block *, int);
+static  bool            cached_clean    (m4_input_block *, m4 *, bool);
+static  const char *    cached_buffer   (m4_input_block *, m4 *, size_t *,
+                                         bool);
+static  void            cached_consume  (m4_input_block *, m4 *, size_t);
 static  int             string_peek     (m4_input_block *, m4 *, bool);
 static  int             string_read     (m4_input_block *, m4 *, bool, bool,
                                          bool);
@@ -140,7 +159,14 @@ static  void    init_builtin_token      (m4 *, m4_obstack *,
                                          m4_symbol_value *);
 static  void    append_quote_token      (m4 *, m4_obstack *,
                                          m4_symbol_value *);
+static  bool    inline_text             (m4 *, size_t);
+static  void    reference_text          (m4 *, size_t);
+static  void    adapt_inline_threshold  (m4 *);
 static  bool    match_input             (m4 *, const char *, size_t, bool);
+static  const char * delim_search       (const char *, size_t, const char *,
+                                         size_t);
+static  const char * quote_search       (const m4_string_pair *,
+                                         const char *, size_t, int *);
 static  int     next_char               (m4 *, bool, bool, bool);
 static  int     peek_char               (m4 *, bool);
 static  bool    pop_input               (m4 *, bool);
@@ -148,6 +174,10 @@ static  void    unget_input             (int);
 static  const char * next_buffer        (m4 *, size_t *, bool);
 static  void    consume_buffer          (m4 *, size_t);
 static  bool    consume_syntax          (m4 *, m4_obstack *, unsigned int);
+static  m4__token_type next_token       (m4 *, m4_symbol_value *, int *,
+                                         m4_obstack *, bool,
+                                         const m4_call_info *, bool)
+  M4_GNUC_ALWAYS_INLINE;
 
 #ifdef DEBUG_INPUT
 # include "quotearg.h"
@@ -208,11 +238,19 @@ struct m4_input_block
   const char *file;             /* File where this input is from.  */
   int line;                     /* Line where this input is from.  */
 
+  /* If nonzero, the text from origin_start to origin_end is a copy of
+     the macro definition with this identity, starting at
+     origin_offset.  See m4__push_string_origin.  */
+  size_t origin;
+  size_t origin_offset;
+  const char *origin_start;
+  const char *origin_end;
+
   union
     {
       struct
         {
-          char *str;            /* String value.  */
+          const char *str;      /* String value.  */
           size_t len;           /* Remaining length.  */
         }
       u_s;      /* See string_funcs.  */
@@ -224,6 +262,13 @@ struct m4_input_block
           bool_bitfield line_start : 1; /* Saved start_of_input_line state.  */
         }
       u_f;      /* See file_funcs.  */
+      struct
+        {
+          const char *str;              /* Remaining file contents.  */
+          size_t len;                   /* Remaining length.  */
+          bool line_start;              /* Saved start_of_input_line state.  */
+        }
+      u_m;      /* See cached_funcs.  */
       struct
         {
           m4__symbol_chain *chain;      /* Current link in chain.  */
@@ -260,18 +305,60 @@ static m4_input_block *wsp;
    pushing text for rescanning.  */
 static m4_input_block *next;
 
+/* Where the origin of next lies within the text being collected, and
+   the last link of next at that point.  */
+static size_t next_origin_start;
+static size_t next_origin_end;
+static m4__symbol_chain *next_origin_link;
+
+/* Counter for assigning origin identities; any identity no larger
+   than origin_floor was assigned under a different syntax, namely
+   one older than origin_generation.  */
+static size_t origin_count;
+static size_t origin_floor;
+static size_t origin_generation;
+
+/* Incremented whenever isp changes.  */
+static size_t input_serial;
+
 /* Flag for next_char () to increment current_line.  */
 static bool start_of_input_line;
 
 /* Flag for next_char () to recognize change in input block.  */
 static bool input_change;
 
+/* Longest text that m4__push_symbol () copies rather than references.  */
+static size_t inline_threshold;
+
+/* True if inline_threshold adapts to the input.  */
+static bool inline_adaptive;
+
+/* Measurements behind inline_threshold.  The totals are reported
+   whenever the threshold changes; the rest cover the current window
+   of INPUT_INLINE_WINDOW decisions.  */
+static struct
+{
+  size_t links;                 /* References created, in total.  */
+  size_t bytes_inlined;         /* Bytes copied instead, in total.  */
+  size_t decisions;             /* Texts measured against the limit.  */
+  size_t near_links;            /* Texts referenced, but within twice
+                                   the limit.  */
+  size_t window_links;          /* References created.  */
+  size_t window_refcounts;      /* Sum of the resulting refcounts.  */
+} inline_stats;
+
 /* Vtable for handling input from files.  */
 static struct input_funcs file_funcs = {
   file_peek, file_read, file_unget, file_clean, file_print, file_buffer,
   file_consume
 };
 
+/* Vtable for handling input from files in the include cache.  */
+static struct input_funcs cached_funcs = {
+  cached_peek, cached_read, cached_unget, cached_clean, file_print,
+  cached_buffer, cached_consume
+};
+
 /* Vtable for handling input from strings.  */
 static struct input_funcs string_funcs = {
   string_peek, string_read, string_unget, NULL, string_print, string_buffer,
@@ -463,14 +550,144 @@ m4_push_file (m4 *context, FILE *fp, const char *title, bool close_file)
   i->u.u_f.end = false;
   i->u.u_f.close = close_file;
   i->u.u_f.line_start = start_of_input_line;
+  i->origin = 0;
 
   m4_set_output_line (context, -1);
 
   i->prev = isp;
   isp = i;
+  input_serial++;
   input_change = true;
 }
 
+
+/* Include files served from memory by the content cache in path.c.
+   These behave exactly like file input, including line tracking,
+   except that the data never needs to be read.  */
+static int
+cached_peek (m4_input_block *me, m4 *context M4_GNUC_UNUSED,
+             bool allow_argv M4_GNUC_UNUSED)
+{
+  return me->u.u_m.len ? to_uchar (*me->u.u_m.str) : CHAR_RETRY;
+}
+
+static int
+cached_read (m4_input_block *me, m4 *context, bool allow_quote M4_GNUC_UNUSED,
+             bool allow_argv M4_GNUC_UNUSED, bool allow_unget M4_GNUC_UNUSED)
+{
+  int ch;
+
+  if (start_of_input_line)
+    {
+      start_of_input_line = false;
+      m4_set_current_line (context, ++me->line);
+    }
+  if (!me->u.u_m.len)
+    return CHAR_RETRY;
+  me->u.u_m.len--;
+  ch = to_uchar (*me->u.u_m.str++);
+  if (ch == '\n')
+    start_of_input_line = true;
+  return ch;
+}
+
+static void
+cached_unget (m4_input_block *me, int ch)
+{
+  assert (ch < CHAR_EOF && to_uchar (me->u.u_m.str[-1]) == ch);
+  me->u.u_m.str--;
+  me->u.u_m.len++;
+  if (ch == '\n')
+    start_of_input_line = false;
+}
+
+static bool
+cached_clean (m4_input_block *me, m4 *context, bool cleanup)
+{
+  if (!cleanup)
+    return false;
+  if (me->prev != &input_eof)
+    m4_debug_message (context, M4_DEBUG_TRACE_INPUT,
+                      _("input reverted to %s, line %d"),
+                      me->prev->file, me->prev->line);
+  else
+    m4_debug_message (context, M4_DEBUG_TRACE_INPUT, _("input exhausted"));
+  start_of_input_line = me->u.u_m.line_start;
+  m4_set_output_line (context, -1);
+  return true;
+}
+
+static const char *
+cached_buffer (m4_input_block *me, m4 *context, size_t *len,
+               bool allow_quote M4_GNUC_UNUSED)
+{
+  if (start_of_input_line)
+    {
+      start_of_input_line = false;
+      m4_set_current_line (context, ++me->line);
+    }
+  if (!me->u.u_m.len)
+    return buffer_retry;
+  *len = me->u.u_m.len;
+  return me->u.u_m.str;
+}
+
+static void
+cached_consume (m4_input_block *me, m4 *context, size_t len)
+{
+  const char *buf = me->u.u_m.str;
+  const char *p;
+  size_t buf_len = 0;
+  assert (!start_of_input_line && len <= me->u.u_m.len);
+  while ((p = (char *) memchr (buf + buf_len, '\n', len - buf_len)))
+    {
+      if (p == buf + len - 1)
+        start_of_input_line = true;
+      else
+        m4_set_current_line (context, ++me->line);
+      buf_len = p - buf + 1;
+    }
+  me->u.u_m.str += len;
+  me->u.u_m.len -= len;
+}
+
+/* Push LEN bytes of DATA, the cached contents of the file TITLE, on
+   the input stack.  This is like m4_push_file, except that DATA must
+   remain valid for the life of the context.  */
+void
+m4__push_cached_file (m4 *context, const char *data, size_t len,
+                      const char *title)
+{
+  m4_input_block *i;
+
+  if (next != NULL)
+    {
+      obstack_free (current_input, next);
+      next = NULL;
+    }
+
+  m4_debug_message (context, M4_DEBUG_TRACE_INPUT, _("input read from %s"),
+                    quotearg_style (locale_quoting_style, title));
+
+  i = (m4_input_block *) obstack_alloc (current_input, sizeof *i);
+  i->funcs = &cached_funcs;
+  i->file = obstack_copy0 (&file_names, title, strlen (title));
+  i->line = 1;
+
+  i->u.u_m.str = data;
+  i->u.u_m.len = len;
+  i->u.u_m.line_start = start_of_input_line;
+  i->origin = 0;
+
+  m4_set_output_line (context, -1);
+
+  i->prev = isp;
+  isp = i;
+  input_serial++;
+  input_change = true;
+}
+
+
 
 /* Handle string expansion text.  */
 static int
@@ -548,6 +765,7 @@ m4_push_string_init (m4 *context, const char *file, int line)
   next->funcs = &string_funcs;
   next->file = file;
   next->line = line;
+  next->origin = 0;
   next->u.u_s.len = 0;
 
   return current_input;
@@ -590,7 +808,7 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
   if (m4_is_symbol_value_text (value))
     {
       assert (level < SIZE_MAX);
-      if (m4_get_symbol_value_len (value) <= INPUT_INLINE_THRESHOLD)
+      if (inline_text (context, m4_get_symbol_value_len (value)))
         {
           obstack_grow (current_input, m4_get_symbol_value_text (value),
                         m4_get_symbol_value_len (value));
@@ -620,8 +838,8 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
       assert (value->type == M4_SYMBOL_COMP);
       src_chain = value->u.u_c.chain;
       while (level < SIZE_MAX && src_chain && src_chain->type == M4__CHAIN_STR
-             && (src_chain->u.u_s.len <= INPUT_INLINE_THRESHOLD
-                 || (!inuse && src_chain->u.u_s.level == SIZE_MAX)))
+             && ((!inuse && src_chain->u.u_s.level == SIZE_MAX)
+                 || inline_text (context, src_chain->u.u_s.len)))
         {
           obstack_grow (current_input, src_chain->u.u_s.str,
                         src_chain->u.u_s.len);
@@ -652,7 +870,7 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
       chain->u.u_s.str = m4_get_symbol_value_text (value);
       chain->u.u_s.len = m4_get_symbol_value_len (value);
       chain->u.u_s.level = level;
-      m4__adjust_refcount (context, level, true);
+      reference_text (context, level);
       inuse = true;
     }
   while (src_chain)
@@ -675,8 +893,8 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
         {
           /* Allow inlining the final link with subsequent text.  */
           if (!src_chain->next && src_chain->type == M4__CHAIN_STR
-              && (src_chain->u.u_s.len <= INPUT_INLINE_THRESHOLD
-                  || (!inuse && src_chain->u.u_s.level == SIZE_MAX)))
+              && ((!inuse && src_chain->u.u_s.level == SIZE_MAX)
+                  || inline_text (context, src_chain->u.u_s.len)))
             {
               obstack_grow (current_input, src_chain->u.u_s.str,
                             src_chain->u.u_s.len);
@@ -689,7 +907,7 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
           chain->next = NULL;
           if (chain->type == M4__CHAIN_STR && chain->u.u_s.level == SIZE_MAX)
             {
-              if (chain->u.u_s.len <= INPUT_INLINE_THRESHOLD || !inuse)
+              if (!inuse || inline_text (context, chain->u.u_s.len))
                 chain->u.u_s.str = (char *) obstack_copy (current_input,
                                                           chain->u.u_s.str,
                                                           chain->u.u_s.len);
@@ -711,12 +929,73 @@ m4__push_symbol (m4 *context, m4_symbol_value *value, size_t level, bool inuse)
           inuse |= m4__arg_adjust_refcount (context, chain->u.u_a.argv, true);
         }
       else if (chain->type == M4__CHAIN_STR && chain->u.u_s.level < SIZE_MAX)
-        m4__adjust_refcount (context, chain->u.u_s.level, true);
+        reference_text (context, chain->u.u_s.level);
       src_chain = src_chain->next;
     }
   return inuse;
 }
 
+/* Return true if LEN bytes of text should be copied onto the input
+   stack rather than referenced where they are, and record the
+   decision for adapt_inline_threshold ().  */
+static bool
+inline_text (m4 *context, size_t len)
+{
+  bool result = len <= inline_threshold;
+
+  if (result)
+    inline_stats.bytes_inlined += len;
+  else if (len / 2 <= inline_threshold)
+    inline_stats.near_links++;
+  if (inline_adaptive && ++inline_stats.decisions == INPUT_INLINE_WINDOW)
+    adapt_inline_threshold (context);
+  return result;
+}
+
+/* Add a reference to argument stack LEVEL, on behalf of a link in the
+   input stack, and record it for adapt_inline_threshold ().  */
+static void
+reference_text (m4 *context, size_t level)
+{
+  inline_stats.links++;
+  inline_stats.window_links++;
+  inline_stats.window_refcounts += m4__adjust_refcount (context, level, true);
+}
+
+/* Adjust inline_threshold at the end of a window of decisions.  A
+   reference costs about the same whatever the length of its text, but
+   it also keeps the argument stack it points into alive until the
+   input engine has read past it.  So when those stacks already carry
+   several references each, and a good share of the referenced texts
+   were within twice the limit, double the limit so that they are
+   copied instead.  Once the stacks are no longer under pressure, halve
+   it again, down to INPUT_INLINE_THRESHOLD.  */
+static void
+adapt_inline_threshold (m4 *context)
+{
+  size_t old = inline_threshold;
+  size_t pressure = 0;
+
+  if (inline_stats.window_links)
+    pressure = inline_stats.window_refcounts / inline_stats.window_links;
+  if (INPUT_INLINE_PRESSURE <= pressure && inline_threshold < INPUT_INLINE_MAX
+      && INPUT_INLINE_WINDOW <= inline_stats.near_links * 8)
+    inline_threshold *= 2;
+  else if (inline_stats.window_links && pressure < INPUT_INLINE_PRESSURE / 2
+           && INPUT_INLINE_THRESHOLD < inline_threshold)
+    inline_threshold /= 2;
+  if (inline_threshold != old)
+    m4_debug_message (context, M4_DEBUG_TRACE_INPUT,
+                      _("input inline threshold changed from %zu to %zu"
+                        " (%zu links, %zu bytes inlined)"),
+                      old, inline_threshold, inline_stats.links,
+                      inline_stats.bytes_inlined);
+  inline_stats.decisions = 0;
+  inline_stats.near_links = 0;
+  inline_stats.window_links = 0;
+  inline_stats.window_refcounts = 0;
+}
+
 /* Last half of m4_push_string ().  If next is now NULL, a call to
    m4_push_file () has pushed a different input block to the top of
    the stack.  Otherwise, all unfinished text on the obstack returned
@@ -735,16 +1014,34 @@ m4_push_string_finish (void)
 
   if (len || next->funcs == &composite_funcs)
     {
+      const char *str;
+
+      if (next->origin
+          && (len != next_origin_end
+              || next_origin_link != (next->funcs == &composite_funcs
+                                      ? next->u.u_c.end : NULL)))
+        next->origin = 0;
       if (next->funcs == &string_funcs)
         {
-          next->u.u_s.str = (char *) obstack_finish (current_input);
+          str = next->u.u_s.str = (char *) obstack_finish (current_input);
           next->u.u_s.len = len;
         }
       else
-        m4__make_text_link (current_input, &next->u.u_c.chain,
-                            &next->u.u_c.end);
+        {
+          m4__make_text_link (current_input, &next->u.u_c.chain,
+                              &next->u.u_c.end);
+          str = len ? next->u.u_c.end->u.u_s.str : NULL;
+        }
+      if (next->origin && len)
+        {
+          next->origin_start = str + next_origin_start;
+          next->origin_end = str + len;
+        }
+      else
+        next->origin = 0;
       next->prev = isp;
       isp = next;
+      input_serial++;
       input_change = true;
     }
   else
@@ -752,6 +1049,76 @@ m4_push_string_finish (void)
   next = NULL;
 }
 
+/* Forget all origin identities if the syntax has changed since they
+   were assigned.  */
+static void
+origin_refresh (m4 *context)
+{
+  if (origin_generation != m4__syntax_generation (M4SYNTAX))
+    {
+      origin_floor = origin_count;
+      origin_generation = m4__syntax_generation (M4SYNTAX);
+    }
+}
+
+/* Called between push_string_init and push_string_finish, to record
+   that the text collected on OBS from offset START to its current end
+   is a copy of the definition VALUE, starting at OFFSET.  If nothing
+   else is added before push_string_finish, the input block remembers
+   this origin, so that m4__input_origin can later identify text read
+   from it by where it lies in VALUE.  The identity of VALUE is also
+   tied to the current syntax, so that the same definition read under
+   different quotes is never mistaken for the same input.  */
+void
+m4__push_string_origin (m4 *context, m4_obstack *obs, m4_symbol_value *value,
+                        size_t offset, size_t start)
+{
+  size_t len = obstack_object_size (obs);
+
+  assert (m4_is_symbol_value_text (value));
+  if (!next || obs != current_input || len <= start)
+    return;
+  origin_refresh (context);
+  if (value->u.u_t.origin <= origin_floor)
+    value->u.u_t.origin = ++origin_count;
+  next->origin = value->u.u_t.origin;
+  next->origin_offset = offset;
+  next_origin_start = start;
+  next_origin_end = len;
+  next_origin_link = (next->funcs == &composite_funcs
+                      ? next->u.u_c.end : NULL);
+}
+
+/* If the next input byte lies in text that was copied from a macro
+   definition under the current syntax, return the identity of that
+   definition and set *OFFSET to the position of the byte within it;
+   otherwise return 0.  Either way, set *SERIAL to a number that
+   changes whenever an input block is pushed or popped, so that the
+   caller can tell whether two positions lie in the same block.  */
+size_t
+m4__input_origin (m4 *context, size_t *offset, size_t *serial)
+{
+  const char *str;
+
+  *serial = input_serial;
+  if (!isp->origin)
+    return 0;
+  if (isp->funcs == &string_funcs)
+    str = isp->u.u_s.str;
+  else if (isp->funcs == &composite_funcs
+           && isp->u.u_c.chain == isp->u.u_c.end
+           && isp->u.u_c.chain->type == M4__CHAIN_STR)
+    str = isp->u.u_c.chain->u.u_s.str;
+  else
+    return 0;
+  origin_refresh (context);
+  if (isp->origin <= origin_floor || str < isp->origin_start
+      || isp->origin_end < str)
+    return 0;
+  *offset = isp->origin_offset + (str - isp->origin_start);
+  return isp->origin;
+}
+
 
 /* A composite block contains multiple sub-blocks which are processed
    in FIFO order, even though the obstack allocates memory in LIFO
@@ -989,7 +1356,7 @@ composite_print (m4_input_block *me, m4 *context, m4_obstack *obs,
         }
       chain = chain->next;
     }
-  if (len)
+  if (len && !done)
     m4_shipout_string_trunc (obs, (char *) obstack_base (current_input), len,
                              NULL, &maxlen);
   if (quote)
@@ -1171,6 +1538,48 @@ m4_input_print (m4 *context, m4_obstack *obs, int debug_level)
   block->funcs->print_func (block, context, obs, debug_level);
 }
 
+/* For binary tracing, grow OBS with at most MAX_LEN bytes of the text
+   of the input block created by push_string_init, unquoted and
+   untruncated, set *LEN to its full length, and return true.  Return
+   false without touching OBS if the block is not plain text, such as
+   an included file or text holding builtin tokens, in which case
+   m4_input_print must describe it.  */
+bool
+m4__input_text (m4 *context, m4_obstack *obs, size_t max_len, size_t *len)
+{
+  size_t pending = obstack_object_size (current_input);
+  m4__symbol_chain *chain;
+  m4_arg_iterator iter;
+  const char *text;
+  size_t seg_len;
+  size_t total = 0;
+
+  if (!next)
+    return false;
+  if (next->funcs == &composite_funcs)
+    {
+      for (chain = next->u.u_c.chain; chain; chain = chain->next)
+        if (chain->type == M4__CHAIN_FUNC
+            || (chain->type == M4__CHAIN_ARGV && chain->u.u_a.has_func))
+          return false;
+      m4__arg_iterator_chain (context, next->u.u_c.chain, &iter);
+      while (m4_arg_iterator_next (&iter, &text, &seg_len))
+        {
+          if (total < max_len)
+            obstack_grow (obs, text, (seg_len < max_len - total
+                                      ? seg_len : max_len - total));
+          total += seg_len;
+        }
+    }
+  else
+    assert (next->funcs == &string_funcs);
+  if (total < max_len)
+    obstack_grow (obs, obstack_base (current_input),
+                  pending < max_len - total ? pending : max_len - total);
+  *len = total + pending;
+  return true;
+}
+
 /* Return an obstack ready for direct expansion of wrapup text, and
    set *END to the location that should be updated if any builtin
    tokens are wrapped.  Store the location of CALLER with the wrapped
@@ -1196,6 +1605,7 @@ m4__push_wrapup_init (m4 *context, const m4_call_info *caller,
       i->funcs = &composite_funcs;
       i->file = caller->file;
       i->line = caller->line;
+      i->origin = 0;
       i->u.u_c.chain = i->u.u_c.end = NULL;
       wsp = i;
     }
@@ -1243,6 +1653,7 @@ pop_input (m4 *context, bool cleanup)
   next = NULL; /* might be set in m4_push_string_init () */
 
   isp = tmp;
+  input_serial++;
   input_change = true;
   return true;
 }
@@ -1276,10 +1687,11 @@ m4_pop_wrapup (m4 *context)
 
   current_input = wrapup_stack;
   wrapup_stack = (m4_obstack *) xmalloc (sizeof *wrapup_stack);
-  obstack_init (wrapup_stack);
+  m4__chunk_obstack_init (context, wrapup_stack);
 
   isp = wsp;
   wsp = &input_eof;
+  input_serial++;
   input_change = true;
 
   return true;
@@ -1335,7 +1747,7 @@ append_quote_token (m4 *context, m4_obstack *obs, m4_symbol_value *value)
      memory overhead of parsing another INPUT_CHAIN link outweighs the
      time to inline the symbol text.  */
   if (src_chain->type == M4__CHAIN_STR
-      && src_chain->u.u_s.len <= INPUT_INLINE_THRESHOLD)
+      && inline_text (context, src_chain->u.u_s.len))
     {
       assert (src_chain->u.u_s.level <= SIZE_MAX);
       obstack_grow (obs, src_chain->u.u_s.str, src_chain->u.u_s.len);
@@ -1389,7 +1801,7 @@ init_argv_symbol (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 
   /* If the next character is not ',' or ')', then unlink the last
      argument from argv and schedule it for reparsing.  This way,
-     expand_argument never has to deal with concatenation of argv with
+     collect_step never has to deal with concatenation of argv with
      arbitrary text.  Note that the implementation of safe_quotes
      ensures peek_input won't return CHAR_ARGV if the user is perverse
      enough to mix comment delimiters with argument separators:
@@ -1403,10 +1815,10 @@ init_argv_symbol (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 
      When the $@ ref is used unchanged, we completely bypass the
      decrement of the argv refcount in next_char, since the ref is
-     still live via the current collect_arguments.  However, when the
-     last element of the $@ ref is reparsed, we must increase the argv
-     refcount here, to compensate for the fact that it will be
-     decreased once the final element is parsed.  */
+     still live via the frame currently collecting arguments.
+     However, when the last element of the $@ ref is reparsed, we must
+     increase the argv refcount here, to compensate for the fact that
+     it will be decreased once the final element is parsed.  */
   assert (!comments->len1
           || (!m4_has_syntax (M4SYNTAX, *comments->str1,
                               M4_SYNTAX_COMMA | M4_SYNTAX_CLOSE)
@@ -1423,6 +1835,52 @@ init_argv_symbol (m4 *context, m4_obstack *obs, m4_symbol_value *value)
 }
 
 
+/* Most input blocks keep their unread text as a flat run of bytes:
+   the rest of a string, the rest of a cached file, or the current
+   text link of a composite chain.  Return a pointer to the length of
+   that run in the top input block, so that next_char and peek_char
+   can read from it without going through the block's callbacks, or
+   NULL if there is no such run or it has per-byte bookkeeping that
+   the callbacks must do.  Set *STR to the address of the pointer to
+   the next byte.  If ALLOW_QUOTE, a text link that can be returned
+   whole as CHAR_QUOTE is not offered.  CONSUME is true if a byte
+   will be read from the run, rather than just peeked at.  */
+static inline size_t *
+input_window (m4 *context, const char ***str, bool allow_quote,
+              bool consume)
+{
+  m4__symbol_chain *chain;
+
+  if (isp->funcs == &string_funcs)
+    {
+      *str = &isp->u.u_s.str;
+      return &isp->u.u_s.len;
+    }
+  if (isp->funcs == &cached_funcs)
+    {
+      /* Newlines update the line number, and must go through
+         cached_read.  */
+      if (start_of_input_line || !isp->u.u_m.len
+          || *isp->u.u_m.str == '\n')
+        return NULL;
+      *str = &isp->u.u_m.str;
+      return &isp->u.u_m.len;
+    }
+  if (isp->funcs == &composite_funcs)
+    {
+      chain = isp->u.u_c.chain;
+      if (!chain || chain->type != M4__CHAIN_STR || !chain->u.u_s.len
+          || (allow_quote && chain->quote_age == m4__quote_age (M4SYNTAX)))
+        return NULL;
+      /* Partial consumption invalidates quote age.  */
+      if (consume)
+        chain->quote_age = 0;
+      *str = &chain->u.u_s.str;
+      return &chain->u.u_s.len;
+    }
+  return NULL;
+}
+
 /* Low level input is done a character at a time.  The function
    next_char () is used to read and advance the input to the next
    character.  If ALLOW_QUOTE, and the current input matches the
@@ -1439,6 +1897,9 @@ next_char (m4 *context, bool allow_quote, bool allow_argv, bool allow_unget)
 
   while (1)
     {
+      const char **str;
+      size_t *len;
+
       if (input_change)
         {
           m4_set_current_file (context, isp->file);
@@ -1446,6 +1907,15 @@ next_char (m4 *context, bool allow_quote, bool allow_argv, bool allow_unget)
           input_change = false;
         }
 
+      /* Read inline while the top block has bytes at hand; its
+         callbacks are only needed once they run out.  */
+      len = input_window (context, &str, allow_quote, true);
+      if (len && *len)
+        {
+          --*len;
+          return to_uchar (*(*str)++);
+        }
+
       assert (isp->funcs->read_func);
       while (((ch = isp->funcs->read_func (isp, context, allow_quote,
                                            allow_argv, allow_unget))
@@ -1470,6 +1940,12 @@ peek_char (m4 *context, bool allow_argv)
 {
   int ch;
   m4_input_block *block = isp;
+  const char **str;
+  size_t *len;
+
+  len = input_window (context, &str, false, false);
+  if (len && *len)
+    return to_uchar (**str);
 
   while (1)
     {
@@ -1662,6 +2138,93 @@ match_input (m4 *context, const char *s, size_t len, bool consume)
    || (to_uchar ((s)[0]) == (ch)                                        \
        && ((len) >> 1 ? match_input (C, s, len, consume) : (len))))
 
+/* Like MATCH, but if SIMPLE is true, the syntax is known to use
+   single byte delimiters that are the only members of their syntax
+   category, so checking the category of CH is enough.  */
+#define MATCH_DELIM(C, simple, ch, cat, s, len, consume)                \
+  ((simple) ? m4_has_syntax (m4_get_syntax_table (C), ch, cat)          \
+   : MATCH (C, ch, cat, s, len, consume))
+
+/* Search the LEN bytes at BUFFER for the delimiter S of length
+   S_LEN, which may be several bytes long.  Candidates are found by
+   their first byte with memchr, then verified in place with memcmp,
+   so a failed candidate costs no trip through the input stack.
+   Return a pointer to the first complete match, or to a candidate
+   whose leading bytes match but which runs past the end of BUFFER,
+   so that the caller can settle it with match_input; return NULL if
+   there is neither.  */
+static const char *
+delim_search (const char *buffer, size_t len, const char *s, size_t s_len)
+{
+  const char *end = buffer + len;
+  const char *p = buffer;
+  size_t avail;
+
+  if (!s_len)
+    return NULL;
+  while ((p = (char *) memchr (p, *s, end - p)))
+    {
+      avail = end - p;
+      if (memcmp (p, s, avail < s_len ? avail : s_len) == 0)
+        return p;
+      p++;
+    }
+  return NULL;
+}
+
+/* Search the LEN bytes at BUFFER, which lie inside a quoted string
+   nested *LEVEL deep, for the delimiters of QUOTE, either of which
+   may be several bytes long.  Adjust *LEVEL for every complete
+   delimiter seen, checking the end quote first as MATCH_DELIM would.
+   Return a pointer just past the end quote that brings *LEVEL to
+   zero, a pointer to a candidate delimiter that runs past the end of
+   BUFFER, or BUFFER + LEN if the whole buffer belongs to the
+   string.  */
+static const char *
+quote_search (const m4_string_pair *quote, const char *buffer, size_t len,
+              int *level)
+{
+  const char *end = buffer + len;
+  const char *p = buffer;
+  size_t avail;
+
+  while ((p = (char *) memchr2 (p, *quote->str1, *quote->str2, end - p)))
+    {
+      avail = end - p;
+      if (*p == *quote->str2 && quote->len2)
+        {
+          if (avail < quote->len2)
+            {
+              if (memcmp (p, quote->str2, avail) == 0)
+                return p;
+            }
+          else if (memcmp (p, quote->str2, quote->len2) == 0)
+            {
+              p += quote->len2;
+              if (--*level == 0)
+                return p;
+              continue;
+            }
+        }
+      if (*p == *quote->str1 && quote->len1)
+        {
+          if (avail < quote->len1)
+            {
+              if (memcmp (p, quote->str1, avail) == 0)
+                return p;
+            }
+          else if (memcmp (p, quote->str1, quote->len1) == 0)
+            {
+              p += quote->len1;
+              ++*level;
+              continue;
+            }
+        }
+      p++;
+    }
+  return end;
+}
+
 /* While the current input character has the given SYNTAX, append it
    to OBS.  Take care not to pop input source unless the next source
    would continue the chain.  Return true if the chain ended with
@@ -1729,14 +2292,14 @@ m4_input_init (m4 *context)
   m4_set_current_line (context, 0);
 
   current_input = (m4_obstack *) xmalloc (sizeof *current_input);
-  obstack_init (current_input);
+  m4__chunk_obstack_init (context, current_input);
   wrapup_stack = (m4_obstack *) xmalloc (sizeof *wrapup_stack);
-  obstack_init (wrapup_stack);
+  m4__chunk_obstack_init (context, wrapup_stack);
 
   /* Allocate an object in the current chunk, so that obstack_free
      will always work even if the first token parsed spills to a new
      chunk.  */
-  obstack_init (&token_stack);
+  m4__chunk_obstack_init (context, &token_stack);
   token_bottom = obstack_finish (&token_stack);
 
   isp = &input_eof;
@@ -1744,6 +2307,12 @@ m4_input_init (m4 *context)
   next = NULL;
 
   start_of_input_line = false;
+
+  inline_threshold = m4_get_inline_threshold_opt (context);
+  inline_adaptive = !inline_threshold;
+  if (inline_adaptive)
+    inline_threshold = INPUT_INLINE_THRESHOLD;
+  memset (&inline_stats, 0, sizeof inline_stats);
 }
 
 /* Free memory used by the input engine.  */
@@ -1771,10 +2340,17 @@ m4_input_exit (void)
    collected on the obstack token_stack, which never contains more
    than one token text at a time.  The storage pointed to by the
    fields in TOKEN is therefore subject to change the next time
-   m4__next_token () is called.  */
-m4__token_type
-m4__next_token (m4 *context, m4_symbol_value *token, int *line,
-                m4_obstack *obs, bool allow_argv, const m4_call_info *caller)
+   m4__next_token () is called.
+
+   SIMPLE is a constant in each caller, so that this is compiled once
+   for any syntax, and once for the common syntax where escapes,
+   active characters and multi-byte or duplicated delimiters need no
+   checks (see is_simple_syntax in syntax.c).  m4__next_token calls
+   the variant that the syntax table selected.  */
+static inline m4__token_type
+next_token (m4 *context, m4_symbol_value *token, int *line,
+            m4_obstack *obs, bool allow_argv, const m4_call_info *caller,
+            bool simple)
 {
   int ch;
   int quote_level;
@@ -1825,7 +2401,7 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
         return M4_TOKEN_ARGV;
       }
 
-    if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ESCAPE))
+    if (!simple && m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ESCAPE))
       { /* ESCAPED WORD */
         obstack_1grow (&token_stack, ch);
         if ((ch = next_char (context, false, false, false)) < CHAR_EOF)
@@ -1841,16 +2417,16 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
       }
     else if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ALPHA))
       {
-        type = (m4_is_syntax_macro_escaped (M4SYNTAX)
+        type = (!simple && m4_is_syntax_macro_escaped (M4SYNTAX)
                 ? M4_TOKEN_STRING : M4_TOKEN_WORD);
         if (type == M4_TOKEN_STRING && obs)
           obs_safe = obs;
         obstack_1grow (obs_safe, ch);
         consume_syntax (context, obs_safe, M4_SYNTAX_ALPHA | M4_SYNTAX_NUM);
       }
-    else if (MATCH (context, ch, M4_SYNTAX_LQUOTE,
-                    context->syntax->quote.str1,
-                    context->syntax->quote.len1, true))
+    else if (MATCH_DELIM (context, simple, ch, M4_SYNTAX_LQUOTE,
+                          context->syntax->quote.str1,
+                          context->syntax->quote.len1, true))
       { /* QUOTED STRING */
         if (obs)
           obs_safe = obs;
@@ -1865,16 +2441,34 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
             if (buffer)
               {
                 const char *p = buffer;
-                if (m4_is_syntax_single_quotes (M4SYNTAX))
+                if (!m4__quote_age (M4SYNTAX)
+                    && (simple || m4_is_syntax_single_quotes (M4SYNTAX)))
+                  {
+                    /* Verify multi-byte delimiters in place, leaving
+                       only those that straddle the buffer end for the
+                       byte-wise path.  */
+                    p = quote_search (&context->syntax->quote, buffer, len,
+                                      &quote_level);
+                    if (!quote_level)
+                      {
+                        obstack_grow (obs_safe, buffer,
+                                      (p - buffer
+                                       - context->syntax->quote.len2));
+                        consume_buffer (context, p - buffer);
+                        break;
+                      }
+                    if (p == buffer + len)
+                      p = NULL;
+                  }
+                else if (simple || m4_is_syntax_single_quotes (M4SYNTAX))
                   do
                     {
                       p = (char *) memchr2 (p, *context->syntax->quote.str1,
                                             *context->syntax->quote.str2,
                                             buffer + len - p);
                     }
-                  while (p && m4__quote_age (M4SYNTAX)
-                         && (*p++ == *context->syntax->quote.str2
-                             ? --quote_level : ++quote_level));
+                  while (p && (*p++ == *context->syntax->quote.str2
+                               ? --quote_level : ++quote_level));
                 else
                   {
                     size_t remaining = len;
@@ -1931,24 +2525,24 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
               init_builtin_token (context, obs, obs ? token : NULL);
             else if (ch == CHAR_QUOTE)
               append_quote_token (context, obs, token);
-            else if (MATCH (context, ch, M4_SYNTAX_RQUOTE,
-                            context->syntax->quote.str2,
-                            context->syntax->quote.len2, true))
+            else if (MATCH_DELIM (context, simple, ch, M4_SYNTAX_RQUOTE,
+                                  context->syntax->quote.str2,
+                                  context->syntax->quote.len2, true))
               {
                 if (--quote_level == 0)
                   break;
-                if (1 < context->syntax->quote.len2)
+                if (!simple && 1 < context->syntax->quote.len2)
                   obstack_grow (obs_safe, context->syntax->quote.str2,
                                 context->syntax->quote.len2);
                 else
                   obstack_1grow (obs_safe, ch);
               }
-            else if (MATCH (context, ch, M4_SYNTAX_LQUOTE,
-                            context->syntax->quote.str1,
-                            context->syntax->quote.len1, true))
+            else if (MATCH_DELIM (context, simple, ch, M4_SYNTAX_LQUOTE,
+                                  context->syntax->quote.str1,
+                                  context->syntax->quote.len1, true))
               {
                 quote_level++;
-                if (1 < context->syntax->quote.len1)
+                if (!simple && 1 < context->syntax->quote.len1)
                   obstack_grow (obs_safe, context->syntax->quote.str1,
                                 context->syntax->quote.len1);
                 else
@@ -1958,13 +2552,13 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
               obstack_1grow (obs_safe, ch);
           }
       }
-    else if (MATCH (context, ch, M4_SYNTAX_BCOMM,
-                    context->syntax->comm.str1,
-                    context->syntax->comm.len1, true))
+    else if (MATCH_DELIM (context, simple, ch, M4_SYNTAX_BCOMM,
+                          context->syntax->comm.str1,
+                          context->syntax->comm.len1, true))
       { /* COMMENT */
         if (obs && !m4_get_discard_comments_opt (context))
           obs_safe = obs;
-        if (1 < context->syntax->comm.len1)
+        if (!simple && 1 < context->syntax->comm.len1)
           obstack_grow (obs_safe, context->syntax->comm.str1,
                         context->syntax->comm.len1);
         else
@@ -1977,9 +2571,19 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
             if (buffer)
               {
                 const char *p;
-                if (m4_is_syntax_single_comments (M4SYNTAX))
-                  p = (char *) memchr (buffer, *context->syntax->comm.str2,
-                                       len);
+                if (simple || m4_is_syntax_single_comments (M4SYNTAX))
+                  {
+                    p = delim_search (buffer, len, context->syntax->comm.str2,
+                                      context->syntax->comm.len2);
+                    if (p && (context->syntax->comm.len2
+                              <= (size_t) (buffer + len - p)))
+                      {
+                        p += context->syntax->comm.len2;
+                        obstack_grow (obs_safe, buffer, p - buffer);
+                        consume_buffer (context, p - buffer);
+                        break;
+                      }
+                  }
                 else
                   {
                     size_t remaining = len;
@@ -2026,11 +2630,11 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
                 init_builtin_token (context, NULL, NULL);
                 continue;
               }
-            if (MATCH (context, ch, M4_SYNTAX_ECOMM,
-                       context->syntax->comm.str2,
-                       context->syntax->comm.len2, true))
+            if (MATCH_DELIM (context, simple, ch, M4_SYNTAX_ECOMM,
+                             context->syntax->comm.str2,
+                             context->syntax->comm.len2, true))
               {
-                if (1 < context->syntax->comm.len2)
+                if (!simple && 1 < context->syntax->comm.len2)
                   obstack_grow (obs_safe, context->syntax->comm.str2,
                                 context->syntax->comm.len2);
                 else
@@ -2043,7 +2647,7 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
         type = (m4_get_discard_comments_opt (context)
                 ? M4_TOKEN_NONE : M4_TOKEN_COMMENT);
       }
-    else if (m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ACTIVE))
+    else if (!simple && m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_ACTIVE))
       { /* ACTIVE CHARACTER */
         obstack_1grow (&token_stack, ch);
         type = M4_TOKEN_WORD;
@@ -2128,6 +2732,25 @@ m4__next_token (m4 *context, m4_symbol_value *token, int *line,
   return type;
 }
 
+/* The variant of next_token for any syntax.  */
+m4__token_type
+m4__next_token_general (m4 *context, m4_symbol_value *token, int *line,
+                        m4_obstack *obs, bool allow_argv,
+                        const m4_call_info *caller)
+{
+  return next_token (context, token, line, obs, allow_argv, caller, false);
+}
+
+/* The variant of next_token for single byte delimiters, without
+   escapes or active characters.  */
+m4__token_type
+m4__next_token_simple (m4 *context, m4_symbol_value *token, int *line,
+                       m4_obstack *obs, bool allow_argv,
+                       const m4_call_info *caller)
+{
+  return next_token (context, token, line, obs, allow_argv, caller, true);
+}
+
 /* Peek at the next token in the input stream to see if it is an open
    parenthesis.  It is possible that what is peeked at may change as a
    result of changequote (or friends).  This honors multi-character
@@ -2149,6 +2772,91 @@ m4__next_token_is_open (m4 *context)
   return m4_has_syntax (M4SYNTAX, ch, M4_SYNTAX_OPEN);
 }
 
+/* Copy the longest run of text at the start of the current input
+   buffer that m4__next_token would only break into tokens to be
+   output unchanged, straight to the current diversion, and consume
+   it.  This is only valid at the top level, when no arguments are
+   being collected.  The run stops before anything that could start a
+   quoted string, a comment, an escaped word, an active character or
+   a macro call, and before a word that reaches the end of the buffer,
+   since it might continue in the next one; m4__next_token then takes
+   over.  Words are looked up in place, without first being copied to
+   token_stack.  Nothing is done while synclines are enabled, since
+   each token must be checked for a needed syncline, or if
+   m4__safe_quotes is false, since then a delimiter can span bytes
+   that are otherwise harmless.  */
+void
+m4__next_literal_text (m4 *context)
+{
+  m4_syntax_table *syntax = M4SYNTAX;
+  const char *buffer;
+  const char *end;
+  const char *p;
+  size_t len;
+  int lquote;
+  int bcomm;
+  bool words;
+
+  if (!m4__safe_quotes (syntax) || m4_get_syncoutput_opt (context))
+    return;
+  buffer = next_buffer (context, &len, false);
+  if (!buffer || !len)
+    return;
+
+  lquote = to_uchar (*syntax->quote.str1);
+  bcomm = syntax->comm.len1 ? to_uchar (*syntax->comm.str1) : -1;
+  words = !m4_is_syntax_macro_escaped (syntax);
+  end = buffer + len;
+  for (p = buffer; p < end; )
+    {
+      int ch = to_uchar (*p);
+
+      if (m4_has_syntax (syntax, ch, M4_SYNTAX_ESCAPE))
+        break;
+      if (m4_has_syntax (syntax, ch, M4_SYNTAX_ALPHA))
+        {
+          const char *word = p;
+          m4_symbol *symbol;
+
+          do
+            p++;
+          while (p < end && m4_has_syntax (syntax, *p,
+                                           M4_SYNTAX_ALPHA | M4_SYNTAX_NUM));
+          if (!words)
+            continue;
+          if (p == end)
+            {
+              p = word;
+              break;
+            }
+          /* Like expand_token, a blind builtin not followed by an
+             open parenthesis is plain text.  */
+          symbol = m4_symbol_lookup (M4SYMTAB, word, p - word);
+          if (symbol
+              && !(symbol->value->type == M4_SYMBOL_FUNC
+                   && BIT_TEST (SYMBOL_FLAGS (symbol), VALUE_BLIND_ARGS_BIT)
+                   && !m4_has_syntax (syntax, *p, M4_SYNTAX_OPEN)))
+            {
+              p = word;
+              break;
+            }
+          continue;
+        }
+      if (ch == lquote || ch == bcomm
+          || m4_has_syntax (syntax, ch, (M4_SYNTAX_LQUOTE | M4_SYNTAX_BCOMM
+                                         | M4_SYNTAX_ACTIVE)))
+        break;
+      p++;
+    }
+
+  if (p != buffer)
+    {
+      m4_divert_text (context, NULL, buffer, p - buffer,
+                      m4_get_current_line (context));
+      consume_buffer (context, p - buffer);
+    }
+}
+
 
 #ifdef DEBUG_INPUT
 
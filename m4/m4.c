@@ -23,7 +23,7 @@
 #include "bitrotate.h"
 #include "m4private.h"
 
-#define DEFAULT_NESTING_LIMIT	1024
+#define DEFAULT_NESTING_LIMIT	SIZE_MAX
 #define DEFAULT_NAMEMAP_SIZE    61
 
 static size_t
@@ -74,26 +74,20 @@ m4_delete (m4 *context)
   if (context->syntax)
     m4_syntax_delete (context->syntax);
 
+  m4__maps_delete (context);
+
   /* debug_file should have been reset to stdout or stderr, both of
      which are closed later.  */
   assert (context->debug_file == stderr || context->debug_file == stdout);
 
   obstack_free (&context->trace_messages, NULL);
+  m4__trace_delete (context);
+  m4__profile_delete (context);
+  m4__syscache_delete (context);
+  m4__run_cache_delete (context);
 
   if (context->search_path)
-    {
-      m4__search_path *path = context->search_path->list;
-
-      while (path)
-        {
-          m4__search_path *stale = path;
-          path = path->next;
-
-          DELETE (stale->dir); /* Cast away const.  */
-          free (stale);
-        }
-      free (context->search_path);
-    }
+    m4__include_delete (context);
 
   for (i = 0; i < context->stacks_count; i++)
     {
@@ -108,6 +102,15 @@ m4_delete (m4 *context)
         }
     }
   free (context->arg_stacks);
+  m4__chunk_delete (context);
+
+  assert (context->frames == NULL);
+  while (context->frame_pool)
+    {
+      m4__macro_frame *stale = context->frame_pool;
+      context->frame_pool = stale->prev;
+      free (stale);
+    }
 
   free (context);
 }
@@ -31,6 +31,7 @@ BEGIN_C_DECLS
 /* --- MODULE AUTHOR DECLARATIONS --- */
 
 typedef struct m4               m4;
+typedef struct m4_arg_iterator  m4_arg_iterator;
 typedef struct m4_builtin       m4_builtin;
 typedef struct m4_call_info     m4_call_info;
 typedef struct m4_macro         m4_macro;
@@ -97,6 +98,17 @@ struct m4_string_pair
   size_t len2;          /* Second length.  */
 };
 
+/* Walk the text of a macro argument in segments, without copying it;
+   see m4_arg_iterator_init.  The fields are private.  */
+struct m4_arg_iterator
+{
+  m4 *context;          /* Context of the macro call.  */
+  bool flatten;         /* True if builtins are ignored.  */
+  const char *text;     /* Pending text segment.  */
+  size_t len;           /* Length of pending segment, or 0.  */
+  void *chain;          /* Next link of a composite argument, or NULL.  */
+};
+
 /* Declare a prototype for the function "builtin_<NAME>".  Note that
    the function name includes any macro expansion of NAME.  */
 #define M4BUILTIN(name)                                                 \
@@ -182,10 +194,12 @@ extern void             m4_delete       (m4 *);
         M4FIELD(FILE *,            debug_file,     debug_file)          \
         M4FIELD(m4_obstack,        trace_messages, trace_messages)      \
         M4FIELD(int,               exit_status,    exit_status)         \
+        M4FIELD(bool,              exit_requested, exit_requested)      \
         M4FIELD(int,    current_diversion,         current_diversion)   \
         M4FIELD(size_t, nesting_limit_opt,         nesting_limit)       \
         M4FIELD(int,    debug_level_opt,           debug_level)         \
         M4FIELD(size_t, max_debug_arg_length_opt,  max_debug_arg_length)\
+        M4FIELD(size_t, inline_threshold_opt,      inline_threshold)    \
         M4FIELD(int,    regexp_syntax_opt,         regexp_syntax)       \
 
 
@@ -199,6 +213,9 @@ extern void             m4_delete       (m4 *);
         M4OPT_BIT(M4_OPT_FATAL_WARN_BIT,        fatal_warnings_opt)     \
         M4OPT_BIT(M4_OPT_WARN_EXIT_BIT,         warnings_exit_opt)      \
         M4OPT_BIT(M4_OPT_SAFER_BIT,             safer_opt)              \
+        M4OPT_BIT(M4_OPT_CACHE_INCLUDES_BIT,    cache_includes_opt)     \
+        M4OPT_BIT(M4_OPT_TRACK_DEPS_BIT,        track_dependencies_opt) \
+        M4OPT_BIT(M4_OPT_TRACE_BINARY_BIT,      trace_binary_opt)       \
 
 
 #define M4FIELD(type, base, field)                                      \
@@ -222,9 +239,25 @@ m4_context_opt_bit_table
 
 typedef void m4_module_init_func   (m4 *, m4_module *, m4_obstack *);
 
+/* Description of a module linked into the program, so that loading it
+   needs no file search or dlopen.  A table of these ends with an entry
+   whose NAME is NULL.  */
+typedef struct {
+  const char *name;             /* Name of the exported symbol.  */
+  void *address;                /* Address of the exported symbol.  */
+} m4_static_symbol;
+
+typedef struct {
+  const char *name;                     /* Name of the module.  */
+  m4_module_init_func *init_func;       /* The include_<name> function.  */
+  const m4_static_symbol *symbols;      /* Other symbols, for import.  */
+} m4_static_module;
+
 extern m4_module *  m4_module_load     (m4 *, const char *, m4_obstack *);
+extern m4_module *  m4_module_autoload (m4 *, const char *, m4_obstack *);
 extern void *       m4_module_import   (m4 *, const char *, const char *,
                                         m4_obstack *);
+extern void         m4_module_preload  (m4 *, const m4_static_module *);
 
 extern void         m4_install_builtins (m4*, m4_module *, const m4_builtin*);
 extern void         m4_install_macros   (m4*, m4_module *, const m4_macro*);
@@ -244,6 +277,9 @@ extern m4_symbol_table *m4_symtab_create  (size_t);
 extern void       m4_symtab_delete  (m4_symbol_table *);
 extern void *     m4_symtab_apply   (m4_symbol_table *, bool,
                                      m4_symtab_apply_func *, void *);
+extern size_t     m4_symtab_mark    (m4_symbol_table *);
+extern void *     m4_symtab_apply_removed (m4_symbol_table *,
+                                           m4_symtab_apply_func *, void *);
 
 extern m4_symbol *m4_symbol_lookup  (m4_symbol_table *, const char *, size_t);
 extern m4_symbol *m4_symbol_pushdef (m4_symbol_table *, const char *, size_t,
@@ -264,6 +300,7 @@ extern void       m4_symbol_delete  (m4_symbol_table *, const char *, size_t);
 
 extern m4_symbol_value *m4_get_symbol_value       (m4_symbol *);
 extern bool             m4_get_symbol_traced      (m4_symbol *);
+extern size_t           m4_get_symbol_generation  (m4_symbol *);
 extern bool             m4_set_symbol_name_traced (m4_symbol_table *,
                                                    const char *, size_t, bool);
 extern void     m4_symbol_print         (m4 *, m4_symbol *, m4_obstack *,
@@ -317,6 +354,28 @@ extern void             m4_set_symbol_value_placeholder (m4_symbol_value *,
 
 
 
+/* --- MAP MANAGEMENT --- */
+
+
+typedef void *m4_map_apply_func  (m4 *, const m4_string *, const m4_string *,
+                                  void *);
+typedef void *m4_maps_apply_func (m4 *, const char *, size_t, void *);
+
+extern void     m4_map_set      (m4 *, const char *, size_t, const char *,
+                                 size_t, const char *, size_t);
+extern const m4_string *m4_map_get (m4 *, const char *, size_t, const char *,
+                                    size_t);
+extern bool     m4_map_remove   (m4 *, const char *, size_t, const char *,
+                                 size_t);
+extern size_t   m4_map_size     (m4 *, const char *, size_t);
+extern void     m4_map_clear    (m4 *, const char *, size_t);
+extern size_t   m4_map_generation (m4 *, const char *, size_t);
+extern void *   m4_map_apply    (m4 *, const char *, size_t,
+                                 m4_map_apply_func *, void *);
+extern void *   m4_maps_apply   (m4 *, m4_maps_apply_func *, void *);
+
+
+
 /* --- BUILTIN MANAGEMENT --- */
 
 extern m4_symbol_value  *m4_builtin_find_by_name (m4 *, m4_module *, const char *);
@@ -332,6 +391,7 @@ extern void     m4_macro_call           (m4 *, m4_symbol_value *, m4_obstack *,
                                          m4_macro_args *);
 extern size_t   m4_arg_argc             (m4_macro_args *);
 extern const m4_call_info *m4_arg_info  (m4_macro_args *);
+extern size_t   m4_arg_origin           (m4_macro_args *, size_t *, size_t *);
 extern m4_symbol_value *m4_arg_symbol   (m4_macro_args *, size_t);
 extern bool     m4_is_arg_text          (m4_macro_args *, size_t);
 extern bool     m4_is_arg_func          (m4_macro_args *, size_t);
@@ -341,6 +401,10 @@ extern bool     m4_arg_equal            (m4 *, m4_macro_args *, size_t,
                                          size_t);
 extern bool     m4_arg_empty            (m4_macro_args *, size_t);
 extern size_t   m4_arg_len              (m4 *, m4_macro_args *, size_t, bool);
+extern void     m4_arg_iterator_init    (m4 *, m4_macro_args *, size_t, bool,
+                                         m4_arg_iterator *);
+extern bool     m4_arg_iterator_next    (m4_arg_iterator *, const char **,
+                                         size_t *);
 extern m4_builtin_func *m4_arg_func     (m4_macro_args *, size_t);
 extern m4_obstack *m4_arg_scratch       (m4 *);
 extern m4_macro_args *m4_make_argv_ref  (m4 *, m4_macro_args *, const char *,
@@ -384,9 +448,11 @@ enum {
   M4_DEBUG_TRACE_DEREF          = (1 << 12),
   /* o: output dumpdef to stderr, not debug file */
   M4_DEBUG_TRACE_OUTPUT_DUMPDEF = (1 << 13),
+  /* b: follow errors and warnings with the stack of macro calls */
+  M4_DEBUG_TRACE_BACKTRACE      = (1 << 14),
 
   /* V: very verbose --  print everything */
-  M4_DEBUG_TRACE_VERBOSE        = ((1 << 14) - 1)
+  M4_DEBUG_TRACE_VERBOSE        = ((1 << 15) - 1)
 };
 
 /* initial flags, used if no -d or -E -- equiv: d */
@@ -409,6 +475,9 @@ extern void     m4_debug_message        (m4 *, int, const char *, ...)
 extern void     m4_trace_prepare        (m4 *, const m4_call_info *,
                                          m4_symbol_value *);
 
+extern bool     m4_profile_start        (m4 *, unsigned int);
+extern void     m4_profile_dump         (m4 *, FILE *);
+
 
 /* --- REGEXP SYNTAX --- */
 
@@ -519,12 +588,14 @@ extern void     m4_shipout_string       (m4 *, m4_obstack *, const char *,
                                          size_t, bool);
 extern bool     m4_shipout_string_trunc (m4_obstack *, const char *, size_t,
                                          const m4_string_pair *, size_t *);
+extern const char *m4_escape_mem        (const char *, size_t, size_t *);
 
 extern void     m4_make_diversion    (m4 *, int);
 extern void     m4_insert_diversion  (m4 *, int);
 extern void     m4_insert_file       (m4 *, FILE *);
 extern void     m4_freeze_diversions (m4 *, FILE *);
 extern void     m4_undivert_all      (m4 *);
+extern bool     m4_write_diversion   (m4 *, int, const char *);
 
 
 
@@ -534,9 +605,42 @@ extern void	m4_add_include_directory (m4 *, const char *, bool);
 extern bool	m4_load_filename	 (m4 *, const m4_call_info *,
 					  const char *, m4_obstack *, bool);
 extern char *   m4_path_search		 (m4 *, const char *, const char **);
+extern void	m4_path_cache_flush	 (m4 *);
+extern char *	m4_path_cwd		 (void);
+
+typedef void *m4_dependency_apply_func (m4 *, const char *, void *);
+
+extern void	m4_add_dependency	 (m4 *, const char *);
+extern void *	m4_dependencies_apply	 (m4 *, m4_dependency_apply_func *,
+					  void *);
 extern FILE *	m4_fopen		 (m4 *, const char *, const char *);
 
 
+
+/* --- ESYSCMD CACHE --- */
+
+extern bool     m4_syscmd_cache_open    (m4 *, const char *);
+extern void     m4_syscmd_cache_forbid  (m4 *, const char *, size_t);
+extern void     m4_syscmd_cache_add_input (m4 *, const char *, size_t,
+                                           const char *, size_t);
+extern bool     m4_syscmd_cache_lookup  (m4 *, const char *, m4_obstack *,
+                                         int *);
+extern void     m4_syscmd_cache_store   (m4 *, const m4_call_info *,
+                                         const char *, const char *, size_t,
+                                         int);
+
+
+
+/* --- RUN CACHE --- */
+
+extern bool     m4_run_cache_open       (m4 *, const char *, int,
+                                         char *const *, char *const *);
+extern void     m4_run_cache_forbid     (m4 *, const m4_call_info *);
+extern void     m4_run_cache_add_env    (m4 *, const char *);
+extern bool     m4_run_cache_replay     (m4 *, int *);
+extern void     m4_run_cache_finish     (m4 *, int);
+
+
 
 #define obstack_chunk_alloc     xmalloc
 #define obstack_chunk_free      free
@@ -23,12 +23,20 @@
 
 #include <m4/m4module.h>
 
+#include <signal.h>
+
 #include "cloexec.h"
 #include "quotearg.h"
 #include "xmemdup0.h"
 
 typedef struct m4__search_path_info m4__search_path_info;
 typedef struct m4__macro_arg_stacks m4__macro_arg_stacks;
+typedef struct m4__macro_frame m4__macro_frame;
+typedef struct m4__trace_output m4__trace_output;
+typedef struct m4__profile m4__profile;
+typedef struct m4__syscache m4__syscache;
+typedef struct m4__run_cache m4__run_cache;
+typedef struct m4__chunk_pool m4__chunk_pool;
 typedef struct m4__symbol_chain m4__symbol_chain;
 
 typedef enum {
@@ -68,12 +76,14 @@ struct m4 {
   FILE *        debug_file;             /* File for debugging output.  */
   m4_obstack    trace_messages;
   int           exit_status;            /* Cumulative exit status.  */
+  bool          exit_requested;         /* True once m4exit is called.  */
   int           current_diversion;      /* Current output diversion.  */
 
   /* Option flags  (set in src/main.c).  */
   size_t        nesting_limit;                  /* -L */
   int           debug_level;                    /* -d */
   size_t        max_debug_arg_length;           /* -l */
+  size_t        inline_threshold;               /* --inline-threshold */
   int           regexp_syntax;                  /* -r */
   int           opt_flags;
 
@@ -82,6 +92,16 @@ struct m4 {
   m4__macro_arg_stacks  *arg_stacks;    /* Array of current argv refs.  */
   size_t                stacks_count;   /* Size of arg_stacks.  */
   size_t                expansion_level;/* Macro call nesting level.  */
+  m4__macro_frame       *frames;        /* Stack of active macro calls.  */
+  m4__macro_frame       *frame_pool;    /* Frames available for reuse.  */
+  m4_hash               *maps;          /* Named maps, see map.c.  */
+  size_t                map_generation; /* Changes made to maps so far.  */
+  m4__trace_output      *trace_output;  /* Binary trace state, or NULL.  */
+  m4__profile           *profile;       /* Sampling profiler, or NULL.  */
+  m4__syscache          *syscache;      /* Esyscmd cache, or NULL.  */
+  m4__run_cache         *run_cache;     /* Whole run cache, or NULL.  */
+  m4__chunk_pool        *chunks;        /* Obstack chunks for reuse.  */
+  const m4_static_module *static_modules; /* Modules linked in, or NULL.  */
 };
 
 #define M4_OPT_PREFIX_BUILTINS_BIT      (1 << 0) /* -P */
@@ -93,6 +113,9 @@ struct m4 {
 #define M4_OPT_FATAL_WARN_BIT           (1 << 6) /* -E once */
 #define M4_OPT_WARN_EXIT_BIT            (1 << 7) /* -E twice */
 #define M4_OPT_SAFER_BIT                (1 << 8) /* --safer */
+#define M4_OPT_CACHE_INCLUDES_BIT       (1 << 9) /* --cache-includes */
+#define M4_OPT_TRACK_DEPS_BIT           (1 << 10) /* -M, -MD */
+#define M4_OPT_TRACE_BINARY_BIT         (1 << 11) /* --trace-format */
 
 /* Fast macro versions of accessor functions for public fields of m4,
    that also have an identically named function exported in m4module.h.  */
@@ -113,6 +136,8 @@ struct m4 {
 #  define m4_set_trace_messages(C, V)           ((C)->trace_messages = (V))
 #  define m4_get_exit_status(C)                 ((C)->exit_status)
 #  define m4_set_exit_status(C, V)              ((C)->exit_status = (V))
+#  define m4_get_exit_requested(C)              ((C)->exit_requested)
+#  define m4_set_exit_requested(C, V)           ((C)->exit_requested = (V))
 #  define m4_get_current_diversion(C)           ((C)->current_diversion)
 #  define m4_set_current_diversion(C, V)        ((C)->current_diversion = (V))
 #  define m4_get_nesting_limit_opt(C)           ((C)->nesting_limit)
@@ -121,6 +146,8 @@ struct m4 {
 #  define m4_set_debug_level_opt(C, V)          ((C)->debug_level = (V))
 #  define m4_get_max_debug_arg_length_opt(C)    ((C)->max_debug_arg_length)
 #  define m4_set_max_debug_arg_length_opt(C, V) ((C)->max_debug_arg_length=(V))
+#  define m4_get_inline_threshold_opt(C)        ((C)->inline_threshold)
+#  define m4_set_inline_threshold_opt(C, V)     ((C)->inline_threshold = (V))
 #  define m4_get_regexp_syntax_opt(C)           ((C)->regexp_syntax)
 #  define m4_set_regexp_syntax_opt(C, V)        ((C)->regexp_syntax = (V))
 
@@ -142,6 +169,12 @@ struct m4 {
                 (BIT_TEST((C)->opt_flags, M4_OPT_WARN_EXIT_BIT))
 #  define m4_get_safer_opt(C)                                           \
                 (BIT_TEST((C)->opt_flags, M4_OPT_SAFER_BIT))
+#  define m4_get_cache_includes_opt(C)                                  \
+                (BIT_TEST((C)->opt_flags, M4_OPT_CACHE_INCLUDES_BIT))
+#  define m4_get_track_dependencies_opt(C)                              \
+                (BIT_TEST((C)->opt_flags, M4_OPT_TRACK_DEPS_BIT))
+#  define m4_get_trace_binary_opt(C)                                    \
+                (BIT_TEST((C)->opt_flags, M4_OPT_TRACE_BINARY_BIT))
 
 /* No fast opt bit set macros, as they would need to evaluate their
    arguments more than once, which would subtly change their semantics.  */
@@ -167,6 +200,7 @@ typedef struct m4__builtin m4__builtin;
 
 extern void m4__set_symbol_value_builtin (m4_symbol_value *,
                                           const m4__builtin *);
+extern void m4__builtin_index (m4_module *);
 extern void m4__builtin_print (m4_obstack *, const m4__builtin *, bool,
                                m4__symbol_chain **, const m4_string_pair *,
                                bool);
@@ -179,15 +213,24 @@ struct m4_module
 {
   const char *name;             /* Name of the module.  */
   void *handle;                 /* System module handle.  */
+  const m4_static_module *static_module; /* Registry entry, if linked in.  */
   m4__builtin *builtins;        /* Sorted array of builtins.  */
   m4_macro *macros;		/* Unsorted array of macros.  */
   size_t builtins_len;          /* Number of builtins.  */
+  size_t *builtins_index;       /* Perfect hash slot to builtins index.  */
+  size_t *builtins_displace;    /* Per bucket displacement of the hash.  */
+  size_t builtins_buckets;      /* Length of builtins_displace.  */
+  bool pending;                 /* True if autoloaded but not yet opened.  */
   m4_module *next;
 };
 
 extern m4_module *  m4__module_open (m4 *context, const char *name,
                                      m4_obstack *obs);
 extern m4_module *  m4__module_find (m4 *context, const char *name);
+extern void         m4__module_complete (m4 *context, m4_module *module);
+extern void         m4__module_autoload_value (m4 *context,
+                                               m4_symbol_value *value);
+extern void         m4__module_autoload_all (m4 *context);
 
 
 /* --- SYMBOL TABLE MANAGEMENT --- */
@@ -196,6 +239,7 @@ struct m4_symbol
 {
   bool traced;                  /* True if this symbol is traced.  */
   m4_symbol_value *value;       /* Linked list of pushdef'd values.  */
+  size_t generation;            /* Table generation of the last change.  */
 };
 
 /* Type of a link in a symbol chain.  */
@@ -263,6 +307,9 @@ struct m4_symbol_value
       /* Quote age when this string was built, or zero to force a
          rescan of the string.  Ignored for 0 len.  */
       unsigned int      quote_age;
+      /* Identity of this text as the source of an expansion, or zero
+         if not yet assigned.  See m4__push_string_origin.  */
+      size_t            origin;
     } u_t;                      /* Valid when type is TEXT, PLACEHOLDER.  */
     const m4__builtin * builtin;/* Valid when type is FUNC.  */
     struct
@@ -304,6 +351,16 @@ struct m4_macro_args
   /* The context of the macro call during expansion, and NULL in a
      back-reference.  */
   m4_call_info *info;
+  /* Composite arguments already flattened by m4_arg_text during the
+     call, indexed by argument, or NULL.  Lives on the scratch obstack,
+     so it is reset along with info.  */
+  m4_string *texts;
+  /* If nonzero, all arguments after the first were parsed from
+     origin_len bytes of the macro definition identified by origin,
+     starting at origin_offset, with no intervening macro call.  */
+  size_t origin;
+  size_t origin_offset;
+  size_t origin_len;
   size_t level; /* Which obstack owns this argv.  */
   size_t arraylen; /* True length of allocated elements in array.  */
   /* Used as a variable-length array, storing information about each
@@ -338,6 +395,47 @@ struct m4_call_info
   size_t name_len;      /* The length of name.  */
 };
 
+/* Internal structure describing one macro call whose arguments are
+   still being collected, or which is being called.  These frames are
+   kept on an explicit stack, instead of the C stack, so that nesting
+   is bounded only by available memory.  See macro.c for usage.  */
+struct m4__macro_frame
+{
+  m4__macro_frame *prev;        /* Enclosing frame, or next in pool.  */
+  m4_symbol_value *value;       /* Original value of this macro.  */
+  size_t level;                 /* Expansion level of this macro.  */
+  void *args_base;              /* Base of stack->args on entry.  */
+  void *argv_base;              /* Base of stack->argv on entry.  */
+  m4_call_info info;            /* Context of this macro call.  */
+
+  /* Summary of the arguments collected so far, copied into the
+     m4_macro_args header once collection is complete.  */
+  size_t argc;
+  size_t arraylen;
+  unsigned int quote_age;
+  bool_bitfield wrapper : 1;
+  bool_bitfield has_ref : 1;
+  bool_bitfield flatten : 1;
+  bool_bitfield has_func : 1;
+
+  /* Where the second argument began, from m4__input_origin, and the
+     macro call count at that point; then the length of the text up
+     to the end of the arguments.  */
+  size_t origin;
+  size_t origin_offset;
+  size_t origin_serial;
+  size_t origin_call;
+  size_t origin_len;
+
+  /* State of the argument currently being collected.  */
+  m4_symbol_value *argp;        /* The argument, or NULL when complete.  */
+  unsigned int age;             /* Quote age of the argument so far.  */
+  int paren_level;              /* Unbalanced parentheses so far.  */
+  int line;                     /* Line where the argument began.  */
+  bool_bitfield first : 1;      /* True if no content collected yet.  */
+  bool_bitfield skip_space : 1; /* True while skipping leading space.  */
+};
+
 extern size_t   m4__adjust_refcount     (m4 *, size_t, bool);
 extern bool     m4__arg_adjust_refcount (m4 *, m4_macro_args *, bool);
 extern void     m4__push_arg_quote      (m4 *, m4_obstack *, m4_macro_args *,
@@ -346,6 +444,8 @@ extern bool     m4__arg_print           (m4 *, m4_obstack *, m4_macro_args *,
                                          size_t, const m4_string_pair *, bool,
                                          m4__symbol_chain **, const char *,
                                          size_t *, bool, bool);
+extern void     m4__arg_iterator_chain  (m4 *, m4__symbol_chain *,
+                                         m4_arg_iterator *);
 
 #define VALUE_NEXT(T)           ((T)->next)
 #define VALUE_MODULE(T)         ((T)->module)
@@ -367,6 +467,7 @@ extern bool     m4__arg_print           (m4 *, m4_obstack *, m4_macro_args *,
    that also have an identically named function exported in m4module.h.  */
 #ifdef NDEBUG
 #  define m4_get_symbol_traced(S)       ((S)->traced)
+#  define m4_get_symbol_generation(S)   ((S)->generation)
 #  define m4_get_symbol_value(S)        ((S)->value)
 #  define m4_set_symbol_value(S, V)     ((S)->value = (V))
 
@@ -389,7 +490,8 @@ extern bool     m4__arg_print           (m4 *, m4_obstack *, m4_macro_args *,
 
 #  define m4_set_symbol_value_text(V, T, L, A)                          \
   ((V)->type = M4_SYMBOL_TEXT, (V)->u.u_t.text = (T),                   \
-   (V)->u.u_t.len = (L), (V)->u.u_t.quote_age = (A))
+   (V)->u.u_t.len = (L), (V)->u.u_t.quote_age = (A),                    \
+   (V)->u.u_t.origin = 0)
 #  define m4_set_symbol_value_placeholder(V, T)                         \
   ((V)->type = M4_SYMBOL_PLACEHOLDER, (V)->u.u_t.text = (T))
 #  define m4__set_symbol_value_builtin(V, B)                            \
@@ -411,6 +513,7 @@ extern bool     m4__arg_print           (m4 *, m4_obstack *, m4_macro_args *,
 #define VALUE_BLIND_ARGS_BIT            (1 << 1)
 #define VALUE_SIDE_EFFECT_ARGS_BIT      (1 << 2)
 #define VALUE_DELETED_BIT               (1 << 3)
+#define VALUE_AUTOLOAD_BIT              (1 << 4)
 
 
 struct m4_symbol_arg {
@@ -430,11 +533,65 @@ struct m4_symbol_arg {
 
 extern void m4__symtab_remove_module_references (m4_symbol_table *,
                                                  m4_module *);
+extern void m4__symtab_set_autoload (m4_symbol_table *, m4 *);
 extern bool m4__symbol_value_print (m4 *, m4_symbol_value *, m4_obstack *,
                                     const m4_string_pair *, bool,
                                     m4__symbol_chain **, size_t *, bool);
 
 
+
+/* --- MAP MANAGEMENT --- */
+
+extern void m4__maps_delete (m4 *);
+
+
+
+/* --- BINARY TRACE OUTPUT --- */
+
+extern unsigned int m4__trace_begin     (m4 *, int, size_t);
+extern unsigned int m4__trace_item_begin (m4 *);
+extern void     m4__trace_item_end      (m4 *, unsigned int, unsigned int,
+                                         int, int, size_t, size_t,
+                                         unsigned int);
+extern unsigned int m4__trace_settings  (m4 *);
+extern void     m4__trace_finish        (m4 *, unsigned int,
+                                         const m4_call_info *);
+extern void     m4__trace_flush         (m4 *, bool);
+extern void     m4__trace_delete        (m4 *);
+
+
+
+/* --- SAMPLING PROFILER --- */
+
+/* Set asynchronously by SIGPROF; poll it and call m4__profile_sample
+   when nonzero.  */
+extern volatile sig_atomic_t m4__profile_ticks;
+
+extern void     m4__profile_sample      (m4 *);
+extern void     m4__profile_delete      (m4 *);
+
+
+
+/* --- ESYSCMD CACHE --- */
+
+extern void     m4__syscache_delete     (m4 *);
+
+
+
+/* --- RUN CACHE --- */
+
+extern void     m4__run_cache_absent    (m4 *, const char *);
+extern void     m4__run_cache_delete    (m4 *);
+
+
+
+/* --- OBSTACK CHUNK POOL --- */
+
+extern void     m4__chunk_obstack_init  (m4 *, m4_obstack *);
+extern void     m4__chunk_delete        (m4 *);
+
+
+
 
 /* --- SYNTAX TABLE MANAGEMENT --- */
 
@@ -451,6 +608,27 @@ extern bool m4__symbol_value_print (m4 *, m4_symbol_value *, m4_obstack *,
 #define DEF_BCOMM       "#"     /* Default begin comment delimiter.  */
 #define DEF_ECOMM       "\n"    /* Default end comment delimiter.  */
 
+/* Various different token types.  */
+typedef enum {
+  M4_TOKEN_EOF,         /* End of file, M4_SYMBOL_VOID.  */
+  M4_TOKEN_NONE,        /* Discardable token, M4_SYMBOL_VOID.  */
+  M4_TOKEN_STRING,      /* Quoted string, M4_SYMBOL_TEXT or M4_SYMBOL_COMP.  */
+  M4_TOKEN_COMMENT,     /* Comment, M4_SYMBOL_TEXT or M4_SYMBOL_COMP.  */
+  M4_TOKEN_SPACE,       /* Whitespace, M4_SYMBOL_TEXT.  */
+  M4_TOKEN_WORD,        /* An identifier, M4_SYMBOL_TEXT.  */
+  M4_TOKEN_OPEN,        /* Argument list start, M4_SYMBOL_TEXT.  */
+  M4_TOKEN_COMMA,       /* Argument separator, M4_SYMBOL_TEXT.  */
+  M4_TOKEN_CLOSE,       /* Argument list end, M4_SYMBOL_TEXT.  */
+  M4_TOKEN_SIMPLE,      /* Single character, M4_SYMBOL_TEXT.  */
+  M4_TOKEN_MACDEF,      /* Builtin token, M4_SYMBOL_FUNC or M4_SYMBOL_COMP.  */
+  M4_TOKEN_ARGV         /* A series of parameters, M4_SYMBOL_COMP.  */
+} m4__token_type;
+
+/* A variant of the lexer, see m4__next_token.  */
+typedef m4__token_type m4__next_token_func (m4 *, m4_symbol_value *, int *,
+                                            m4_obstack *, bool,
+                                            const m4_call_info *);
+
 struct m4_syntax_table {
   /* Please read the comment at the top of input.c for details.  table
      holds the current syntax, and orig holds the default syntax.  */
@@ -484,12 +662,19 @@ struct m4_syntax_table {
      frequently used syntax schemes by index.  */
   unsigned short syntax_age;
 
+  /* Count every change to the syntax, without saturating.  */
+  size_t generation;
+
   /* Track the current quote age, determined by all significant
      changequote, changecom, and changesyntax calls, since any of
      these can alter the rescan of a prior parameter in a quoted
      context.  */
   unsigned int quote_age;
 
+  /* The lexer suited to the current syntax, chosen whenever the
+     quote age is recomputed.  */
+  m4__next_token_func *next_token;
+
   /* Track a cached quote pair on the input obstack.  */
   m4_string_pair *cached_quote;
 
@@ -518,6 +703,9 @@ struct m4_syntax_table {
 /* Return the current quote age.  */
 #define m4__quote_age(S)                ((S)->quote_age)
 
+/* Return a number that changes whenever the syntax does.  */
+#define m4__syntax_generation(S)        ((S)->generation)
+
 /* Return true if the current quote age guarantees that parsing the
    current token in the context of a quoted string of the same quote
    age will give the same parse.  */
@@ -534,22 +722,6 @@ extern const m4_string_pair *m4__quote_cache (m4_syntax_table *,
 
 /* --- MACRO MANAGEMENT --- */
 
-/* Various different token types.  */
-typedef enum {
-  M4_TOKEN_EOF,         /* End of file, M4_SYMBOL_VOID.  */
-  M4_TOKEN_NONE,        /* Discardable token, M4_SYMBOL_VOID.  */
-  M4_TOKEN_STRING,      /* Quoted string, M4_SYMBOL_TEXT or M4_SYMBOL_COMP.  */
-  M4_TOKEN_COMMENT,     /* Comment, M4_SYMBOL_TEXT or M4_SYMBOL_COMP.  */
-  M4_TOKEN_SPACE,       /* Whitespace, M4_SYMBOL_TEXT.  */
-  M4_TOKEN_WORD,        /* An identifier, M4_SYMBOL_TEXT.  */
-  M4_TOKEN_OPEN,        /* Argument list start, M4_SYMBOL_TEXT.  */
-  M4_TOKEN_COMMA,       /* Argument separator, M4_SYMBOL_TEXT.  */
-  M4_TOKEN_CLOSE,       /* Argument list end, M4_SYMBOL_TEXT.  */
-  M4_TOKEN_SIMPLE,      /* Single character, M4_SYMBOL_TEXT.  */
-  M4_TOKEN_MACDEF,      /* Builtin token, M4_SYMBOL_FUNC or M4_SYMBOL_COMP.  */
-  M4_TOKEN_ARGV         /* A series of parameters, M4_SYMBOL_COMP.  */
-} m4__token_type;
-
 extern  void            m4__make_text_link (m4_obstack *, m4__symbol_chain **,
                                             m4__symbol_chain **);
 extern  void            m4__append_builtin (m4_obstack *, const m4__builtin *,
@@ -557,13 +729,27 @@ extern  void            m4__append_builtin (m4_obstack *, const m4__builtin *,
                                             m4__symbol_chain **);
 extern  bool            m4__push_symbol (m4 *, m4_symbol_value *, size_t,
                                          bool);
+extern  void            m4__push_string_origin (m4 *, m4_obstack *,
+                                                m4_symbol_value *, size_t,
+                                                size_t);
+extern  size_t          m4__input_origin (m4 *, size_t *, size_t *);
+extern  bool            m4__input_text (m4 *, m4_obstack *, size_t,
+                                        size_t *);
 extern  m4_obstack      *m4__push_wrapup_init (m4 *, const m4_call_info *,
                                                m4__symbol_chain ***);
 extern  void            m4__push_wrapup_finish (void);
-extern  m4__token_type  m4__next_token (m4 *, m4_symbol_value *, int *,
-                                        m4_obstack *, bool,
-                                        const m4_call_info *);
+extern  m4__next_token_func m4__next_token_general;
+extern  m4__next_token_func m4__next_token_simple;
 extern  bool            m4__next_token_is_open (m4 *);
+extern  void            m4__next_literal_text (m4 *);
+
+/* Parse the next token from the input, with the lexer variant chosen
+   for the current syntax.  */
+#define m4__next_token(C, token, line, obs, allow_argv, caller)         \
+  ((C)->syntax->next_token ((C), (token), (line), (obs), (allow_argv),  \
+                            (caller)))
+extern  void            m4__push_cached_file (m4 *, const char *, size_t,
+                                              const char *);
 
 /* Fast macro versions of macro argv accessor functions,
    that also have an identically named function exported in m4module.h.  */
@@ -585,13 +771,29 @@ struct m4__search_path {
   int len;
 };
 
+typedef struct m4__include_content m4__include_content;
+typedef struct m4__dependency m4__dependency;
+
+struct m4__dependency {
+  m4_string name;               /* file name, also hash key */
+  m4__dependency *next;         /* next dependency, in order seen */
+};
+
 struct m4__search_path_info {
   m4__search_path *list;        /* the list of path directories */
   m4__search_path *list_end;    /* the end of same */
   int max_length;               /* length of longest directory name */
+  unsigned int generation;      /* bumped when cached searches go stale */
+  m4_hash *cache;               /* cached results of path searches */
+  m4_hash *contents;            /* cached contents of included files */
+  m4__include_content *retired; /* stale contents, freed at exit */
+  m4_hash *depends;             /* dependencies recorded so far */
+  m4__dependency *depends_list; /* the same, in order seen */
+  m4__dependency *depends_end;  /* the end of same */
 };
 
 extern void m4__include_init (m4 *);
+extern void m4__include_delete (m4 *);
 
 
 /* Debugging the memory allocator.  */
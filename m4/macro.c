@@ -24,6 +24,7 @@
 #include <config.h>
 
 #include "m4private.h"
+#include "trace.h"
 
 /* Define this to 1 see runtime debug info.  Implied by DEBUG.  */
 /*#define DEBUG_INPUT 1 */
@@ -43,13 +44,14 @@
    Therefore, we implement a reference counter for each expansion
    level, tracking how many references exist into the obstack, as well
    as associate a level with each reference.  Of course, expand_macro
-   is actively using argv, so it increments the refcount on entry and
-   decrements it on exit.  Additionally, any time the input engine is
-   handed a reference that it does not inline, it increases the
-   refcount in push_token, then decreases it in pop_input once the
-   reference has been rescanned.  Finally, when the input engine hands
-   a reference back to expand_argument, the refcount increases, which
-   is then cleaned up at the end of expand_macro.
+   is actively using argv, so it increments the refcount when pushing
+   a frame and decrements it when the frame is popped.  Additionally,
+   any time the input engine is handed a reference that it does not
+   inline, it increases the refcount in push_token, then decreases it
+   in pop_input once the reference has been rescanned.  Finally, when
+   the input engine hands a reference back to collect_step, the
+   refcount increases, which is then cleaned up when the frame of the
+   macro being collected is popped.
 
    For a running example, consider this input:
 
@@ -66,29 +68,29 @@
      after second dnl ends:          `'                    0    `'        0
      expand_macro for x, level 0:    `'                    1    `'        0
      expand_macro for a, level 1:    `'                    1    `'        1
-     after collect_arguments for a:  `'                    1    `b'       1
+     after last end_argument for a:  `'                    1    `b'       1
      push `A' to input stack:        `'                    1    `b'       1
      exit expand_macro for a:        `'                    1    `'        0
-     after collect_arguments for x:  `A`a''                1    `'        0
+     after last end_argument for x:  `A`a''                1    `'        0
      push `a(1)`'c(' to input stack: `A`a''                1    `'        0
      push_token saves $@(x) ref:     `A`a''                2    `'        0
      exit expand_macro for x:        `A`a''                1    `'        0
      expand_macro for a, level 0:    `A`a''                2    `'        0
-     after collect_arguments for a:  `A`a''`1'             2    `'        0
+     after last end_argument for a:  `A`a''`1'             2    `'        0
      push `A' to input stack:        `A`a''`1'             2    `'        0
      exit expand_macro for a:        `A`a''                1    `'        0
      output `A':                     `A`a''                1    `'        0
      expand_macro for c, level 0:    `A`a''                2    `'        0
-     expand_argument gets $@(x) ref: `A`a''`$@(x)'         3    `'        0
+     collect_step gets $@(x) ref:    `A`a''`$@(x)'         3    `'        0
      pop_input ends $@(x) ref:       `A`a''`$@(x)'         2    `'        0
      expand_macro for y, level 1:    `A`a''`$@(x)'         2    `'        1
-     after collect_arguments for y:  `A`a''`$@(x)'         2    `b'       1
+     after last end_argument for y:  `A`a''`$@(x)'         2    `b'       1
      push_token saves $@(y) ref:     `A`a''`$@(x)'         2    `b'       2
      push `)' to input stack:        `A`a''`$@(x)'         2    `b'       2
      exit expand_macro for y:        `A`a''`$@(x)'         2    `b'       1
-     expand_argument gets $@(y) ref: `A`a''`$@(x)$@(y)'    2    `b'       2
+     collect_step gets $@(y) ref:    `A`a''`$@(x)$@(y)'    2    `b'       2
      pop_input ends $@(y) ref:       `A`a''`$@(x)$@(y)'    2    `b'       1
-     after collect_arguments for c:  `A`a''`$@(x)$@(y)'    2    `b'       1
+     after last end_argument for c:  `A`a''`$@(x)$@(y)'    2    `b'       1
      push_token saves $*(c) ref:     `A`a''`$@(x)$@(y)'    3    `b'       2
      expand_macro frees $@(x) ref:   `A`a''`$@(x)$@(y)'    2    `b'       2
      expand_macro frees $@(y) ref:   `A`a''`$@(x)$@(y)'    2    `b'       1
@@ -97,15 +99,15 @@
      pop_input ends $*(c)$@(x) ref:  `'                    0    `b'       1
      expand_macro for b, level 0:    `'                    1    `b'       1
      pop_input ends $*(c)$@(y) ref:  `'                    1    `'        0
-     after collect_arguments for b:  `a'                   1    `'        0
+     after last end_argument for b:  `a'                   1    `'        0
      push `a(`' to input stack:      `a'                   1    `'        0
      push_token saves $1(b) ref:     `a'                   2    `'        0
      push `')' to input stack:       `a'                   2    `'        0
      exit expand_macro for b:        `a'                   1    `'        0
      expand_macro for a, level 0 :   `a'                   2    `'        0
-     expand_argument gets $1(b) ref: `a'`$1(b)'            3    `'        0
+     collect_step gets $1(b) ref:    `a'`$1(b)'            3    `'        0
      pop_input ends $1(b) ref:       `a'`$1(b)'            2    `'        0
-     after collect_arguments for a:  `a'`$1(b)'            2    `'        0
+     after last end_argument for a:  `a'`$1(b)'            2    `'        0
      push `A' to input stack:        `a'`$1(b)'            2    `'        0
      expand_macro frees $1(b) ref:   `a'`$1(b)'            1    `'        0
      exit expand_macro for a:        `'                    0    `'        0
@@ -118,20 +120,28 @@
    memory left on the obstack while waiting for refcounts to drop.
 */
 
-static m4_macro_args *collect_arguments (m4 *, m4_call_info *, m4_symbol *,
-                                         m4_obstack *, m4_obstack *);
 static void    expand_macro      (m4 *, const char *, size_t, m4_symbol *);
 static bool    expand_token      (m4 *, m4_obstack *, m4__token_type,
                                   m4_symbol_value *, int, bool);
-static bool    expand_argument   (m4 *, m4_obstack *, m4_symbol_value *,
-                                  const m4_call_info *);
+static void    push_frame        (m4 *, const char *, size_t, m4_symbol *);
+static void    start_argument    (m4 *, m4__macro_frame *);
+static void    collect_step      (m4 *, m4__macro_frame *);
+static void    end_argument      (m4 *, m4__macro_frame *, bool);
+static void    call_frame        (m4 *, m4__macro_frame *);
 static void    process_macro     (m4 *, m4_symbol_value *, m4_obstack *, int,
                                   m4_macro_args *);
 
 static unsigned int trace_pre    (m4 *, m4_macro_args *);
 static void    trace_post        (m4 *, unsigned int, const m4_call_info *);
 static unsigned int trace_header (m4 *, const m4_call_info *);
+static unsigned int trace_pre_binary (m4 *, m4_macro_args *);
+static bool    trace_binary_value (m4 *, unsigned int, int, m4_symbol_value *,
+                                   m4_macro_args *, size_t, int);
+static void    trace_binary_expansion (m4 *, unsigned int, int);
+static bool    chain_has_func    (m4__symbol_chain *);
 static void    trace_flush       (m4 *, unsigned int);
+static m4_symbol_value *arg_symbol (m4_macro_args *, size_t, size_t *, bool);
+static m4__symbol_chain *expand_argv_link (m4 *, m4__symbol_chain *, bool);
 
 
 /* The number of the current call of expand_macro ().  */
@@ -172,9 +182,16 @@ m4_macro_expand_input (m4 *context)
   m4_set_symbol_value_text (&empty_symbol, "", 0, 0);
   VALUE_MAX_ARGS (&empty_symbol) = -1;
 
-  while ((type = m4__next_token (context, &token, &line, NULL, false, NULL))
-         != M4_TOKEN_EOF)
-    expand_token (context, NULL, type, &token, line, true);
+  while (1)
+    {
+      /* Text that holds no macro calls, strings or comments goes
+         straight to the output, without being split into tokens.  */
+      m4__next_literal_text (context);
+      type = m4__next_token (context, &token, &line, NULL, false, NULL);
+      if (type == M4_TOKEN_EOF)
+        break;
+      expand_token (context, NULL, type, &token, line, true);
+    }
 }
 
 
@@ -183,7 +200,10 @@ m4_macro_expand_input (m4 *context)
    contents of TOKEN.  Potential macro names (a TYPE of M4_TOKEN_WORD)
    are looked up in the symbol table, to see if they have a macro
    definition.  If they have, they are expanded as macros, otherwise
-   the text are just copied to the output.  LINE determines where
+   the text are just copied to the output.  When OBS is not NULL, we
+   are collecting an argument on behalf of the innermost frame of the
+   expansion stack, so a macro call merely pushes a new frame, to be
+   completed by the loop in expand_macro.  LINE determines where
    TOKEN began.  FIRST is true if there is no prior content in the
    current macro argument.  Return true if the result is guranteed to
    give the same parse on rescan in a quoted context with the same
@@ -275,7 +295,10 @@ expand_token (m4 *context, m4_obstack *obs, m4__token_type type,
                multi-byte delimiters are formed.  */
             return m4__safe_quotes (M4SYNTAX);
           }
-        expand_macro (context, textp, len2, symbol);
+        if (obs)
+          push_frame (context, textp, len2, symbol);
+        else
+          expand_macro (context, textp, len2, symbol);
         /* Expanding a macro may create new tokens to scan, and those
            tokens may generate unsafe text, but we did not append any
            text now.  */
@@ -291,169 +314,73 @@ expand_token (m4 *context, m4_obstack *obs, m4__token_type type,
 }
 
 
-/* This function parses one argument to a macro call.  It expects the
-   first left parenthesis or the separating comma to have been read by
-   the caller.  It skips leading whitespace, then reads and expands
-   tokens, until it finds a comma or a right parenthesis at the same
-   level of parentheses.  It returns a flag indicating whether the
-   argument read is the last for the active macro call.  The arguments
-   are built on the obstack OBS, indirectly through expand_token ().
-   Report errors on behalf of CALLER.  */
-static bool
-expand_argument (m4 *context, m4_obstack *obs, m4_symbol_value *argp,
-                 const m4_call_info *caller)
-{
-  m4__token_type type;
-  m4_symbol_value token;
-  int paren_level = 0;
-  int line = m4_get_current_line (context);
-  size_t len;
-  unsigned int age = m4__quote_age (M4SYNTAX);
-  bool first = true;
-
-  memset (argp, '\0', sizeof *argp);
-  VALUE_MAX_ARGS (argp) = -1;
+/* The macro expansion is handled by expand_macro ().  Rather than
+   recursing on the C stack each time a macro call appears within the
+   arguments of another, each call in progress is described by a
+   frame on an explicit expansion stack, context->frames, so that the
+   depth of nesting is bounded only by available memory.  Frames are
+   recycled through context->frame_pool, so deep but repetitive
+   recursion does not churn the allocator.
+
+   A frame goes through three phases.  push_frame () performs the
+   bookkeeping on entry to the call, and gobbles the open parenthesis
+   if there are arguments.  collect_step () then reads and expands one
+   token at a time into the argument currently being collected, and
+   end_argument () records each completed argument into the argv
+   table; a macro call encountered along the way just pushes another
+   frame, which must complete before the outer frame sees any more
+   input.  Once the last argument is complete, call_frame () uses
+   m4_macro_call () to do the call of the macro, then pops the frame.
+
+   The frames double as the stack seen by the sampling profiler, so
+   m4__profile_ticks is polled at each step; ticks that arrive while
+   no macro is in progress are charged on entry, before the new frame
+   is pushed.
 
-  /* Skip leading white space.  */
-  do
-    {
-      type = m4__next_token (context, &token, NULL, obs, true, caller);
-    }
-  while (type == M4_TOKEN_SPACE);
+   NAME points to storage on the token stack, so it is only valid
+   until more tokens are parsed.  SYMBOL is the result of the symbol
+   table lookup on NAME.  */
+static void
+expand_macro (m4 *context, const char *name, size_t len, m4_symbol *symbol)
+{
+  m4__macro_frame *outer = context->frames;
 
-  while (1)
+  if (m4__profile_ticks)
+    m4__profile_sample (context);
+  push_frame (context, name, len, symbol);
+  while (context->frames != outer)
     {
-      if (VALUE_MIN_ARGS (argp) < VALUE_MIN_ARGS (&token))
-        VALUE_MIN_ARGS (argp) = VALUE_MIN_ARGS (&token);
-      if (VALUE_MAX_ARGS (&token) < VALUE_MAX_ARGS (argp))
-        VALUE_MAX_ARGS (argp) = VALUE_MAX_ARGS (&token);
-      switch (type)
-        { /* TOKSW */
-        case M4_TOKEN_COMMA:
-        case M4_TOKEN_CLOSE:
-          if (paren_level == 0)
-            {
-              assert (argp->type != M4_SYMBOL_FUNC);
-              if (argp->type != M4_SYMBOL_COMP)
-                {
-                  len = obstack_object_size (obs);
-                  VALUE_MODULE (argp) = NULL;
-                  if (len)
-                    {
-                      obstack_1grow (obs, '\0');
-                      m4_set_symbol_value_text (argp, obstack_finish (obs),
-                                                len, age);
-                    }
-                  else
-                    m4_set_symbol_value_text (argp, "", len, 0);
-                }
-              else
-                {
-                  m4__make_text_link (obs, NULL, &argp->u.u_c.end);
-                  if (argp->u.u_c.chain == argp->u.u_c.end
-                      && argp->u.u_c.chain->type == M4__CHAIN_FUNC)
-                    {
-                      const m4__builtin *func = argp->u.u_c.chain->u.builtin;
-                      argp->type = M4_SYMBOL_FUNC;
-                      argp->u.builtin = func;
-                    }
-                }
-              return type == M4_TOKEN_COMMA;
-            }
-          /* fallthru */
-        case M4_TOKEN_OPEN:
-        case M4_TOKEN_SIMPLE:
-          if (type == M4_TOKEN_OPEN)
-            paren_level++;
-          else if (type == M4_TOKEN_CLOSE)
-            paren_level--;
-          if (!expand_token (context, obs, type, &token, line, first))
-            age = 0;
-          break;
-
-        case M4_TOKEN_EOF:
-          m4_error (context, EXIT_FAILURE, 0, caller,
-                    _("end of file in argument list"));
-          break;
-
-        case M4_TOKEN_WORD:
-        case M4_TOKEN_SPACE:
-        case M4_TOKEN_STRING:
-        case M4_TOKEN_COMMENT:
-        case M4_TOKEN_MACDEF:
-          if (!expand_token (context, obs, type, &token, line, first))
-            age = 0;
-          if (token.type == M4_SYMBOL_COMP)
-            {
-              if (argp->type != M4_SYMBOL_COMP)
-                {
-                  argp->type = M4_SYMBOL_COMP;
-                  argp->u.u_c.chain = token.u.u_c.chain;
-                  argp->u.u_c.wrapper = argp->u.u_c.has_func = false;
-                }
-              else
-                {
-                  assert (argp->u.u_c.end);
-                  argp->u.u_c.end->next = token.u.u_c.chain;
-                }
-              argp->u.u_c.end = token.u.u_c.end;
-              if (token.u.u_c.has_func)
-                argp->u.u_c.has_func = true;
-            }
-          break;
-
-        case M4_TOKEN_ARGV:
-          assert (paren_level == 0 && argp->type == M4_SYMBOL_VOID
-                  && obstack_object_size (obs) == 0
-                  && token.u.u_c.chain == token.u.u_c.end
-                  && token.u.u_c.chain->quote_age == age
-                  && token.u.u_c.chain->type == M4__CHAIN_ARGV);
-          argp->type = M4_SYMBOL_COMP;
-          argp->u.u_c.chain = argp->u.u_c.end = token.u.u_c.chain;
-          argp->u.u_c.wrapper = true;
-          argp->u.u_c.has_func = token.u.u_c.has_func;
-          type = m4__next_token (context, &token, NULL, NULL, false, caller);
-          if (argp->u.u_c.chain->u.u_a.skip_last)
-            assert (type == M4_TOKEN_COMMA);
-          else
-            assert (type == M4_TOKEN_COMMA || type == M4_TOKEN_CLOSE);
-          return type == M4_TOKEN_COMMA;
-
-        default:
-          assert (!"expand_argument");
-          abort ();
-        }
-
-      if (argp->type != M4_SYMBOL_VOID || obstack_object_size (obs))
-        first = false;
-      type = m4__next_token (context, &token, NULL, obs, first, caller);
+      m4__macro_frame *frame = context->frames;
+      if (m4__profile_ticks)
+        m4__profile_sample (context);
+      if (frame->argp)
+        collect_step (context, frame);
+      else
+        call_frame (context, frame);
     }
 }
 
-
-/* The macro expansion is handled by expand_macro ().  It parses the
-   arguments, using collect_arguments (), and builds a table of pointers to
-   the arguments.  The arguments themselves are stored on a local obstack.
-   Expand_macro () uses m4_macro_call () to do the call of the macro.
-
-   Expand_macro () is potentially recursive, since it calls expand_argument
-   (), which might call expand_token (), which might call expand_macro ().
-
-   NAME points to storage on the token stack, so it is only valid
-   until a call to collect_arguments parses more tokens.  SYMBOL is
-   the result of the symbol table lookup on NAME.  */
+/* Push a new frame onto the expansion stack for a call to the macro
+   SYMBOL, named NAME with length LEN.  The frame is ready to be
+   called if the macro has no arguments, otherwise collection of the
+   first argument is started.  */
 static void
-expand_macro (m4 *context, const char *name, size_t len, m4_symbol *symbol)
+push_frame (m4 *context, const char *name, size_t len, m4_symbol *symbol)
 {
-  void *args_base;              /* Base of stack->args on entry.  */
-  void *args_scratch;           /* Base of scratch space for m4_macro_call.  */
-  void *argv_base;              /* Base of stack->argv on entry.  */
-  m4_macro_args *argv;          /* Arguments to the called macro.  */
-  m4_obstack *expansion;        /* Collects the macro's expansion.  */
-  m4_symbol_value *value;       /* Original value of this macro.  */
-  size_t level;                 /* Expansion level of this macro.  */
+  m4__macro_frame *frame;       /* The new frame.  */
   m4__macro_arg_stacks *stack;  /* Storage for this macro.  */
-  m4_call_info info;            /* Context of this macro call.  */
+  m4_symbol_value *value;       /* Original value of this macro.  */
+  m4_macro_args args;           /* Header of the argv table.  */
+  m4_symbol_value token;
+  size_t level;
+
+  frame = context->frame_pool;
+  if (frame)
+    context->frame_pool = frame->prev;
+  else
+    frame = (m4__macro_frame *) xmalloc (sizeof *frame);
+  frame->prev = context->frames;
+  context->frames = frame;
 
   /* Obstack preparation.  */
   level = context->expansion_level;
@@ -473,30 +400,31 @@ expand_macro (m4 *context, const char *name, size_t len, m4_symbol *symbol)
       assert (!stack->refcount);
       stack->args = (m4_obstack *) xmalloc (sizeof *stack->args);
       stack->argv = (m4_obstack *) xmalloc (sizeof *stack->argv);
-      obstack_init (stack->args);
-      obstack_init (stack->argv);
+      m4__chunk_obstack_init (context, stack->args);
+      m4__chunk_obstack_init (context, stack->argv);
       stack->args_base = obstack_finish (stack->args);
       stack->argv_base = obstack_finish (stack->argv);
     }
   assert (obstack_object_size (stack->args) == 0
           && obstack_object_size (stack->argv) == 0);
-  args_base = obstack_finish (stack->args);
-  argv_base = obstack_finish (stack->argv);
+  frame->args_base = obstack_finish (stack->args);
+  frame->argv_base = obstack_finish (stack->argv);
+  frame->level = level;
   m4__adjust_refcount (context, level, true);
   stack->argcount++;
 
   /* Grab the current value of this macro, because it may change while
      collecting arguments.  Likewise, grab any state needed during
      tracing.  */
-  value = m4_get_symbol_value (symbol);
-  info.file = m4_get_current_file (context);
-  info.line = m4_get_current_line (context);
-  info.call_id = ++macro_call_id;
-  info.trace = (m4_is_debug_bit (context, M4_DEBUG_TRACE_ALL)
-                || m4_get_symbol_traced (symbol));
-  info.debug_level = m4_get_debug_level_opt (context);
-  info.name = name;
-  info.name_len = len;
+  frame->value = value = m4_get_symbol_value (symbol);
+  frame->info.file = m4_get_current_file (context);
+  frame->info.line = m4_get_current_line (context);
+  frame->info.call_id = ++macro_call_id;
+  frame->info.trace = (m4_is_debug_bit (context, M4_DEBUG_TRACE_ALL)
+                       || m4_get_symbol_traced (symbol));
+  frame->info.debug_level = m4_get_debug_level_opt (context);
+  frame->info.name = name;
+  frame->info.name_len = len;
 
   /* Prepare for macro expansion.  */
   VALUE_PENDING (value)++;
@@ -505,21 +433,321 @@ expand_macro (m4 *context, const char *name, size_t len, m4_symbol *symbol)
 recursion limit of %zu exceeded, use -L<N> to change it"),
               m4_get_nesting_limit_opt (context));
 
-  m4_trace_prepare (context, &info, value);
-  argv = collect_arguments (context, &info, symbol, stack->args, stack->argv);
-  /* Since collect_arguments can invalidate stack by reallocating
-     context->arg_stacks during a recursive expand_macro call, we must
-     reset it here.  */
-  stack = &context->arg_stacks[level];
+  m4_trace_prepare (context, &frame->info, value);
+
+  /* Must copy here, since we are consuming tokens, and since symbol
+     table can be changed during argument collection.  */
+  frame->info.name = (char *) obstack_copy0 (stack->args, name, len);
+  frame->argc = 1;
+  frame->arraylen = 0;
+  frame->quote_age = m4__quote_age (M4SYNTAX);
+  frame->wrapper = false;
+  frame->has_ref = false;
+  frame->flatten = m4_symbol_flatten_args (symbol);
+  frame->has_func = false;
+  frame->origin = 0;
+  frame->argp = NULL;
+
+  args.argc = 1;
+  args.inuse = false;
+  args.wrapper = false;
+  args.has_ref = false;
+  args.flatten = frame->flatten;
+  args.has_func = false;
+  args.quote_age = frame->quote_age;
+  args.info = &frame->info;
+  args.texts = NULL;
+  args.origin = 0;
+  args.level = level;
+  args.arraylen = 0;
+  obstack_grow (stack->argv, &args, offsetof (m4_macro_args, array));
+
+  if (m4__next_token_is_open (context))
+    {
+      /* Gobble parenthesis, then collect arguments.  */
+      m4__next_token (context, &token, NULL, NULL, false, &frame->info);
+      start_argument (context, frame);
+    }
+}
+
+/* Begin collecting the next argument of FRAME, whose open
+   parenthesis or separating comma has already been read.  */
+static void
+start_argument (m4 *context, m4__macro_frame *frame)
+{
+  m4_obstack *arguments = context->arg_stacks[frame->level].args;
+  m4_symbol_value *argp;
+
+  argp = (m4_symbol_value *) obstack_alloc (arguments, sizeof *argp);
+  memset (argp, '\0', sizeof *argp);
+  VALUE_MAX_ARGS (argp) = -1;
+  frame->argp = argp;
+  frame->paren_level = 0;
+  frame->line = m4_get_current_line (context);
+  frame->age = m4__quote_age (M4SYNTAX);
+  frame->first = true;
+  frame->skip_space = true;
+  if (frame->argc == 2)
+    {
+      frame->origin = m4__input_origin (context, &frame->origin_offset,
+                                        &frame->origin_serial);
+      frame->origin_call = macro_call_id;
+    }
+}
+
+/* Read and expand one token into the argument currently being
+   collected by FRAME, the innermost frame of the expansion stack.
+   Leading whitespace is skipped, then tokens are expanded until a
+   comma or a right parenthesis is found at the same level of
+   parentheses.  The argument is built on the args obstack of FRAME,
+   indirectly through expand_token ().  Report errors on behalf of the
+   macro call described by FRAME.  */
+static void
+collect_step (m4 *context, m4__macro_frame *frame)
+{
+  m4_obstack *obs = context->arg_stacks[frame->level].args;
+  m4_symbol_value *argp = frame->argp;
+  const m4_call_info *caller = &frame->info;
+  m4__token_type type;
+  m4_symbol_value token;
+  size_t len;
+
+  type = m4__next_token (context, &token, NULL, obs, frame->first, caller);
+  if (frame->skip_space)
+    {
+      if (type == M4_TOKEN_SPACE)
+        return;
+      frame->skip_space = false;
+    }
+
+  if (VALUE_MIN_ARGS (argp) < VALUE_MIN_ARGS (&token))
+    VALUE_MIN_ARGS (argp) = VALUE_MIN_ARGS (&token);
+  if (VALUE_MAX_ARGS (&token) < VALUE_MAX_ARGS (argp))
+    VALUE_MAX_ARGS (argp) = VALUE_MAX_ARGS (&token);
+  switch (type)
+    { /* TOKSW */
+    case M4_TOKEN_COMMA:
+    case M4_TOKEN_CLOSE:
+      if (frame->paren_level == 0)
+        {
+          assert (argp->type != M4_SYMBOL_FUNC);
+          if (argp->type != M4_SYMBOL_COMP)
+            {
+              len = obstack_object_size (obs);
+              VALUE_MODULE (argp) = NULL;
+              if (len)
+                {
+                  obstack_1grow (obs, '\0');
+                  m4_set_symbol_value_text (argp, obstack_finish (obs),
+                                            len, frame->age);
+                }
+              else
+                m4_set_symbol_value_text (argp, "", len, 0);
+            }
+          else
+            {
+              m4__make_text_link (obs, NULL, &argp->u.u_c.end);
+              if (argp->u.u_c.chain == argp->u.u_c.end
+                  && argp->u.u_c.chain->type == M4__CHAIN_FUNC)
+                {
+                  const m4__builtin *func = argp->u.u_c.chain->u.builtin;
+                  argp->type = M4_SYMBOL_FUNC;
+                  argp->u.builtin = func;
+                }
+            }
+          end_argument (context, frame, type == M4_TOKEN_COMMA);
+          return;
+        }
+      /* fallthru */
+    case M4_TOKEN_OPEN:
+    case M4_TOKEN_SIMPLE:
+      if (type == M4_TOKEN_OPEN)
+        frame->paren_level++;
+      else if (type == M4_TOKEN_CLOSE)
+        frame->paren_level--;
+      if (!expand_token (context, obs, type, &token, frame->line,
+                         frame->first))
+        frame->age = 0;
+      break;
+
+    case M4_TOKEN_EOF:
+      m4_error (context, EXIT_FAILURE, 0, caller,
+                _("end of file in argument list"));
+      break;
+
+    case M4_TOKEN_WORD:
+    case M4_TOKEN_SPACE:
+    case M4_TOKEN_STRING:
+    case M4_TOKEN_COMMENT:
+    case M4_TOKEN_MACDEF:
+      /* A macro call here pushes a new frame, which must run to
+         completion before this frame reads any more input.  Its
+         expansion is rescanned from the input engine rather than
+         appended to OBS, so the bookkeeping below is unaffected.  */
+      if (!expand_token (context, obs, type, &token, frame->line,
+                         frame->first))
+        frame->age = 0;
+      if (token.type == M4_SYMBOL_COMP)
+        {
+          if (argp->type != M4_SYMBOL_COMP)
+            {
+              argp->type = M4_SYMBOL_COMP;
+              argp->u.u_c.chain = token.u.u_c.chain;
+              argp->u.u_c.wrapper = argp->u.u_c.has_func = false;
+            }
+          else
+            {
+              assert (argp->u.u_c.end);
+              argp->u.u_c.end->next = token.u.u_c.chain;
+            }
+          argp->u.u_c.end = token.u.u_c.end;
+          if (token.u.u_c.has_func)
+            argp->u.u_c.has_func = true;
+        }
+      break;
+
+    case M4_TOKEN_ARGV:
+      assert (frame->paren_level == 0 && argp->type == M4_SYMBOL_VOID
+              && obstack_object_size (obs) == 0
+              && token.u.u_c.chain == token.u.u_c.end
+              && token.u.u_c.chain->quote_age == frame->age
+              && token.u.u_c.chain->type == M4__CHAIN_ARGV);
+      argp->type = M4_SYMBOL_COMP;
+      argp->u.u_c.chain = argp->u.u_c.end = token.u.u_c.chain;
+      argp->u.u_c.wrapper = true;
+      argp->u.u_c.has_func = token.u.u_c.has_func;
+      type = m4__next_token (context, &token, NULL, NULL, false, caller);
+      if (argp->u.u_c.chain->u.u_a.skip_last)
+        assert (type == M4_TOKEN_COMMA);
+      else
+        assert (type == M4_TOKEN_COMMA || type == M4_TOKEN_CLOSE);
+      end_argument (context, frame, type == M4_TOKEN_COMMA);
+      return;
+
+    default:
+      assert (!"collect_step");
+      abort ();
+    }
+
+  if (argp->type != M4_SYMBOL_VOID || obstack_object_size (obs))
+    frame->first = false;
+}
+
+/* Record the argument just collected by FRAME into its table of
+   argument pointers.  If MORE_ARGS, start collecting the next
+   argument, otherwise FRAME is now ready to be called.  */
+static void
+end_argument (m4 *context, m4__macro_frame *frame, bool more_args)
+{
+  m4__macro_arg_stacks *stack = &context->arg_stacks[frame->level];
+  m4_symbol_value *tokenp = frame->argp;
+
+  if ((m4_is_symbol_value_text (tokenp)
+       && !m4_get_symbol_value_len (tokenp))
+      || (frame->flatten && m4_is_symbol_value_func (tokenp)))
+    {
+      obstack_free (stack->args, tokenp);
+      tokenp = &empty_symbol;
+    }
+  obstack_ptr_grow (stack->argv, tokenp);
+  frame->arraylen++;
+  frame->argc++;
+  switch (tokenp->type)
+    {
+    case M4_SYMBOL_TEXT:
+      /* Be conservative - any change in quoting while collecting
+         arguments, or any unsafe argument, will require a rescan if
+         $@ is reused.  */
+      if (m4_get_symbol_value_len (tokenp)
+          && m4_get_symbol_value_quote_age (tokenp) != frame->quote_age)
+        frame->quote_age = 0;
+      break;
+    case M4_SYMBOL_FUNC:
+      frame->has_func = true;
+      break;
+    case M4_SYMBOL_COMP:
+      frame->has_ref = true;
+      if (tokenp->u.u_c.wrapper)
+        {
+          assert (tokenp->u.u_c.chain->type == M4__CHAIN_ARGV
+                  && !tokenp->u.u_c.chain->next);
+          frame->argc += (tokenp->u.u_c.chain->u.u_a.argv->argc
+                          - tokenp->u.u_c.chain->u.u_a.index
+                          - tokenp->u.u_c.chain->u.u_a.skip_last - 1);
+          frame->wrapper = true;
+        }
+      if (tokenp->u.u_c.has_func)
+        frame->has_func = true;
+      break;
+    default:
+      assert (!"end_argument");
+      abort ();
+    }
+
+  if (more_args)
+    start_argument (context, frame);
+  else
+    {
+      frame->argp = NULL;
+      /* The arguments after the first can be identified by where
+         they were read from, provided that they were all read from
+         the same input block without calling any macro, since then
+         they would parse the same way again.  */
+      if (frame->origin)
+        {
+          size_t offset;
+          size_t serial;
+
+          if (m4__input_origin (context, &offset, &serial) != frame->origin
+              || serial != frame->origin_serial
+              || frame->origin_call != macro_call_id || frame->wrapper
+              || offset < frame->origin_offset)
+            frame->origin = 0;
+          else
+            frame->origin_len = offset - frame->origin_offset;
+        }
+    }
+}
+
+/* Call the macro described by FRAME, the innermost frame of the
+   expansion stack, now that all of its arguments are collected.  The
+   expansion is pushed back on the input stack for rescanning.  Then
+   pop FRAME, returning it to the pool for reuse.  */
+static void
+call_frame (m4 *context, m4__macro_frame *frame)
+{
+  m4__macro_arg_stacks *stack = &context->arg_stacks[frame->level];
+  m4_symbol_value *value = frame->value;
+  void *args_scratch;           /* Base of scratch space for m4_macro_call.  */
+  m4_macro_args *argv;          /* Arguments to the called macro.  */
+  m4_obstack *expansion;        /* Collects the macro's expansion.  */
+
+  argv = (m4_macro_args *) obstack_finish (stack->argv);
+  argv->argc = frame->argc;
+  argv->wrapper = frame->wrapper;
+  argv->has_ref = frame->has_ref;
+  argv->has_func = frame->has_func;
+  if (frame->quote_age != m4__quote_age (M4SYNTAX))
+    argv->quote_age = 0;
+  else
+    argv->quote_age = frame->quote_age;
+  argv->arraylen = frame->arraylen;
+  argv->origin = frame->origin;
+  argv->origin_offset = frame->origin_offset;
+  argv->origin_len = frame->origin_len;
   args_scratch = obstack_finish (stack->args);
 
   /* The actual macro call.  */
-  expansion = m4_push_string_init (context, info.file, info.line);
+  expansion = m4_push_string_init (context, frame->info.file,
+                                   frame->info.line);
   m4_macro_call (context, value, expansion, argv);
+  if (m4__profile_ticks)
+    m4__profile_sample (context);
   m4_push_string_finish ();
 
   /* Cleanup.  */
   argv->info = NULL;
+  argv->texts = NULL;
 
   --context->expansion_level;
   --VALUE_PENDING (value);
@@ -539,111 +767,21 @@ recursion limit of %zu exceeded, use -L<N> to change it"),
           obstack_free (stack->args, args_scratch);
           if (debug_macro_level & PRINT_ARGCOUNT_CHANGES)
             xfprintf (stderr, "m4debug: -%zu- `%s' in use, level=%zu, "
-                      "refcount=%zu, argcount=%zu\n", info.call_id,
-                      argv->info->name, level, stack->refcount,
+                      "refcount=%zu, argcount=%zu\n", frame->info.call_id,
+                      frame->info.name, frame->level, stack->refcount,
                       stack->argcount);
         }
       else
         {
-          obstack_free (stack->args, args_base);
-          obstack_free (stack->argv, argv_base);
+          obstack_free (stack->args, frame->args_base);
+          obstack_free (stack->argv, frame->argv_base);
           stack->argcount--;
         }
     }
-}
-
-/* Collect all the arguments to a call of the macro SYMBOL, with call
-   context INFO.  The arguments are stored on the obstack ARGUMENTS
-   and a table of pointers to the arguments on ARGV_STACK.  Return the
-   object describing all of the macro arguments.  */
-static m4_macro_args *
-collect_arguments (m4 *context, m4_call_info *info, m4_symbol *symbol,
-                   m4_obstack *arguments, m4_obstack *argv_stack)
-{
-  m4_symbol_value token;
-  m4_symbol_value *tokenp;
-  bool more_args;
-  m4_macro_args args;
-  m4_macro_args *argv;
 
-  args.argc = 1;
-  args.inuse = false;
-  args.wrapper = false;
-  args.has_ref = false;
-  args.flatten = m4_symbol_flatten_args (symbol);
-  args.has_func = false;
-  /* Must copy here, since we are consuming tokens, and since symbol
-     table can be changed during argument collection.  */
-  info->name = (char *) obstack_copy0 (arguments, info->name, info->name_len);
-  args.quote_age = m4__quote_age (M4SYNTAX);
-  args.info = info;
-  args.level = context->expansion_level - 1;
-  args.arraylen = 0;
-  obstack_grow (argv_stack, &args, offsetof (m4_macro_args, array));
-
-  if (m4__next_token_is_open (context))
-    {
-      /* Gobble parenthesis, then collect arguments.  */
-      m4__next_token (context, &token, NULL, NULL, false, info);
-      do
-        {
-          tokenp = (m4_symbol_value *) obstack_alloc (arguments,
-                                                      sizeof *tokenp);
-          more_args = expand_argument (context, arguments, tokenp, info);
-
-          if ((m4_is_symbol_value_text (tokenp)
-               && !m4_get_symbol_value_len (tokenp))
-              || (args.flatten && m4_is_symbol_value_func (tokenp)))
-            {
-              obstack_free (arguments, tokenp);
-              tokenp = &empty_symbol;
-            }
-          obstack_ptr_grow (argv_stack, tokenp);
-          args.arraylen++;
-          args.argc++;
-          switch (tokenp->type)
-            {
-            case M4_SYMBOL_TEXT:
-              /* Be conservative - any change in quoting while
-                 collecting arguments, or any unsafe argument, will
-                 require a rescan if $@ is reused.  */
-              if (m4_get_symbol_value_len (tokenp)
-                  && m4_get_symbol_value_quote_age (tokenp) != args.quote_age)
-                args.quote_age = 0;
-              break;
-            case M4_SYMBOL_FUNC:
-              args.has_func = true;
-              break;
-            case M4_SYMBOL_COMP:
-              args.has_ref = true;
-              if (tokenp->u.u_c.wrapper)
-                {
-                  assert (tokenp->u.u_c.chain->type == M4__CHAIN_ARGV
-                          && !tokenp->u.u_c.chain->next);
-                  args.argc += (tokenp->u.u_c.chain->u.u_a.argv->argc
-                                - tokenp->u.u_c.chain->u.u_a.index
-                                - tokenp->u.u_c.chain->u.u_a.skip_last - 1);
-                  args.wrapper = true;
-                }
-              if (tokenp->u.u_c.has_func)
-                args.has_func = true;
-              break;
-            default:
-              assert (!"expand_argument");
-              abort ();
-            }
-        }
-      while (more_args);
-    }
-  argv = (m4_macro_args *) obstack_finish (argv_stack);
-  argv->argc = args.argc;
-  argv->wrapper = args.wrapper;
-  argv->has_ref = args.has_ref;
-  argv->has_func = args.has_func;
-  if (args.quote_age != m4__quote_age (M4SYNTAX))
-    argv->quote_age = 0;
-  argv->arraylen = args.arraylen;
-  return argv;
+  context->frames = frame->prev;
+  frame->prev = context->frame_pool;
+  context->frame_pool = frame;
 }
 
 
@@ -690,18 +828,26 @@ m4_macro_call (m4 *context, m4_symbol_value *value, m4_obstack *expansion,
    macros.  It is called with an obstack OBS, where the macros expansion
    will be placed, as an unfinished object.  SYMBOL points to the macro
    definition, giving the expansion text.  ARGC and ARGV are the arguments,
-   as usual.  */
+   as usual.  The text copied verbatim after the last parameter
+   reference is registered as coming from VALUE, so that arguments
+   collected from it can be recognized again.  */
 static void
 process_macro (m4 *context, m4_symbol_value *value, m4_obstack *obs,
                int argc, m4_macro_args *argv)
 {
-  const char *text = m4_get_symbol_value_text (value);
+  const char *start = m4_get_symbol_value_text (value);
+  const char *text = start;
   size_t len = m4_get_symbol_value_len (value);
   const char *end = text + len;
   int i;
   while (1)
     {
       const char *dollar;
+      /* Where the verbatim copy of this stretch of text begins, in
+         VALUE and in OBS.  */
+      size_t offset = text - start;
+      size_t tail = obstack_object_size (obs);
+
       if (m4_is_syntax_single_dollar (M4SYNTAX))
         dollar = (char *) memchr (text, M4SYNTAX->dollar, len);
       else
@@ -719,6 +865,7 @@ process_macro (m4 *context, m4_symbol_value *value, m4_obstack *obs,
       if (!dollar)
         {
           obstack_grow (obs, text, len);
+          m4__push_string_origin (context, obs, value, offset, tail);
           return;
         }
       obstack_grow (obs, text, dollar - text);
@@ -727,6 +874,7 @@ process_macro (m4 *context, m4_symbol_value *value, m4_obstack *obs,
       if (len == 1)
         {
           obstack_1grow (obs, *dollar);
+          m4__push_string_origin (context, obs, value, offset, tail);
           return;
         }
       len--;
@@ -879,7 +1027,15 @@ m4_trace_prepare (m4 *context, const m4_call_info *info,
 
   if (info->debug_level & M4_DEBUG_TRACE_QUOTE)
     quotes = m4_get_syntax_quotes (M4SYNTAX);
-  if (info->trace && (info->debug_level & M4_DEBUG_TRACE_CALL))
+  if (info->trace && (info->debug_level & M4_DEBUG_TRACE_CALL)
+      && m4_get_trace_binary_opt (context))
+    {
+      unsigned int start = m4__trace_begin (context, M4_TRACE_COLLECT, 1);
+      trace_binary_value (context, start, 0, value, NULL, 0,
+                          info->debug_level);
+      m4__trace_finish (context, start, info);
+    }
+  else if (info->trace && (info->debug_level & M4_DEBUG_TRACE_CALL))
     {
       unsigned int start = trace_header (context, info);
       obstack_grow (&context->trace_messages, info->name, info->name_len);
@@ -898,10 +1054,13 @@ static unsigned int
 trace_pre (m4 *context, m4_macro_args *argv)
 {
   int trace_level = argv->info->debug_level;
-  unsigned int start = trace_header (context, argv->info);
+  unsigned int start;
   m4_obstack *trace = &context->trace_messages;
 
   assert (argv->info->trace);
+  if (m4_get_trace_binary_opt (context))
+    return trace_pre_binary (context, argv);
+  start = trace_header (context, argv->info);
   obstack_grow (trace, argv->info->name, argv->info->name_len);
 
   if (1 < m4_arg_argc (argv) && (trace_level & M4_DEBUG_TRACE_ARGS))
@@ -920,22 +1079,198 @@ trace_pre (m4 *context, m4_macro_args *argv)
   return start;
 }
 
+/* Binary counterpart of trace_pre().  Start a call record, with one
+   item per argument holding its raw text, for m4-trace-dump to quote
+   and truncate with the settings sent alongside.  */
+static unsigned int
+trace_pre_binary (m4 *context, m4_macro_args *argv)
+{
+  int trace_level = argv->info->debug_level;
+  size_t count = 0;
+  unsigned int start;
+  size_t i;
+
+  if (trace_level & M4_DEBUG_TRACE_ARGS)
+    count = m4_arg_argc (argv) - 1;
+  start = m4__trace_begin (context, M4_TRACE_CALL, count);
+  for (i = 1; i <= count; i++)
+    if (trace_binary_value (context, start, i - 1,
+                            arg_symbol (argv, i, NULL, argv->flatten),
+                            argv, i, trace_level))
+      break;
+  return start;
+}
+
+/* Store VALUE as item INDEX of the binary trace record at START; if
+   ARGV is not NULL, VALUE is its argument ARG.  Text is copied raw,
+   only as far as the truncation length lets the text trace show it.
+   Text mixed with builtin tokens is rare enough that it is still
+   formatted here, according to DEBUG_LEVEL.  Return true if the text
+   trace would show VALUE truncated, so that no further arguments are
+   shown.  */
+static bool
+trace_binary_value (m4 *context, unsigned int start, int index,
+                    m4_symbol_value *value, m4_macro_args *argv, size_t arg,
+                    int debug_level)
+{
+  m4_obstack *trace = &context->trace_messages;
+  unsigned int settings = m4__trace_settings (context);
+  size_t max_len = m4_get_max_debug_arg_length_opt (context);
+  bool flatten = argv && argv->flatten;
+  unsigned int data = m4__trace_item_begin (context);
+  m4_module *module = NULL;
+  int kind = M4_TRACE_TEXT;
+  size_t module_len = 0;
+  size_t len = 0;
+  const char *text;
+
+  if (value->type == M4_SYMBOL_PLACEHOLDER
+      && BIT_TEST (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT))
+    m4__module_autoload_value (context, value);
+
+  switch (value->type)
+    {
+    case M4_SYMBOL_TEXT:
+      len = m4_get_symbol_value_len (value);
+      obstack_grow (trace, m4_get_symbol_value_text (value),
+                    len < max_len ? len : max_len);
+      module = VALUE_MODULE (value);
+      break;
+
+    case M4_SYMBOL_FUNC:
+      if (!flatten)
+        {
+          kind = M4_TRACE_FUNC;
+          text = value->u.builtin->builtin.name;
+          len = strlen (text);
+          obstack_grow (trace, text, len);
+          module = value->u.builtin->module;
+        }
+      break;
+
+    case M4_SYMBOL_PLACEHOLDER:
+      if (!flatten)
+        {
+          kind = M4_TRACE_PLACEHOLDER;
+          text = m4_get_symbol_value_placeholder (value);
+          len = strlen (text);
+          obstack_grow (trace, text, len);
+          module = VALUE_MODULE (value);
+        }
+      break;
+
+    case M4_SYMBOL_COMP:
+      if (argv && (flatten || !chain_has_func (value->u.u_c.chain)))
+        {
+          m4_arg_iterator iter;
+          size_t seg_len;
+
+          m4_arg_iterator_init (context, argv, arg, false, &iter);
+          while (m4_arg_iterator_next (&iter, &text, &seg_len))
+            {
+              if (len < max_len)
+                obstack_grow (trace, text, (seg_len < max_len - len
+                                            ? seg_len : max_len - len));
+              len += seg_len;
+            }
+        }
+      else
+        {
+          const m4_string_pair *quotes = NULL;
+          size_t arg_length = max_len;
+          bool truncated;
+
+          if (debug_level & M4_DEBUG_TRACE_QUOTE)
+            quotes = m4_get_syntax_quotes (M4SYNTAX);
+          truncated = m4__symbol_value_print (context, value, trace, quotes,
+                                              flatten, NULL, &arg_length,
+                                              false);
+          len = obstack_object_size (trace) - data;
+          m4__trace_item_end (context, start, data, index, M4_TRACE_FORMATTED,
+                              len, 0, settings);
+          return truncated;
+        }
+      break;
+
+    default:
+      assert (!"trace_binary_value");
+      abort ();
+    }
+
+  if (module && (debug_level & M4_DEBUG_TRACE_MODULE))
+    {
+      text = m4_get_module_name (module);
+      module_len = strlen (text);
+      obstack_grow (trace, text, module_len);
+    }
+  m4__trace_item_end (context, start, data, index, kind, len, module_len,
+                      settings);
+  return kind == M4_TRACE_TEXT && max_len <= len;
+}
+
+/* Store the expansion of the macro call being traced as the expansion
+   item of the binary trace record at START.  Plain text is copied raw,
+   as for arguments, and anything else is formatted according to
+   DEBUG_LEVEL.  */
+static void
+trace_binary_expansion (m4 *context, unsigned int start, int debug_level)
+{
+  m4_obstack *trace = &context->trace_messages;
+  unsigned int settings = m4__trace_settings (context);
+  unsigned int data = m4__trace_item_begin (context);
+  size_t len;
+
+  if (m4__input_text (context, trace,
+                      m4_get_max_debug_arg_length_opt (context), &len))
+    m4__trace_item_end (context, start, data, -1, M4_TRACE_TEXT, len, 0,
+                        settings);
+  else
+    {
+      m4_input_print (context, trace, debug_level);
+      m4__trace_item_end (context, start, data, -1, M4_TRACE_FORMATTED,
+                          obstack_object_size (trace) - data, 0, settings);
+    }
+}
+
+/* Return true if CHAIN, the links of a composite value, holds builtin
+   tokens, directly or through a $@ reference.  */
+static bool
+chain_has_func (m4__symbol_chain *chain)
+{
+  for ( ; chain; chain = chain->next)
+    if (chain->type == M4__CHAIN_FUNC
+        || (chain->type == M4__CHAIN_ARGV && chain->u.u_a.has_func))
+      return true;
+  return false;
+}
+
 /* If requested by the trace state in INFO, format the final part of a
    trace line.  Then print all collected information from START,
    returned from a prior trace_pre().  Used from m4_macro_call ().  */
 static void
 trace_post (m4 *context, unsigned int start, const m4_call_info *info)
 {
+  bool binary = m4_get_trace_binary_opt (context);
+
   assert (info->trace);
   if (info->debug_level & M4_DEBUG_TRACE_EXPANSION)
     {
-      obstack_grow (&context->trace_messages, " -> ", 4);
-      m4_input_print (context, &context->trace_messages, info->debug_level);
+      if (binary)
+        trace_binary_expansion (context, start, info->debug_level);
+      else
+        {
+          obstack_grow (&context->trace_messages, " -> ", 4);
+          m4_input_print (context, &context->trace_messages,
+                          info->debug_level);
+        }
     }
-  trace_flush (context, start);
+  if (binary)
+    m4__trace_finish (context, start, info);
+  else
+    trace_flush (context, start);
 }
 
-
+
 /* Accessors into m4_macro_args.  */
 
 /* Adjust the refcount of argument stack LEVEL.  If INCREASE, then
@@ -1216,13 +1551,17 @@ m4_is_arg_composite (m4_macro_args *argv, size_t arg)
    is not text.  Arg 0 is always text, and indices beyond argc return
    the empty string.  If FLATTEN, builtins are ignored.  The result is
    always NUL-terminated, even if it includes embedded NUL
-   characters.  */
+   characters.  A composite argument is flattened onto the scratch
+   obstack only the first time it is requested during a macro call;
+   later requests, and m4_arg_len, reuse that copy.  */
 const char *
 m4_arg_text (m4 *context, m4_macro_args *argv, size_t arg, bool flatten)
 {
   m4_symbol_value *value;
   m4__symbol_chain *chain;
   m4_obstack *obs;
+  char *text;
+  size_t len;
 
   if (arg == 0)
     {
@@ -1231,12 +1570,21 @@ m4_arg_text (m4 *context, m4_macro_args *argv, size_t arg, bool flatten)
     }
   if (argv->argc <= arg)
     return "";
+  if (argv->texts && argv->texts[arg].str)
+    return argv->texts[arg].str;
+  flatten |= argv->flatten;
   value = arg_symbol (argv, arg, NULL, flatten);
   if (m4_is_symbol_value_text (value))
     return m4_get_symbol_value_text (value);
   assert (value->type == M4_SYMBOL_COMP);
   chain = value->u.u_c.chain;
   obs = m4_arg_scratch (context);
+  if (argv->info && !argv->texts)
+    {
+      argv->texts = (m4_string *) obstack_alloc (obs, (argv->argc
+                                                       * sizeof *argv->texts));
+      memset (argv->texts, 0, argv->argc * sizeof *argv->texts);
+    }
   while (chain)
     {
       switch (chain->type)
@@ -1250,11 +1598,11 @@ m4_arg_text (m4 *context, m4_macro_args *argv, size_t arg, bool flatten)
           assert (!"m4_arg_text");
           abort ();
         case M4__CHAIN_ARGV:
-          assert (!chain->u.u_a.has_func || flatten || argv->flatten);
+          assert (!chain->u.u_a.has_func || flatten);
           m4__arg_print (context, obs, chain->u.u_a.argv, chain->u.u_a.index,
                          m4__quote_cache (M4SYNTAX, NULL, chain->quote_age,
                                           chain->u.u_a.quotes),
-                         flatten || argv->flatten || chain->u.u_a.flatten,
+                         flatten || chain->u.u_a.flatten,
                          NULL, NULL, NULL, false, false);
           break;
         default:
@@ -1263,8 +1611,146 @@ m4_arg_text (m4 *context, m4_macro_args *argv, size_t arg, bool flatten)
         }
       chain = chain->next;
     }
+  len = obstack_object_size (obs);
   obstack_1grow (obs, '\0');
-  return (char *) obstack_finish (obs);
+  text = (char *) obstack_finish (obs);
+  if (argv->texts)
+    {
+      argv->texts[arg].str = text;
+      argv->texts[arg].len = len;
+    }
+  return text;
+}
+
+/* Expand LINK, a $@ reference found in an argument, into a chain of
+   text and builtin links on the scratch obstack, which continues with
+   the links after LINK.  The text of the referenced arguments is not
+   copied, only the quotes and commas between them.  If FLATTEN,
+   builtins are flattened.  Return the first link of the new
+   chain.  */
+static m4__symbol_chain *
+expand_argv_link (m4 *context, m4__symbol_chain *link, bool flatten)
+{
+  m4_obstack *obs = m4_arg_scratch (context);
+  m4__symbol_chain head;
+  m4__symbol_chain *chain = &head;
+
+  head.next = NULL;
+  head.type = M4__CHAIN_STR;
+  head.u.u_s.str = NULL;
+  head.u.u_s.len = 0;
+  m4__arg_print (context, obs, link->u.u_a.argv, link->u.u_a.index,
+                 m4__quote_cache (M4SYNTAX, NULL, link->quote_age,
+                                  link->u.u_a.quotes),
+                 flatten || link->u.u_a.flatten, &chain, NULL, NULL, false,
+                 false);
+  assert (obstack_object_size (obs) == 0 && chain != &head);
+  chain->next = link->next;
+  return head.next;
+}
+
+/* Prepare ITER to walk the text of argument ARG of ARGV in segments,
+   as m4_arg_iterator_next returns them, rather than as one flattened
+   copy like m4_arg_text.  Arg 0 is the macro name, and indices beyond
+   argc are empty.  If FLATTEN, builtins are ignored; otherwise, abort
+   if the argument is not text.  */
+void
+m4_arg_iterator_init (m4 *context, m4_macro_args *argv, size_t arg,
+                      bool flatten, m4_arg_iterator *iter)
+{
+  m4_symbol_value *value;
+
+  iter->context = context;
+  iter->flatten = flatten || argv->flatten;
+  iter->text = NULL;
+  iter->len = 0;
+  iter->chain = NULL;
+  if (arg == 0)
+    {
+      assert (argv->info);
+      iter->text = argv->info->name;
+      iter->len = argv->info->name_len;
+    }
+  else if (argv->argc <= arg)
+    return;
+  else if (argv->texts && argv->texts[arg].str)
+    {
+      iter->text = argv->texts[arg].str;
+      iter->len = argv->texts[arg].len;
+    }
+  else
+    {
+      value = arg_symbol (argv, arg, NULL, flatten);
+      if (m4_is_symbol_value_text (value))
+        {
+          iter->text = m4_get_symbol_value_text (value);
+          iter->len = m4_get_symbol_value_len (value);
+        }
+      else
+        {
+          assert (value->type == M4_SYMBOL_COMP);
+          iter->chain = value->u.u_c.chain;
+        }
+    }
+}
+
+/* Prepare ITER to walk CHAIN, the links of a composite value that
+   holds no builtin tokens, in segments as m4_arg_iterator_next returns
+   them.  */
+void
+m4__arg_iterator_chain (m4 *context, m4__symbol_chain *chain,
+                        m4_arg_iterator *iter)
+{
+  iter->context = context;
+  iter->flatten = false;
+  iter->text = NULL;
+  iter->len = 0;
+  iter->chain = chain;
+}
+
+/* Store the next non-empty segment of the argument being walked by
+   ITER into *TEXT and *LEN, and return true; or return false once the
+   whole argument has been seen.  Segments point into the argument
+   storage, and remain valid until the current macro call ends.  */
+bool
+m4_arg_iterator_next (m4_arg_iterator *iter, const char **text, size_t *len)
+{
+  m4__symbol_chain *chain;
+
+  if (iter->len)
+    {
+      *text = iter->text;
+      *len = iter->len;
+      iter->len = 0;
+      return true;
+    }
+  while ((chain = (m4__symbol_chain *) iter->chain))
+    {
+      iter->chain = chain->next;
+      switch (chain->type)
+        {
+        case M4__CHAIN_STR:
+          if (chain->u.u_s.len)
+            {
+              *text = chain->u.u_s.str;
+              *len = chain->u.u_s.len;
+              return true;
+            }
+          break;
+        case M4__CHAIN_FUNC:
+          assert (iter->flatten);
+          break;
+        case M4__CHAIN_ARGV:
+          assert (!chain->u.u_a.has_func || iter->flatten);
+          iter->chain = expand_argv_link (iter->context, chain,
+                                          iter->flatten);
+          break;
+        default:
+          assert (!"m4_arg_iterator_next");
+          abort ();
+        }
+    }
+  return false;
 }
 
 /* Given ARGV, compare text arguments INDEXA and INDEXB for equality.
@@ -1281,8 +1767,6 @@ m4_arg_equal (m4 *context, m4_macro_args *argv, size_t indexa, size_t indexb)
   m4__symbol_chain tmpb;
   m4__symbol_chain *ca = &tmpa;
   m4__symbol_chain *cb = &tmpb;
-  m4__symbol_chain *chain;
-  m4_obstack *obs = m4_arg_scratch (context);
 
   /* Quick tests.  */
   if (sa == &empty_symbol || sb == &empty_symbol)
@@ -1292,6 +1776,42 @@ m4_arg_equal (m4 *context, m4_macro_args *argv, size_t indexa, size_t indexb)
             && memcmp (m4_get_symbol_value_text (sa),
                        m4_get_symbol_value_text (sb),
                        m4_get_symbol_value_len (sa)) == 0);
+  if ((m4_is_symbol_value_text (sa)
+       || (sa->type == M4_SYMBOL_COMP && !sa->u.u_c.chain->next
+           && sa->u.u_c.chain->type == M4__CHAIN_STR))
+      && (m4_is_symbol_value_text (sb)
+          || (sb->type == M4_SYMBOL_COMP && !sb->u.u_c.chain->next
+              && sb->u.u_c.chain->type == M4__CHAIN_STR)))
+    {
+      /* Single-link chains are common after $@ or ifelse
+         rescanning; compare them directly rather than walking.  */
+      const char *stra;
+      const char *strb;
+      size_t lena;
+      size_t lenb;
+
+      if (m4_is_symbol_value_text (sa))
+        {
+          stra = m4_get_symbol_value_text (sa);
+          lena = m4_get_symbol_value_len (sa);
+        }
+      else
+        {
+          stra = sa->u.u_c.chain->u.u_s.str;
+          lena = sa->u.u_c.chain->u.u_s.len;
+        }
+      if (m4_is_symbol_value_text (sb))
+        {
+          strb = m4_get_symbol_value_text (sb);
+          lenb = m4_get_symbol_value_len (sb);
+        }
+      else
+        {
+          strb = sb->u.u_c.chain->u.u_s.str;
+          lenb = sb->u.u_c.chain->u.u_s.len;
+        }
+      return lena == lenb && memcmp (stra, strb, lena) == 0;
+    }
 
   /* Convert both arguments to chains, if not one already.  */
   switch (sa->type)
@@ -1340,36 +1860,12 @@ m4_arg_equal (m4 *context, m4_macro_args *argv, size_t indexa, size_t indexb)
     {
       if (ca->type == M4__CHAIN_ARGV)
         {
-          tmpa.next = NULL;
-          tmpa.type = M4__CHAIN_STR;
-          tmpa.u.u_s.str = NULL;
-          tmpa.u.u_s.len = 0;
-          chain = &tmpa;
-          m4__arg_print (context, obs, ca->u.u_a.argv, ca->u.u_a.index,
-                         m4__quote_cache (M4SYNTAX, NULL, ca->quote_age,
-                                          ca->u.u_a.quotes),
-                         argv->flatten || ca->u.u_a.flatten, &chain, NULL,
-                         NULL, false, false);
-          assert (obstack_object_size (obs) == 0 && chain != &tmpa);
-          chain->next = ca->next;
-          ca = tmpa.next;
+          ca = expand_argv_link (context, ca, argv->flatten);
           continue;
         }
       if (cb->type == M4__CHAIN_ARGV)
         {
-          tmpb.next = NULL;
-          tmpb.type = M4__CHAIN_STR;
-          tmpb.u.u_s.str = NULL;
-          tmpb.u.u_s.len = 0;
-          chain = &tmpb;
-          m4__arg_print (context, obs, cb->u.u_a.argv, cb->u.u_a.index,
-                         m4__quote_cache (M4SYNTAX, NULL, cb->quote_age,
-                                          cb->u.u_a.quotes),
-                         argv->flatten || cb->u.u_a.flatten, &chain, NULL,
-                         NULL, false, false);
-          assert (obstack_object_size (obs) == 0 && chain != &tmpb);
-          chain->next = cb->next;
-          cb = tmpb.next;
+          cb = expand_argv_link (context, cb, argv->flatten);
           continue;
         }
       if (ca->type == M4__CHAIN_FUNC)
@@ -1448,6 +1944,9 @@ m4_arg_len (m4 *context, m4_macro_args *argv, size_t arg, bool flatten)
     }
   if (argv->argc <= arg)
     return 0;
+  if (argv->texts && argv->texts[arg].str)
+    return argv->texts[arg].len;
+  flatten |= argv->flatten;
   value = arg_symbol (argv, arg, NULL, flatten);
   if (m4_is_symbol_value_text (value))
     return m4_get_symbol_value_len (value);
@@ -1605,6 +2104,8 @@ m4_make_argv_ref (m4 *context, m4_macro_args *argv, const char *argv0,
   new_argv->inuse = false;
   new_argv->quote_age = argv->quote_age;
   new_argv->info = info;
+  new_argv->texts = NULL;
+  new_argv->origin = 0;
   info->trace = (argv->info->debug_level & M4_DEBUG_TRACE_ALL) || trace;
   info->name = argv0;
   info->name_len = argv0_len;
@@ -1770,6 +2271,23 @@ m4_arg_info (m4_macro_args *argv)
   return argv->info;
 }
 
+/* Given ARGV, return a nonzero identity if all arguments after the
+   first were parsed from the text of a macro definition, with no
+   macro calls in between, and set *OFFSET and *LEN to where that text
+   lies within the definition.  Two calls with the same identity,
+   offset, and length thus received the same arguments after the
+   first.  Otherwise return 0.  */
+size_t
+m4_arg_origin (m4_macro_args *argv, size_t *offset, size_t *len)
+{
+  if (argv->origin)
+    {
+      *offset = argv->origin_offset;
+      *len = argv->origin_len;
+    }
+  return argv->origin;
+}
+
 /* Return an obstack useful for scratch calculations, and which will
    not interfere with macro expansion.  The obstack will be reset when
    expand_macro completes.  */
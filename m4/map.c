@@ -0,0 +1,311 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include "m4private.h"
+
+#include "xmemdup0.h"
+
+/* This file manages named associative arrays, or maps, which give
+   macro packages a keyed store that lives outside of the symbol
+   table.  Every map is an m4_hash keyed by `m4_string', and the maps
+   themselves are kept in a second hash in the context, keyed by map
+   name.  A map only exists while it has at least one entry, so that
+   deleting the last key is indistinguishable from never having
+   created the map.  Every change to a map stamps it with the next
+   value of a counter in the context, so that a frozen layer can tell
+   which maps changed since its base was reloaded.  */
+
+/* Initial sizes; must be 1 less than a power of 2, as for
+   M4_HASH_DEFAULT_SIZE.  Maps grow as needed, so start small.  */
+#define M4_MAPS_DEFAULT_SIZE    31
+#define M4_MAP_DEFAULT_SIZE     63
+
+typedef struct {
+  m4_string name;               /* Name of map, also its hash key.  */
+  m4_hash *table;               /* Entries of this map.  */
+  size_t generation;            /* Map generation of the last change.  */
+} map_table;
+
+typedef struct {
+  m4_string key;                /* Key of entry, also its hash key.  */
+  m4_string value;              /* Value of entry.  */
+} map_entry;
+
+static map_table *map_find              (m4 *, const char *, size_t, bool);
+static void *     entry_destroy_CB      (m4_hash *, const void *, void *,
+                                         void *);
+static void *     map_destroy_CB        (m4_hash *, const void *, void *,
+                                         void *);
+
+
+/* Return the map named NAME of length LEN, or NULL if it does not
+   exist.  If CREATE, add an empty map by that name instead.  */
+static map_table *
+map_find (m4 *context, const char *name, size_t len, bool create)
+{
+  map_table **pmap = NULL;
+  map_table *map;
+  m4_string key;
+
+  if (!context->maps)
+    {
+      if (!create)
+        return NULL;
+      context->maps = m4_hash_new (M4_MAPS_DEFAULT_SIZE,
+                                   m4_hash_string_hash, m4_hash_string_cmp);
+    }
+
+  /* Safe to cast away const, since m4_hash_lookup doesn't modify
+     key.  */
+  key.str = (char *) name;
+  key.len = len;
+  pmap = (map_table **) m4_hash_lookup (context->maps, &key);
+  if (pmap)
+    return *pmap;
+  if (!create)
+    return NULL;
+
+  map = (map_table *) xmalloc (sizeof *map);
+  map->name.str = xmemdup0 (name, len);
+  map->name.len = len;
+  map->table = m4_hash_new (M4_MAP_DEFAULT_SIZE, m4_hash_string_hash,
+                            m4_hash_string_cmp);
+  m4_hash_insert (context->maps, &map->name, map);
+  return map;
+}
+
+/* Callback to remove an entry from the map HASH and free it.  */
+static void *
+entry_destroy_CB (m4_hash *hash, const void *key, void *value,
+                  void *ignored M4_GNUC_UNUSED)
+{
+  map_entry *entry = (map_entry *) value;
+
+  m4_hash_remove (hash, key);
+  free (entry->key.str);
+  free (entry->value.str);
+  free (entry);
+  return NULL;
+}
+
+/* Callback to remove a map from HASH, and free it along with all of
+   its entries.  */
+static void *
+map_destroy_CB (m4_hash *hash, const void *key, void *value,
+                void *ignored M4_GNUC_UNUSED)
+{
+  map_table *map = (map_table *) value;
+
+  m4_hash_remove (hash, key);
+  m4_hash_apply (map->table, entry_destroy_CB, NULL);
+  m4_hash_delete (map->table);
+  free (map->name.str);
+  free (map);
+  return NULL;
+}
+
+
+/* -- MAP MANAGEMENT --
+
+   These functions are used by the map builtins, as well as by
+   frozen file and dumpdef support.  */
+
+/* Associate KEY of length KEY_LEN with VALUE of length VALUE_LEN in
+   the map named NAME of length LEN, creating the map if necessary and
+   replacing any previous value for KEY.  */
+void
+m4_map_set (m4 *context, const char *name, size_t len, const char *key,
+            size_t key_len, const char *value, size_t value_len)
+{
+  map_table *map = map_find (context, name, len, true);
+  map_entry **pentry;
+  map_entry *entry;
+  m4_string tmp;
+
+  tmp.str = (char *) key;
+  tmp.len = key_len;
+  pentry = (map_entry **) m4_hash_lookup (map->table, &tmp);
+  if (pentry)
+    {
+      entry = *pentry;
+      free (entry->value.str);
+    }
+  else
+    {
+      entry = (map_entry *) xmalloc (sizeof *entry);
+      entry->key.str = xmemdup0 (key, key_len);
+      entry->key.len = key_len;
+      m4_hash_insert (map->table, &entry->key, entry);
+    }
+  entry->value.str = xmemdup0 (value, value_len);
+  entry->value.len = value_len;
+  map->generation = ++context->map_generation;
+}
+
+/* Return the value associated with KEY of length KEY_LEN in the map
+   named NAME of length LEN, or NULL if there is no such entry.  */
+const m4_string *
+m4_map_get (m4 *context, const char *name, size_t len, const char *key,
+            size_t key_len)
+{
+  map_table *map = map_find (context, name, len, false);
+  map_entry **pentry;
+  m4_string tmp;
+
+  if (!map)
+    return NULL;
+  tmp.str = (char *) key;
+  tmp.len = key_len;
+  pentry = (map_entry **) m4_hash_lookup (map->table, &tmp);
+  return pentry ? &(*pentry)->value : NULL;
+}
+
+/* Remove KEY of length KEY_LEN from the map named NAME of length LEN,
+   and return true if it was present.  The map itself is removed along
+   with its last entry.  */
+bool
+m4_map_remove (m4 *context, const char *name, size_t len, const char *key,
+               size_t key_len)
+{
+  map_table *map = map_find (context, name, len, false);
+  map_entry **pentry;
+  m4_string tmp;
+
+  if (!map)
+    return false;
+  tmp.str = (char *) key;
+  tmp.len = key_len;
+  pentry = (map_entry **) m4_hash_lookup (map->table, &tmp);
+  if (!pentry)
+    return false;
+  entry_destroy_CB (map->table, &tmp, *pentry, NULL);
+  map->generation = ++context->map_generation;
+  if (!m4_get_hash_length (map->table))
+    map_destroy_CB (context->maps, &map->name, map, NULL);
+  return true;
+}
+
+/* Return the number of entries in the map named NAME of length LEN,
+   which is 0 if the map does not exist.  */
+size_t
+m4_map_size (m4 *context, const char *name, size_t len)
+{
+  map_table *map = map_find (context, name, len, false);
+
+  return map ? m4_get_hash_length (map->table) : 0;
+}
+
+/* Remove the map named NAME of length LEN, along with all of its
+   entries.  */
+void
+m4_map_clear (m4 *context, const char *name, size_t len)
+{
+  map_table *map = map_find (context, name, len, false);
+
+  if (map)
+    {
+      map_destroy_CB (context->maps, &map->name, map, NULL);
+      context->map_generation++;
+    }
+}
+
+/* Return the generation of the last change to the map named NAME of
+   length LEN, or 0 if the map does not exist.  If NAME is NULL,
+   return the generation of the last change to any map instead.
+   Generations only grow, so a map changed after a call to this
+   function has a larger generation than the call returned.  */
+size_t
+m4_map_generation (m4 *context, const char *name, size_t len)
+{
+  map_table *map;
+
+  if (!name)
+    return context->map_generation;
+  map = map_find (context, name, len, false);
+  return map ? map->generation : 0;
+}
+
+/* For every entry in the map named NAME of length LEN, in no
+   particular order, execute the callback FUNC with the key and value
+   of the entry being visited, and the opaque parameter USERDATA.  FUNC
+   must not modify the map.  If FUNC returns non-NULL, abort the
+   iteration and return the same result; otherwise return NULL when
+   iteration completes.  */
+void *
+m4_map_apply (m4 *context, const char *name, size_t len,
+              m4_map_apply_func *func, void *userdata)
+{
+  map_table *map = map_find (context, name, len, false);
+  m4_hash_iterator *place = NULL;
+  void *result = NULL;
+
+  if (!map)
+    return NULL;
+  while ((place = m4_get_hash_iterator_next (map->table, place)))
+    {
+      map_entry *entry = (map_entry *) m4_get_hash_iterator_value (place);
+      result = func (context, &entry->key, &entry->value, userdata);
+      if (result != NULL)
+        {
+          m4_free_hash_iterator (map->table, place);
+          break;
+        }
+    }
+  return result;
+}
+
+/* For every map in CONTEXT, in no particular order, execute the
+   callback FUNC with the name of the map being visited, and the opaque
+   parameter USERDATA.  FUNC may use m4_map_apply on the map it is
+   given, but must not add or remove maps.  The return value follows
+   the same convention as m4_map_apply.  */
+void *
+m4_maps_apply (m4 *context, m4_maps_apply_func *func, void *userdata)
+{
+  m4_hash_iterator *place = NULL;
+  void *result = NULL;
+
+  if (!context->maps)
+    return NULL;
+  while ((place = m4_get_hash_iterator_next (context->maps, place)))
+    {
+      map_table *map = (map_table *) m4_get_hash_iterator_value (place);
+      result = func (context, map->name.str, map->name.len, userdata);
+      if (result != NULL)
+        {
+          m4_free_hash_iterator (context->maps, place);
+          break;
+        }
+    }
+  return result;
+}
+
+/* Free all maps of CONTEXT, when the context itself is deleted.  */
+void
+m4__maps_delete (m4 *context)
+{
+  if (context->maps)
+    {
+      m4_hash_apply (context->maps, map_destroy_CB, NULL);
+      m4_hash_delete (context->maps);
+      context->maps = NULL;
+    }
+}
@@ -23,6 +23,8 @@
 #include <dlfcn.h>
 
 #include "m4private.h"
+
+#include "close-stream.h"
 #include "xvasprintf.h"
 
 /* Define this to see runtime debug info.  Implied by DEBUG.  */
@@ -63,10 +65,29 @@
  * and macros registered by `mymod_LTX_m4_init_module' are installed
  * into the symbol table using `install_builtin_table' and `install_
  * macro_table' respectively.
+ *
+ * A program can also link modules in directly, and register them with
+ * `m4_module_preload'.  Such a module is found by name in the table
+ * of m4_static_module entries, without searching M4PATH or calling
+ * dlopen; `m4_module_import' then looks up its symbols in the same
+ * table rather than with dlsym.
+ *
+ * Finally, `m4_module_autoload' defers opening a module altogether.
+ * It reads the autoload index `NAME.autoload' from the module path,
+ * which lists the builtins and macros the module defines (the build
+ * generates one for each module that m4 loads at startup), and defines
+ * each of those names as a placeholder carrying VALUE_AUTOLOAD_BIT.
+ * The module is entered in the list of loaded modules straight away,
+ * but is only opened, and its placeholders replaced by the real
+ * definitions, once m4_symbol_lookup finds one of them.  Without an
+ * index, the module is loaded as usual.
  **/
 
 #define MODULE_SELF_NAME        "!myself!"
 
+/* Suffix of the autoload index of a module.  */
+#define AUTOLOAD_SUFFIX         ".autoload"
+
 #if DLSYM_USCORE
 static void *
 uscore_sym (void *handle, const char *symbol)
@@ -86,6 +107,14 @@ static void         install_builtin_table (m4*, m4_module *);
 static void         install_macro_table   (m4*, m4_module *);
 
 static int          compare_builtin_CB    (const void *a, const void *b);
+static const m4_static_module *static_module_find (m4 *, const char *);
+static void *       module_dlopen         (m4 *, const char *);
+static m4_module *  module_create         (m4 *, const char *);
+static void         module_init           (m4 *, m4_module *, m4_obstack *);
+static void         install_autoload_table (m4 *, m4_module *, FILE *,
+                                            const char *);
+static void *       autoload_symbol_CB    (m4_symbol_table *, const char *,
+                                           size_t, m4_symbol *, void *);
 
 const char *
 m4_get_module_name (const m4_module *module)
@@ -107,8 +136,26 @@ m4_module_import (m4 *context, const char *module_name,
      polluting the symbol table when importing a function?  */
   if (!module)
     module = m4_module_load (context, module_name, obs);
+  else if (module->pending)
+    m4__module_complete (context, module);
 
-  if (module)
+  if (module && module->static_module)
+    {
+      const m4_static_symbol *symbol = module->static_module->symbols;
+
+      for ( ; symbol && symbol->name; symbol++)
+        if (STREQ (symbol->name, symbol_name))
+          {
+            symbol_address = symbol->address;
+            break;
+          }
+
+      if (!symbol_address)
+        m4_error (context, 0, 0, NULL,
+                  _("cannot load symbol `%s' from module `%s'"),
+                  symbol_name, module_name);
+    }
+  else if (module)
     {
       symbol_address = dlsym (module->handle, symbol_name);
 
@@ -149,6 +196,7 @@ m4_install_builtins (m4 *context, m4_module *module, const m4_builtin *bp)
     }
   qsort (module->builtins, module->builtins_len,
          sizeof *module->builtins, compare_builtin_CB);
+  m4__builtin_index (module);
 }
 
 static void
@@ -241,6 +289,187 @@ m4_module_load (m4 *context, const char *name, m4_obstack *obs)
   return module;
 }
 
+/* Load the module NAME like m4_module_load, but if an autoload index
+   for it is found in the module path, only define its builtins and
+   macros as placeholders, and leave opening it to the first lookup of
+   one of them.  */
+m4_module *
+m4_module_autoload (m4 *context, const char *name, m4_obstack *obs)
+{
+  static const char *	suffixes[]	= { AUTOLOAD_SUFFIX, NULL };
+  m4_module *module = m4__module_find (context, name);
+  char *filepath;
+  FILE *file;
+
+  if (module)
+    return module;
+
+  filepath = m4_path_search (context, name, suffixes);
+  file = filepath ? m4_fopen (context, filepath, "r") : NULL;
+  if (!file)
+    {
+      free (filepath);
+      return m4_module_load (context, name, obs);
+    }
+
+  module = module_create (context, name);
+  module->pending = true;
+  m4__symtab_set_autoload (M4SYMTAB, context);
+  install_autoload_table (context, module, file, filepath);
+  if (close_stream (file) != 0)
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot read autoload index %s"),
+              quotearg_style (locale_quoting_style, filepath));
+  free (filepath);
+  return module;
+}
+
+/* Define a placeholder in the symbol table for each name listed in
+   the autoload index of MODULE, open as FILE from FILEPATH.  Each line
+   of the index is either `builtin NAME' or `macro NAME'; blank lines
+   and lines starting with `#' are ignored.  */
+static void
+install_autoload_table (m4 *context, m4_module *module, FILE *file,
+                        const char *filepath)
+{
+  m4_obstack obs;
+  int ch;
+
+  obstack_init (&obs);
+  do
+    {
+      bool builtin;
+      const char *name;
+      char *line;
+      m4_symbol_value *value;
+
+      while ((ch = getc (file)) != EOF && ch != '\n')
+        obstack_1grow (&obs, ch);
+      obstack_1grow (&obs, '\0');
+      line = (char *) obstack_finish (&obs);
+
+      if (!*line || *line == '#')
+        {
+          obstack_free (&obs, line);
+          continue;
+        }
+      builtin = strncmp (line, "builtin ", 8) == 0;
+      if (!builtin && strncmp (line, "macro ", 6) != 0)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("invalid autoload index %s"),
+                  quotearg_style (locale_quoting_style, filepath));
+      name = strchr (line, ' ') + 1;
+
+      value = m4_symbol_value_create ();
+      m4_set_symbol_value_placeholder (value, xstrdup (name));
+      VALUE_MODULE (value) = module;
+      BIT_SET (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT);
+      if (builtin && m4_get_prefix_builtins_opt (context))
+        {
+          char *prefixed = xasprintf ("m4_%s", name);
+          m4_symbol_pushdef (M4SYMTAB, prefixed, strlen (prefixed), value);
+          free (prefixed);
+        }
+      else
+        m4_symbol_pushdef (M4SYMTAB, name, strlen (name), value);
+      obstack_free (&obs, line);
+    }
+  while (ch != EOF);
+  obstack_free (&obs, NULL);
+
+  m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
+                    _("module %s: autoload index %s"),
+                    m4_get_module_name (module), quotearg_style (locale_quoting_style, filepath));
+}
+
+/* Open MODULE, which m4_module_autoload entered in the module list
+   without opening it, now that one of its definitions is needed.  */
+void
+m4__module_complete (m4 *context, m4_module *module)
+{
+  assert (module->pending);
+  module->pending = false;
+  module->static_module = static_module_find (context, module->name);
+  if (!module->static_module)
+    module->handle = module_dlopen (context, module->name);
+  if (!module->static_module && !module->handle)
+    {
+      const char *err = dlerror ();
+      if (!err) err = _("unknown error");
+
+      m4_error (context, EXIT_FAILURE, 0, NULL,
+                _("cannot open module `%s': %s"), module->name, err);
+    }
+  module_init (context, module, NULL);
+}
+
+/* Replace the autoload placeholder VALUE by the builtin or macro of
+   the same name from its module, opening the module if needed.  */
+void
+m4__module_autoload_value (m4 *context, m4_symbol_value *value)
+{
+  m4_module *module = VALUE_MODULE (value);
+  char *name = (char *) m4_get_symbol_value_placeholder (value);
+  m4_symbol_value *builtin;
+  const m4_macro *mp;
+
+  assert (module && BIT_TEST (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT));
+  BIT_RESET (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT);
+  if (module->pending)
+    m4__module_complete (context, module);
+
+  builtin = m4_builtin_find_by_name (context, module, name);
+  if (builtin)
+    {
+      m4__set_symbol_value_builtin (value, builtin->u.builtin);
+      free (builtin);
+      free (name);
+      return;
+    }
+  for (mp = module->macros; mp && mp->name; mp++)
+    if (STREQ (mp->name, name))
+      {
+        size_t len = strlen (mp->value);
+
+        m4_set_symbol_value_text (value, xmemdup0 (mp->value, len), len, 0);
+        VALUE_MIN_ARGS (value) = mp->min_args;
+        VALUE_MAX_ARGS (value) = mp->max_args;
+        free (name);
+        return;
+      }
+
+  /* The index is out of date; leave a plain placeholder, like one for
+     a builtin missing from a frozen file.  */
+  m4_warn (context, 0, NULL, _("module `%s' does not define `%s'"),
+           m4_get_module_name (module), name);
+  VALUE_MODULE (value) = NULL;
+}
+
+/* Replace the autoload placeholders anywhere in the value stack of
+   SYMBOL.  */
+static void *
+autoload_symbol_CB (m4_symbol_table *symtab M4_GNUC_UNUSED,
+                    const char *name M4_GNUC_UNUSED,
+                    size_t len M4_GNUC_UNUSED, m4_symbol *symbol,
+                    void *userdata)
+{
+  m4_symbol_value *value;
+
+  for (value = m4_get_symbol_value (symbol); value; value = VALUE_NEXT (value))
+    if (value->type == M4_SYMBOL_PLACEHOLDER
+        && BIT_TEST (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT))
+      m4__module_autoload_value ((m4 *) userdata, value);
+  return NULL;
+}
+
+/* Replace every autoload placeholder in the symbol table of CONTEXT
+   by its real definition, such as before freezing the table.  */
+void
+m4__module_autoload_all (m4 *context)
+{
+  m4_symtab_apply (M4SYMTAB, false, autoload_symbol_CB, context);
+}
+
 
 /* Return successive loaded modules. */
 m4_module *
@@ -259,6 +488,28 @@ m4__module_find (m4 *context, const char *name)
 }
 
 
+/* Register TABLE as the modules linked into the program, so that
+   loading any of them by name uses its table entry.  */
+void
+m4_module_preload (m4 *context, const m4_static_module *table)
+{
+  assert (context);
+  context->static_modules = table;
+}
+
+/* Return the entry of the module NAME in the table of modules linked
+   into the program, or NULL if it must be loaded from a file.  */
+static const m4_static_module *
+static_module_find (m4 *context, const char *name)
+{
+  const m4_static_module *entry = context->static_modules;
+
+  for ( ; entry && entry->name; entry++)
+    if (STREQ (entry->name, name))
+      return entry;
+  return NULL;
+}
+
 /* Compare two builtins A and B for sorting, as in qsort.  */
 static int
 compare_builtin_CB (const void *a, const void *b)
@@ -273,72 +524,110 @@ compare_builtin_CB (const void *a, const void *b)
 }
 
 /* Load a module.  NAME can be a absolute file name or, if relative,
-   it is searched for in the module path.  The module is unloaded in
-   case of error.  */
+   it is searched for in the module path, unless it names a module
+   linked into the program.  The module is unloaded in case of
+   error.  */
 m4_module *
 m4__module_open (m4 *context, const char *name, m4_obstack *obs)
 {
-  static const char *	suffixes[]	= { "", LT_MODULE_EXT, NULL };
   m4_module *		module		= NULL;
 
   assert (context);
 
+  const m4_static_module *linked = static_module_find (context, name);
+  void *handle   = linked ? NULL : module_dlopen (context, name);
+
+  if (linked || handle)
+    {
+      module = module_create (context, name);
+      module->handle = handle;
+      module->static_module = linked;
+      module_init (context, module, obs);
+    }
+  else
+    {
+      const char *err = dlerror ();
+      if (!err) err = _("unknown error");
+
+      /* Couldn't open the module; diagnose and exit. */
+      m4_error (context, EXIT_FAILURE, 0, NULL,
+                _("cannot open module `%s': %s"), name, err);
+    }
+
+  return module;
+}
+
+/* Search the module path for the file of module NAME and open it,
+   returning its system handle, or NULL on failure.  */
+static void *
+module_dlopen (m4 *context, const char *name)
+{
+  static const char *	suffixes[]	= { "", LT_MODULE_EXT, NULL };
   char *filepath = m4_path_search (context, name, suffixes);
-  void *handle   = NULL;
+  void *handle = NULL;
 
   if (filepath)
     {
       handle = dlopen (filepath, RTLD_NOW|RTLD_GLOBAL);
+      if (handle)
+        m4_add_dependency (context, filepath);
       free (filepath);
     }
+  return handle;
+}
 
-  if (handle)
-    {
-      m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
-                        _("module %s: opening file %s"),
-                        name ? name : MODULE_SELF_NAME,
-                        quotearg_style (locale_quoting_style, name));
+/* Enter a new module called NAME in the list of loaded modules of
+   CONTEXT, and return it.  */
+static m4_module *
+module_create (m4 *context, const char *name)
+{
+  m4_module *module = (m4_module *) xzalloc (sizeof *module);
 
-      module = (m4_module *) xzalloc (sizeof *module);
-      module->name   = xstrdup (name);
-      module->handle = handle;
-      module->next   = context->modules;
+  module->name   = xstrdup (name);
+  module->next   = context->modules;
 
-      context->modules = module;
-      m4_hash_insert (context->namemap, xstrdup (name), module);
+  context->modules = module;
+  m4_hash_insert (context->namemap, xstrdup (name), module);
+  return module;
+}
 
-      /* Find and run any initializing function in the opened module,
-         the first time the module is opened.  */
+/* Run the initializing function of MODULE, which has just been
+   opened.  */
+static void
+module_init (m4 *context, m4_module *module, m4_obstack *obs)
+{
+  const char *name = module->name;
+
+  m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
+                    _("module %s: opening file %s"),
+                    name ? name : MODULE_SELF_NAME,
+                    quotearg_style (locale_quoting_style, name));
+
+  /* Find and run any initializing function in the opened module,
+     the first time the module is opened.  */
+  m4_module_init_func *init_func;
+  if (module->static_module)
+    init_func = module->static_module->init_func;
+  else
+    {
       char *entry_point = xasprintf ("include_%s", name);
-      m4_module_init_func *init_func =
-          (m4_module_init_func *) dlsym (handle, entry_point);
+      init_func = (m4_module_init_func *) dlsym (module->handle, entry_point);
       free (entry_point);
+    }
 
-      if (init_func)
-        {
-          init_func (context, module, obs);
-
-          m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
-                            _("module %s: init hook called"), name);
-        }
-      else
-        {
-          m4_error (context, EXIT_FAILURE, 0, NULL,
-                    _("module `%s' has no entry point"), name);
-        }
+  if (init_func)
+    {
+      init_func (context, module, obs);
 
       m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
-                        _("module %s: opened"), name);
+                        _("module %s: init hook called"), name);
     }
   else
     {
-      const char *err = dlerror ();
-      if (!err) err = _("unknown error");
-
-      /* Couldn't open the module; diagnose and exit. */
       m4_error (context, EXIT_FAILURE, 0, NULL,
-                _("cannot open module `%s': %s"), name, err);
+                _("module `%s' has no entry point"), name);
     }
 
-  return module;
+  m4_debug_message (context, M4_DEBUG_TRACE_MODULE,
+                    _("module %s: opened"), name);
 }
@@ -26,6 +26,7 @@
 
 #include "binary-io.h"
 #include "clean-temp.h"
+#include "close-stream.h"
 #include "exitfail.h"
 #include "gl_avltree_oset.h"
 #include "gl_xoset.h"
@@ -126,6 +127,11 @@ static int tmp_file2_owner;
 /* True if tmp_file2 is more recently used.  */
 static bool tmp_file2_recent;
 
+/* Quoting options and reusable result buffer for m4_escape_mem.  */
+static struct quoting_options *escape_options;
+static char *escape_buffer;
+static size_t escape_size;
+
 
 /* Internal routines.  */
 
@@ -409,6 +415,11 @@ m4_output_exit (void)
   diversion_table = NULL;
   gl_oset_free (table);
   obstack_free (&diversion_storage, NULL);
+  free (escape_options);
+  free (escape_buffer);
+  escape_options = NULL;
+  escape_buffer = NULL;
+  escape_size = 0;
 }
 
 /* Reorganize in-memory diversion buffers so the current diversion can
@@ -779,6 +790,40 @@ m4_shipout_string_trunc (m4_obstack *obs, const char *s, size_t len,
   return max == 0;
 }
 
+/* Return an ASCII-encoded representation of the LEN bytes at STR,
+   which may contain embedded NUL characters, in the style of
+   escape_quoting_style, and set *RESULT_LEN to its length.  Unlike
+   quotearg_style_mem, the length comes back from the encoder itself,
+   so callers need not rescan a large result with strlen.  The result
+   is only valid until the next call.  */
+const char *
+m4_escape_mem (const char *str, size_t len, size_t *result_len)
+{
+  size_t n;
+
+  if (!escape_options)
+    {
+      /* Start from plain escape_quoting_style, as quotearg_style_mem
+         does, whatever the program did to the default options.  */
+      int ch;
+      escape_options = clone_quoting_options (NULL);
+      set_quoting_style (escape_options, escape_quoting_style);
+      set_quoting_flags (escape_options, 0);
+      for (ch = UCHAR_MAX + 1; --ch >= 0; )
+        set_char_quoting (escape_options, ch, 0);
+    }
+  n = quotearg_buffer (escape_buffer, escape_size, str, len, escape_options);
+  if (escape_size <= n)
+    {
+      free (escape_buffer);
+      escape_size = n + 1;
+      escape_buffer = xcharalloc (escape_size);
+      quotearg_buffer (escape_buffer, escape_size, str, len, escape_options);
+    }
+  *result_len = n;
+  return escape_buffer;
+}
+
 
 
 /* --- FUNCTIONS FOR USE BY DIVERSIONS --- */
@@ -892,7 +937,7 @@ insert_file (m4 *context, FILE *file, bool escaped)
 {
   static char buffer[COPY_BUFFER_SIZE];
   size_t length;
-  char *str = buffer;
+  const char *str = buffer;
   bool first = true;
 
   assert (output_diversion);
@@ -911,9 +956,9 @@ insert_file (m4 *context, FILE *file, bool escaped)
             first = false;
           else
             m4_output_text (context, "\\\n", 2);
-          str = quotearg_style_mem (escape_quoting_style, buffer, length);
+          str = m4_escape_mem (buffer, length, &length);
         }
-      m4_output_text (context, str, escaped ? strlen (str) : length);
+      m4_output_text (context, str, length);
     }
 }
 
@@ -956,15 +1001,15 @@ insert_diversion_helper (m4 *context, m4_diversion *diversion, bool escaped)
             }
           else
             {
-              char *str = diversion->u.buffer;
+              const char *str = diversion->u.buffer;
               size_t len = diversion->used;
               /* Avoid double-charging the total in-memory size when
                  transferring from one in-memory diversion to
                  another.  */
               total_buffer_size -= diversion->size;
               if (escaped)
-                str = quotearg_style_mem (escape_quoting_style, str, len);
-              m4_output_text (context, str, escaped ? strlen (str) : len);
+                str = m4_escape_mem (str, len, &len);
+              m4_output_text (context, str, len);
             }
         }
       else if (!output_diversion->u.file)
@@ -1058,6 +1103,127 @@ m4_undivert_all (m4 *context)
   gl_oset_iterator_free (&iter);
 }
 
+/* Write diversion DIVNUM to the file NAME, replacing its previous
+   contents, then discard the diversion just as undiverting it would.
+   An in-memory diversion is written with a single fwrite, and a
+   spilled one is renamed into place when NAME is on the same file
+   system as the temporary directory, rather than copied through the
+   output.  Renaming would replace a symbolic link, or split a file
+   with several hard links, so such a NAME is written through instead,
+   as fopen would.  Return false, with errno set, if NAME cannot be
+   written; the diversion is then left intact.  DIVNUM must be
+   positive, and not the current diversion.  */
+bool
+m4_write_diversion (m4 *context, int divnum, const char *name)
+{
+  m4_diversion *diversion = NULL;
+  const void *elt;
+  FILE *file;
+  struct stat st;
+  bool exists;
+
+  assert (0 < divnum && divnum != m4_get_current_diversion (context));
+  if (gl_oset_search_atleast (diversion_table, threshold_diversion_CB,
+                              &divnum, &elt)
+      && ((m4_diversion *) elt)->divnum == divnum)
+    diversion = (m4_diversion *) elt;
+
+  exists = lstat (name, &st) == 0;
+  if (diversion && !diversion->size && diversion->used
+      && (exists ? S_ISREG (st.st_mode) && st.st_nlink == 1
+          : errno == ENOENT))
+    {
+      const char *tmpname;
+
+      /* Renaming needs the data on disk, and mingw can't rename an
+         open file anyway.  */
+      if (divnum == tmp_file1_owner)
+        {
+          if (close_stream_temp (tmp_file1))
+            m4_error (context, EXIT_FAILURE, errno, NULL,
+                      _("cannot close temporary file for diversion"));
+          tmp_file1_owner = 0;
+        }
+      else if (divnum == tmp_file2_owner)
+        {
+          if (close_stream_temp (tmp_file2))
+            m4_error (context, EXIT_FAILURE, errno, NULL,
+                      _("cannot close temporary file for diversion"));
+          tmp_file2_owner = 0;
+        }
+      tmpname = m4_tmpname (divnum);
+      if (rename (tmpname, name) == 0)
+        {
+          /* The temporary file was private to us; give the result the
+             permissions of the file it replaced, or else of any other
+             file m4 creates.  */
+          if (exists)
+            chmod (name, st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+          else
+            {
+              mode_t mask = umask (0);
+              umask (mask);
+              chmod (name, (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP
+                            | S_IROTH | S_IWOTH) & ~mask);
+            }
+          /* NAME may not have existed before.  */
+          m4_path_cache_flush (context);
+          unregister_temp_file (output_temp_dir, tmpname);
+          diversion->used = 0;
+          if (!gl_oset_remove (diversion_table, diversion))
+            assert (false);
+          diversion->u.next = free_list;
+          free_list = diversion;
+          return true;
+        }
+      if (errno != EXDEV)
+        return false;
+    }
+
+  file = fopen (name, O_BINARY ? "wb" : "w");
+  if (file == NULL)
+    return false;
+  if (diversion && diversion->size)
+    fwrite (diversion->u.buffer, 1, diversion->used, file);
+  else if (diversion && diversion->used)
+    {
+      static char buffer[COPY_BUFFER_SIZE];
+      FILE *tmp = m4_tmpopen (context, divnum, true);
+      size_t length;
+
+      while ((length = fread (buffer, 1, sizeof buffer, tmp)) != 0)
+        fwrite (buffer, 1, length, file);
+      if (ferror (tmp))
+        m4_error (context, EXIT_FAILURE, errno, NULL,
+                  _("reading inserted file"));
+      if (m4_tmpclose (tmp, divnum) != 0)
+        m4_error (context, 0, errno, NULL,
+                  _("cannot clean temporary file for diversion"));
+    }
+  if (close_stream (file) != 0)
+    return false;
+  m4_path_cache_flush (context);
+
+  if (diversion)
+    {
+      if (diversion->size)
+        {
+          total_buffer_size -= diversion->size;
+          free (diversion->u.buffer);
+          diversion->size = 0;
+        }
+      else if (m4_tmpremove (divnum) != 0)
+        m4_error (context, 0, errno, NULL,
+                  _("cannot clean temporary file for diversion"));
+      diversion->used = 0;
+      if (!gl_oset_remove (diversion_table, diversion))
+        assert (false);
+      diversion->u.next = free_list;
+      free_list = diversion;
+    }
+  return true;
+}
+
 /* Produce all diversion information in frozen format on FILE.  */
 void
 m4_freeze_diversions (m4 *context, FILE *file)
@@ -33,6 +33,8 @@
 #include "configmake.h"
 #include "dirname.h"
 #include "filenamecat.h"
+#include "stat-time.h"
+#include "timespec.h"
 
 #if OS2 /* Any others? */
 #  define TRUNCATE_FILENAME 1
@@ -51,9 +53,49 @@ static const char *FILE_SUFFIXES[] = {
 
 static const char *NO_SUFFIXES[] = { "", NULL };
 
+/* Initial sizes of the path resolution and content caches; must be 1
+   less than a power of 2, as for M4_HASH_DEFAULT_SIZE.  */
+#define PATH_CACHE_DEFAULT_SIZE         63
+#define CONTENT_CACHE_DEFAULT_SIZE      31
+
+/* An entry in the path resolution cache.  The key is the file name
+   together with the suffix list it was searched with, and the entry
+   is only trusted while its generation matches that of the search
+   path.  Failed searches are cached too, so that repeatedly probing
+   for an optional file costs nothing after the first attempt.  */
+typedef struct {
+  m4_string name;               /* File name as requested, hash key.  */
+  const char **suffixes;        /* Suffix list searched, hash key.  */
+  unsigned int generation;      /* Search path generation of result.  */
+  char *path;                   /* Resolved file, or NULL on failure.  */
+  int error;                    /* Errno to report on failure.  */
+  bool traced;                  /* True to repeat the debug trace.  */
+} path_cache_entry;
+
+/* The contents of an included regular file, identified by the device,
+   inode, modification time and size it had when read.  Entries that
+   go stale are moved to a retired list rather than freed, since an
+   input block may still be reading from their data.  */
+struct m4__include_content {
+  m4_string path;               /* Resolved file name, hash key.  */
+  dev_t dev;                    /* Device of file.  */
+  ino_t ino;                    /* Inode of file.  */
+  struct timespec mtime;        /* Modification time of file.  */
+  off_t size;                   /* Size of file, also length of data.  */
+  char *data;                   /* Contents of file.  */
+  m4__include_content *next;    /* Next retired entry.  */
+};
+
 static void search_path_add (m4__search_path_info *, const char *, bool);
 static void search_path_env_init (m4__search_path_info *, char *, bool);
 static void include_env_init (m4 *context);
+static char *path_search (m4 *, const char *, const char **, bool *);
+static bool path_probe (m4 *, const char *);
+static size_t path_cache_hash (const void *);
+static int path_cache_cmp (const void *, const void *);
+static void *path_cache_destroy_CB (m4_hash *, const void *, void *, void *);
+static void *content_destroy_CB (m4_hash *, const void *, void *, void *);
+static bool content_push (m4 *, const char *, FILE *);
 
 #ifdef DEBUG_INCL
 static void include_dump (m4 *context);
@@ -71,6 +113,7 @@ search_path_add (m4__search_path_info *info, const char *dir, bool prepend)
 
   path->len = strlen (dir);
   path->dir = xstrdup (dir);
+  info->generation++;
 
   if (path->len > info->max_length) /* remember len of longest directory */
     info->max_length = path->len;
@@ -183,19 +226,83 @@ m4_add_include_directory (m4 *context, const char *dir, bool prepend)
 }
 
 
+/* Hash and comparison functions for path_cache_entry keys.  */
+static size_t
+path_cache_hash (const void *ptr)
+{
+  const path_cache_entry *key = (const path_cache_entry *) ptr;
+
+  return m4_hash_string_hash (&key->name) ^ (size_t) key->suffixes;
+}
+
+static int
+path_cache_cmp (const void *key, const void *try)
+{
+  const path_cache_entry *a = (const path_cache_entry *) key;
+  const path_cache_entry *b = (const path_cache_entry *) try;
+
+  if (a->suffixes != b->suffixes)
+    return a->suffixes < b->suffixes ? -1 : 1;
+  return m4_hash_string_cmp (&a->name, &b->name);
+}
+
+/* Callback to remove a resolution cache entry from HASH and free it.  */
+static void *
+path_cache_destroy_CB (m4_hash *hash, const void *key, void *value,
+                       void *ignored M4_GNUC_UNUSED)
+{
+  path_cache_entry *entry = (path_cache_entry *) value;
+
+  m4_hash_remove (hash, key);
+  free (entry->name.str);
+  free (entry->path);
+  free (entry);
+  return NULL;
+}
+
+/* Forget the results of all previous path searches.  This must be
+   called whenever files may have been created or removed behind our
+   back, such as by running a shell command.  */
+void
+m4_path_cache_flush (m4 *context)
+{
+  m4__get_search_path (context)->generation++;
+}
+
+/* Return a malloc'd copy of the current working directory, or NULL
+   with errno set if it cannot be determined.  */
+char *
+m4_path_cwd (void)
+{
+  size_t size = 256;
+  char *cwd;
+
+  for (;;)
+    {
+      cwd = xcharalloc (size);
+      if (getcwd (cwd, size))
+        return cwd;
+      free (cwd);
+      if (errno != ERANGE)
+        return NULL;
+      size *= 2;
+    }
+}
+
 /* Search for FILENAME according to -B options, `.', -I options, then
-   M4PATH environment.  If successful, return the open file, and if
-   RESULT is not NULL, set *RESULT to a malloc'd string that
+   M4PATH environment.  If successful, return a malloc'd string that
    represents the file found with respect to the current working
    directory.  Otherwise, return NULL, and errno reflects the failure
-   from searching `.' (regardless of what else was searched).  */
+   from searching `.' (regardless of what else was searched).  Results
+   are cached until the search path changes or m4_path_cache_flush is
+   called, so SUFFIXES must be a list with static storage.  */
 char *
 m4_path_search (m4 *context, const char *filename, const char **suffixes)
 {
-  m4__search_path *incl;
-  char *filepath;		/* buffer for constructed name */
-  size_t max_suffix_len = 0;
-  int i, e = 0;
+  m4__search_path_info *info = m4__get_search_path (context);
+  path_cache_entry key;
+  path_cache_entry **pentry;
+  path_cache_entry *entry;
 
   /* Reject empty file.  */
   if (*filename == '\0')
@@ -208,6 +315,83 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
   if (suffixes == NULL)
     suffixes = NO_SUFFIXES;
 
+  if (!info->cache)
+    info->cache = m4_hash_new (PATH_CACHE_DEFAULT_SIZE, path_cache_hash,
+                               path_cache_cmp);
+
+  /* Safe to cast away const, since m4_hash_lookup doesn't modify
+     key.  */
+  key.name.str = (char *) filename;
+  key.name.len = strlen (filename);
+  key.suffixes = suffixes;
+  pentry = (path_cache_entry **) m4_hash_lookup (info->cache, &key);
+  if (pentry)
+    {
+      entry = *pentry;
+      if (entry->generation != info->generation)
+        {
+          free (entry->path);
+          entry->path = path_search (context, filename, suffixes,
+                                     &entry->traced);
+          entry->error = errno;
+          entry->generation = info->generation;
+        }
+      else if (entry->traced)
+        m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                          _("path search for %s found %s"),
+                          quotearg_style (locale_quoting_style, filename),
+                          quotearg_n_style (1, locale_quoting_style,
+                                            entry->path));
+    }
+  else
+    {
+      entry = (path_cache_entry *) xmalloc (sizeof *entry);
+      entry->name.str = xmemdup0 (filename, key.name.len);
+      entry->name.len = key.name.len;
+      entry->suffixes = suffixes;
+      entry->path = path_search (context, filename, suffixes,
+                                 &entry->traced);
+      entry->error = errno;
+      entry->generation = info->generation;
+      m4_hash_insert (info->cache, entry, entry);
+    }
+
+  if (!entry->path)
+    {
+      errno = entry->error;
+      return NULL;
+    }
+  return xstrdup (entry->path);
+}
+
+/* Return true if FILE can be read.  Otherwise, record FILE as missing
+   for the run cache, and leave errno as set by access.  */
+static bool
+path_probe (m4 *context, const char *file)
+{
+  int e;
+
+  if (access (file, R_OK) == 0)
+    return true;
+  e = errno;
+  m4__run_cache_absent (context, file);
+  errno = e;
+  return false;
+}
+
+/* Perform the uncached search on behalf of m4_path_search, and set
+   *TRACED to whether the result was announced as a debug message.  */
+static char *
+path_search (m4 *context, const char *filename, const char **suffixes,
+             bool *traced)
+{
+  m4__search_path *incl;
+  char *filepath;		/* buffer for constructed name */
+  size_t max_suffix_len = 0;
+  int i, e = 0;
+
+  *traced = false;
+
   /* Find the longest suffix, so that we will always allocate enough
      memory for a filename with suffix.  */
   for (i = 0; suffixes && suffixes[i]; ++i)
@@ -232,7 +416,7 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
       for (i = 0; suffixes && suffixes[i]; ++i)
         {
           strcpy (filepath + mem, suffixes[i]);
-          if (access (filepath, R_OK) == 0)
+          if (path_probe (context, filepath))
 	    return filepath;
 
           /* If search fails, we'll use the error we got from the first
@@ -257,8 +441,9 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
       xfprintf (stderr, "path_search (%s) -- trying %s\n", filename, pathname);
 #endif
 
-      if (access (pathname, R_OK) == 0)
+      if (path_probe (context, pathname))
         {
+          *traced = true;
           m4_debug_message (context, M4_DEBUG_TRACE_PATH,
                             _("path search for %s found %s"),
                             quotearg_style (locale_quoting_style, filename),
@@ -279,7 +464,7 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
       for (i = 0; suffixes && suffixes[i]; ++i)
         {
           strcpy (filepath + mem, suffixes[i]);
-          if (access (filepath, R_OK) == 0)
+          if (path_probe (context, filepath))
             return filepath;
         }
       free (filepath);
@@ -291,7 +476,8 @@ m4_path_search (m4 *context, const char *filename, const char **suffixes)
 
 
 /* Attempt to open FILE; if it opens, verify that it is not a
-   directory, and ensure it does not leak across execs.  */
+   directory, and ensure it does not leak across execs.  Files opened
+   for reading are recorded as dependencies.  */
 FILE *
 m4_fopen (m4 *context, const char *file, const char *mode)
 {
@@ -303,6 +489,8 @@ m4_fopen (m4 *context, const char *file, const char *mode)
       int fd;
 
       fp = fopen (file, mode);
+      if (fp == NULL)
+        return NULL;
       fd = fileno (fp);
 
       if (fstat (fd, &st) == 0 && S_ISDIR (st.st_mode))
@@ -314,11 +502,168 @@ m4_fopen (m4 *context, const char *file, const char *mode)
       if (set_cloexec_flag (fileno (fp), true) != 0)
         m4_error (context, 0, errno, NULL,
                   _("cannot protect input file across forks"));
+      if (*mode == 'r')
+        m4_add_dependency (context, file);
     }
   return fp;
 }
 
 
+/* Functions for dependency tracking */
+
+/* If dependency tracking is enabled, record FILE as an input of this
+   run, unless it was already recorded.  */
+void
+m4_add_dependency (m4 *context, const char *file)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  m4__dependency *dep;
+  m4_string key;
+
+  if (!m4_get_track_dependencies_opt (context))
+    return;
+
+  if (!info->depends)
+    info->depends = m4_hash_new (CONTENT_CACHE_DEFAULT_SIZE,
+                                 m4_hash_string_hash, m4_hash_string_cmp);
+
+  /* Safe to cast away const, since m4_hash_lookup doesn't modify
+     key.  */
+  key.str = (char *) file;
+  key.len = strlen (file);
+  if (m4_hash_lookup (info->depends, &key))
+    return;
+
+  dep = (m4__dependency *) xmalloc (sizeof *dep);
+  dep->name.str = xmemdup0 (file, key.len);
+  dep->name.len = key.len;
+  dep->next = NULL;
+  if (info->depends_end)
+    info->depends_end->next = dep;
+  else
+    info->depends_list = dep;
+  info->depends_end = dep;
+  m4_hash_insert (info->depends, &dep->name, dep);
+}
+
+/* For every dependency recorded so far, in the order they were first
+   seen, execute the callback FUNC with the file name and the opaque
+   parameter USERDATA.  If FUNC returns non-NULL, abort the iteration
+   and return the same result; otherwise return NULL when iteration
+   completes.  */
+void *
+m4_dependencies_apply (m4 *context, m4_dependency_apply_func *func,
+                       void *userdata)
+{
+  m4__dependency *dep;
+  void *result = NULL;
+
+  for (dep = m4__get_search_path (context)->depends_list; dep;
+       dep = dep->next)
+    if ((result = func (context, dep->name.str, userdata)) != NULL)
+      break;
+  return result;
+}
+
+
+/* Callback to remove a content cache entry from HASH and free it.  */
+static void *
+content_destroy_CB (m4_hash *hash, const void *key, void *value,
+                    void *ignored M4_GNUC_UNUSED)
+{
+  m4__include_content *content = (m4__include_content *) value;
+
+  m4_hash_remove (hash, key);
+  free (content->path.str);
+  free (content->data);
+  free (content);
+  return NULL;
+}
+
+/* Push the contents of the regular file FILEPATH from the content
+   cache, and return true.  If FP is NULL, only succeed when the cache
+   holds the current contents of FILEPATH.  Otherwise FP is FILEPATH
+   freshly opened, and its contents are read into the cache; on
+   success FP is closed, and on failure it is left positioned at the
+   start of the file for normal reading.  */
+static bool
+content_push (m4 *context, const char *filepath, FILE *fp)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  m4__include_content **pcontent = NULL;
+  m4__include_content *content;
+  m4_string key;
+  struct stat st;
+  char *data;
+
+  if (!info->contents)
+    info->contents = m4_hash_new (CONTENT_CACHE_DEFAULT_SIZE,
+                                  m4_hash_string_hash, m4_hash_string_cmp);
+
+  /* Safe to cast away const, since m4_hash_lookup doesn't modify
+     key.  */
+  key.str = (char *) filepath;
+  key.len = strlen (filepath);
+  pcontent = (m4__include_content **) m4_hash_lookup (info->contents, &key);
+
+  if ((fp ? fstat (fileno (fp), &st) : stat (filepath, &st)) != 0
+      || !S_ISREG (st.st_mode) || SIZE_MAX <= (uintmax_t) st.st_size)
+    return false;
+
+  if (pcontent)
+    {
+      content = *pcontent;
+      if (content->dev == st.st_dev && content->ino == st.st_ino
+          && content->size == st.st_size
+          && timespec_cmp (content->mtime, get_stat_mtime (&st)) == 0)
+        {
+          if (fp)
+            fclose (fp);
+          m4__push_cached_file (context, content->data, content->size,
+                                filepath);
+          return true;
+        }
+    }
+  if (!fp)
+    return false;
+
+  data = xcharalloc (st.st_size + 1);
+  if (fread (data, 1, st.st_size, fp) != (size_t) st.st_size
+      || getc (fp) != EOF || ferror (fp))
+    {
+      /* The file changed while we were reading it; leave it to the
+         normal input engine.  */
+      free (data);
+      rewind (fp);
+      return false;
+    }
+  fclose (fp);
+
+  if (pcontent)
+    {
+      /* Retire the stale entry, since the input stack may still
+         refer to its data.  */
+      content = *pcontent;
+      m4_hash_remove (info->contents, &content->path);
+      content->next = info->retired;
+      info->retired = content;
+    }
+  content = (m4__include_content *) xmalloc (sizeof *content);
+  content->path.str = xmemdup0 (filepath, key.len);
+  content->path.len = key.len;
+  content->dev = st.st_dev;
+  content->ino = st.st_ino;
+  content->mtime = get_stat_mtime (&st);
+  content->size = st.st_size;
+  content->data = data;
+  content->next = NULL;
+  m4_hash_insert (info->contents, &content->path, content);
+
+  m4__push_cached_file (context, content->data, content->size, filepath);
+  return true;
+}
+
+
 /* Generic load function.  Push the input file or load the module named
    FILENAME, if it can be found in the search path.  Complain
    about inaccesible files iff SILENT is false.  */
@@ -332,7 +677,7 @@ m4_load_filename (m4 *context, const m4_call_info *caller,
 
   if (m4_get_posixly_correct_opt (context))
     {
-      if (access (filename, R_OK) == 0)
+      if (path_probe (context, filename))
         filepath = xstrdup (filename);
     }
   else
@@ -351,6 +696,13 @@ m4_load_filename (m4 *context, const m4_call_info *caller,
     {
       FILE *fp = NULL;
 
+      if (filepath && m4_get_cache_includes_opt (context)
+          && content_push (context, filepath, NULL))
+        {
+          free (filepath);
+          return true;
+        }
+
       if (filepath)
         fp = m4_fopen (context, filepath, "r");
 
@@ -363,7 +715,9 @@ m4_load_filename (m4 *context, const m4_call_info *caller,
           return false;
         }
 
-      m4_push_file (context, fp, filepath, true);
+      if (!m4_get_cache_includes_opt (context)
+          || !content_push (context, filepath, fp))
+        m4_push_file (context, fp, filepath, true);
       new_input = true;
     }
   free (filepath);
@@ -372,6 +726,58 @@ m4_load_filename (m4 *context, const m4_call_info *caller,
 }
 
 
+/* Free the search path and its caches, when CONTEXT is deleted.  */
+void
+m4__include_delete (m4 *context)
+{
+  m4__search_path_info *info = m4__get_search_path (context);
+  m4__search_path *path = info->list;
+
+  while (path)
+    {
+      m4__search_path *stale = path;
+      path = path->next;
+
+      DELETE (stale->dir); /* Cast away const.  */
+      free (stale);
+    }
+
+  if (info->cache)
+    {
+      m4_hash_apply (info->cache, path_cache_destroy_CB, NULL);
+      m4_hash_delete (info->cache);
+    }
+  if (info->contents)
+    {
+      m4_hash_apply (info->contents, content_destroy_CB, NULL);
+      m4_hash_delete (info->contents);
+    }
+  while (info->retired)
+    {
+      m4__include_content *stale = info->retired;
+      info->retired = stale->next;
+
+      free (stale->path.str);
+      free (stale->data);
+      free (stale);
+    }
+
+  if (info->depends)
+    {
+      while (info->depends_list)
+        {
+          m4__dependency *stale = info->depends_list;
+          info->depends_list = stale->next;
+
+          m4_hash_remove (info->depends, &stale->name);
+          free (stale->name.str);
+          free (stale);
+        }
+      m4_hash_delete (info->depends);
+    }
+  free (info);
+}
+
 void
 m4__include_init (m4 *context)
 {
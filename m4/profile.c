@@ -0,0 +1,255 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <signal.h>
+#include <sys/time.h>
+
+#include "m4private.h"
+
+#include "xmemdup0.h"
+
+/* This file implements the sampling profiler behind
+   `--sample-profile'.  An interval timer delivers SIGPROF at the
+   requested rate, and the signal handler does nothing but count the
+   tick.  Since it is not safe to look at the expansion stack from
+   within a signal handler, expand_macro () checks the count at each
+   step, and charges the pending ticks to the stack of macro calls in
+   progress at that point, context->frames.  Each distinct stack is
+   kept as one line of `folded' output, as understood by common flame
+   graph tools: the frames from outermost to innermost, separated by
+   semicolons, then a space and the number of samples.  */
+
+/* Initial size of the sample table; must be 1 less than a power of
+   2, as for M4_HASH_DEFAULT_SIZE.  */
+#define PROFILE_DEFAULT_SIZE    255
+
+/* Name used for samples taken while no macro call is in progress.  */
+#define PROFILE_TOP_LEVEL       "(top level)"
+
+/* Number of timer ticks not yet charged to a stack.  */
+volatile sig_atomic_t m4__profile_ticks;
+
+struct m4__profile {
+  m4_hash *samples;             /* Map m4_string to profile_entry.  */
+  m4_obstack scratch;           /* Space for building folded stacks.  */
+  m4__macro_frame **frames;     /* Frames of the current stack.  */
+  size_t frames_size;           /* Allocated length of FRAMES.  */
+};
+
+typedef struct {
+  m4_string stack;              /* Folded stack, also its hash key.  */
+  size_t count;                 /* Samples taken with this stack.  */
+} profile_entry;
+
+static void     profile_handler         (int);
+static int      profile_entry_cmp       (const void *, const void *);
+static void *   profile_entry_delete_CB (m4_hash *, const void *, void *,
+                                         void *);
+
+
+/* Count one tick of the profiling timer.  */
+static void
+profile_handler (int sig M4_GNUC_UNUSED)
+{
+  m4__profile_ticks++;
+}
+
+/* Start sampling the expansion stack of CONTEXT HZ times per second
+   of processor time.  Return false, with errno set, if the profiling
+   timer is not available.  */
+bool
+m4_profile_start (m4 *context, unsigned int hz)
+{
+#if HAVE_SETITIMER && defined SIGPROF
+  struct sigaction action;
+  struct itimerval timer;
+  unsigned long int usec;
+
+  assert (0 < hz);
+  if (!context->profile)
+    {
+      m4__profile *profile = (m4__profile *) xzalloc (sizeof *profile);
+      profile->samples = m4_hash_new (PROFILE_DEFAULT_SIZE,
+                                      m4_hash_string_hash, m4_hash_string_cmp);
+      obstack_init (&profile->scratch);
+      context->profile = profile;
+    }
+
+  /* Restart interrupted system calls, so that the rest of m4 need not
+     be prepared for EINTR.  */
+  memset (&action, 0, sizeof action);
+  action.sa_handler = profile_handler;
+  sigemptyset (&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction (SIGPROF, &action, NULL) != 0)
+    return false;
+
+  usec = 1000000 / hz;
+  if (!usec)
+    usec = 1;
+  timer.it_interval.tv_sec = usec / 1000000;
+  timer.it_interval.tv_usec = usec % 1000000;
+  timer.it_value = timer.it_interval;
+  return setitimer (ITIMER_PROF, &timer, NULL) == 0;
+#else /* !HAVE_SETITIMER || !SIGPROF */
+  errno = ENOSYS;
+  return false;
+#endif /* !HAVE_SETITIMER || !SIGPROF */
+}
+
+/* Charge any pending timer ticks to the current expansion stack of
+   CONTEXT.  Called by expand_macro () when m4__profile_ticks is
+   nonzero.  */
+void
+m4__profile_sample (m4 *context)
+{
+  m4__profile *profile = context->profile;
+  size_t ticks = m4__profile_ticks;
+  m4__macro_frame *frame;
+  profile_entry **pentry;
+  profile_entry *entry;
+  m4_string key;
+  size_t depth = 0;
+  size_t i;
+
+  m4__profile_ticks -= ticks;
+  if (!profile)
+    return;
+
+  for (frame = context->frames; frame; frame = frame->prev)
+    {
+      if (profile->frames_size <= depth)
+        profile->frames = (m4__macro_frame **)
+          x2nrealloc (profile->frames, &profile->frames_size,
+                      sizeof *profile->frames);
+      profile->frames[depth++] = frame;
+    }
+  if (!depth)
+    obstack_grow (&profile->scratch, PROFILE_TOP_LEVEL,
+                  strlen (PROFILE_TOP_LEVEL));
+  for (i = depth; i--; )
+    {
+      const m4_call_info *info = &profile->frames[i]->info;
+      obstack_grow (&profile->scratch, info->name, info->name_len);
+      obstack_printf (&profile->scratch, " (%s:%d)", info->file, info->line);
+      if (i)
+        obstack_1grow (&profile->scratch, ';');
+    }
+
+  key.len = obstack_object_size (&profile->scratch);
+  key.str = (char *) obstack_finish (&profile->scratch);
+  pentry = (profile_entry **) m4_hash_lookup (profile->samples, &key);
+  if (pentry)
+    entry = *pentry;
+  else
+    {
+      entry = (profile_entry *) xmalloc (sizeof *entry);
+      entry->stack.str = xmemdup0 (key.str, key.len);
+      entry->stack.len = key.len;
+      entry->count = 0;
+      m4_hash_insert (profile->samples, &entry->stack, entry);
+    }
+  entry->count += ticks;
+  obstack_free (&profile->scratch, key.str);
+}
+
+/* Compare two profile entries by their folded stack, for qsort.  */
+static int
+profile_entry_cmp (const void *a, const void *b)
+{
+  const profile_entry *x = *(profile_entry *const *) a;
+  const profile_entry *y = *(profile_entry *const *) b;
+  int result = memcmp (x->stack.str, y->stack.str,
+                       x->stack.len < y->stack.len ? x->stack.len
+                       : y->stack.len);
+
+  if (result == 0)
+    result = x->stack.len < y->stack.len ? -1 : x->stack.len > y->stack.len;
+  return result;
+}
+
+/* Stop the profiling timer, and write the samples collected so far
+   for CONTEXT to FP as folded stacks, sorted by stack.  */
+void
+m4_profile_dump (m4 *context, FILE *fp)
+{
+  m4__profile *profile = context->profile;
+  m4_hash_iterator *place = NULL;
+  profile_entry **entries;
+  size_t count = 0;
+  size_t i;
+
+#if HAVE_SETITIMER && defined SIGPROF
+  {
+    struct itimerval timer;
+
+    memset (&timer, 0, sizeof timer);
+    setitimer (ITIMER_PROF, &timer, NULL);
+  }
+#endif /* HAVE_SETITIMER && SIGPROF */
+  if (!profile)
+    return;
+  if (m4__profile_ticks)
+    m4__profile_sample (context);
+
+  entries = (profile_entry **) xnmalloc (m4_get_hash_length (profile->samples),
+                                         sizeof *entries);
+  while ((place = m4_get_hash_iterator_next (profile->samples, place)))
+    entries[count++] = (profile_entry *) m4_get_hash_iterator_value (place);
+  qsort (entries, count, sizeof *entries, profile_entry_cmp);
+  for (i = 0; i < count; i++)
+    {
+      fwrite (entries[i]->stack.str, 1, entries[i]->stack.len, fp);
+      xfprintf (fp, " %zu\n", entries[i]->count);
+    }
+  free (entries);
+}
+
+/* Callback to remove an entry from the sample table HASH and free
+   it.  */
+static void *
+profile_entry_delete_CB (m4_hash *hash, const void *key, void *value,
+                         void *ignored M4_GNUC_UNUSED)
+{
+  profile_entry *entry = (profile_entry *) value;
+
+  m4_hash_remove (hash, key);
+  free (entry->stack.str);
+  free (entry);
+  return NULL;
+}
+
+/* Free the profile state, when CONTEXT is deleted.  */
+void
+m4__profile_delete (m4 *context)
+{
+  m4__profile *profile = context->profile;
+
+  if (profile)
+    {
+      m4_hash_apply (profile->samples, profile_entry_delete_CB, NULL);
+      m4_hash_delete (profile->samples);
+      obstack_free (&profile->scratch, NULL);
+      free (profile->frames);
+      free (profile);
+      context->profile = NULL;
+    }
+}
@@ -0,0 +1,786 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "m4private.h"
+
+#include "close-stream.h"
+#include "tempname.h"
+#include "xmemdup0.h"
+
+/* This file implements the whole-run cache behind `--cache-dir'.
+   The key of a run is its command line, the current directory, and
+   the environment variables that m4 itself looks at; it is hashed to
+   name a file in the cache directory.  While the run proceeds, its
+   standard output and standard error are captured, and every file it
+   reads is recorded, through the same hooks as dependency tracking;
+   so are the files that path searches found missing, and the
+   environment variables read by getenv.  At the end of a successful
+   run, the entry is written with the full key, the dependencies,
+   along with a hash of the contents of each file read, the exit
+   status and the captured output.  The next run with the same key
+   checks every dependency, and if nothing changed, replays the
+   output without expanding anything.
+
+   Builtins whose result cannot be predicted from the dependencies,
+   such as those that run commands, read the clock, or create files,
+   make the run uncacheable by calling m4_run_cache_forbid.  So do
+   options with side effects other than output, and reading standard
+   input.  */
+
+/* Initial size of the tables of recorded dependencies; must be 1 less
+   than a power of 2, as for M4_HASH_DEFAULT_SIZE.  */
+#define RUN_CACHE_DEFAULT_SIZE  31
+
+/* Magic string at the start of every cache entry and every key.
+   Bump the number whenever the key or the layout changes.  */
+#define RUN_CACHE_MAGIC         "M4RUN 1"
+
+/* Suffix of the temporary file for a new entry; the X's are replaced
+   by gen_tempname.  */
+#define RUN_CACHE_TEMP_SUFFIX   ".tmpXXXXXX"
+
+/* Seed of the 64-bit FNV-1a hash used for entry names and for file
+   contents.  */
+#define RUN_CACHE_HASH_INIT     0xcbf29ce484222325ULL
+
+/* Environment variables that are part of every key, since m4 reads
+   them on its own.  */
+static const char *const run_cache_env[] = {
+  "M4PATH", "POSIXLY_CORRECT", "TZ", "LANG", "LANGUAGE", "LC_ALL",
+  "LC_COLLATE", "LC_CTYPE", "LC_MESSAGES", "LC_NUMERIC", "LC_TIME",
+  NULL
+};
+
+struct m4__run_cache {
+  char *dir;                    /* Cache directory.  */
+  char *key;                    /* Key of this run.  */
+  size_t key_len;               /* Length of KEY.  */
+  char *file;                   /* Entry for KEY in DIR.  */
+  bool merged;                  /* True if stdout and stderr are shared.  */
+  bool forbidden;               /* True if this run cannot be cached.  */
+  bool capturing;               /* True while output is redirected.  */
+  FILE *out;                    /* Captured standard output.  */
+  FILE *err;                    /* Captured standard error, unless merged.  */
+  int saved_out;                /* Real standard output while capturing.  */
+  int saved_err;                /* Real standard error while capturing.  */
+  m4_hash *env;                 /* Variables read, as run_cache_dep.  */
+  m4_hash *absent;              /* Files found missing, as run_cache_dep.  */
+  m4_obstack scratch;           /* Space for dependency records.  */
+};
+
+typedef struct {
+  m4_string name;               /* File or variable name, the hash key.  */
+  char *value;                  /* Value of variable, or NULL if unset.  */
+} run_cache_dep;
+
+/* The cache that is capturing output, for the benefit of
+   run_cache_exit.  */
+static m4__run_cache *run_cache_active;
+
+static uint_least64_t run_cache_hash    (uint_least64_t, const char *,
+                                         size_t);
+static bool     run_cache_hash_file     (const char *, uint_least64_t *,
+                                         uintmax_t *);
+static void     run_cache_add_dep       (m4_hash *, const char *, size_t,
+                                         const char *);
+static const char *run_cache_check      (const char *, size_t);
+static void     run_cache_capture       (m4 *);
+static bool     run_cache_release       (m4__run_cache *, char **, size_t *,
+                                         char **, size_t *);
+static void     run_cache_exit          (void);
+static void     run_cache_store         (m4 *, int, const char *, size_t,
+                                         const char *, size_t);
+static bool     read_all                (FILE *, char **, size_t *);
+static void *   file_record_CB          (m4 *, const char *, void *);
+static void *   absent_record_CB        (m4_hash *, const void *, void *,
+                                         void *);
+static void *   env_record_CB           (m4_hash *, const void *, void *,
+                                         void *);
+static void *   dep_destroy_CB          (m4_hash *, const void *, void *,
+                                         void *);
+
+
+/* Return the 64-bit FNV-1a hash of LEN bytes at BUF, continuing from
+   HASH.  */
+static uint_least64_t
+run_cache_hash (uint_least64_t hash, const char *buf, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash ^= to_uchar (buf[i]);
+      hash = (hash * 0x100000001b3ULL) & 0xffffffffffffffffULL;
+    }
+  return hash;
+}
+
+/* Hash the contents of FILE into *HASH, and store its size in *SIZE.
+   Return false if FILE is not a regular file that can be read.  */
+static bool
+run_cache_hash_file (const char *file, uint_least64_t *hash, uintmax_t *size)
+{
+  char buf[BUFSIZ];
+  struct stat st;
+  size_t len;
+  bool ok;
+  FILE *fp = fopen (file, "rb");
+
+  if (!fp)
+    return false;
+  if (fstat (fileno (fp), &st) != 0 || !S_ISREG (st.st_mode))
+    {
+      fclose (fp);
+      return false;
+    }
+  *hash = RUN_CACHE_HASH_INIT;
+  *size = 0;
+  while ((len = fread (buf, 1, sizeof buf, fp)) != 0)
+    {
+      *hash = run_cache_hash (*hash, buf, len);
+      *size += len;
+    }
+  ok = !ferror (fp);
+  fclose (fp);
+  return ok;
+}
+
+/* Record NAME of length LEN in the dependency table TABLE, with
+   VALUE, unless it is already there.  */
+static void
+run_cache_add_dep (m4_hash *table, const char *name, size_t len,
+                   const char *value)
+{
+  run_cache_dep *dep;
+  m4_string key;
+
+  key.str = (char *) name;
+  key.len = len;
+  if (m4_hash_lookup (table, &key))
+    return;
+
+  dep = (run_cache_dep *) xmalloc (sizeof *dep);
+  dep->name.str = xmemdup0 (name, len);
+  dep->name.len = len;
+  dep->value = value ? xstrdup (value) : NULL;
+  m4_hash_insert (table, &dep->name, dep);
+}
+
+/* Use DIR, which is created if it does not exist yet, to cache whole
+   runs.  The key of this run is made of the ARGC arguments in ARGV,
+   and of the environment ENVP if it is not NULL, on top of the
+   current directory and the usual environment variables.  Return
+   false, with errno set, if DIR is not a usable directory.  */
+bool
+m4_run_cache_open (m4 *context, const char *dir, int argc,
+                   char *const *argv, char *const *envp)
+{
+  m4__run_cache *cache;
+  m4_obstack *obs;
+  struct stat st;
+  struct stat st_err;
+  uint_least64_t hash;
+  char *cwd;
+  char *key;
+  int i;
+
+  if (mkdir (dir, 0777) != 0 && errno != EEXIST)
+    return false;
+  if (stat (dir, &st) != 0)
+    return false;
+  if (!S_ISDIR (st.st_mode))
+    {
+      errno = ENOTDIR;
+      return false;
+    }
+
+  cwd = m4_path_cwd ();
+  if (!cwd)
+    return false;
+
+  assert (!context->run_cache);
+  cache = (m4__run_cache *) xzalloc (sizeof *cache);
+  cache->dir = xstrdup (dir);
+  cache->saved_out = cache->saved_err = -1;
+  cache->env = m4_hash_new (RUN_CACHE_DEFAULT_SIZE,
+                            m4_hash_string_hash, m4_hash_string_cmp);
+  cache->absent = m4_hash_new (RUN_CACHE_DEFAULT_SIZE,
+                               m4_hash_string_hash, m4_hash_string_cmp);
+  obstack_init (&cache->scratch);
+  context->run_cache = cache;
+
+  /* Output replayed to a single file must keep stdout and stderr
+     interleaved, so it is captured as one stream, and such runs need
+     their own entry.  */
+  cache->merged = (fstat (STDOUT_FILENO, &st) == 0
+                   && fstat (STDERR_FILENO, &st_err) == 0
+                   && st.st_dev == st_err.st_dev
+                   && st.st_ino == st_err.st_ino);
+
+  obs = &cache->scratch;
+  obstack_grow0 (obs, RUN_CACHE_MAGIC, strlen (RUN_CACHE_MAGIC));
+  obstack_grow0 (obs, VERSION, strlen (VERSION));
+  obstack_grow0 (obs, cwd, strlen (cwd));
+  obstack_grow0 (obs, cache->merged ? "merged" : "split",
+                 cache->merged ? 6 : 5);
+  free (cwd);
+  obstack_printf (obs, "%d", argc);
+  obstack_1grow (obs, '\0');
+  for (i = 0; i < argc; i++)
+    obstack_grow0 (obs, argv[i], strlen (argv[i]));
+  for (i = 0; run_cache_env[i]; i++)
+    {
+      const char *value = getenv (run_cache_env[i]);
+
+      obstack_grow (obs, run_cache_env[i], strlen (run_cache_env[i]));
+      if (value)
+        {
+          obstack_1grow (obs, '=');
+          obstack_grow (obs, value, strlen (value));
+        }
+      obstack_1grow (obs, '\0');
+    }
+  for ( ; envp && *envp; envp++)
+    obstack_grow0 (obs, *envp, strlen (*envp));
+  cache->key_len = obstack_object_size (obs);
+  key = (char *) obstack_finish (obs);
+  cache->key = (char *) xmemdup (key, cache->key_len);
+  obstack_free (obs, key);
+
+  hash = run_cache_hash (RUN_CACHE_HASH_INIT, cache->key, cache->key_len);
+  obstack_printf (obs, "%s/%08lx%08lx", dir,
+                  (unsigned long int) (hash >> 32) & 0xffffffff,
+                  (unsigned long int) hash & 0xffffffff);
+  obstack_1grow (obs, '\0');
+  key = (char *) obstack_finish (obs);
+  cache->file = xstrdup (key);
+  obstack_free (obs, key);
+
+  /* The files read by this run are found through dependency
+     tracking.  */
+  m4_set_track_dependencies_opt (context, true);
+  return true;
+}
+
+/* Mark this run as uncacheable, because of the macro call or the
+   option described by CALLER.  */
+void
+m4_run_cache_forbid (m4 *context, const m4_call_info *caller)
+{
+  m4__run_cache *cache = context->run_cache;
+
+  if (!cache || cache->forbidden)
+    return;
+  cache->forbidden = true;
+  m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                    _("run cache disabled by %s"),
+                    quotearg_style_mem (locale_quoting_style, caller->name,
+                                        caller->name_len));
+}
+
+/* Record that the outcome of this run depends on the environment
+   variable NAME.  Call this before the variable is read or changed,
+   so that the value recorded is the one this run started with.  */
+void
+m4_run_cache_add_env (m4 *context, const char *name)
+{
+  m4__run_cache *cache = context->run_cache;
+
+  if (cache && cache->capturing)
+    run_cache_add_dep (cache->env, name, strlen (name), getenv (name));
+}
+
+/* Record that a path search did not find FILE, so that a cached run
+   is not reused once FILE shows up.  */
+void
+m4__run_cache_absent (m4 *context, const char *file)
+{
+  m4__run_cache *cache = context->run_cache;
+
+  if (cache && cache->capturing)
+    run_cache_add_dep (cache->absent, file, strlen (file), NULL);
+}
+
+/* Check the LEN bytes of dependency records at DEPS against the
+   current state of the world.  Return NULL if they all still hold,
+   otherwise the name of the first one that changed.  */
+static const char *
+run_cache_check (const char *deps, size_t len)
+{
+  const char *end = deps + len;
+  const char *next;
+
+  for ( ; deps < end; deps = next)
+    {
+      const char *rec = deps;
+
+      next = (const char *) memchr (rec, '\0', end - rec);
+      if (!next)
+        return rec;
+      next++;
+      switch (*rec)
+        {
+        case 'f':
+          {
+            unsigned long int hi, lo;
+            uintmax_t stored_size;
+            uintmax_t size;
+            uint_least64_t hash;
+            int n;
+
+            if (sscanf (rec + 1, "%8lx%8lx %ju%n", &hi, &lo, &stored_size,
+                        &n) != 3 || rec[1 + n] != ' ')
+              return rec;
+            if (!run_cache_hash_file (rec + 2 + n, &hash, &size)
+                || size != stored_size
+                || hash != (((uint_least64_t) hi << 32) | lo))
+              return rec + 2 + n;
+          }
+          break;
+
+        case 'a':
+          if (access (rec + 1, R_OK) == 0)
+            return rec + 1;
+          break;
+
+        case 'e':
+          {
+            const char *value = getenv (rec + 1);
+            const char *stored = next;
+
+            next = (const char *) memchr (stored, '\0', end - stored);
+            if (!next)
+              return rec + 1;
+            next++;
+            if (*stored == '=' ? !value || !STREQ (value, stored + 1)
+                : value != NULL)
+              return rec + 1;
+          }
+          break;
+
+        default:
+          return rec;
+        }
+    }
+  return NULL;
+}
+
+/* Read the rest of FP into a new buffer, stored in *DATA with its
+   length in *LEN.  Return false on read error.  */
+static bool
+read_all (FILE *fp, char **data, size_t *len)
+{
+  size_t size = BUFSIZ;
+  size_t n;
+
+  *len = 0;
+  *data = xcharalloc (size);
+  while ((n = fread (*data + *len, 1, size - *len, fp)) != 0)
+    {
+      *len += n;
+      if (*len == size)
+        *data = x2realloc (*data, &size);
+    }
+  return !ferror (fp);
+}
+
+/* Look up the entry for this run in the cache.  On a hit, write the
+   saved standard output and standard error, store the saved exit
+   status in STATUS, and return true; the caller should then exit
+   without processing any input.  Otherwise return false, and unless
+   the run is uncacheable, start capturing output, to be saved by
+   m4_run_cache_finish.  */
+bool
+m4_run_cache_replay (m4 *context, int *status)
+{
+  m4__run_cache *cache = context->run_cache;
+  const char *stale = NULL;
+  size_t key_len;
+  size_t deps_len;
+  size_t out_len;
+  size_t err_len;
+  int stored_status;
+  char *data = NULL;
+  char nl;
+  FILE *fp;
+  bool hit = false;
+
+  if (!cache || cache->forbidden)
+    return false;
+
+  fp = fopen (cache->file, "rb");
+  if (fp)
+    {
+      struct stat st;
+      long int start;
+
+      if (fscanf (fp, RUN_CACHE_MAGIC " %zu %zu %d %zu %zu%c", &key_len,
+                  &deps_len, &stored_status, &out_len, &err_len, &nl) == 6
+          && nl == '\n' && key_len == cache->key_len
+          && (start = ftell (fp)) != -1 && fstat (fileno (fp), &st) == 0
+          && (uintmax_t) st.st_size - start
+             == (uintmax_t) key_len + deps_len + out_len + err_len)
+        {
+          data = xcharalloc (key_len + deps_len + out_len + err_len + 1);
+          if (fread (data, 1, st.st_size - start, fp)
+              == (size_t) (st.st_size - start)
+              && memcmp (data, cache->key, key_len) == 0)
+            {
+              stale = run_cache_check (data + key_len, deps_len);
+              hit = !stale;
+            }
+        }
+      fclose (fp);
+    }
+
+  if (hit)
+    {
+      const char *out = data + key_len + deps_len;
+
+      m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                        _("run cache hit in %s"),
+                        quotearg_style (locale_quoting_style, cache->file));
+      fwrite (out, 1, out_len, stdout);
+      fflush (stdout);
+      fwrite (out + out_len, 1, err_len, stderr);
+      *status = stored_status;
+    }
+  else
+    {
+      if (stale)
+        m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                          _("run cache entry %s is stale, %s changed"),
+                          quotearg_style (locale_quoting_style, cache->file),
+                          quotearg_n_style (1, locale_quoting_style, stale));
+      else
+        m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                          _("run cache miss in %s"),
+                          quotearg_style (locale_quoting_style, cache->file));
+      run_cache_capture (context);
+    }
+  free (data);
+  return hit;
+}
+
+/* Redirect standard output and standard error to temporary files, so
+   that they can be saved at the end of the run.  If that is not
+   possible, the run is simply not cached.  */
+static void
+run_cache_capture (m4 *context)
+{
+  m4__run_cache *cache = context->run_cache;
+  static bool registered;
+
+  fflush (stdout);
+  fflush (stderr);
+  cache->out = tmpfile ();
+  cache->err = cache->merged ? NULL : tmpfile ();
+  cache->saved_out = dup (STDOUT_FILENO);
+  cache->saved_err = dup (STDERR_FILENO);
+  if (!cache->out || (!cache->merged && !cache->err)
+      || cache->saved_out < 0 || cache->saved_err < 0
+      || set_cloexec_flag (cache->saved_out, true) != 0
+      || set_cloexec_flag (cache->saved_err, true) != 0
+      || dup2 (fileno (cache->out), STDOUT_FILENO) < 0
+      || dup2 (fileno (cache->merged ? cache->out : cache->err),
+               STDERR_FILENO) < 0)
+    {
+      /* Nothing was written since the flush, so putting back the
+         original descriptors is enough.  */
+      if (0 <= cache->saved_out)
+        {
+          dup2 (cache->saved_out, STDOUT_FILENO);
+          close (cache->saved_out);
+        }
+      if (0 <= cache->saved_err)
+        {
+          dup2 (cache->saved_err, STDERR_FILENO);
+          close (cache->saved_err);
+        }
+      if (cache->out)
+        fclose (cache->out);
+      if (cache->err)
+        fclose (cache->err);
+      cache->out = cache->err = NULL;
+      cache->saved_out = cache->saved_err = -1;
+      cache->forbidden = true;
+      return;
+    }
+
+  cache->capturing = true;
+  run_cache_active = cache;
+  if (!registered)
+    {
+      registered = true;
+      atexit (run_cache_exit);
+    }
+}
+
+/* Stop capturing output for CACHE, and copy what was captured to the
+   real standard output and standard error.  Unless OUT is NULL, also
+   hand back the captured text in *OUT and *ERR, with their lengths in
+   *OUT_LEN and *ERR_LEN.  Return false if the captured output could
+   not be read back.  */
+static bool
+run_cache_release (m4__run_cache *cache, char **out, size_t *out_len,
+                   char **err, size_t *err_len)
+{
+  char *out_data = NULL;
+  char *err_data = NULL;
+  size_t out_size = 0;
+  size_t err_size = 0;
+  bool ok;
+
+  fflush (stdout);
+  fflush (stderr);
+  cache->capturing = false;
+  run_cache_active = NULL;
+  rewind (cache->out);
+  ok = read_all (cache->out, &out_data, &out_size);
+  if (cache->err)
+    {
+      rewind (cache->err);
+      ok &= read_all (cache->err, &err_data, &err_size);
+    }
+
+  dup2 (cache->saved_out, STDOUT_FILENO);
+  dup2 (cache->saved_err, STDERR_FILENO);
+  close (cache->saved_out);
+  close (cache->saved_err);
+  fclose (cache->out);
+  if (cache->err)
+    fclose (cache->err);
+  cache->out = cache->err = NULL;
+  cache->saved_out = cache->saved_err = -1;
+
+  fwrite (out_data, 1, out_size, stdout);
+  fflush (stdout);
+  if (err_size)
+    fwrite (err_data, 1, err_size, stderr);
+
+  if (out)
+    {
+      *out = out_data;
+      *out_len = out_size;
+      *err = err_data;
+      *err_len = err_size;
+    }
+  else
+    {
+      free (out_data);
+      free (err_data);
+    }
+  return ok;
+}
+
+/* Hand the output captured so far back to the real standard streams,
+   when m4 exits in the middle of a run.  Such a run is not cached.  */
+static void
+run_cache_exit (void)
+{
+  if (run_cache_active)
+    run_cache_release (run_cache_active, NULL, NULL, NULL, NULL);
+}
+
+/* End this run with exit STATUS.  If output is being captured, copy
+   it to the real standard output and standard error, and unless the
+   run turned out to be uncacheable, save it in the cache along with
+   STATUS and the dependencies of the run.  */
+void
+m4_run_cache_finish (m4 *context, int status)
+{
+  m4__run_cache *cache = context->run_cache;
+  char *out;
+  char *err;
+  size_t out_len;
+  size_t err_len;
+
+  if (!cache || !cache->capturing)
+    return;
+  if (run_cache_release (cache, &out, &out_len, &err, &err_len)
+      && !cache->forbidden)
+    run_cache_store (context, status, out, out_len, err, err_len);
+  free (out);
+  free (err);
+}
+
+/* Callback to append the record of one file read by the run to the
+   scratch obstack of the cache.  Return FILE, to stop the iteration,
+   if it cannot be hashed.  */
+static void *
+file_record_CB (m4 *context, const char *file, void *userdata M4_GNUC_UNUSED)
+{
+  m4_obstack *obs = &context->run_cache->scratch;
+  uint_least64_t hash;
+  uintmax_t size;
+
+  if (!run_cache_hash_file (file, &hash, &size))
+    return (void *) file;
+  obstack_printf (obs, "f%08lx%08lx %ju ",
+                  (unsigned long int) (hash >> 32) & 0xffffffff,
+                  (unsigned long int) hash & 0xffffffff, size);
+  obstack_grow0 (obs, file, strlen (file));
+  return NULL;
+}
+
+/* Callback to append the record of one missing file to the obstack
+   OBS.  */
+static void *
+absent_record_CB (m4_hash *hash M4_GNUC_UNUSED, const void *key M4_GNUC_UNUSED,
+                  void *value, void *obs)
+{
+  run_cache_dep *dep = (run_cache_dep *) value;
+
+  obstack_1grow ((m4_obstack *) obs, 'a');
+  obstack_grow0 ((m4_obstack *) obs, dep->name.str, dep->name.len);
+  return NULL;
+}
+
+/* Callback to append the record of one environment variable to the
+   obstack OBS.  */
+static void *
+env_record_CB (m4_hash *hash M4_GNUC_UNUSED, const void *key M4_GNUC_UNUSED,
+               void *value, void *obs)
+{
+  run_cache_dep *dep = (run_cache_dep *) value;
+
+  obstack_1grow ((m4_obstack *) obs, 'e');
+  obstack_grow0 ((m4_obstack *) obs, dep->name.str, dep->name.len);
+  if (dep->value)
+    {
+      obstack_1grow ((m4_obstack *) obs, '=');
+      obstack_grow0 ((m4_obstack *) obs, dep->value, strlen (dep->value));
+    }
+  else
+    obstack_1grow ((m4_obstack *) obs, '\0');
+  return NULL;
+}
+
+/* Save the entry for this run, with exit STATUS, standard output OUT
+   of length OUT_LEN, and standard error ERR of length ERR_LEN.
+   Failure to write the entry is only worth a warning, since the
+   output of this run is good anyway.  */
+static void
+run_cache_store (m4 *context, int status, const char *out, size_t out_len,
+                 const char *err, size_t err_len)
+{
+  m4__run_cache *cache = context->run_cache;
+  m4_obstack *obs = &cache->scratch;
+  const char *unhashed;
+  char *deps;
+  char *temp;
+  size_t deps_len;
+  FILE *fp;
+  int fd;
+
+  /* An empty object keeps the base of the obstack fixed, so it can
+     be freed whatever happens below.  */
+  deps = (char *) obstack_finish (obs);
+  unhashed = (const char *) m4_dependencies_apply (context, file_record_CB,
+                                                   NULL);
+  if (unhashed)
+    {
+      m4_call_info info = {0};
+
+      info.name = unhashed;
+      info.name_len = strlen (unhashed);
+      m4_run_cache_forbid (context, &info);
+      obstack_free (obs, deps);
+      return;
+    }
+  m4_hash_apply (cache->absent, absent_record_CB, obs);
+  m4_hash_apply (cache->env, env_record_CB, obs);
+  deps_len = obstack_object_size (obs);
+  obstack_1grow (obs, '\0');
+  deps = (char *) obstack_finish (obs);
+
+  obstack_grow (obs, cache->file, strlen (cache->file));
+  obstack_grow0 (obs, RUN_CACHE_TEMP_SUFFIX, strlen (RUN_CACHE_TEMP_SUFFIX));
+  temp = (char *) obstack_finish (obs);
+
+  fd = gen_tempname (temp, 0, 0, GT_FILE);
+  fp = fd < 0 ? NULL : fdopen (fd, "wb");
+  if (!fp)
+    {
+      if (0 <= fd)
+        {
+          close (fd);
+          unlink (temp);
+        }
+      m4_warn (context, errno, NULL, _("cannot create cache file %s"),
+               quotearg_style (locale_quoting_style, cache->file));
+    }
+  else
+    {
+      fprintf (fp, RUN_CACHE_MAGIC " %zu %zu %d %zu %zu\n", cache->key_len,
+               deps_len, status, out_len, err_len);
+      fwrite (cache->key, 1, cache->key_len, fp);
+      fwrite (deps, 1, deps_len, fp);
+      fwrite (out, 1, out_len, fp);
+      fwrite (err, 1, err_len, fp);
+      if (close_stream (fp) != 0 || rename (temp, cache->file) != 0)
+        {
+          m4_warn (context, errno, NULL, _("cannot write cache file %s"),
+                   quotearg_style (locale_quoting_style, cache->file));
+          unlink (temp);
+        }
+    }
+  obstack_free (obs, deps);
+}
+
+/* Callback to remove a dependency from HASH and free it.  */
+static void *
+dep_destroy_CB (m4_hash *hash, const void *key, void *value,
+                void *ignored M4_GNUC_UNUSED)
+{
+  run_cache_dep *dep = (run_cache_dep *) value;
+
+  m4_hash_remove (hash, key);
+  free (dep->name.str);
+  free (dep->value);
+  free (dep);
+  return NULL;
+}
+
+/* Free the run cache state, when CONTEXT is deleted.  */
+void
+m4__run_cache_delete (m4 *context)
+{
+  m4__run_cache *cache = context->run_cache;
+
+  if (cache)
+    {
+      assert (!cache->capturing);
+      m4_hash_apply (cache->env, dep_destroy_CB, NULL);
+      m4_hash_delete (cache->env);
+      m4_hash_apply (cache->absent, dep_destroy_CB, NULL);
+      m4_hash_delete (cache->absent);
+      obstack_free (&cache->scratch, NULL);
+      free (cache->dir);
+      free (cache->key);
+      free (cache->file);
+      free (cache);
+      context->run_cache = NULL;
+    }
+}
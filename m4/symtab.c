@@ -43,21 +43,34 @@
    and the trace bit attached to the name was never lost.  There is a
    small amount of fluff in these functions to make sure that such
    symbols (with empty value stacks) are invisible to the users of
-   this module.  */
+   this module.
+
+   Every change to a symbol stamps it with the next value of a counter
+   kept in the table, its generation.  Once m4_symtab_mark has been
+   called, the names of symbols removed from the table are remembered
+   as well, so that a frozen layer can record exactly the symbols that
+   changed since its base was reloaded.  */
 
 #define M4_SYMTAB_DEFAULT_SIZE          2047
 
 struct m4_symbol_table {
   m4_hash *table;
+  m4 *autoload;         /* Context to resolve autoload placeholders.  */
+  size_t generation;    /* Changes made to the table so far.  */
+  m4_hash *removed;     /* Names removed since the mark, or NULL.  */
 };
 
 static m4_symbol *symtab_fetch          (m4_symbol_table*, const char *,
                                          size_t);
+static void       symbol_touch          (m4_symbol_table *, m4_symbol *);
+static void       symtab_remove         (m4_symbol_table *, m4_string *);
 static void       symbol_popval         (m4_symbol *);
 static void *     symbol_destroy_CB     (m4_symbol_table *, const char *,
                                          size_t, m4_symbol *, void *);
 static void *     arg_destroy_CB        (m4_hash *, const void *, void *,
                                          void *);
+static void *     removed_destroy_CB    (m4_hash *, const void *, void *,
+                                         void *);
 static void *     arg_copy_CB           (m4_hash *, const void *, void *,
                                          m4_hash *);
 
@@ -73,6 +86,9 @@ m4_symtab_create (size_t size)
 
   symtab->table = m4_hash_new (size ? size : M4_SYMTAB_DEFAULT_SIZE,
                                m4_hash_string_hash, m4_hash_string_cmp);
+  symtab->autoload = NULL;
+  symtab->generation = 0;
+  symtab->removed = NULL;
   return symtab;
 }
 
@@ -82,6 +98,12 @@ m4_symtab_delete (m4_symbol_table *symtab)
   assert (symtab);
   assert (symtab->table);
 
+  if (symtab->removed)
+    {
+      m4_hash_apply (symtab->removed, removed_destroy_CB, NULL);
+      m4_hash_delete (symtab->removed);
+      symtab->removed = NULL;
+    }
   m4_symtab_apply (symtab, true, symbol_destroy_CB, NULL);
   m4_hash_delete (symtab->table);
   free (symtab);
@@ -123,6 +145,81 @@ m4_symtab_apply (m4_symbol_table *symtab, bool include_trace,
   return result;
 }
 
+/* Return the current generation of SYMTAB, and from now on remember
+   the name of every symbol removed from it, for the benefit of
+   m4_symtab_apply_removed.  Any symbol changed after this call has a
+   generation larger than the value returned.  Calling this again
+   forgets the names removed before.  */
+size_t
+m4_symtab_mark (m4_symbol_table *symtab)
+{
+  assert (symtab);
+
+  if (symtab->removed)
+    m4_hash_apply (symtab->removed, removed_destroy_CB, NULL);
+  else
+    symtab->removed = m4_hash_new (0, m4_hash_string_hash,
+                                   m4_hash_string_cmp);
+  return symtab->generation;
+}
+
+/* For every name removed from SYMTAB since the last m4_symtab_mark,
+   and not present again, execute the callback FUNC with the name and
+   a NULL symbol, and the opaque parameter USERDATA.  The return value
+   follows the same convention as m4_symtab_apply.  */
+void *
+m4_symtab_apply_removed (m4_symbol_table *symtab,
+                         m4_symtab_apply_func *func, void *userdata)
+{
+  m4_hash_iterator *place  = NULL;
+  void *            result = NULL;
+
+  assert (symtab);
+  assert (func);
+
+  if (!symtab->removed)
+    return NULL;
+  while ((place = m4_get_hash_iterator_next (symtab->removed, place)))
+    {
+      const m4_string *key
+        = (const m4_string *) m4_get_hash_iterator_key (place);
+      if (!m4_hash_lookup (symtab->table, key))
+        result = func (symtab, key->str, key->len, NULL, userdata);
+      if (result != NULL)
+        {
+          m4_free_hash_iterator (symtab->removed, place);
+          break;
+        }
+    }
+
+  return result;
+}
+
+/* Record a change to SYMBOL in SYMTAB.  */
+static void
+symbol_touch (m4_symbol_table *symtab, m4_symbol *symbol)
+{
+  symbol->generation = ++symtab->generation;
+}
+
+/* Remove the entry for KEY from SYMTAB, whose symbol must already be
+   freed.  KEY is also freed, unless the name is remembered for
+   m4_symtab_apply_removed.  */
+static void
+symtab_remove (m4_symbol_table *symtab, m4_string *key)
+{
+  m4_string *old_key = (m4_string *) m4_hash_remove (symtab->table, key);
+
+  symtab->generation++;
+  if (symtab->removed && !m4_hash_lookup (symtab->removed, old_key))
+    m4_hash_insert (symtab->removed, old_key, old_key);
+  else
+    {
+      free (old_key->str);
+      free (old_key);
+    }
+}
+
 /* Ensure that NAME of length LEN exists in the table, creating an
    entry if needed.  */
 static m4_symbol *
@@ -158,6 +255,16 @@ symtab_fetch (m4_symbol_table *symtab, const char *name, size_t len)
   return symbol;
 }
 
+/* Make m4_symbol_lookup on SYMTAB open the module behind an autoload
+   placeholder on top of the value stack, using CONTEXT, before the
+   symbol is returned.  */
+void
+m4__symtab_set_autoload (m4_symbol_table *symtab, m4 *context)
+{
+  assert (symtab);
+  symtab->autoload = context;
+}
+
 /* Remove every symbol that references the given module from
    the symbol table.  */
 void
@@ -185,6 +292,7 @@ m4__symtab_remove_module_references (m4_symbol_table *symtab,
               if (VALUE_MODULE (next) == module)
                 {
                   VALUE_NEXT (data) = VALUE_NEXT (next);
+                  symbol_touch (symtab, symbol);
 
                   assert (next->type != M4_SYMBOL_PLACEHOLDER);
                   m4_symbol_value_delete (next);
@@ -235,12 +343,14 @@ symbol_destroy_CB (m4_symbol_table *symtab, const char *name, size_t len,
    an existing table.  */
 
 /* Return the symbol associated to NAME of length LEN, or else
-   NULL.  */
+   NULL.  If its definition is still an autoload placeholder, replace
+   it with the real definition first.  */
 m4_symbol *
 m4_symbol_lookup (m4_symbol_table *symtab, const char *name, size_t len)
 {
   m4_string key;
   m4_symbol **psymbol;
+  m4_symbol_value *value;
 
   /* Safe to cast away const, since m4_hash_lookup doesn't modify
      key.  */
@@ -250,7 +360,12 @@ m4_symbol_lookup (m4_symbol_table *symtab, const char *name, size_t len)
 
   /* If just searching, return status of search -- if only an empty
      struct is returned, that is treated as a failed lookup.  */
-  return (psymbol && m4_get_symbol_value (*psymbol)) ? *psymbol : NULL;
+  if (!psymbol || !(value = m4_get_symbol_value (*psymbol)))
+    return NULL;
+  if (value->type == M4_SYMBOL_PLACEHOLDER && symtab->autoload
+      && BIT_TEST (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT))
+    m4__module_autoload_value (symtab->autoload, value);
+  return *psymbol;
 }
 
 
@@ -271,6 +386,7 @@ m4_symbol_pushdef (m4_symbol_table *symtab, const char *name, size_t len,
   symbol                = symtab_fetch (symtab, name, len);
   VALUE_NEXT (value)    = m4_get_symbol_value (symbol);
   symbol->value         = value;
+  symbol_touch (symtab, symbol);
 
   assert (m4_get_symbol_value (symbol));
 
@@ -296,6 +412,7 @@ m4_symbol_define (m4_symbol_table *symtab, const char *name, size_t len,
 
   VALUE_NEXT (value) = m4_get_symbol_value (symbol);
   symbol->value      = value;
+  symbol_touch (symtab, symbol);
 
   assert (m4_get_symbol_value (symbol));
 
@@ -321,16 +438,14 @@ m4_symbol_popdef (m4_symbol_table *symtab, const char *name, size_t len)
   assert (*psymbol);
 
   symbol_popval (*psymbol);
+  symbol_touch (symtab, *psymbol);
 
   /* Only remove the hash table entry if the last value in the
      symbol value stack was successfully removed.  */
   if (!m4_get_symbol_value (*psymbol) && !m4_get_symbol_traced (*psymbol))
     {
-      m4_string *old_key;
       DELETE (*psymbol);
-      old_key = (m4_string *) m4_hash_remove (symtab->table, &key);
-      free (old_key->str);
-      free (old_key);
+      symtab_remove (symtab, &key);
     }
 }
 
@@ -424,11 +539,18 @@ m4_symbol_rename (m4_symbol_table *symtab, const char *name, size_t len1,
       /* Remove the old name from the symbol table.  */
       pkey = (m4_string *) m4_hash_remove (symtab->table, &key);
       assert (pkey && !m4_hash_lookup (symtab->table, &key));
-      free (pkey->str);
+      if (symtab->removed && !m4_hash_lookup (symtab->removed, pkey))
+        {
+          m4_string *old_key = (m4_string *) xmemdup (pkey, sizeof *pkey);
+          m4_hash_insert (symtab->removed, old_key, old_key);
+        }
+      else
+        free (pkey->str);
 
       pkey->str = xmemdup0 (newname, len2);
       pkey->len = len2;
       m4_hash_insert (symtab->table, pkey, *psymbol);
+      symbol_touch (symtab, symbol);
     }
   /* else
        NAME does not name a symbol in symtab->table!  */
@@ -437,6 +559,20 @@ m4_symbol_rename (m4_symbol_table *symtab, const char *name, size_t len1,
 }
 
 
+/* Callback used by m4_symtab_mark () and m4_symtab_delete () to
+   forget a removed name.  */
+static void *
+removed_destroy_CB (m4_hash *hash, const void *name, void *key,
+                    void *ignored M4_GNUC_UNUSED)
+{
+  m4_string *old_key = (m4_string *) key;
+
+  m4_hash_remove (hash, name);
+  free (old_key->str);
+  free (old_key);
+  return NULL;
+}
+
 /* Callback used by m4_symbol_popdef () to release the memory used
    by values in the arg_signature hash.  */
 static void *
@@ -605,11 +741,12 @@ m4_set_symbol_name_traced (m4_symbol_table *symtab, const char *name,
 
   result = symbol->traced;
   symbol->traced = traced;
+  if (result != traced)
+    symbol_touch (symtab, symbol);
   if (!traced && !m4_get_symbol_value (symbol))
     {
       /* Free an undefined entry once it is no longer traced.  */
       m4_string key;
-      m4_string *old_key;
       assert (result);
       free (symbol);
 
@@ -617,9 +754,7 @@ m4_set_symbol_name_traced (m4_symbol_table *symtab, const char *name,
          key.  */
       key.str = (char *) name;
       key.len = len;
-      old_key = (m4_string *) m4_hash_remove (symtab->table, &key);
-      free (old_key->str);
-      free (old_key);
+      symtab_remove (symtab, &key);
     }
 
   return result;
@@ -643,6 +778,12 @@ m4__symbol_value_print (m4 *context, m4_symbol_value *value, m4_obstack *obs,
   size_t len = maxlen ? *maxlen : SIZE_MAX;
   bool result = false;
 
+  /* Values below the top of a pushdef stack are not resolved by
+     lookup, so do it now.  */
+  if (value->type == M4_SYMBOL_PLACEHOLDER
+      && BIT_TEST (VALUE_FLAGS (value), VALUE_AUTOLOAD_BIT))
+    m4__module_autoload_value (context, value);
+
   switch (value->type)
     {
     case M4_SYMBOL_TEXT:
@@ -786,6 +927,14 @@ m4_get_symbol_traced (m4_symbol *symbol)
   return symbol->traced;
 }
 
+#undef m4_get_symbol_generation
+size_t
+m4_get_symbol_generation (m4_symbol *symbol)
+{
+  assert (symbol);
+  return symbol->generation;
+}
+
 #undef m4_symbol_value_flatten_args
 bool
 m4_symbol_value_flatten_args (m4_symbol_value *value)
@@ -896,6 +1045,7 @@ m4_set_symbol_value_text (m4_symbol_value *value, const char *text, size_t len,
   value->u.u_t.text = text;
   value->u.u_t.len = len;
   value->u.u_t.quote_age = quote_age;
+  value->u.u_t.origin = 0;
 }
 
 #undef m4__set_symbol_value_builtin
@@ -113,6 +113,7 @@
 static int add_syntax_attribute         (m4_syntax_table *, char, int);
 static int remove_syntax_attribute      (m4_syntax_table *, char, int);
 static void set_quote_age               (m4_syntax_table *, bool, bool);
+static bool is_simple_syntax            (m4_syntax_table *);
 
 m4_syntax_table *
 m4_syntax_create (void)
@@ -794,6 +795,7 @@ set_quote_age (m4_syntax_table *syntax, bool reset, bool change)
    it may take more time in doing so).  */
 
   unsigned short local_syntax_age;
+  syntax->generation++;
   if (reset)
     local_syntax_age = 0;
   else if (change && syntax->syntax_age < 0xffff)
@@ -824,6 +826,49 @@ set_quote_age (m4_syntax_table *syntax, bool reset, bool change)
     }
   else
     syntax->quote_age = 0;
+
+  /* Anything that changes the quote age may also change which lexer
+     can handle the syntax.  */
+  syntax->next_token = (is_simple_syntax (syntax) ? m4__next_token_simple
+                        : m4__next_token_general);
+}
+
+/* Return true if SYNTAX can be parsed by m4__next_token_simple: the
+   quote delimiters, and the comment delimiters unless comments are
+   disabled, are single bytes that are the only members of their
+   syntax categories, and no byte is an escape or active character.
+   This holds for the default syntax and after any changequote or
+   changecom with single byte arguments.  */
+static bool
+is_simple_syntax (m4_syntax_table *syntax)
+{
+  int lquote = 0;
+  int rquote = 0;
+  int bcomm = 0;
+  int ecomm = 0;
+  int ch;
+
+  if (syntax->quote.len1 != 1 || syntax->quote.len2 != 1
+      || !m4_has_syntax (syntax, *syntax->quote.str1, M4_SYNTAX_LQUOTE)
+      || !m4_has_syntax (syntax, *syntax->quote.str2, M4_SYNTAX_RQUOTE))
+    return false;
+  if (syntax->comm.len1
+      && (syntax->comm.len1 != 1 || syntax->comm.len2 != 1
+          || !m4_has_syntax (syntax, *syntax->comm.str1, M4_SYNTAX_BCOMM)
+          || !m4_has_syntax (syntax, *syntax->comm.str2, M4_SYNTAX_ECOMM)))
+    return false;
+  for (ch = UCHAR_MAX + 1; --ch >= 0; )
+    {
+      if (m4_has_syntax (syntax, ch, M4_SYNTAX_ESCAPE | M4_SYNTAX_ACTIVE))
+        return false;
+      lquote += m4_has_syntax (syntax, ch, M4_SYNTAX_LQUOTE);
+      rquote += m4_has_syntax (syntax, ch, M4_SYNTAX_RQUOTE);
+      bcomm += m4_has_syntax (syntax, ch, M4_SYNTAX_BCOMM);
+      ecomm += m4_has_syntax (syntax, ch, M4_SYNTAX_ECOMM);
+    }
+  return (lquote == 1 && rquote == 1
+          && bcomm == (syntax->comm.len1 != 0)
+          && (!syntax->comm.len1 || ecomm == 1));
 }
 
 /* Interface for caching frequently used quote pairs, independently of
@@ -0,0 +1,464 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "m4private.h"
+
+#include "close-stream.h"
+#include "stat-time.h"
+#include "tempname.h"
+#include "xmemdup0.h"
+
+/* This file implements the result cache behind `--esyscmd-cache'.
+   Before esyscmd runs a command, it asks for a cached result, keyed
+   by the text of the command, the current directory, the environment
+   variables that are likely to change what the command prints, and
+   the modification time and size of any input files declared for the
+   command with esyscmdinputs.  The key is hashed to name a file in
+   the cache directory; the file holds the full key, so that a hash
+   collision is just a miss, followed by the exit status and the
+   standard output of the command.  Entries are written to a temporary
+   file and renamed into place, so that several m4 processes can share
+   a cache directory.
+
+   Commands passed to esyscmdnocache are never cached, nor are
+   commands killed by a signal.  Standard error of the command is not
+   saved, and so is lost on a hit.  */
+
+/* Initial size of the table of per-command settings; must be 1 less
+   than a power of 2, as for M4_HASH_DEFAULT_SIZE.  */
+#define SYSCACHE_DEFAULT_SIZE   31
+
+/* Magic string at the start of every cache entry.  Bump the number
+   whenever the key or the layout changes.  */
+#define SYSCACHE_MAGIC          "M4ESYSCMD 1"
+
+/* Suffix of the temporary file for a new entry; the X's are replaced
+   by gen_tempname.  */
+#define SYSCACHE_TEMP_SUFFIX    ".tmpXXXXXX"
+
+/* Environment variables that are part of every key, on top of those
+   the command refers to itself.  */
+static const char *const syscache_env[] = {
+  "PATH", "HOME", "SHELL", "TZ", "LANG", "LC_ALL", "LC_COLLATE",
+  "LC_CTYPE", "LC_MESSAGES", "LC_MONETARY", "LC_NUMERIC", "LC_TIME",
+  NULL
+};
+
+struct m4__syscache {
+  char *dir;                    /* Cache directory.  */
+  char *cwd;                    /* Current directory, part of each key.  */
+  m4_hash *commands;            /* Map m4_string to syscache_command.  */
+  m4_obstack scratch;           /* Space for keys and file names.  */
+  size_t hits;                  /* Results served from the cache.  */
+  size_t misses;                /* Results not found in the cache.  */
+  size_t skipped;               /* Commands not eligible for caching.  */
+};
+
+typedef struct {
+  m4_string cmd;                /* Text of command, also its hash key.  */
+  bool nocache;                 /* True if the command is never cached.  */
+  char **inputs;                /* Files the result depends on.  */
+  size_t inputs_count;          /* Number of used entries in INPUTS.  */
+  size_t inputs_size;           /* Allocated length of INPUTS.  */
+} syscache_command;
+
+static m4__syscache *   syscache                (m4 *);
+static syscache_command *syscache_command_find  (m4 *, const char *, size_t,
+                                                 bool);
+static void     syscache_env_key        (m4_obstack *, const char *, size_t);
+static char *   syscache_key            (m4 *, const char *,
+                                         const syscache_command *, size_t *);
+static char *   syscache_file           (m4 *, const char *, size_t);
+static void *   command_destroy_CB      (m4_hash *, const void *, void *,
+                                         void *);
+
+
+/* Return the cache state of CONTEXT, creating it on first use.  */
+static m4__syscache *
+syscache (m4 *context)
+{
+  m4__syscache *cache = context->syscache;
+
+  if (!cache)
+    {
+      cache = (m4__syscache *) xzalloc (sizeof *cache);
+      cache->commands = m4_hash_new (SYSCACHE_DEFAULT_SIZE,
+                                     m4_hash_string_hash, m4_hash_string_cmp);
+      obstack_init (&cache->scratch);
+      context->syscache = cache;
+    }
+  return cache;
+}
+
+/* Return the settings for the command CMD of length LEN, or NULL if
+   there are none.  If CREATE, add default settings instead.  */
+static syscache_command *
+syscache_command_find (m4 *context, const char *cmd, size_t len, bool create)
+{
+  m4__syscache *cache = syscache (context);
+  syscache_command **pentry;
+  syscache_command *entry;
+  m4_string key;
+
+  key.str = (char *) cmd;
+  key.len = len;
+  pentry = (syscache_command **) m4_hash_lookup (cache->commands, &key);
+  if (pentry)
+    return *pentry;
+  if (!create)
+    return NULL;
+
+  entry = (syscache_command *) xzalloc (sizeof *entry);
+  entry->cmd.str = xmemdup0 (cmd, len);
+  entry->cmd.len = len;
+  m4_hash_insert (cache->commands, &entry->cmd, entry);
+  return entry;
+}
+
+/* Use DIR, which is created if it does not exist yet, to cache the
+   results of esyscmd.  Return false, with errno set, if DIR is not a
+   usable directory.  */
+bool
+m4_syscmd_cache_open (m4 *context, const char *dir)
+{
+  m4__syscache *cache;
+  struct stat st;
+  char *cwd;
+
+  if (mkdir (dir, 0777) != 0 && errno != EEXIST)
+    return false;
+  if (stat (dir, &st) != 0)
+    return false;
+  if (!S_ISDIR (st.st_mode))
+    {
+      errno = ENOTDIR;
+      return false;
+    }
+
+  cwd = m4_path_cwd ();
+  if (!cwd)
+    return false;
+
+  cache = syscache (context);
+  free (cache->dir);
+  free (cache->cwd);
+  cache->dir = xstrdup (dir);
+  cache->cwd = cwd;
+  return true;
+}
+
+/* Never cache the result of the command CMD of length LEN.  */
+void
+m4_syscmd_cache_forbid (m4 *context, const char *cmd, size_t len)
+{
+  syscache_command_find (context, cmd, len, true)->nocache = true;
+}
+
+/* Add FILE of length FILE_LEN to the inputs of the command CMD of
+   length LEN, so that a cached result is only used while FILE keeps
+   the modification time and size it had when the result was
+   stored.  */
+void
+m4_syscmd_cache_add_input (m4 *context, const char *cmd, size_t len,
+                           const char *file, size_t file_len)
+{
+  syscache_command *entry = syscache_command_find (context, cmd, len, true);
+  size_t i;
+
+  for (i = 0; i < entry->inputs_count; i++)
+    if (strlen (entry->inputs[i]) == file_len
+        && memcmp (entry->inputs[i], file, file_len) == 0)
+      return;
+  if (entry->inputs_count == entry->inputs_size)
+    entry->inputs = (char **) x2nrealloc (entry->inputs, &entry->inputs_size,
+                                          sizeof *entry->inputs);
+  entry->inputs[entry->inputs_count++] = xmemdup0 (file, file_len);
+}
+
+/* Append to OBS the setting of the environment variable NAME of
+   length LEN, as part of a key.  */
+static void
+syscache_env_key (m4_obstack *obs, const char *name, size_t len)
+{
+  char *var = xmemdup0 (name, len);
+  const char *value = getenv (var);
+
+  free (var);
+  obstack_grow (obs, name, len);
+  if (value)
+    {
+      obstack_1grow (obs, '=');
+      obstack_grow (obs, value, strlen (value));
+    }
+  obstack_1grow (obs, '\0');
+}
+
+/* Build the key for the command CMD, with settings ENTRY or NULL, on
+   the scratch obstack.  Return it, and store its length in LEN.  */
+static char *
+syscache_key (m4 *context, const char *cmd, const syscache_command *entry,
+              size_t *len)
+{
+  m4__syscache *cache = context->syscache;
+  m4_obstack *obs = &cache->scratch;
+  const char *p;
+  size_t i;
+
+  obstack_grow0 (obs, cmd, strlen (cmd));
+  obstack_grow0 (obs, cache->cwd, strlen (cache->cwd));
+  for (i = 0; syscache_env[i]; i++)
+    syscache_env_key (obs, syscache_env[i], strlen (syscache_env[i]));
+
+  /* Also cover any variable the command expands itself, whether as
+     $NAME or as ${NAME...}.  */
+  for (p = strchr (cmd, '$'); p; p = strchr (p, '$'))
+    {
+      size_t n;
+
+      p++;
+      if (*p == '{')
+        p++;
+      n = strspn (p, "abcdefghijklmnopqrstuvwxyz"
+                  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+      if (n && !isdigit (to_uchar (*p)))
+        syscache_env_key (obs, p, n);
+      p += n;
+    }
+
+  if (entry)
+    for (i = 0; i < entry->inputs_count; i++)
+      {
+        const char *file = entry->inputs[i];
+        struct stat st;
+
+        obstack_grow0 (obs, file, strlen (file));
+        if (stat (file, &st) == 0)
+          {
+            struct timespec mtime = get_stat_mtime (&st);
+            obstack_printf (obs, "%jd.%09ld %jd", (intmax_t) mtime.tv_sec,
+                            (long int) mtime.tv_nsec, (intmax_t) st.st_size);
+          }
+        else
+          obstack_1grow (obs, '-');
+        obstack_1grow (obs, '\0');
+      }
+
+  *len = obstack_object_size (obs);
+  return (char *) obstack_finish (obs);
+}
+
+/* Return the name of the cache file for KEY of length LEN, allocated
+   on the scratch obstack.  The name is a 64-bit FNV-1a hash of the
+   key, in hexadecimal.  */
+static char *
+syscache_file (m4 *context, const char *key, size_t len)
+{
+  m4__syscache *cache = context->syscache;
+  uint_least64_t hash = 0xcbf29ce484222325ULL;
+  char name[17];
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash ^= to_uchar (key[i]);
+      hash = (hash * 0x100000001b3ULL) & 0xffffffffffffffffULL;
+    }
+  sprintf (name, "%08lx%08lx", (unsigned long int) (hash >> 32) & 0xffffffff,
+           (unsigned long int) hash & 0xffffffff);
+  obstack_printf (&cache->scratch, "%s/%s", cache->dir, name);
+  obstack_1grow (&cache->scratch, '\0');
+  return (char *) obstack_finish (&cache->scratch);
+}
+
+/* Look up the result of running CMD in the cache.  On a hit, append
+   the output of CMD to OBS, store its exit status in STATUS, and
+   return true.  Return false if caching is not enabled, if CMD is not
+   to be cached, or if there is no valid entry for CMD; the caller
+   should then run CMD and call m4_syscmd_cache_store.  */
+bool
+m4_syscmd_cache_lookup (m4 *context, const char *cmd, m4_obstack *obs,
+                        int *status)
+{
+  m4__syscache *cache = context->syscache;
+  const syscache_command *entry;
+  char *key;
+  char *file;
+  size_t key_len;
+  size_t stored_key_len;
+  size_t out_len;
+  int stored_status;
+  char nl;
+  FILE *fp;
+  bool hit = false;
+
+  if (!cache || !cache->dir)
+    return false;
+  entry = syscache_command_find (context, cmd, strlen (cmd), false);
+  if (entry && entry->nocache)
+    {
+      cache->skipped++;
+      m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                        _("esyscmd cache skipped for %s"
+                          " (hits %zu, misses %zu, skipped %zu)"),
+                        quotearg_style (locale_quoting_style, cmd),
+                        cache->hits, cache->misses, cache->skipped);
+      return false;
+    }
+
+  key = syscache_key (context, cmd, entry, &key_len);
+  file = syscache_file (context, key, key_len);
+  fp = fopen (file, "rb");
+  if (fp)
+    {
+      if (fscanf (fp, SYSCACHE_MAGIC " %zu %d %zu%c", &stored_key_len,
+                  &stored_status, &out_len, &nl) == 4
+          && nl == '\n' && stored_key_len == key_len)
+        {
+          char *stored_key = xcharalloc (key_len);
+
+          if (fread (stored_key, 1, key_len, fp) == key_len
+              && memcmp (stored_key, key, key_len) == 0)
+            {
+              obstack_make_room (obs, out_len);
+              if (fread (obstack_next_free (obs), 1, out_len, fp) == out_len)
+                {
+                  obstack_blank_fast (obs, out_len);
+                  *status = stored_status;
+                  hit = true;
+                }
+            }
+          free (stored_key);
+        }
+      fclose (fp);
+    }
+  obstack_free (&cache->scratch, key);
+
+  if (hit)
+    cache->hits++;
+  else
+    cache->misses++;
+  m4_debug_message (context, M4_DEBUG_TRACE_PATH,
+                    (hit ? _("esyscmd cache hit for %s"
+                             " (hits %zu, misses %zu, skipped %zu)")
+                     : _("esyscmd cache miss for %s"
+                         " (hits %zu, misses %zu, skipped %zu)")),
+                    quotearg_style (locale_quoting_style, cmd),
+                    cache->hits, cache->misses, cache->skipped);
+  return hit;
+}
+
+/* Store OUTPUT of length LEN and exit STATUS as the result of running
+   CMD, after m4_syscmd_cache_lookup missed.  Failure to write the
+   entry is only worth a warning on behalf of the macro call CALLER,
+   since the result is still good for this run.  */
+void
+m4_syscmd_cache_store (m4 *context, const m4_call_info *caller,
+                       const char *cmd, const char *output, size_t len,
+                       int status)
+{
+  m4__syscache *cache = context->syscache;
+  const syscache_command *entry;
+  char *key;
+  char *file;
+  char *temp;
+  size_t key_len;
+  FILE *fp;
+  int fd;
+
+  if (!cache || !cache->dir)
+    return;
+  entry = syscache_command_find (context, cmd, strlen (cmd), false);
+  if (entry && entry->nocache)
+    return;
+
+  key = syscache_key (context, cmd, entry, &key_len);
+  file = syscache_file (context, key, key_len);
+  obstack_grow (&cache->scratch, file, strlen (file));
+  obstack_grow0 (&cache->scratch, SYSCACHE_TEMP_SUFFIX,
+                 strlen (SYSCACHE_TEMP_SUFFIX));
+  temp = (char *) obstack_finish (&cache->scratch);
+
+  fd = gen_tempname (temp, 0, 0, GT_FILE);
+  fp = fd < 0 ? NULL : fdopen (fd, "wb");
+  if (!fp)
+    {
+      if (0 <= fd)
+        {
+          close (fd);
+          unlink (temp);
+        }
+      m4_warn (context, errno, caller, _("cannot create esyscmd cache file %s"),
+               quotearg_style (locale_quoting_style, file));
+    }
+  else
+    {
+      fprintf (fp, SYSCACHE_MAGIC " %zu %d %zu\n", key_len, status, len);
+      fwrite (key, 1, key_len, fp);
+      fwrite (output, 1, len, fp);
+      if (close_stream (fp) != 0 || rename (temp, file) != 0)
+        {
+          m4_warn (context, errno, caller,
+                   _("cannot write esyscmd cache file %s"),
+                   quotearg_style (locale_quoting_style, file));
+          unlink (temp);
+        }
+    }
+  obstack_free (&cache->scratch, key);
+}
+
+/* Callback to remove an entry from the command table HASH and free
+   it.  */
+static void *
+command_destroy_CB (m4_hash *hash, const void *key, void *value,
+                    void *ignored M4_GNUC_UNUSED)
+{
+  syscache_command *entry = (syscache_command *) value;
+  size_t i;
+
+  m4_hash_remove (hash, key);
+  for (i = 0; i < entry->inputs_count; i++)
+    free (entry->inputs[i]);
+  free (entry->inputs);
+  free (entry->cmd.str);
+  free (entry);
+  return NULL;
+}
+
+/* Free the esyscmd cache state, when CONTEXT is deleted.  */
+void
+m4__syscache_delete (m4 *context)
+{
+  m4__syscache *cache = context->syscache;
+
+  if (cache)
+    {
+      m4_hash_apply (cache->commands, command_destroy_CB, NULL);
+      m4_hash_delete (cache->commands);
+      obstack_free (&cache->scratch, NULL);
+      free (cache->dir);
+      free (cache->cwd);
+      free (cache);
+      context->syscache = NULL;
+    }
+}
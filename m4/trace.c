@@ -0,0 +1,459 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include "m4private.h"
+#include "trace.h"
+
+#include "binary-io.h"
+#include "xmemdup0.h"
+
+/* This file writes the binary form of trace output, selected with
+   `--trace-format=binary'.  A record is assembled on the trace
+   obstack, just like a text trace line, so that nested traces can be
+   started and completed while the arguments of an outer call are
+   pending.  Completed records are copied into a large buffer, which
+   is written to the debug file in one go once it fills up, rather
+   than with several stdio calls per trace line.  Macro and file
+   names are replaced by small integer ids.  Arguments are copied
+   raw, at most as many bytes as the text trace would show, and the
+   quotes and truncation length are only sent when they change, so
+   that nothing is formatted per call.  The layout is described in
+   trace.h; the m4-trace-dump program turns it back into text.  */
+
+/* Size of the output buffer.  */
+#define TRACE_BUFFER_SIZE       65536
+
+/* Initial size of the string id table; must be 1 less than a power
+   of 2, as for M4_HASH_DEFAULT_SIZE.  */
+#define TRACE_STRINGS_DEFAULT_SIZE 255
+
+/* Round N up to the alignment of trace records.  */
+#define TRACE_ALIGN(N)          (((N) + 7) & ~(size_t) 7)
+
+/* Quotes and truncation length, as recorded by m4__trace_settings.  */
+typedef struct {
+  m4_string_pair quotes;        /* Copy of the quote delimiters.  */
+  size_t max_len;               /* Truncation length.  */
+  bool sent;                    /* True once written to the debug file.  */
+} trace_settings;
+
+struct m4__trace_output {
+  char *buffer;                 /* Records not yet written.  */
+  size_t used;                  /* Bytes in use in BUFFER.  */
+  m4_hash *strings;             /* Map m4_string to trace_string.  */
+  uint32_t next_id;             /* Id to give the next new string.  */
+  bool started;                 /* True once the file header is out.  */
+  trace_settings *settings;     /* Settings seen so far, by id - 1.  */
+  size_t settings_count;        /* Number of entries in SETTINGS.  */
+  size_t settings_size;         /* Allocated size of SETTINGS.  */
+  size_t syntax_generation;     /* Syntax generation of last check.  */
+};
+
+typedef struct {
+  m4_string str;                /* Text of string, also its hash key.  */
+  uint32_t id;                  /* Id assigned to STR.  */
+} trace_string;
+
+static m4__trace_output *trace_output   (m4 *);
+static void     trace_write             (m4 *, const void *, size_t);
+static void     trace_pad               (m4 *, size_t);
+static uint32_t trace_intern            (m4 *, const char *, size_t);
+static void     trace_send_settings     (m4 *, uint32_t);
+static void *   string_destroy_CB       (m4_hash *, const void *, void *,
+                                         void *);
+
+
+/* Return the binary trace state of CONTEXT, creating it on first
+   use.  */
+static m4__trace_output *
+trace_output (m4 *context)
+{
+  m4__trace_output *output = context->trace_output;
+
+  if (!output)
+    {
+      output = (m4__trace_output *) xzalloc (sizeof *output);
+      output->buffer = xcharalloc (TRACE_BUFFER_SIZE);
+      output->strings = m4_hash_new (TRACE_STRINGS_DEFAULT_SIZE,
+                                     m4_hash_string_hash, m4_hash_string_cmp);
+      output->next_id = 1;
+      context->trace_output = output;
+    }
+  return output;
+}
+
+/* Append LEN bytes of DATA to the output buffer, writing out the
+   buffer first if there is not enough room.  Anything too large for
+   the buffer is written directly.  Prefix the stream with the file
+   header if this is the first data since the debug file changed.  */
+static void
+trace_write (m4 *context, const void *data, size_t len)
+{
+  m4__trace_output *output = trace_output (context);
+
+  if (!output->started)
+    {
+      m4_trace_file_header header;
+
+      memset (&header, 0, sizeof header);
+      memcpy (header.magic, M4_TRACE_MAGIC, M4_TRACE_MAGIC_LEN);
+      header.byte_order = M4_TRACE_BYTE_ORDER;
+      header.version = M4_TRACE_VERSION;
+      output->started = true;
+      set_binary_mode (fileno (m4_get_debug_file (context)), O_BINARY);
+      trace_write (context, &header, sizeof header);
+    }
+  if (TRACE_BUFFER_SIZE - output->used < len)
+    m4__trace_flush (context, false);
+  if (TRACE_BUFFER_SIZE < len)
+    fwrite (data, 1, len, m4_get_debug_file (context));
+  else
+    {
+      memcpy (output->buffer + output->used, data, len);
+      output->used += len;
+    }
+}
+
+/* Return the id of the string STR of length LEN, first sending a
+   STRING record to define it if it has not been seen since the debug
+   file changed.  */
+static uint32_t
+trace_intern (m4 *context, const char *str, size_t len)
+{
+  m4__trace_output *output = trace_output (context);
+  trace_string **pentry;
+  trace_string *entry;
+  m4_trace_string record;
+  m4_string key;
+
+  key.str = (char *) str;
+  key.len = len;
+  pentry = (trace_string **) m4_hash_lookup (output->strings, &key);
+  if (pentry)
+    return (*pentry)->id;
+
+  entry = (trace_string *) xmalloc (sizeof *entry);
+  entry->str.str = xmemdup0 (str, len);
+  entry->str.len = len;
+  entry->id = output->next_id++;
+  m4_hash_insert (output->strings, &entry->str, entry);
+
+  memset (&record, 0, sizeof record);
+  record.type = M4_TRACE_STRING;
+  record.size = TRACE_ALIGN (sizeof record + len);
+  record.id = entry->id;
+  record.len = len;
+  trace_write (context, &record, sizeof record);
+  trace_write (context, str, len);
+  trace_pad (context, record.size - sizeof record - len);
+  return entry->id;
+}
+
+/* Write a SETTINGS record for the settings with id ID, unless that was
+   already done since the debug file changed.  */
+static void
+trace_send_settings (m4 *context, uint32_t id)
+{
+  m4__trace_output *output = context->trace_output;
+  trace_settings *settings;
+  m4_trace_settings record;
+  size_t len;
+
+  if (!id)
+    return;
+  settings = &output->settings[id - 1];
+  if (settings->sent)
+    return;
+  settings->sent = true;
+  len = settings->quotes.len1 + settings->quotes.len2;
+  memset (&record, 0, sizeof record);
+  record.type = M4_TRACE_SETTINGS;
+  record.size = TRACE_ALIGN (sizeof record + len);
+  record.max_len = (settings->max_len == SIZE_MAX ? UINT64_MAX
+                    : settings->max_len);
+  record.id = id;
+  record.lquote_len = settings->quotes.len1;
+  record.rquote_len = settings->quotes.len2;
+  trace_write (context, &record, sizeof record);
+  trace_write (context, settings->quotes.str1, settings->quotes.len1);
+  trace_write (context, settings->quotes.str2, settings->quotes.len2);
+  trace_pad (context, record.size - sizeof record - len);
+}
+
+/* Write LEN zero bytes of padding, less than 8.  */
+static void
+trace_pad (m4 *context, size_t len)
+{
+  static const char pad[8];
+
+  trace_write (context, pad, len);
+}
+
+/* Callback to remove an entry from the string id table HASH and free
+   it.  */
+static void *
+string_destroy_CB (m4_hash *hash, const void *key, void *value,
+                   void *ignored M4_GNUC_UNUSED)
+{
+  trace_string *entry = (trace_string *) value;
+
+  m4_hash_remove (hash, key);
+  free (entry->str.str);
+  free (entry);
+  return NULL;
+}
+
+
+/* Start a binary trace record of TYPE on the trace obstack, with room
+   for COUNT items, and return its offset, to be passed to the other
+   functions below.  The items are filled in with m4__trace_item_begin
+   and m4__trace_item_end, before the record is completed with
+   m4__trace_finish.  Other records may be started and finished in the
+   meantime, as long as they are properly nested.  */
+unsigned int
+m4__trace_begin (m4 *context, int type, size_t count)
+{
+  m4_obstack *trace = &context->trace_messages;
+  unsigned int start = obstack_object_size (trace);
+  m4_trace_record record;
+
+  memset (&record, 0, sizeof record);
+  record.type = type;
+  record.level = context->expansion_level;
+  obstack_grow (trace, &record, sizeof record);
+  obstack_blank (trace, count * sizeof (m4_trace_item));
+  memset ((char *) obstack_base (trace) + start + sizeof record, 0,
+          count * sizeof (m4_trace_item));
+  return start;
+}
+
+/* Return the offset where the bytes of a new item start, which the
+   caller then grows onto the trace obstack.  */
+unsigned int
+m4__trace_item_begin (m4 *context)
+{
+  return obstack_object_size (&context->trace_messages);
+}
+
+/* Complete an item of KIND for the record at START, whose bytes were
+   grown since DATA was returned by m4__trace_item_begin; the last
+   MODULE of those bytes are a module name.  LEN is the full length of
+   the text, and SETTINGS the id from m4__trace_settings that applies
+   to it.  Store it as item INDEX, which must be the next free one, or
+   as the expansion if INDEX is negative.  */
+void
+m4__trace_item_end (m4 *context, unsigned int start, unsigned int data,
+                    int index, int kind, size_t len, size_t module,
+                    unsigned int settings)
+{
+  m4_obstack *trace = &context->trace_messages;
+  char *base = (char *) obstack_base (trace);
+  m4_trace_record record;
+  m4_trace_item item;
+
+  memset (&item, 0, sizeof item);
+  item.len = len;
+  item.offset = data - start;
+  item.size = obstack_object_size (trace) - data - module;
+  item.kind = kind;
+  item.module = module;
+  item.settings = settings;
+  memcpy (&record, base + start, sizeof record);
+  if (index < 0)
+    record.expansion = item;
+  else
+    {
+      assert ((uint32_t) index == record.count);
+      memcpy (base + start + sizeof record + index * sizeof item, &item,
+              sizeof item);
+      record.count++;
+    }
+  memcpy (base + start, &record, sizeof record);
+}
+
+/* Return the id of the quotes and truncation length currently in
+   effect, recording them if they changed since the last call.  Only
+   the syntax generation and the length are compared in the common
+   case.  */
+unsigned int
+m4__trace_settings (m4 *context)
+{
+  m4__trace_output *output = trace_output (context);
+  size_t generation = m4__syntax_generation (M4SYNTAX);
+  size_t max_len = m4_get_max_debug_arg_length_opt (context);
+  const m4_string_pair *quotes;
+  trace_settings *last = NULL;
+  trace_settings *settings;
+
+  if (output->settings_count)
+    {
+      last = &output->settings[output->settings_count - 1];
+      if (output->syntax_generation == generation && last->max_len == max_len)
+        return output->settings_count;
+    }
+  output->syntax_generation = generation;
+  quotes = m4_get_syntax_quotes (M4SYNTAX);
+  if (last && last->max_len == max_len
+      && last->quotes.len1 == quotes->len1
+      && last->quotes.len2 == quotes->len2
+      && memcmp (last->quotes.str1, quotes->str1, quotes->len1) == 0
+      && memcmp (last->quotes.str2, quotes->str2, quotes->len2) == 0)
+    return output->settings_count;
+
+  if (output->settings_count == output->settings_size)
+    output->settings = (trace_settings *) x2nrealloc (output->settings,
+                                                      &output->settings_size,
+                                                      sizeof *settings);
+  settings = &output->settings[output->settings_count++];
+  settings->quotes.str1 = xmemdup0 (quotes->str1, quotes->len1);
+  settings->quotes.len1 = quotes->len1;
+  settings->quotes.str2 = xmemdup0 (quotes->str2, quotes->len2);
+  settings->quotes.len2 = quotes->len2;
+  settings->max_len = max_len;
+  settings->sent = false;
+  return output->settings_count;
+}
+
+/* Complete the record at START, filling in the details of the macro
+   call INFO, or the current input location if INFO is NULL.  Queue
+   the record for output, after the settings it refers to, then clear
+   it from the trace obstack.  */
+void
+m4__trace_finish (m4 *context, unsigned int start, const m4_call_info *info)
+{
+  m4_obstack *trace = &context->trace_messages;
+  size_t len = obstack_object_size (trace);
+  int debug_level;
+  const char *file;
+  int line;
+  m4_trace_record record;
+  m4_trace_item item;
+  uint32_t i;
+  char *base;
+
+  if (info)
+    {
+      debug_level = info->debug_level;
+      file = info->file;
+      line = info->line;
+    }
+  else
+    {
+      debug_level = m4_get_debug_level_opt (context);
+      file = m4_get_current_file (context);
+      line = m4_get_current_line (context);
+    }
+  if (m4_get_debug_file (context))
+    {
+      size_t pad = TRACE_ALIGN (len - start) - (len - start);
+
+      obstack_blank (trace, pad);
+      base = (char *) obstack_base (trace);
+      memset (base + len, 0, pad);
+      len += pad;
+      memcpy (&record, base + start, sizeof record);
+      record.size = len - start;
+      if (info)
+        {
+          record.call_id = info->call_id;
+          record.id = trace_intern (context, info->name, info->name_len);
+        }
+      if (info || line)
+        {
+          record.file = trace_intern (context, file, strlen (file));
+          record.line = line;
+        }
+      if (debug_level & M4_DEBUG_TRACE_FILE)
+        record.flags |= M4_TRACE_SHOW_FILE;
+      if (debug_level & M4_DEBUG_TRACE_LINE)
+        record.flags |= M4_TRACE_SHOW_LINE;
+      if (debug_level & M4_DEBUG_TRACE_CALLID)
+        record.flags |= M4_TRACE_SHOW_CALLID;
+      if (debug_level & M4_DEBUG_TRACE_QUOTE)
+        record.flags |= M4_TRACE_SHOW_QUOTE;
+      if (debug_level & M4_DEBUG_TRACE_MODULE)
+        record.flags |= M4_TRACE_SHOW_MODULE;
+      if (record.type == M4_TRACE_CALL
+          && (debug_level & M4_DEBUG_TRACE_EXPANSION))
+        record.flags |= M4_TRACE_HAS_EXPANSION;
+      for (i = 0; i < record.count; i++)
+        {
+          memcpy (&item, base + start + sizeof record + i * sizeof item,
+                  sizeof item);
+          trace_send_settings (context, item.settings);
+        }
+      trace_send_settings (context, record.expansion.settings);
+      memcpy (base + start, &record, sizeof record);
+      trace_write (context, base + start, record.size);
+    }
+  obstack_blank_fast (trace, start - len);
+}
+
+/* Write any buffered binary trace records to the debug file.  If
+   FORGET, the debug file is about to change, so that the next file
+   needs its own header and string definitions.  */
+void
+m4__trace_flush (m4 *context, bool forget)
+{
+  m4__trace_output *output = context->trace_output;
+  FILE *file = m4_get_debug_file (context);
+
+  if (!output)
+    return;
+  if (output->used && file)
+    fwrite (output->buffer, 1, output->used, file);
+  output->used = 0;
+  if (forget)
+    {
+      size_t i;
+
+      m4_hash_apply (output->strings, string_destroy_CB, NULL);
+      output->next_id = 1;
+      output->started = false;
+      for (i = 0; i < output->settings_count; i++)
+        output->settings[i].sent = false;
+    }
+}
+
+/* Free the binary trace state, when CONTEXT is deleted.  */
+void
+m4__trace_delete (m4 *context)
+{
+  m4__trace_output *output = context->trace_output;
+
+  if (output)
+    {
+      size_t i;
+
+      assert (output->used == 0);
+      for (i = 0; i < output->settings_count; i++)
+        {
+          free (output->settings[i].quotes.str1);
+          free (output->settings[i].quotes.str2);
+        }
+      free (output->settings);
+      m4_hash_apply (output->strings, string_destroy_CB, NULL);
+      m4_hash_delete (output->strings);
+      free (output->buffer);
+      free (output);
+      context->trace_output = NULL;
+    }
+}
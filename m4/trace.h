@@ -0,0 +1,132 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M4_TRACE_H
+#define M4_TRACE_H 1
+
+#include <stdint.h>
+
+/* Layout of the binary trace stream written by `--trace-format=binary'
+   and read back by m4-trace-dump.  The stream is in host byte order,
+   and is only meant to be read on the machine that wrote it.
+
+   A stream starts with an m4_trace_file_header.  Since the debug file
+   is opened for appending, the header may appear again later in the
+   stream, in which case all string and settings ids are forgotten.
+   After the header come records, each starting with its TYPE and SIZE.
+   SIZE covers the whole record, rounded up to a multiple of 8 with zero
+   padding, so that a reader can skip record types it does not
+   understand.
+
+   Strings that repeat from one record to the next, namely macro and
+   file names, are sent once in an m4_trace_string record, and referred
+   to by their id afterwards.  The quotes and truncation length that
+   decide how arguments are displayed are likewise sent once in an
+   m4_trace_settings record whenever they change.  Id 0 is never
+   assigned.
+
+   Every other record is an m4_trace_record, followed by COUNT
+   m4_trace_item descriptors, followed by the bytes the descriptors
+   point to.  Arguments and expansions are stored as raw bytes, only
+   as many as the truncation length in effect lets the text trace
+   show; quoting, truncation and module names are left to the
+   reader.  */
+
+#define M4_TRACE_MAGIC          "M4TRACE\1"
+#define M4_TRACE_MAGIC_LEN      8
+#define M4_TRACE_BYTE_ORDER     0x01020304
+#define M4_TRACE_VERSION        2
+
+typedef struct {
+  char magic[M4_TRACE_MAGIC_LEN];       /* M4_TRACE_MAGIC.  */
+  uint32_t byte_order;                  /* M4_TRACE_BYTE_ORDER.  */
+  uint32_t version;                     /* M4_TRACE_VERSION.  */
+} m4_trace_file_header;
+
+enum {
+  M4_TRACE_STRING = 1,  /* An m4_trace_string.  */
+  M4_TRACE_CALL,        /* Macro call ID, with arguments and expansion.  */
+  M4_TRACE_COLLECT,     /* Macro ID about to collect arguments; -dc.  */
+  M4_TRACE_MESSAGE,     /* m4debug message, as its single item.  */
+  M4_TRACE_SETTINGS     /* An m4_trace_settings.  */
+};
+
+/* Bits for the FLAGS field, recording which parts of the record the
+   text form of the trace shows.  */
+#define M4_TRACE_SHOW_FILE      (1 << 0) /* -df */
+#define M4_TRACE_SHOW_LINE      (1 << 1) /* -dl */
+#define M4_TRACE_SHOW_CALLID    (1 << 2) /* -di */
+#define M4_TRACE_HAS_EXPANSION  (1 << 3) /* -de */
+#define M4_TRACE_SHOW_QUOTE     (1 << 4) /* -dq */
+#define M4_TRACE_SHOW_MODULE    (1 << 5) /* -dm */
+
+/* Kinds of m4_trace_item.  */
+enum {
+  M4_TRACE_TEXT = 1,    /* Text, stored raw.  */
+  M4_TRACE_FUNC,        /* Builtin token, with the builtin name stored.  */
+  M4_TRACE_PLACEHOLDER, /* Unknown builtin, with its name stored.  */
+  M4_TRACE_FORMATTED    /* Text already formatted by m4.  */
+};
+
+/* Description of one argument, or of the expansion.  LEN is the full
+   length of the text, of which only the first SIZE bytes are stored
+   at OFFSET; the text trace shows a TEXT item truncated once LEN
+   reaches the truncation length of its SETTINGS.  A module name of
+   MODULE bytes may follow the stored bytes.  */
+typedef struct {
+  uint64_t len;         /* Length of the whole text.  */
+  uint32_t offset;      /* Offset of the stored bytes in the record.  */
+  uint32_t size;        /* Number of bytes stored.  */
+  uint32_t kind;        /* M4_TRACE_TEXT...  */
+  uint32_t module;      /* Length of the module name, or 0.  */
+  uint32_t settings;    /* Settings id in effect, or 0.  */
+  uint32_t unused;      /* Zero.  */
+} m4_trace_item;
+
+typedef struct {
+  uint32_t type;        /* One of M4_TRACE_CALL...  */
+  uint32_t size;        /* Total bytes, including items and padding.  */
+  uint64_t call_id;     /* Unique id of the macro call.  */
+  uint32_t id;          /* String id of macro name.  */
+  uint32_t file;        /* String id of file name, or 0.  */
+  uint32_t line;        /* Line number, or 0.  */
+  uint32_t level;       /* Expansion nesting level.  */
+  uint32_t flags;       /* M4_TRACE_SHOW_FILE...  */
+  uint32_t count;       /* Number of argument items that follow.  */
+  m4_trace_item expansion; /* Expansion, if M4_TRACE_HAS_EXPANSION.  */
+} m4_trace_record;
+
+typedef struct {
+  uint32_t type;        /* M4_TRACE_STRING.  */
+  uint32_t size;        /* Total bytes, including padding.  */
+  uint32_t id;          /* Id of the new string.  */
+  uint32_t len;         /* Length of the string that follows.  */
+} m4_trace_string;
+
+typedef struct {
+  uint32_t type;        /* M4_TRACE_SETTINGS.  */
+  uint32_t size;        /* Total bytes, including padding.  */
+  uint64_t max_len;     /* Truncation length, or UINT64_MAX.  */
+  uint32_t id;          /* Id of the new settings.  */
+  uint32_t lquote_len;  /* Length of the left quote that follows.  */
+  uint32_t rquote_len;  /* Length of the right quote after that.  */
+  uint32_t unused;      /* Zero.  */
+} m4_trace_settings;
+
+#endif /* !M4_TRACE_H */
@@ -211,8 +211,34 @@ m4_verror_at_line (m4 *context, bool warn, int status, int errnum,
     full = xasprintf (_("warning: %s"), format);
   else if (macro)
     full = xasprintf (_("%s: %s"), macro, format);
-  verror_at_line (status, errnum, line ? file : NULL, line,
-                  full ? full : format, args);
+  /* Exiting bypasses the usual flush when the debug file is closed.  */
+  if (status)
+    m4__trace_flush (context, false);
+  if (m4_is_debug_bit (context, M4_DEBUG_TRACE_BACKTRACE) && context->frames)
+    {
+      /* Follow the message with the enclosing macro calls, innermost
+         first, skipping the frame of CALLER itself.  Exit only once
+         the whole backtrace is out.  */
+      m4__macro_frame *frame;
+
+      verror_at_line (0, errnum, line ? file : NULL, line,
+                      full ? full : format, args);
+      for (frame = context->frames; frame; frame = frame->prev)
+        {
+          const m4_call_info *info = &frame->info;
+          if (caller && info->call_id == caller->call_id)
+            continue;
+          error_at_line (0, 0, info->line ? info->file : NULL, info->line,
+                         (frame->argp ? _("in arguments of %s")
+                          : _("in call of %s")),
+                         quotearg_n_mem (1, info->name, info->name_len));
+        }
+      if (status)
+        exit (status);
+    }
+  else
+    verror_at_line (status, errnum, line ? file : NULL, line,
+                    full ? full : format, args);
   free (full);
   free (safe_macro);
   if ((!warn || m4_get_fatal_warnings_opt (context))
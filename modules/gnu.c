@@ -29,7 +29,9 @@
 #endif
 
 #include "modules/m4.h"
+#include "memcmp2.h"
 #include "quotearg.h"
+#include "binary-io.h"
 #include "spawn-pipe.h"
 #include "wait-process.h"
 
@@ -42,14 +44,23 @@
   BUILTIN (__line__,    false,  false,  false,  0,      0  )    \
   BUILTIN (__program__, false,  false,  false,  0,      0  )    \
   BUILTIN (builtin,     true,   true,   false,  1,      -1 )    \
+  BUILTIN (case,        true,   true,   false,  2,      -1 )    \
   BUILTIN (changeresyntax,false,true,   false,  1,      1  )    \
   BUILTIN (changesyntax,false,  true,   false,  1,      -1 )    \
   BUILTIN (debugfile,   false,  false,  false,  0,      1  )    \
   BUILTIN (debuglen,    false,  true,   false,  1,      1  )    \
   BUILTIN (debugmode,   false,  false,  false,  0,      1  )    \
   BUILTIN (esyscmd,     false,  true,   true,   1,      1  )    \
+  BUILTIN (esyscmdinputs,false, true,   false,  2,      -1 )    \
+  BUILTIN (esyscmdnocache,false,true,   false,  1,      -1 )    \
   BUILTIN (format,      false,  true,   false,  1,      -1 )    \
   BUILTIN (indir,       true,   true,   false,  1,      -1 )    \
+  BUILTIN (mapclear,    false,  true,   false,  1,      -1 )    \
+  BUILTIN (mapdel,      false,  true,   false,  2,      -1 )    \
+  BUILTIN (mapget,      false,  true,   false,  2,      3  )    \
+  BUILTIN (mapkeys,     false,  true,   false,  1,      1  )    \
+  BUILTIN (mapset,      false,  true,   false,  2,      3  )    \
+  BUILTIN (mapsize,     false,  true,   false,  1,      1  )    \
   BUILTIN (mkdtemp,     false,  true,   false,  1,      1  )    \
   BUILTIN (patsubst,    false,  true,   true,   2,      4  )    \
   BUILTIN (regexp,      false,  true,   true,   2,      4  )    \
@@ -57,6 +68,7 @@
   BUILTIN (m4modules,   false,  false,  false,  0,      0  )    \
   BUILTIN (m4symbols,   true,   false,  false,  0,      -1 )    \
   BUILTIN (syncoutput,  false,  true,   false,  1,      1  )    \
+  BUILTIN (undivertfile,false, true,   false,  2,      2  )    \
 
 
 /* Generate prototypes for each builtin handler function. */
@@ -357,6 +369,214 @@ regexp_substitute (m4 *context, m4_obstack *obs, const m4_call_info *caller,
 }
 
 
+/* Multibranch dispatch.  A case table maps each literal label of a
+   case invocation to its argument index, so that the subject can be
+   located with a single hash probe instead of one comparison per
+   label.  Since the arguments of each call are collected afresh,
+   tables are cached by the contents of their label set.  Comparing
+   every label on each call would cost as much as the lookup saves,
+   so a table also remembers the call site it was last used from, as
+   given by m4_arg_origin; a call site within an unchanged macro body
+   thus finds its table without looking at the labels at all.  */
+
+/* As with REGEX_CACHE_SIZE, this is large enough for the handful of
+   dispatch tables that are typically active at once.  */
+#define CASE_CACHE_SIZE 16
+
+/* Structure for a cached set of case labels.  */
+typedef struct {
+  unsigned count;                       /* usage counter */
+  size_t origin;                        /* identity of last call site */
+  size_t origin_offset;                 /* ... its offset */
+  size_t origin_len;                    /* ... and its length */
+  size_t hash;                          /* hash of the whole label set */
+  size_t labels;                        /* number of labels */
+  size_t len;                           /* total length of labels */
+  char *str;                            /* copy of the labels, abutted */
+  size_t *ends;                         /* end offset of each label */
+  size_t mask;                          /* number of buckets, minus one */
+  size_t *buckets;                      /* label number plus one, or 0 */
+} m4_case_table;
+
+/* Storage for the cache of case tables.  */
+static m4_case_table case_cache[CASE_CACHE_SIZE];
+
+/* Return a hash value for the LEN bytes at STR, using the same
+   algorithm as the symbol table.  */
+static size_t
+case_hash (const char *str, size_t len)
+{
+  m4_string key;
+
+  key.str = (char *) str;
+  key.len = len;
+  return m4_hash_string_hash (&key);
+}
+
+/* Return true if label I of TABLE is the LEN bytes at STR.  */
+static bool
+case_label_equal (const m4_case_table *table, size_t i, const char *str,
+                  size_t len)
+{
+  size_t start = i ? table->ends[i - 1] : 0;
+
+  return (table->ends[i] - start == len
+          && memcmp (table->str + start, str, len) == 0);
+}
+
+/* Return the number of the first label in TABLE that matches the LEN
+   bytes at STR, or TABLE->labels if there is none.  */
+static size_t
+case_lookup (const m4_case_table *table, const char *str, size_t len)
+{
+  size_t slot = case_hash (str, len) & table->mask;
+  size_t label;
+
+  while ((label = table->buckets[slot]) != 0)
+    {
+      if (case_label_equal (table, label - 1, str, len))
+        return label - 1;
+      slot = (slot + 1) & table->mask;
+    }
+  return table->labels;
+}
+
+/* Return the cached case table last used by a call with the same
+   arguments as ARGV, which has LABELS labels, or NULL if the arguments
+   cannot be identified without looking at them.  */
+static m4_case_table *
+case_find (m4_macro_args *argv, size_t labels)
+{
+  size_t offset;
+  size_t len;
+  size_t origin = m4_arg_origin (argv, &offset, &len);
+  size_t i;
+
+  if (!origin)
+    return NULL;
+  for (i = 0; i < CASE_CACHE_SIZE; i++)
+    {
+      m4_case_table *table = &case_cache[i];
+
+      if (table->origin == origin && table->origin_offset == offset
+          && table->origin_len == len && table->str)
+        {
+          assert (table->labels == labels);
+          table->count++;
+          return table;
+        }
+    }
+  return NULL;
+}
+
+/* Return the case table for the LABELS labels found in every other
+   argument of ARGV, starting at index 2, building it if necessary.
+   The caller must have verified that each label is text.  */
+static m4_case_table *
+case_build (m4 *context, m4_macro_args *argv, size_t labels)
+{
+  size_t hash = labels;         /* hash of the whole label set */
+  size_t len = 0;               /* total length of all labels */
+  size_t i;                     /* iterator */
+  size_t j;                     /* iterator */
+  m4_case_table *victim;        /* cache slot to replace */
+  unsigned victim_count;        /* track which victim to replace */
+  size_t buckets;               /* size of new hash table */
+
+  /* First, check if this label set is already cached.  If so,
+     increase its use count and return it.  */
+  for (i = 0; i < labels; i++)
+    {
+      hash = hash * 31 + case_hash (M4ARG (2 + 2 * i), M4ARGLEN (2 + 2 * i));
+      len += M4ARGLEN (2 + 2 * i);
+    }
+  for (i = 0; i < CASE_CACHE_SIZE; i++)
+    {
+      m4_case_table *table = &case_cache[i];
+
+      if (!table->str || table->hash != hash || table->labels != labels
+          || table->len != len)
+        continue;
+      for (j = 0; j < labels; j++)
+        if (!case_label_equal (table, j, M4ARG (2 + 2 * j),
+                               M4ARGLEN (2 + 2 * j)))
+          break;
+      if (j == labels)
+        {
+          table->count++;
+          return table;
+        }
+    }
+
+  /* Now, find a victim slot, aging the entries the same way as
+     regexp_compile.  */
+  victim = case_cache;
+  victim_count = victim->count;
+  if (victim_count)
+    victim->count--;
+  for (i = 1; i < CASE_CACHE_SIZE; i++)
+    {
+      if (case_cache[i].count < victim_count)
+        {
+          victim_count = case_cache[i].count;
+          victim = &case_cache[i];
+        }
+      if (case_cache[i].count)
+        case_cache[i].count--;
+    }
+  free (victim->str);
+  free (victim->ends);
+  free (victim->buckets);
+  victim->count = CASE_CACHE_SIZE;
+  victim->hash = hash;
+  victim->labels = labels;
+  victim->len = len;
+  victim->str = xcharalloc (len + 1);
+  victim->ends = (size_t *) xnmalloc (labels, sizeof *victim->ends);
+  for (len = i = 0; i < labels; i++)
+    {
+      memcpy (victim->str + len, M4ARG (2 + 2 * i), M4ARGLEN (2 + 2 * i));
+      len += M4ARGLEN (2 + 2 * i);
+      victim->ends[i] = len;
+    }
+
+  /* Build an open-addressed table that is at most half full.  A
+     duplicate label keeps the bucket of its first occurrence.  */
+  for (buckets = 4; buckets < labels * 2; buckets *= 2)
+    ;
+  victim->mask = buckets - 1;
+  victim->buckets = (size_t *) xcalloc (buckets, sizeof *victim->buckets);
+  for (i = 0; i < labels; i++)
+    {
+      size_t start = i ? victim->ends[i - 1] : 0;
+      size_t slot = (case_hash (victim->str + start, victim->ends[i] - start)
+                     & victim->mask);
+
+      while ((j = victim->buckets[slot]) != 0
+             && !case_label_equal (victim, j - 1, victim->str + start,
+                                   victim->ends[i] - start))
+        slot = (slot + 1) & victim->mask;
+      if (!j)
+        victim->buckets[slot] = i + 1;
+    }
+  return victim;
+}
+
+/* Return the case table for the LABELS labels found in every other
+   argument of ARGV, starting at index 2, and remember the call site
+   of ARGV with it.  The caller must have verified that each label is
+   text, and already tried case_find.  */
+static m4_case_table *
+case_compile (m4 *context, m4_macro_args *argv, size_t labels)
+{
+  m4_case_table *table = case_build (context, argv, labels);
+
+  table->origin = m4_arg_origin (argv, &table->origin_offset,
+                                 &table->origin_len);
+  return table;
+}
+
+
 
 /**
  * __file__
@@ -461,6 +681,47 @@ M4BUILTIN_HANDLER (builtin)
 }
 
 
+/* The builtin "case" is a multibranch on a single subject, avoiding
+   the need to repeat the subject for each comparison as in ifelse.
+   When the subject and all labels are text, the matching label is
+   found by a hash lookup in a cached case table; otherwise, the
+   labels are compared one at a time like ifelse.  */
+
+/**
+ * case(SUBJECT, LABEL-1, RESULT-1, [LABEL-2, RESULT-2, ...], [DEFAULT])
+ **/
+M4BUILTIN_HANDLER (case)
+{
+  size_t labels = (argc - 2) / 2;
+  size_t label;
+  m4_case_table *table = NULL;
+
+  if (labels && m4_is_arg_text (argv, 1))
+    {
+      table = case_find (argv, labels);
+      if (!table)
+        {
+          for (label = 0; label < labels; label++)
+            if (!m4_is_arg_text (argv, 2 + 2 * label))
+              break;
+          if (label == labels)
+            table = case_compile (context, argv, labels);
+        }
+    }
+  if (table)
+    label = case_lookup (table, M4ARG (1), M4ARGLEN (1));
+  else
+    for (label = 0; label < labels; label++)
+      if (m4_arg_equal (context, argv, 1, 2 + 2 * label))
+        break;
+
+  if (label < labels)
+    m4_push_arg (context, obs, argv, 3 + 2 * label);
+  else if (argc % 2 == 1)
+    m4_push_arg (context, obs, argv, argc - 1);
+}
+
+
 /* Change the current regexp syntax to SPEC of length LEN, or report
    failure on behalf of CALLER.  Currently this affects the builtins:
    `patsubst', `regexp' and `renamesyms'.  */
@@ -578,6 +839,8 @@ M4BUILTIN_HANDLER (debugfile)
       if (strlen (str) < len)
         m4_warn (context, 0, me, _("argument %s truncated"),
                  quotearg_style_mem (locale_quoting_style, str, len));
+      if (*str)
+        m4_run_cache_forbid (context, me);
       if (!m4_debug_set_output (context, me, str))
         m4_warn (context, errno, me, _("cannot set debug file %s"),
               quotearg_style (locale_quoting_style, str));
@@ -624,6 +887,10 @@ M4BUILTIN_HANDLER (debugmode)
 }
 
 
+/* Room to make on the expansion obstack before each read of the
+   command output.  */
+#define ESYSCMD_READ_SIZE 65536
+
 /* Same as the sysymd builtin from m4.c module, but expand to the
    output of SHELL-COMMAND. */
 
@@ -638,14 +905,16 @@ M4BUILTIN_HANDLER (esyscmd)
   size_t len = M4ARGLEN (1);
   M4_MODULE_IMPORT (m4, m4_set_sysval);
   M4_MODULE_IMPORT (m4, m4_sysval_flush);
+  M4_MODULE_IMPORT (m4, m4_syscmd_spawn);
 
-  if (m4_set_sysval && m4_sysval_flush)
+  if (m4_set_sysval && m4_sysval_flush && m4_syscmd_spawn)
     {
       pid_t child;
       int fd;
-      FILE *pin;
+      ssize_t read_len;
       int status;
       int sig_status;
+      size_t start;
       const char *prog_args[4] = { "sh", "-c" };
       const char *caller;
 
@@ -665,60 +934,57 @@ M4BUILTIN_HANDLER (esyscmd)
           return;
         }
 
-      m4_sysval_flush (context, false);
-#if W32_NATIVE
-      if (strstr (M4_SYSCMD_SHELL, "cmd"))
+      /* Even a result from the esyscmd cache may be stale by the time
+         the run cache would replay it.  */
+      m4_run_cache_forbid (context, me);
+      if (m4_syscmd_cache_lookup (context, cmd, obs, &status))
         {
-          prog_args[0] = "cmd";
-          prog_args[1] = "/c";
+          m4_set_sysval (status);
+          return;
         }
-#endif
-      prog_args[2] = cmd;
+
+      m4_sysval_flush (context, false);
+      /* The command may create or remove files.  */
+      m4_path_cache_flush (context);
       caller = m4_info_name (me);
-      errno = 0;
-      child = create_pipe_in (caller, M4_SYSCMD_SHELL, (char **) prog_args,
-                              NULL, false, true, false, &fd);
+      start = obstack_object_size (obs);
+      child = m4_syscmd_spawn (cmd, &fd);
       if (child == -1)
         {
-          m4_error (context, 0, errno, me, _("cannot run command %s"),
-                    quotearg_style (locale_quoting_style, cmd));
-          m4_set_sysval (127);
-          return;
-        }
-#if OS2
-      /* On OS/2 kLIBC, fdopen() creates a stream in a mode of a file
-         descriptor.  So incldue "t" to open stream in a text mode explicitly. */
-      pin = fdopen (fd, "rt");
-#else
-      pin = fdopen (fd, "r");
+#if W32_NATIVE
+          if (strstr (M4_SYSCMD_SHELL, "cmd"))
+            {
+              prog_args[0] = "cmd";
+              prog_args[1] = "/c";
+            }
 #endif
-      if (!pin)
+          prog_args[2] = cmd;
+          errno = 0;
+          child = create_pipe_in (caller, M4_SYSCMD_SHELL, (char **) prog_args,
+                                  NULL, false, true, false, &fd);
+        }
+      if (child == -1)
         {
           m4_error (context, 0, errno, me, _("cannot run command %s"),
                     quotearg_style (locale_quoting_style, cmd));
           m4_set_sysval (127);
-          close (fd);
           return;
         }
-      while (1)
+#if OS2
+      /* On OS/2 kLIBC, the pipe is in binary mode; read it as text.  */
+      set_binary_mode (fd, O_TEXT);
+#endif
+      /* Read the output straight onto the expansion, in large
+         chunks.  */
+      do
         {
-          size_t avail = obstack_room (obs);
-          if (!avail)
-            {
-              int ch = getc (pin);
-              if (ch == EOF)
-                break;
-              obstack_1grow (obs, ch);
-            }
-          else
-            {
-              size_t len = fread (obstack_next_free (obs), 1, avail, pin);
-              if (len <= 0)
-                break;
-              obstack_blank_fast (obs, len);
-            }
+          obstack_make_room (obs, ESYSCMD_READ_SIZE);
+          read_len = read (fd, obstack_next_free (obs), obstack_room (obs));
+          if (0 < read_len)
+            obstack_blank_fast (obs, read_len);
         }
-      if (ferror (pin) || fclose (pin))
+      while (0 < read_len || (read_len < 0 && errno == EINTR));
+      if (read_len < 0 || close (fd) != 0)
         m4_error (context, EXIT_FAILURE, errno, me,
                   _("cannot read pipe to command %s"),
                   quotearg_style (locale_quoting_style, cmd));
@@ -735,6 +1001,10 @@ M4BUILTIN_HANDLER (esyscmd)
           if (status == 127 && errno)
             m4_error (context, 0, errno, me, _("cannot run command %s"),
                       quotearg_style (locale_quoting_style, cmd));
+          else
+            m4_syscmd_cache_store (context, me, cmd,
+                                   (char *) obstack_base (obs) + start,
+                                   obstack_object_size (obs) - start, status);
           m4_set_sysval (status);
         }
     }
@@ -742,6 +1012,34 @@ M4BUILTIN_HANDLER (esyscmd)
     assert (!"Unable to import from m4 module");
 }
 
+/* With --esyscmd-cache, esyscmd saves the output of each command, and
+   serves it again while the command text, environment and declared
+   inputs stay the same.  These builtins tune that for particular
+   commands.  */
+
+/**
+ * esyscmdinputs(SHELL-COMMAND, FILE, ...)
+ **/
+M4BUILTIN_HANDLER (esyscmdinputs)
+{
+  size_t i;
+
+  for (i = 2; i < argc; i++)
+    m4_syscmd_cache_add_input (context, M4ARG (1), M4ARGLEN (1),
+                               M4ARG (i), M4ARGLEN (i));
+}
+
+/**
+ * esyscmdnocache(SHELL-COMMAND, ...)
+ **/
+M4BUILTIN_HANDLER (esyscmdnocache)
+{
+  size_t i;
+
+  for (i = 1; i < argc; i++)
+    m4_syscmd_cache_forbid (context, M4ARG (i), M4ARGLEN (i));
+}
+
 
 /* Frontend for printf like formatting.  The function format () lives in
    the file format.c.  */
@@ -795,6 +1093,104 @@ M4BUILTIN_HANDLER (indir)
 }
 
 
+/* The map builtins provide associative arrays, stored apart from the
+   symbol table so that large tables neither slow down macro lookup
+   nor clutter m4symbols.  A map springs into existence when its first
+   key is set, and vanishes when its last key is deleted.  */
+
+/**
+ * mapclear(MAP, ...)
+ **/
+M4BUILTIN_HANDLER (mapclear)
+{
+  size_t i;
+
+  for (i = 1; i < argc; i++)
+    m4_map_clear (context, M4ARG (i), M4ARGLEN (i));
+}
+
+/**
+ * mapdel(MAP, KEY, ...)
+ **/
+M4BUILTIN_HANDLER (mapdel)
+{
+  size_t i;
+
+  for (i = 2; i < argc; i++)
+    m4_map_remove (context, M4ARG (1), M4ARGLEN (1), M4ARG (i), M4ARGLEN (i));
+}
+
+/**
+ * mapget(MAP, KEY, [DEFAULT])
+ **/
+M4BUILTIN_HANDLER (mapget)
+{
+  const m4_string *value = m4_map_get (context, M4ARG (1), M4ARGLEN (1),
+                                       M4ARG (2), M4ARGLEN (2));
+
+  if (value)
+    m4_shipout_string (context, obs, value->str, value->len, true);
+  else if (argc > 3)
+    m4_shipout_string (context, obs, M4ARG (3), M4ARGLEN (3), true);
+}
+
+/* Callback for mapkeys to collect each key on the obstack USERDATA.  */
+static void *
+mapkeys_CB (m4 *context M4_GNUC_UNUSED, const m4_string *key,
+            const m4_string *value M4_GNUC_UNUSED, void *userdata)
+{
+  obstack_grow ((m4_obstack *) userdata, key, sizeof *key);
+  return NULL;
+}
+
+/* qsort comparison routine, for sorting the keys of a map.  */
+static int
+mapkeys_cmp_CB (const void *s1, const void *s2)
+{
+  const m4_string *a = (const m4_string *) s1;
+  const m4_string *b = (const m4_string *) s2;
+  return memcmp2 (a->str, a->len, b->str, b->len);
+}
+
+/**
+ * mapkeys(MAP)
+ **/
+M4BUILTIN_HANDLER (mapkeys)
+{
+  m4_obstack *scratch = m4_arg_scratch (context);
+  m4_string *keys;
+  size_t size;
+
+  m4_map_apply (context, M4ARG (1), M4ARGLEN (1), mapkeys_CB, scratch);
+  size = obstack_object_size (scratch) / sizeof *keys;
+  keys = (m4_string *) obstack_finish (scratch);
+  qsort (keys, size, sizeof *keys, mapkeys_cmp_CB);
+  for (; size > 0; --size, keys++)
+    {
+      m4_shipout_string (context, obs, keys->str, keys->len, true);
+      if (size > 1)
+        obstack_1grow (obs, ',');
+    }
+}
+
+/**
+ * mapset(MAP, KEY, [VALUE])
+ **/
+M4BUILTIN_HANDLER (mapset)
+{
+  m4_map_set (context, M4ARG (1), M4ARGLEN (1), M4ARG (2), M4ARGLEN (2),
+              M4ARG (3), M4ARGLEN (3));
+}
+
+/**
+ * mapsize(MAP)
+ **/
+M4BUILTIN_HANDLER (mapsize)
+{
+  m4_shipout_int (obs, m4_map_size (context, M4ARG (1), M4ARGLEN (1)));
+}
+
+
 /* The builtin "mkdtemp" allows creation of temporary directories.  */
 
 /**
@@ -1075,3 +1471,40 @@ M4BUILTIN_HANDLER (syncoutput)
                               M4ARGLEN (1), value);
   m4_set_syncoutput_opt (context, value);
 }
+
+
+/* Generators that produce many files in one run can collect the text
+   of each in its own diversion, then have it written out directly,
+   without rescanning and without passing it through the output.  */
+
+/**
+ * undivertfile(DIVNUM, FILE)
+ **/
+M4BUILTIN_HANDLER (undivertfile)
+{
+  const m4_call_info *me = m4_arg_info (argv);
+  const char *name = M4ARG (2);
+  size_t len = M4ARGLEN (2);
+  int divnum;
+
+  if (m4_get_safer_opt (context))
+    {
+      m4_error (context, 0, 0, me, _("disabled by --safer"));
+      return;
+    }
+  if (!m4_numeric_arg (context, me, M4ARG (1), M4ARGLEN (1), &divnum))
+    return;
+  if (divnum <= 0 || divnum == m4_get_current_diversion (context))
+    m4_warn (context, 0, me, _("cannot write diversion %d to a file"),
+             divnum);
+  else if (strlen (name) != len || !len)
+    m4_warn (context, 0, me, _("invalid file name %s"),
+             quotearg_style_mem (locale_quoting_style, name, len));
+  else
+    {
+      m4_run_cache_forbid (context, me);
+      if (!m4_write_diversion (context, divnum, name))
+        m4_error (context, 0, errno, me, _("cannot write diversion %d to %s"),
+                  divnum, quotearg_style (locale_quoting_style, name));
+    }
+}
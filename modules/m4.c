@@ -28,18 +28,27 @@
 #  include "m4private.h"
 #endif
 
+#include <signal.h>
+#if !W32_NATIVE
+# include <spawn.h>
+#endif
+
+#include "cloexec.h"
 #include "execute.h"
+#include "fatal-signal.h"
 #include "memchr2.h"
 #include "memcmp2.h"
 #include "quotearg.h"
 #include "stdlib--.h"
 #include "tempname.h"
 #include "unistd--.h"
+#include "wait-process.h"
 
 #include <modules/m4.h>
 
 extern void m4_set_sysval    (int);
 extern void m4_sysval_flush  (m4 *, bool);
+extern pid_t m4_syscmd_spawn (const char *, int *);
 extern void m4_dump_symbols  (m4 *, m4_dump_symbol_data *, size_t,
                               m4_macro_args *, bool);
 extern const char *m4_expand_ranges (const char *, size_t *, m4_obstack *);
@@ -94,6 +103,12 @@ static void	include		(m4 *context, m4_obstack *obs, size_t argc,
 static int      dumpdef_cmp_CB  (const void *s1, const void *s2);
 static void *   dump_symbol_CB  (m4_symbol_table *, const char *, size_t,
                                  m4_symbol *symbol, void *userdata);
+static void *   dump_map_CB     (m4 *, const char *, size_t, void *);
+static void *   dump_map_entry_CB (m4 *, const m4_string *, const m4_string *,
+                                   void *);
+static int      dump_map_cmp_CB (const void *s1, const void *s2);
+static void     dump_map        (m4 *, m4_obstack *, FILE *, const char *,
+                                 size_t, const m4_string_pair *, size_t);
 static const char *ntoa         (number value, int radix);
 static void     numb_obstack    (m4_obstack *obs, number value,
                                  int radix, int min);
@@ -300,7 +315,13 @@ m4_dump_symbols (m4 *context, m4_dump_symbol_data *data, size_t argc,
 
       for (i = 1; i < argc; i++)
         {
-          symbol = m4_symbol_value_lookup (context, argv, i, complain);
+          /* A name that is only in use as a map is not worth a
+             warning; dumpdef shows the map instead.  */
+          bool warn = complain && !(m4_is_arg_text (argv, i)
+                                    && m4_map_size (context, M4ARG (i),
+                                                    M4ARGLEN (i)));
+
+          symbol = m4_symbol_value_lookup (context, argv, i, warn);
           if (symbol)
             dump_symbol_CB (NULL, M4ARG (i), M4ARGLEN (i), symbol, data);
         }
@@ -323,7 +344,9 @@ M4BUILTIN_HANDLER (dumpdef)
   bool stack = m4_is_debug_bit (context, M4_DEBUG_TRACE_STACK);
   size_t arg_length = m4_get_max_debug_arg_length_opt (context);
   bool module = m4_is_debug_bit (context, M4_DEBUG_TRACE_MODULE);
+  /* Binary trace output has no room for dumpdef text.  */
   FILE *output = (m4_is_debug_bit (context, M4_DEBUG_TRACE_OUTPUT_DUMPDEF)
+                  || m4_get_trace_binary_opt (context)
                   ? stderr : m4_get_debug_file (context));
 
   if (!output)
@@ -354,6 +377,115 @@ M4BUILTIN_HANDLER (dumpdef)
       fwrite (value, 1, len, output);
       obstack_free (obs, value);
     }
+
+  /* Follow the macros with the contents of any maps, either all of
+     them, or those that were named.  */
+  if (argc == 1)
+    {
+      m4_obstack *scratch = m4_arg_scratch (context);
+      m4_string *names;
+      size_t size;
+
+      m4_maps_apply (context, dump_map_CB, scratch);
+      size = obstack_object_size (scratch) / sizeof *names;
+      names = (m4_string *) obstack_finish (scratch);
+      qsort (names, size, sizeof *names, dumpdef_cmp_CB);
+      for (; size > 0; --size, names++)
+        dump_map (context, obs, output, names->str, names->len, quotes,
+                  arg_length);
+    }
+  else
+    {
+      size_t i;
+
+      for (i = 1; i < argc; i++)
+        if (m4_is_arg_text (argv, i))
+          dump_map (context, obs, output, M4ARG (i), M4ARGLEN (i), quotes,
+                    arg_length);
+    }
+}
+
+/* Callback for dumpdef to collect the names of all maps on the
+   obstack USERDATA.  */
+static void *
+dump_map_CB (m4 *context M4_GNUC_UNUSED, const char *name, size_t len,
+             void *userdata)
+{
+  m4_obstack *obs = (m4_obstack *) userdata;
+  m4_string key;
+
+  /* Safe to cast away const, since the names are not modified.  */
+  key.str = (char *) name;
+  key.len = len;
+  obstack_grow (obs, &key, sizeof key);
+  return NULL;
+}
+
+/* Callback for dumpdef to collect the entries of a map on the
+   obstack USERDATA.  */
+static void *
+dump_map_entry_CB (m4 *context M4_GNUC_UNUSED, const m4_string *key,
+                   const m4_string *value, void *userdata)
+{
+  m4_obstack *obs = (m4_obstack *) userdata;
+  m4_string_pair pair;
+
+  pair.str1 = key->str;
+  pair.len1 = key->len;
+  pair.str2 = value->str;
+  pair.len2 = value->len;
+  obstack_grow (obs, &pair, sizeof pair);
+  return NULL;
+}
+
+/* qsort comparison routine, for sorting map entries by key.  */
+static int
+dump_map_cmp_CB (const void *s1, const void *s2)
+{
+  const m4_string_pair *a = (const m4_string_pair *) s1;
+  const m4_string_pair *b = (const m4_string_pair *) s2;
+  return memcmp2 (a->str1, a->len1, b->str1, b->len1);
+}
+
+/* Print each entry of the map NAME of length LEN to OUTPUT, sorted
+   by key, in the form `NAME[KEY]:<TAB>VALUE', using OBS to build each
+   line.  QUOTES and ARG_LENGTH control the display of each value, as
+   for macro definitions.  */
+static void
+dump_map (m4 *context, m4_obstack *obs, FILE *output, const char *name,
+          size_t len, const m4_string_pair *quotes, size_t arg_length)
+{
+  m4_obstack *scratch = m4_arg_scratch (context);
+  m4_string_pair *base;
+  m4_string_pair *entry;
+  size_t size;
+
+  m4_map_apply (context, name, len, dump_map_entry_CB, scratch);
+  size = obstack_object_size (scratch) / sizeof *base;
+  base = (m4_string_pair *) obstack_finish (scratch);
+  qsort (base, size, sizeof *base, dump_map_cmp_CB);
+
+  for (entry = base; size > 0; --size, entry++)
+    {
+      size_t max_len = arg_length;
+      char *value;
+      size_t value_len;
+
+      obstack_grow (obs, name, len);
+      obstack_1grow (obs, '[');
+      obstack_grow (obs, entry->str1, entry->len1);
+      obstack_1grow (obs, ']');
+      obstack_1grow (obs, ':');
+      obstack_1grow (obs, '\t');
+      m4_shipout_string_trunc (obs, entry->str2, entry->len2, quotes,
+                               &max_len);
+      obstack_1grow (obs, '\n');
+      value_len = obstack_object_size (obs);
+      value = (char *) obstack_finish (obs);
+      fwrite (value, 1, value_len, output);
+      obstack_free (obs, value);
+    }
+  obstack_free (scratch, base);
 }
 
 /* The macro "defn" returns the quoted definition of the macro named by
@@ -456,6 +588,118 @@ m4_sysval_flush (m4 *context, bool report)
     }
 }
 
+/* Characters that may appear in a command run without the shell,
+   other than the blanks that separate its words.  Not `^', which is
+   a pipe in the traditional Bourne shell.  */
+#define SYSCMD_PLAIN_CHARS                                      \
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"        \
+  "0123456789%+,-./:=@_"
+
+/* Command names that the shell handles itself, or differently from
+   the program of the same name found in PATH.  */
+static const char *const syscmd_shell_words[] = {
+  "alias", "bg", "break", "case", "cd", "command", "continue", "do",
+  "done", "echo", "elif", "else", "esac", "eval", "exec", "exit",
+  "export", "fc", "fg", "fi", "for", "function", "getopts", "hash", "if",
+  "jobs", "kill", "local", "printf", "pwd", "read", "readonly", "return",
+  "select", "set", "shift", "source", "test", "then", "time", "times",
+  "trap", "type", "ulimit", "umask", "unalias", "unset", "until", "wait",
+  "while", NULL
+};
+
+/* Start CMD without going through the shell, provided it is a simple
+   command whose words contain nothing the shell would interpret, so
+   that running it directly makes no difference.  If FD is not NULL,
+   the standard output of the command goes to a pipe, whose read end
+   is stored in *FD.  Return the process id of the command, or -1 if
+   CMD should be run by the shell instead, including when it could
+   not be started, so that the shell reports the failure as usual.  */
+pid_t
+m4_syscmd_spawn (const char *cmd, int *fd)
+{
+#if W32_NATIVE
+  return -1;
+#else
+  const char *const *word;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attrs;
+  sigset_t blocked_signals;
+  char **args;
+  char *words;
+  char *p;
+  size_t argc = 0;
+  int pipe_fd[2];
+  pid_t child = -1;
+
+  if (cmd[strspn (cmd, SYSCMD_PLAIN_CHARS " \t")])
+    return -1;
+
+  words = xstrdup (cmd);
+  args = (char **) xnmalloc (strlen (cmd) / 2 + 2, sizeof *args);
+  for (p = strtok (words, " \t"); p; p = strtok (NULL, " \t"))
+    args[argc++] = p;
+  args[argc] = NULL;
+  /* Leave assignments and builtins to the shell.  */
+  if (!argc || strchr (args[0], '='))
+    goto done;
+  for (word = syscmd_shell_words; *word; word++)
+    if (strcmp (args[0], *word) == 0)
+      goto done;
+
+  if (fd)
+    {
+      if (pipe (pipe_fd) < 0)
+        goto done;
+      if (pipe_fd[0] <= STDERR_FILENO || pipe_fd[1] <= STDERR_FILENO
+          || set_cloexec_flag (pipe_fd[0], true) != 0
+          || set_cloexec_flag (pipe_fd[1], true) != 0)
+        {
+          close (pipe_fd[0]);
+          close (pipe_fd[1]);
+          goto done;
+        }
+    }
+
+  /* As in gnulib's execute, block fatal signals until the child is
+     registered for cleanup, but do not let the child inherit that.  */
+  sigprocmask (SIG_SETMASK, NULL, &blocked_signals);
+  block_fatal_signals ();
+  if (posix_spawn_file_actions_init (&actions) == 0)
+    {
+      if (posix_spawnattr_init (&attrs) == 0)
+        {
+          if ((!fd || posix_spawn_file_actions_adddup2 (&actions, pipe_fd[1],
+                                                        STDOUT_FILENO) == 0)
+              && posix_spawnattr_setsigmask (&attrs, &blocked_signals) == 0
+              && posix_spawnattr_setflags (&attrs,
+                                           POSIX_SPAWN_SETSIGMASK) == 0
+              && posix_spawnp (&child, args[0], &actions, &attrs, args,
+                               environ) == 0)
+            register_slave_subprocess (child);
+          else
+            child = -1;
+          posix_spawnattr_destroy (&attrs);
+        }
+      posix_spawn_file_actions_destroy (&actions);
+    }
+  unblock_fatal_signals ();
+
+  if (fd)
+    {
+      close (pipe_fd[1]);
+      if (child == -1)
+        close (pipe_fd[0]);
+      else
+        *fd = pipe_fd[0];
+    }
+
+ done:
+  free (args);
+  free (words);
+  return child;
+#endif /* !W32_NATIVE */
+}
+
 M4BUILTIN_HANDLER (syscmd)
 {
   const m4_call_info *me = m4_arg_info (argv);
@@ -463,6 +707,7 @@ M4BUILTIN_HANDLER (syscmd)
   size_t len = M4ARGLEN (1);
   int status;
   int sig_status;
+  pid_t child;
   const char *prog_args[4] = { "sh", "-c" };
 
   if (m4_get_safer_opt (context))
@@ -481,17 +726,32 @@ M4BUILTIN_HANDLER (syscmd)
       return;
     }
   m4_sysval_flush (context, false);
-#if W32_NATIVE
-  if (strstr (M4_SYSCMD_SHELL, "cmd"))
+  /* The command may create or remove files, and its effects cannot
+     be replayed from the run cache.  */
+  m4_path_cache_flush (context);
+  m4_run_cache_forbid (context, me);
+  child = m4_syscmd_spawn (cmd, NULL);
+  if (child != -1)
     {
-      prog_args[0] = "cmd";
-      prog_args[1] = "/c";
+      errno = 0;
+      status = wait_subprocess (child, m4_info_name (me), false, false, true,
+                                false, &sig_status);
     }
+  else
+    {
+#if W32_NATIVE
+      if (strstr (M4_SYSCMD_SHELL, "cmd"))
+        {
+          prog_args[0] = "cmd";
+          prog_args[1] = "/c";
+        }
 #endif
-  prog_args[2] = cmd;
-  errno = 0;
-  status = execute (m4_info_name (me), M4_SYSCMD_SHELL, (char **) prog_args,
-                    false, false, false, false, true, false, &sig_status);
+      prog_args[2] = cmd;
+      errno = 0;
+      status = execute (m4_info_name (me), M4_SYSCMD_SHELL,
+                        (char **) prog_args, false, false, false, false, true,
+                        false, &sig_status);
+    }
   if (sig_status)
     {
       assert (status == 127);
@@ -694,6 +954,7 @@ m4_make_temp (m4 *context, m4_obstack *obs, const m4_call_info *caller,
       m4_error (context, 0, 0, caller, _("disabled by --safer"));
       return;
     }
+  m4_run_cache_forbid (context, caller);
 
   /* Guarantee that there are six trailing 'X' characters, even if the
      user forgot to supply them.  Output must be quoted if
@@ -731,6 +992,7 @@ m4_make_temp (m4 *context, m4_obstack *obs, const m4_call_info *caller,
     {
       if (!dir)
         close (fd);
+      m4_path_cache_flush (context);
       /* Remove NUL, then finish quote.  */
       obstack_blank_fast (obs, -1);
       obstack_grow (obs, quotes->str2, quotes->len2);
@@ -833,6 +1095,8 @@ M4BUILTIN_HANDLER (m4exit)
   /* Check for saved error.  */
   if (exit_code == 0 && m4_get_exit_status (context) != 0)
     exit_code = m4_get_exit_status (context);
+  m4_run_cache_finish (context, exit_code);
+  m4_set_exit_requested (context, true);
   exit (exit_code);
 }
 
@@ -1049,6 +1313,117 @@ m4_expand_ranges (const char *s, size_t *len, m4_obstack *obs)
   return (char *) obstack_finish (obs);
 }
 
+/* Translit keeps a small cache of compiled translation tables, keyed
+   by its second and third arguments.  Callers such as case conversion
+   macros use only a handful of distinct tables, but call them over and
+   over.  */
+#define TRANSLIT_CACHE_SIZE 8
+
+enum { ASIS, REPLACE, DELETE };
+
+/* A translation table, compiled from the second and third arguments
+   of translit before range expansion.  */
+typedef struct {
+  unsigned count;                       /* usage counter */
+  size_t from_len;                      /* length of FROM */
+  size_t to_len;                        /* length of TO */
+  char *key;                            /* FROM followed by TO, or NULL */
+  bool deletes;                         /* true if any byte is DELETE */
+  char found[UCHAR_MAX + 1];            /* ASIS, REPLACE or DELETE */
+  unsigned char map[UCHAR_MAX + 1];     /* replacement, or byte itself */
+} translit_table;
+
+/* Storage for the cache of translation tables.  */
+static translit_table translit_cache[TRANSLIT_CACHE_SIZE];
+
+/* Return the translation table for FROM of length FROM_LEN and TO of
+   length TO_LEN, compiling it unless it is already cached.  Slots are
+   recycled the same way as in the regex cache of the gnu module.  */
+static const translit_table *
+translit_compile (m4 *context, const char *from, size_t from_len,
+                  const char *to, size_t to_len)
+{
+  translit_table *victim;
+  unsigned victim_count;
+  unsigned char ch;
+  int i;
+
+  for (i = 0; i < TRANSLIT_CACHE_SIZE; i++)
+    {
+      translit_table *table = &translit_cache[i];
+      if (table->key && from_len == table->from_len
+          && to_len == table->to_len
+          && memcmp (from, table->key, from_len) == 0
+          && memcmp (to, table->key + from_len, to_len) == 0)
+        {
+          table->count++;
+          return table;
+        }
+    }
+
+  victim = translit_cache;
+  victim_count = victim->count;
+  if (victim_count)
+    victim->count--;
+  for (i = 1; i < TRANSLIT_CACHE_SIZE; i++)
+    {
+      if (translit_cache[i].count < victim_count)
+        {
+          victim_count = translit_cache[i].count;
+          victim = &translit_cache[i];
+        }
+      if (translit_cache[i].count)
+        translit_cache[i].count--;
+    }
+  victim->count = TRANSLIT_CACHE_SIZE;
+  free (victim->key);
+  victim->key = xcharalloc (from_len + to_len + 1);
+  memcpy (victim->key, from, from_len);
+  memcpy (victim->key + from_len, to, to_len);
+  victim->from_len = from_len;
+  victim->to_len = to_len;
+
+  if (memchr (to, '-', to_len) != NULL)
+    to = m4_expand_ranges (to, &to_len, m4_arg_scratch (context));
+  if (memchr (from, '-', from_len) != NULL)
+    from = m4_expand_ranges (from, &from_len, m4_arg_scratch (context));
+
+  /* Calling memchr(from) for each character in data is quadratic,
+     since both strings can be arbitrarily long.  Instead, create a
+     from-to mapping in one pass of from, then use that map in one
+     pass of data, for linear behavior.  Traditional behavior is that
+     only the first instance of a character in from is consulted,
+     hence the found map.  Bytes left ASIS map to themselves, so that
+     a table without deletions is applied by lookup alone.  */
+  memset (victim->found, ASIS, sizeof victim->found);
+  for (i = 0; i <= UCHAR_MAX; i++)
+    victim->map[i] = i;
+  victim->deletes = false;
+  while (from_len--)
+    {
+      ch = *from++;
+      if (victim->found[ch] == ASIS)
+        {
+          if (to_len)
+            {
+              victim->found[ch] = REPLACE;
+              victim->map[ch] = *to;
+            }
+          else
+            {
+              victim->found[ch] = DELETE;
+              victim->deletes = true;
+            }
+        }
+      if (to_len)
+        {
+          to++;
+          to_len--;
+        }
+    }
+  return victim;
+}
+
 /* The macro "translit" translates all characters in the first
    argument, which are present in the second argument, into the
    corresponding character from the third argument.  If the third
@@ -1056,16 +1431,14 @@ m4_expand_ranges (const char *s, size_t *len, m4_obstack *obs)
    second argument are deleted from the first.  */
 M4BUILTIN_HANDLER (translit)
 {
-  const char *data;
+  m4_arg_iterator iter;
+  const char *text;
   const char *from;
   const char *to;
   size_t from_len;
   size_t to_len;
-  char map[UCHAR_MAX + 1];
-  char found[UCHAR_MAX + 1];
-  unsigned char ch;
-
-  enum { ASIS, REPLACE, DELETE };
+  size_t len;
+  const translit_table *table;
 
   if (m4_arg_empty (argv, 1) || m4_arg_empty (argv, 2))
     {
@@ -1078,81 +1451,76 @@ M4BUILTIN_HANDLER (translit)
 
   to = M4ARG (3);
   to_len = M4ARGLEN (3);
-  if (memchr (to, '-', to_len) != NULL)
-    to = m4_expand_ranges (to, &to_len, m4_arg_scratch (context));
 
-  /* If there are only one or two bytes to replace, it is faster to
-     use memchr2.  Using expand_ranges does nothing unless there are
-     at least three bytes.  */
+  /* The text to translate is walked a segment at a time, so that an
+     argument built from $@ is never flattened into a copy first.  If
+     there are only one or two bytes to replace, it is faster to use
+     memchr2.  Using expand_ranges does nothing unless there are at
+     least three bytes.  */
+  m4_arg_iterator_init (context, argv, 1, false, &iter);
   if (from_len <= 2)
     {
       const char *p;
-      size_t len = M4ARGLEN (1);
       int second = from[from_len / 2];
-      data = M4ARG (1);
-      while ((p = (char *) memchr2 (data, from[0], second, len)))
+
+      if (memchr (to, '-', to_len) != NULL)
+        to = m4_expand_ranges (to, &to_len, m4_arg_scratch (context));
+      while (m4_arg_iterator_next (&iter, &text, &len))
         {
-          obstack_grow (obs, data, p - data);
-          len -= p - data + 1;
-          data = p + 1;
-          if (*p == from[0] && to_len)
-            obstack_1grow (obs, to[0]);
-          else if (*p == second && 1 < to_len)
-            obstack_1grow (obs, to[1]);
+          while ((p = (char *) memchr2 (text, from[0], second, len)))
+            {
+              obstack_grow (obs, text, p - text);
+              len -= p - text + 1;
+              text = p + 1;
+              if (*p == from[0] && to_len)
+                obstack_1grow (obs, to[0]);
+              else if (*p == second && 1 < to_len)
+                obstack_1grow (obs, to[1]);
+            }
+          obstack_grow (obs, text, len);
         }
-      obstack_grow (obs, data, len);
       return;
     }
 
-  if (memchr (from, '-', from_len) != NULL)
-    from = m4_expand_ranges (from, &from_len, m4_arg_scratch (context));
+  table = translit_compile (context, from, from_len, to, to_len);
 
-  /* Calling memchr(from) for each character in data is quadratic,
-     since both strings can be arbitrarily long.  Instead, create a
-     from-to mapping in one pass of from, then use that map in one
-     pass of data, for linear behavior.  Traditional behavior is that
-     only the first instance of a character in from is consulted,
-     hence the found map.  */
-  memset (map, 0, sizeof map);
-  memset (found, 0, sizeof found);
-  while (from_len--)
+  /* The result of each segment is never longer than the segment, so
+     reserve room for all of it up front and store into it
+     directly.  */
+  while (m4_arg_iterator_next (&iter, &text, &len))
     {
-      ch = *from++;
-      if (found[ch] == ASIS)
+      const unsigned char *data = (const unsigned char *) text;
+      unsigned char *dest;
+
+      obstack_make_room (obs, len);
+      dest = (unsigned char *) obstack_next_free (obs);
+      if (!table->deletes)
         {
-          if (to_len)
+          const unsigned char *map = table->map;
+          size_t i = 0;
+
+          for (; i + 4 <= len; i += 4)
             {
-              found[ch] = REPLACE;
-              map[ch] = *to;
+              dest[i] = map[data[i]];
+              dest[i + 1] = map[data[i + 1]];
+              dest[i + 2] = map[data[i + 2]];
+              dest[i + 3] = map[data[i + 3]];
             }
-          else
-            found[ch] = DELETE;
+          for (; i < len; i++)
+            dest[i] = map[data[i]];
+          obstack_blank_fast (obs, len);
         }
-      if (to_len)
+      else
         {
-          to++;
-          to_len--;
-        }
-    }
+          unsigned char *p = dest;
 
-  data = M4ARG (1);
-  from_len = M4ARGLEN (1);
-  while (from_len--)
-    {
-      ch = *data++;
-      switch (found[ch])
-        {
-        case ASIS:
-          obstack_1grow (obs, ch);
-          break;
-        case REPLACE:
-          obstack_1grow (obs, map[ch]);
-          break;
-        case DELETE:
-          break;
-        default:
-          assert (!"translit");
-          abort ();
+          while (len--)
+            {
+              unsigned char ch = *data++;
+              *p = table->map[ch];
+              p += table->found[ch] != DELETE;
+            }
+          obstack_blank_fast (obs, p - dest);
         }
     }
 }
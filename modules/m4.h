@@ -39,6 +39,7 @@ typedef struct
    across the interface boundary.  */
 typedef void m4_sysval_flush_func (m4 *context, bool report);
 typedef void m4_set_sysval_func (int value);
+typedef pid_t m4_syscmd_spawn_func (const char *cmd, int *fd);
 typedef void m4_dump_symbols_func (m4 *context, m4_dump_symbol_data *data,
                                    size_t argc, m4_macro_args *argv,
                                    bool complain);
@@ -99,6 +99,7 @@ M4BUILTIN_HANDLER (getenv)
 {
   char *env;
 
+  m4_run_cache_add_env (context, M4ARG (1));
   env = getenv (M4ARG (1));
 
   if (env != NULL)
@@ -118,6 +119,7 @@ M4BUILTIN_HANDLER (setenv)
       return;
 
   /* TODO - error checking.  */
+  m4_run_cache_add_env (context, M4ARG (1));
   setenv (M4ARG (1), M4ARG (2), overwrite);
 }
 
@@ -127,6 +129,7 @@ M4BUILTIN_HANDLER (setenv)
 M4BUILTIN_HANDLER (unsetenv)
 {
   /* TODO - error checking.  */
+  m4_run_cache_add_env (context, M4ARG (1));
   unsetenv (M4ARG (1));
 }
 
@@ -137,6 +140,7 @@ M4BUILTIN_HANDLER (getlogin)
 {
   char *login;
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   login = getlogin ();
 
   if (login != NULL)
@@ -148,6 +152,7 @@ M4BUILTIN_HANDLER (getlogin)
  **/
 M4BUILTIN_HANDLER (getpid)
 {
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   m4_shipout_int (obs, getpid ());
 }
 
@@ -156,6 +161,7 @@ M4BUILTIN_HANDLER (getpid)
  **/
 M4BUILTIN_HANDLER (getppid)
 {
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   m4_shipout_int (obs, getppid ());
 }
 
@@ -166,6 +172,7 @@ M4BUILTIN_HANDLER (getpwnam)
 {
   struct passwd *pw;
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   pw = getpwnam (M4ARG (1));
 
   if (pw != NULL)
@@ -194,6 +201,7 @@ M4BUILTIN_HANDLER (getpwuid)
   struct passwd *pw;
   int uid;
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   if (!m4_numeric_arg (context, m4_arg_info (argv), M4ARG (1), M4ARGLEN (1),
                        &uid))
     return;
@@ -225,6 +233,7 @@ M4BUILTIN_HANDLER (hostname)
 {
   char buf[1024];
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   if (gethostname (buf, sizeof buf) < 0)
     return;
 
@@ -236,6 +245,7 @@ M4BUILTIN_HANDLER (hostname)
  **/
 M4BUILTIN_HANDLER (rand)
 {
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   m4_shipout_int (obs, rand ());
 }
 
@@ -246,6 +256,7 @@ M4BUILTIN_HANDLER (srand)
 {
   int seed;
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   if (argc == 1)
     seed = time (0L) * getpid ();
   else
@@ -265,6 +276,7 @@ M4BUILTIN_HANDLER (uname)
 {
   struct utsname ut;
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   if (uname (&ut) == 0)
     {
       m4_shipout_string (context, obs, ut.sysname, SIZE_MAX, true);
@@ -284,5 +296,6 @@ M4BUILTIN_HANDLER (uname)
  **/
 M4BUILTIN_HANDLER (getuid)
 {
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   m4_shipout_int (obs, getuid ());
 }
@@ -93,6 +93,7 @@ M4BUILTIN_HANDLER (currenttime)
   time_t now;
   int l;
 
+  m4_run_cache_forbid (context, m4_arg_info (argv));
   now = time (0L);
   l = sprintf (buf, "%ld", now);
 
@@ -115,7 +116,10 @@ M4BUILTIN_HANDLER (ctime)
       t = i;
     }
   else
-    t = time (0L);
+    {
+      m4_run_cache_forbid (context, m4_arg_info (argv));
+      t = time (0L);
+    }
 
   s = ctime (&t);
   obstack_grow (obs, s, 24);
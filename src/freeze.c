@@ -24,19 +24,74 @@
 
 #include "m4.h"
 
+#include <sys/stat.h>
+
 #include "binary-io.h"
 #include "close-stream.h"
+#include "dirname.h"
+#include "filenamecat.h"
 #include "quotearg.h"
 #include "verify.h"
 #include "xmemdup0.h"
 
+/* A frozen file reloaded by this run, known by its device and inode
+   so that a layer naming its base by another path still finds it.  */
+typedef struct frozen_layer frozen_layer;
+struct frozen_layer
+{
+  frozen_layer *next;           /* layer reloaded before this one */
+  dev_t dev;                    /* device of the file */
+  ino_t ino;                    /* inode of the file */
+};
+
+/* The state recorded by set_frozen_base, which produce_frozen_state
+   then writes a layer against.  */
+typedef struct
+{
+  char *name;                   /* absolute file name of the base */
+  size_t generation;            /* symbol table generation */
+  size_t map_generation;        /* generation of the maps */
+  m4_string *maps;              /* names of the maps present */
+  size_t map_count;             /* number of maps present */
+  size_t map_size;              /* allocated size of maps */
+  m4_module *module;            /* newest module loaded, or NULL */
+  m4_string_pair quote;         /* quote delimiters */
+  m4_string_pair comm;          /* comment delimiters */
+  int regexp_syntax;            /* default regexp syntax */
+  int debug_level;              /* debug flags */
+  unsigned short syntax[UCHAR_MAX + 1]; /* syntax table */
+} frozen_base;
+
+/* Every frozen file reloaded so far, most recent first.  */
+static frozen_layer *layers;
+
+/* The base of the layer to produce, or NULL for a complete state.  */
+static frozen_base *base;
+
 static  void  produce_mem_dump          (FILE *, const char *, size_t);
 static  void  produce_resyntax_dump     (m4 *, FILE *);
-static  void  produce_syntax_dump       (FILE *, m4_syntax_table *, char);
-static  void  produce_module_dump       (m4 *, FILE *, m4_module *);
+static  void  produce_syntax_dump       (FILE *, m4_syntax_table *, char,
+                                         bool);
+static  void  produce_module_dump       (m4 *, FILE *, m4_module *,
+                                         m4_module *);
 static  void  produce_symbol_dump       (m4 *, FILE *, m4_symbol_table *);
+static  void  produce_forget_dump       (FILE *, char, const char *, size_t);
 static  void *dump_symbol_CB            (m4_symbol_table *, const char *,
                                          size_t, m4_symbol *, void *);
+static  void *dump_changed_symbol_CB    (m4_symbol_table *, const char *,
+                                         size_t, m4_symbol *, void *);
+static  void *dump_removed_symbol_CB    (m4_symbol_table *, const char *,
+                                         size_t, m4_symbol *, void *);
+static  void *dump_map_CB               (m4 *, const char *, size_t, void *);
+static  void *dump_changed_map_CB       (m4 *, const char *, size_t, void *);
+static  void *dump_map_entry_CB         (m4 *, const m4_string *,
+                                         const m4_string *, void *);
+static  void *base_map_CB               (m4 *, const char *, size_t, void *);
+static  char *absolute_file_name        (const char *);
+static  bool  string_pair_equal         (const m4_string_pair *,
+                                         const m4_string_pair *);
+static  void  free_frozen_base          (void);
+static  bool  record_layer              (m4 *, FILE *);
 static  void  issue_expect_message      (m4 *, int);
 static  int   decode_char               (m4 *, FILE *, bool *);
 
@@ -46,9 +101,9 @@ static  int   decode_char               (m4 *, FILE *, bool *);
 static void
 produce_mem_dump (FILE *file, const char *mem, size_t len)
 {
-  char *quoted = quotearg_style_mem (escape_quoting_style, mem, len);
+  const char *quoted = m4_escape_mem (mem, len, &len);
   /* Any errors will be detected by ferror later.  */
-  fwrite (quoted, strlen (quoted), 1, file);
+  fwrite (quoted, len, 1, file);
 }
 
 
@@ -64,8 +119,9 @@ produce_resyntax_dump (m4 *context, FILE *file)
 {
   int code = m4_get_regexp_syntax_opt (context);
 
-  /* Don't dump default syntax code (`0' for GNU_EMACS).  */
-  if (code)
+  /* Don't dump default syntax code (`0' for GNU_EMACS), or for a
+     layer, the syntax code of its base.  */
+  if (base ? code != base->regexp_syntax : code)
     {
       const char *resyntax = m4_regexp_syntax_decode (code);
 
@@ -79,8 +135,12 @@ produce_resyntax_dump (m4 *context, FILE *file)
     }
 }
 
+/* Produce the `S' directive for syntax category CH of SYNTAX, listing
+   only the bytes that differ from the default syntax, or with ALL,
+   every byte of the category, so that reloading it overrides whatever
+   syntax was in place before.  */
 static void
-produce_syntax_dump (FILE *file, m4_syntax_table *syntax, char ch)
+produce_syntax_dump (FILE *file, m4_syntax_table *syntax, char ch, bool all)
 {
   char buf[UCHAR_MAX + 1];
   int code = m4_syntax_code (ch);
@@ -88,12 +148,12 @@ produce_syntax_dump (FILE *file, m4_syntax_table *syntax, char ch)
   int i;
 
   for (i = 0; i < UCHAR_MAX + 1; ++i)
-    if (m4_has_syntax (syntax, i, code) && code != syntax->orig[i])
+    if (m4_has_syntax (syntax, i, code) && (all || code != syntax->orig[i]))
       buf[count++] = i;
 
   /* If code falls in M4_SYNTAX_MASKS, then we must treat it
      specially, since it will not be found in syntax->orig.  */
-  if (count == 1
+  if (!all && count == 1
       && ((code == M4_SYNTAX_RQUOTE && *buf == *DEF_RQUOTE)
           || (code == M4_SYNTAX_ECOMM && *buf == *DEF_ECOMM)))
     return;
@@ -106,12 +166,13 @@ produce_syntax_dump (FILE *file, m4_syntax_table *syntax, char ch)
     }
 }
 
-/* Store the debug mode in textual format.  */
+/* Store the debug mode in textual format.  If SUBTRACT, the directive
+   clears FLAGS rather than setting the debug mode to FLAGS.  */
 static void
-produce_debugmode_state (FILE *file, int flags)
+produce_debugmode_state (FILE *file, int flags, bool subtract)
 {
   /* This code tracks the number of bits in M4_DEBUG_TRACE_VERBOSE.  */
-  char str[15];
+  char str[16];
   int offset = 0;
   verify ((1 << (sizeof str - 1)) - 1 == M4_DEBUG_TRACE_VERBOSE);
   if (flags & M4_DEBUG_TRACE_ARGS)
@@ -142,23 +203,29 @@ produce_debugmode_state (FILE *file, int flags)
     str[offset++] = 'd';
   if (flags & M4_DEBUG_TRACE_OUTPUT_DUMPDEF)
     str[offset++] = 'o';
+  if (flags & M4_DEBUG_TRACE_BACKTRACE)
+    str[offset++] = 'b';
   str[offset] = '\0';
   if (offset)
-    xfprintf (file, "d%d\n%s\n", offset, str);
+    xfprintf (file, "d%d\n%s%s\n", offset + subtract, subtract ? "-" : "",
+              str);
 }
 
 /* The modules must be dumped in the order in which they will be
    reloaded from the frozen file.  We store handles in a push
-   down stack, so we need to dump them in the reverse order to that.  */
+   down stack, so we need to dump them in the reverse order to that.
+   Stop at module STOP, which was already loaded by the base of a
+   layer, or at the bottom of the stack if STOP is NULL.  */
 static void
-produce_module_dump (m4 *context, FILE *file, m4_module *module)
+produce_module_dump (m4 *context, FILE *file, m4_module *module,
+                     m4_module *stop)
 {
   const char *name = m4_get_module_name (module);
   size_t len = strlen (name);
 
   module = m4_module_next (context, module);
-  if (module)
-    produce_module_dump (context, file, module);
+  if (module && module != stop)
+    produce_module_dump (context, file, module, stop);
 
   xfprintf (file, "M%zu\n", len);
   produce_mem_dump (file, name, len);
@@ -167,14 +234,34 @@ produce_module_dump (m4 *context, FILE *file, m4_module *module)
 
 /* Process all entries in one bucket, from the last to the first.
    This order ensures that, at reload time, pushdef's will be
-   executed with the oldest definitions first.  */
+   executed with the oldest definitions first.  A layer only holds the
+   symbols changed since its base was reloaded, each of them forgotten
+   first, so that its whole stack of values replaces the one from the
+   base.  */
 static void
 produce_symbol_dump (m4 *context, FILE *file, m4_symbol_table *symtab)
 {
-  if (m4_symtab_apply (symtab, true, dump_symbol_CB, file))
+  if (!base)
+    {
+      if (m4_symtab_apply (symtab, true, dump_symbol_CB, file))
+        assert (false);
+      return;
+    }
+  if (m4_symtab_apply_removed (symtab, dump_removed_symbol_CB, file)
+      || m4_symtab_apply (symtab, true, dump_changed_symbol_CB, file))
     assert (false);
 }
 
+/* Produce a directive OP forgetting the symbol or map NAME of length
+   LEN.  */
+static void
+produce_forget_dump (FILE *file, char op, const char *name, size_t len)
+{
+  xfprintf (file, "%c%zu\n", op, len);
+  produce_mem_dump (file, name, len);
+  fputc ('\n', file);
+}
+
 /* Given a stack of symbol values starting with VALUE, destructively
    reverse the stack and return the pointer to what was previously the
    last value in the stack.  VALUE may be NULL.  The symbol table that
@@ -267,13 +354,187 @@ dump_symbol_CB (m4_symbol_table *symtab, const char *symbol_name, size_t len,
   return NULL;
 }
 
-/* Produce a frozen state to the given file NAME. */
+/* Like dump_symbol_CB, but skip SYMBOL if it did not change since the
+   base was reloaded, and otherwise forget it first.  */
+static void *
+dump_changed_symbol_CB (m4_symbol_table *symtab, const char *symbol_name,
+                        size_t len, m4_symbol *symbol, void *userdata)
+{
+  if (m4_get_symbol_generation (symbol) <= base->generation)
+    return NULL;
+  produce_forget_dump ((FILE *) userdata, 'U', symbol_name, len);
+  return dump_symbol_CB (symtab, symbol_name, len, symbol, userdata);
+}
+
+/* Forget the symbol with name SYMBOL_NAME of length LEN, which was
+   removed since the base was reloaded.  */
+static void *
+dump_removed_symbol_CB (m4_symbol_table *symtab M4_GNUC_UNUSED,
+                        const char *symbol_name, size_t len,
+                        m4_symbol *symbol M4_GNUC_UNUSED, void *userdata)
+{
+  produce_forget_dump ((FILE *) userdata, 'U', symbol_name, len);
+  return NULL;
+}
+
+/* Information passed from dump_map_CB to dump_map_entry_CB.  */
+typedef struct
+{
+  FILE *file;                   /* file to dump to */
+  const char *name;             /* name of map being dumped */
+  size_t len;                   /* length of name */
+} map_dump_data;
+
+/* Dump every entry of the map named MAP_NAME of length LEN.  USERDATA
+   is interpreted as the FILE* to dump to.  */
+static void *
+dump_map_CB (m4 *context, const char *map_name, size_t len, void *userdata)
+{
+  map_dump_data data;
+
+  data.file = (FILE *) userdata;
+  data.name = map_name;
+  data.len = len;
+  return m4_map_apply (context, map_name, len, dump_map_entry_CB, &data);
+}
+
+/* Like dump_map_CB, but skip the map MAP_NAME of length LEN if it did
+   not change since the base was reloaded.  */
+static void *
+dump_changed_map_CB (m4 *context, const char *map_name, size_t len,
+                     void *userdata)
+{
+  if (m4_map_generation (context, map_name, len) <= base->map_generation)
+    return NULL;
+  return dump_map_CB (context, map_name, len, userdata);
+}
+
+/* Dump one map entry, with KEY and VALUE.  USERDATA is the
+   map_dump_data built by dump_map_CB.  */
+static void *
+dump_map_entry_CB (m4 *context M4_GNUC_UNUSED, const m4_string *key,
+                   const m4_string *value, void *userdata)
+{
+  map_dump_data *data = (map_dump_data *) userdata;
+
+  xfprintf (data->file, "A%zu,%zu,%zu\n", data->len, key->len, value->len);
+  produce_mem_dump (data->file, data->name, data->len);
+  fputc ('\n', data->file);
+  produce_mem_dump (data->file, key->str, key->len);
+  fputc ('\n', data->file);
+  produce_mem_dump (data->file, value->str, value->len);
+  fputc ('\n', data->file);
+  return NULL;
+}
+
+/* Collect the name MAP_NAME of length LEN of a map present when the
+   base was reloaded.  */
+static void *
+base_map_CB (m4 *context M4_GNUC_UNUSED, const char *map_name, size_t len,
+             void *userdata M4_GNUC_UNUSED)
+{
+  if (base->map_count == base->map_size)
+    base->maps = (m4_string *) x2nrealloc (base->maps, &base->map_size,
+                                           sizeof *base->maps);
+  base->maps[base->map_count].str = xmemdup0 (map_name, len);
+  base->maps[base->map_count++].len = len;
+  return NULL;
+}
+
+/* Return true if the delimiters in PAIR1 and PAIR2 are the same.  */
+static bool
+string_pair_equal (const m4_string_pair *pair1, const m4_string_pair *pair2)
+{
+  return (pair1->len1 == pair2->len1 && pair1->len2 == pair2->len2
+          && memcmp (pair1->str1, pair2->str1, pair1->len1) == 0
+          && memcmp (pair1->str2, pair2->str2, pair1->len2) == 0);
+}
+
+/* Return a newly allocated absolute file name for NAME, which is
+   relative to the current directory unless it is already absolute.
+   If the current directory is unknown, return a copy of NAME.  */
+static char *
+absolute_file_name (const char *name)
+{
+  char *cwd;
+  char *result;
+
+  if (IS_ABSOLUTE_FILE_NAME (name))
+    return xstrdup (name);
+  cwd = m4_path_cwd ();
+  if (!cwd)
+    return xstrdup (name);
+  while (name[0] == '.' && ISSLASH (name[1]))
+    for (name += 2; ISSLASH (*name); name++)
+      ;
+  result = file_name_concat (cwd, name, NULL);
+  free (cwd);
+  return result;
+}
+
+/* Record the current state as the base NAME, which was just reloaded,
+   so that produce_frozen_state only writes what changes from now on.
+   The base is named by the absolute file name it was found at, so
+   that a layer can be reloaded from any directory.  */
+void
+set_frozen_base (m4 *context, const char *name)
+{
+  const m4_string_pair *pair;
+  char *filepath;
+
+  if (base)
+    free_frozen_base ();
+  base = (frozen_base *) xzalloc (sizeof *base);
+  filepath = m4_path_search (context, name, NULL);
+  base->name = absolute_file_name (filepath ? filepath : name);
+  free (filepath);
+  base->generation = m4_symtab_mark (M4SYMTAB);
+  base->map_generation = m4_map_generation (context, NULL, 0);
+  m4_maps_apply (context, base_map_CB, NULL);
+  base->module = m4_module_next (context, NULL);
+  pair = m4_get_syntax_quotes (M4SYNTAX);
+  base->quote.str1 = xmemdup0 (pair->str1, pair->len1);
+  base->quote.len1 = pair->len1;
+  base->quote.str2 = xmemdup0 (pair->str2, pair->len2);
+  base->quote.len2 = pair->len2;
+  pair = m4_get_syntax_comments (M4SYNTAX);
+  base->comm.str1 = xmemdup0 (pair->str1, pair->len1);
+  base->comm.len1 = pair->len1;
+  base->comm.str2 = xmemdup0 (pair->str2, pair->len2);
+  base->comm.len2 = pair->len2;
+  base->regexp_syntax = m4_get_regexp_syntax_opt (context);
+  base->debug_level = m4_get_debug_level_opt (context);
+  memcpy (base->syntax, M4SYNTAX->table, sizeof base->syntax);
+}
+
+/* Forget the base recorded by set_frozen_base.  */
+static void
+free_frozen_base (void)
+{
+  size_t i;
+
+  for (i = 0; i < base->map_count; i++)
+    free (base->maps[i].str);
+  free (base->maps);
+  free (base->name);
+  free (base->quote.str1);
+  free (base->quote.str2);
+  free (base->comm.str1);
+  free (base->comm.str2);
+  DELETE (base);
+}
+
+/* Produce a frozen state to the given file NAME.  If a base was set
+   with set_frozen_base, only produce a layer holding the changes
+   since the base was reloaded.  */
 void
 produce_frozen_state (m4 *context, const char *name)
 {
   FILE *file = fopen (name, O_BINARY ? "wb" : "w");
   const char *str;
   const m4_string_pair *pair;
+  int debug_level;
+  size_t i;
 
   if (!file)
     {
@@ -288,9 +549,19 @@ produce_frozen_state (m4 *context, const char *name)
             PACKAGE, VERSION);
   fputs ("V2\n", file);
 
+  /* Name the base of a layer.  */
+  if (base)
+    {
+      size_t len = strlen (base->name);
+      xfprintf (file, "B%zu\n", len);
+      produce_mem_dump (file, base->name, len);
+      fputc ('\n', file);
+    }
+
   /* Dump quote delimiters.  */
   pair = m4_get_syntax_quotes (M4SYNTAX);
-  if (STRNEQ (pair->str1, DEF_LQUOTE) || STRNEQ (pair->str2, DEF_RQUOTE))
+  if (base ? !string_pair_equal (pair, &base->quote)
+      : STRNEQ (pair->str1, DEF_LQUOTE) || STRNEQ (pair->str2, DEF_RQUOTE))
     {
       xfprintf (file, "Q%zu,%zu\n", pair->len1, pair->len2);
       produce_mem_dump (file, pair->str1, pair->len1);
@@ -301,7 +572,8 @@ produce_frozen_state (m4 *context, const char *name)
 
   /* Dump comment delimiters.  */
   pair = m4_get_syntax_comments (M4SYNTAX);
-  if (STRNEQ (pair->str1, DEF_BCOMM) || STRNEQ (pair->str2, DEF_ECOMM))
+  if (base ? !string_pair_equal (pair, &base->comm)
+      : STRNEQ (pair->str1, DEF_BCOMM) || STRNEQ (pair->str2, DEF_ECOMM))
     {
       xfprintf (file, "C%zu,%zu\n", pair->len1, pair->len2);
       produce_mem_dump (file, pair->str1, pair->len1);
@@ -313,20 +585,56 @@ produce_frozen_state (m4 *context, const char *name)
   /* Dump regular expression syntax.  */
   produce_resyntax_dump (context, file);
 
-  /* Dump syntax table.  */
-  str = "I@WLBOD${}SA(),RE";
-  while (*str)
-    produce_syntax_dump (file, M4SYNTAX, *str++);
+  /* Dump syntax table.  A layer whose syntax differs from its base
+     dumps every category in full, since the default syntax does not
+     tell what to undo.  */
+  if (!base
+      || memcmp (base->syntax, M4SYNTAX->table, sizeof base->syntax) != 0)
+    {
+      str = "I@WLBOD${}SA(),RE";
+      while (*str)
+        produce_syntax_dump (file, M4SYNTAX, *str++, base != NULL);
+    }
 
   /* Dump debugmode state.  */
-  produce_debugmode_state (file, m4_get_debug_level_opt (context));
+  debug_level = m4_get_debug_level_opt (context);
+  if (!base)
+    produce_debugmode_state (file, debug_level, false);
+  else if (debug_level != base->debug_level)
+    {
+      if (debug_level)
+        produce_debugmode_state (file, debug_level, false);
+      else
+        produce_debugmode_state (file, base->debug_level, true);
+    }
 
-  /* Dump all loaded modules.  */
-  produce_module_dump (context, file, m4_module_next (context, NULL));
+  /* Dump all loaded modules, after opening any that were autoloaded,
+     since placeholders for their definitions cannot be frozen.  */
+  m4__module_autoload_all (context);
+  if (m4_module_next (context, NULL) != (base ? base->module : NULL))
+    produce_module_dump (context, file, m4_module_next (context, NULL),
+                         base ? base->module : NULL);
 
   /* Dump all symbols.  */
   produce_symbol_dump (context, file, M4SYMTAB);
 
+  /* Dump all maps.  A layer forgets the maps of its base that changed
+     since, then dumps them again in full along with any new map.  */
+  if (!base)
+    m4_maps_apply (context, dump_map_CB, file);
+  else if (m4_map_generation (context, NULL, 0) != base->map_generation)
+    {
+      for (i = 0; i < base->map_count; i++)
+        {
+          size_t generation = m4_map_generation (context, base->maps[i].str,
+                                                 base->maps[i].len);
+          if (!generation || base->map_generation < generation)
+            produce_forget_dump (file, 'a', base->maps[i].str,
+                                 base->maps[i].len);
+        }
+      m4_maps_apply (context, dump_changed_map_CB, file);
+    }
+
   /* Let diversions be issued from output.c module, its cleaner to have this
      piece of code there.  */
   m4_freeze_diversions (context, file);
@@ -337,6 +645,23 @@ produce_frozen_state (m4 *context, const char *name)
   if (close_stream (file) != 0)
     m4_error (context, EXIT_FAILURE, errno, NULL,
               _("unable to create frozen state"));
+  if (base)
+    free_frozen_base ();
+}
+
+/* Release the memory used to track frozen files, once no more will be
+   reloaded or produced.  */
+void
+frozen_state_exit (void)
+{
+  while (layers)
+    {
+      frozen_layer *next = layers->next;
+      free (layers);
+      layers = next;
+    }
+  if (base)
+    free_frozen_base ();
 }
 
 /* Issue a message saying that some character is an EXPECTED character. */
@@ -443,8 +768,33 @@ decode_char (m4 *context, FILE *in, bool *advance_line)
 }
 
 
+/* Remember the frozen file open on FILE as reloaded, and return true,
+   unless it was already reloaded before, in which case return
+   false.  */
+static bool
+record_layer (m4 *context, FILE *file)
+{
+  struct stat st;
+  frozen_layer *layer;
+
+  if (fstat (fileno (file), &st) < 0)
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot stat frozen file"));
+  for (layer = layers; layer; layer = layer->next)
+    if (layer->dev == st.st_dev && layer->ino == st.st_ino)
+      return false;
+  layer = (frozen_layer *) xmalloc (sizeof *layer);
+  layer->dev = st.st_dev;
+  layer->ino = st.st_ino;
+  layer->next = layers;
+  layers = layer;
+  return true;
+}
+
 /*  Reload state from the given file NAME.  We are seeking speed,
-    here.  */
+    here.  A frozen file that was already reloaded is skipped, and a
+    layer reloads its base first unless that was already done, so
+    each file applies once however often it is named.  */
 
 void
 reload_frozen_state (m4 *context, const char *name)
@@ -459,6 +809,7 @@ reload_frozen_state (m4 *context, const char *name)
   size_t allocated[3];
   int number[3] = {0};
   bool advance_line = true;
+  bool first = true;
 
 #define GET_CHARACTER                                                   \
   do                                                                    \
@@ -571,6 +922,12 @@ reload_frozen_state (m4 *context, const char *name)
   if (file == NULL)
     m4_error (context, EXIT_FAILURE, errno, NULL, _("cannot open %s"),
               quotearg_style (locale_quoting_style, name));
+  free (filepath);
+  if (!record_layer (context, file))
+    {
+      fclose (file);
+      return;
+    }
   m4_set_current_file (context, name);
 
   allocated[0] = 100;
@@ -621,6 +978,103 @@ reload_frozen_state (m4 *context, const char *name)
                     _("ill-formed frozen file, unknown directive %c"),
                     character);
 
+        case 'a':
+        case 'U':
+          /* Forget a map, or a symbol along with its trace bit.  */
+          operation = character;
+          if (version < 2)
+            {
+              /* 'a' and 'U' operators are not supported in format
+                 version 1. */
+              m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, version 2 directive `%c' encountered"), operation);
+            }
+
+          GET_CHARACTER;
+          GET_NUMBER (number[0], false);
+          VALIDATE ('\n');
+          GET_STRING (file, string[0], allocated[0], number[0], false);
+          VALIDATE ('\n');
+
+          if (operation == 'a')
+            m4_map_clear (context, string[0], number[0]);
+          else
+            {
+              m4_symbol_delete (M4SYMTAB, string[0], number[0]);
+              m4_set_symbol_name_traced (M4SYMTAB, string[0], number[0],
+                                         false);
+            }
+          break;
+
+        case 'A':
+          /* Set a map entry.  */
+          if (version < 2)
+            {
+              /* 'A' operator is not supported in format version 1. */
+              m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, version 2 directive `%c' encountered"), 'A');
+            }
+
+          GET_CHARACTER;
+          GET_NUMBER (number[0], false);
+          VALIDATE (',');
+          GET_CHARACTER;
+          GET_NUMBER (number[1], false);
+          VALIDATE (',');
+          GET_CHARACTER;
+          GET_NUMBER (number[2], false);
+          VALIDATE ('\n');
+
+          GET_STRING (file, string[0], allocated[0], number[0], false);
+          VALIDATE ('\n');
+          GET_CHARACTER;
+          GET_STRING (file, string[1], allocated[1], number[1], true);
+          VALIDATE ('\n');
+          GET_CHARACTER;
+          GET_STRING (file, string[2], allocated[2], number[2], true);
+          VALIDATE ('\n');
+
+          m4_map_set (context, string[0], number[0], string[1], number[1],
+                      string[2], number[2]);
+          break;
+
+        case 'B':
+          /* Reload the base of this layer, then drop its diversions,
+             since the layer holds all of the diverted text.  */
+          if (version < 2)
+            {
+              /* 'B' operator is not supported in format version 1. */
+              m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, version 2 directive `%c' encountered"), 'B');
+            }
+          if (!first)
+            m4_error (context, EXIT_FAILURE, 0, NULL,
+                      _("ill-formed frozen file, misplaced directive `%c'"),
+                      'B');
+
+          GET_CHARACTER;
+          GET_NUMBER (number[0], false);
+          VALIDATE ('\n');
+          GET_STRING (file, string[0], allocated[0], number[0], false);
+          VALIDATE ('\n');
+
+          if (strlen (string[0]) < number[0])
+            m4_error (context, EXIT_FAILURE, 0, NULL, _("\
+ill-formed frozen file, invalid base %s encountered"),
+                      quotearg_style_mem (locale_quoting_style,
+                                          string[0], number[0]));
+          {
+            int line = m4_get_current_line (context);
+
+            reload_frozen_state (context, string[0]);
+            m4_set_current_file (context, name);
+            m4_set_current_line (context, line);
+          }
+          m4_make_diversion (context, -1);
+          m4_undivert_all (context);
+          m4_make_diversion (context, 0);
+          break;
+
         case 'd':
           /* Set debugmode flags.  */
           if (version < 2)
@@ -979,6 +1433,7 @@ ill-formed frozen file, invalid module %s encountered"),
           break;
 
         }
+      first = false;
       GET_DIRECTIVE;
     }
 
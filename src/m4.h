@@ -27,17 +27,18 @@
 
 #include "gettext.h"
 
-/* Error handling.  */
-#ifdef USE_STACKOVF
-void setup_stackovf_trap (char *const *, char *const *,
-                          void (*handler) (void));
-void stackovf_exit (void);
-#endif
-
 
 /* File: freeze.c --- frozen state files.  */
 
 void produce_frozen_state (m4 *context, const char *);
 void reload_frozen_state  (m4 *context, const char *);
+void set_frozen_base      (m4 *context, const char *);
+void frozen_state_exit    (void);
+
+
+/* File: static-modules.c --- generated from the modules linked into
+   m4 by `configure --enable-static-modules'.  */
+
+extern const m4_static_module preloaded_modules[];
 
 #endif /* M4_H */
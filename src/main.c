@@ -27,11 +27,14 @@
 
 #include "closein.h"
 #include "configmake.h"
+#include "dirname.h"
 #include "getopt.h"
 #include "propername.h"
 #include "quotearg.h"
 #include "version-etc.h"
+#include "xstrndup.h"
 #include "xstrtol.h"
+#include "xvasprintf.h"
 
 #define AUTHORS                                                 \
   proper_name_utf8 ("Rene' Seindal", "Ren\xc3\xa9 Seindal"),    \
@@ -45,24 +48,51 @@ typedef struct deferred
   const char *value;
 } deferred;
 
-
-/* Error handling functions.  */
+/* Make dependency output, as requested by -M and friends.  */
+typedef struct dependency_info
+{
+  m4 *context;                  /* context to query, or NULL when done */
+  const char *file;             /* -MF file, or NULL */
+  const char **targets;         /* -MT targets */
+  size_t target_count;          /* number of -MT targets */
+  const char *first_input;      /* first command line file, or NULL */
+  char *target;                 /* default target, when malloc'd */
+  char *default_file;           /* default -MF file, when malloc'd */
+  FILE *fp;                     /* stream being written */
+  size_t column;                /* current column in fp */
+  bool only;                    /* true for -M, false for -MD */
+  bool phony;                   /* true for -MP */
+} dependency_info;
+
+/* Wrap dependency lines longer than this.  */
+#define DEPENDENCY_LINE_WIDTH 75
+
+static dependency_info dependencies;
+
+/* Sampling profile output, as requested by --sample-profile.  */
+typedef struct profile_info
+{
+  m4 *context;                  /* context being profiled, or NULL */
+  const char *file;             /* --profile-file file, or NULL */
+  unsigned int hz;              /* samples per second, or 0 */
+} profile_info;
 
-#ifdef USE_STACKOVF
+/* Highest sampling rate accepted by --sample-profile.  */
+#define PROFILE_MAX_HZ 1000000
 
-/* Tell user stack overflowed and abort.  */
-static void
-stackovf_handler (void)
-{
-  /* FIXME - calling gettext and error inside a signal handler is dangerous,
-     since these functions invoke functions that are not signal-safe.  We
-     are sort of justified by the fact that we will exit and never return,
-     but this should really be fixed.  */
-  error (EXIT_FAILURE, 0, _("stack overflow (infinite define recursion?)"));
-}
+static profile_info profile;
 
-#endif /* USE_STACKOVF */
+/* Diversions to write to files at exit, as requested by
+   --undivert-file.  */
+typedef struct undivert_file
+{
+  int divnum;                   /* diversion to write */
+  const char *file;             /* file to write it to */
+} undivert_file;
 
+static undivert_file *undivert_files;
+static size_t undivert_files_count;
+static size_t undivert_files_size;
 
 
 /* Print a usage message and exit with STATUS.  */
@@ -92,13 +122,19 @@ Operation modes:\n\
       fputs (_("\
   -b, --batch                  buffer output, process interrupts\n\
   -c, --discard-comments       do not copy comments to the output\n\
+      --cache-dir=DIR          replay the output of an identical earlier\n\
+                                 run saved in DIR, or save this run there\n\
   -E, --fatal-warnings         once: warnings become errors, twice: stop\n\
                                  execution at first error\n\
+      --esyscmd-cache=DIR      reuse the output of esyscmd commands saved\n\
+                                 in DIR by earlier runs\n\
   -i, --interactive            unbuffer output, ignore interrupts\n\
   -P, --prefix-builtins        force a `m4_' prefix to all builtins\n\
   -Q, --quiet, --silent        suppress some warnings for builtins\n\
   -r, --regexp-syntax[=SPEC]   set default regexp syntax to SPEC [GNU_M4]\n\
       --safer                  disable potentially unsafe builtins\n\
+      --undivert-file=N=FILE   write diversion N to FILE at exit, rather\n\
+                                 than to standard output\n\
   -W, --warnings               enable all warnings\n\
 "), stdout);
       puts ("");
@@ -111,6 +147,7 @@ SPEC is any one of:\n\
       fputs (_("\
 Preprocessor features:\n\
   -B, --prepend-include=DIR    add DIR to include path before `.'\n\
+      --cache-includes         keep included files in memory for reuse\n\
   -D, --define=NAME[=VALUE]    define NAME as having VALUE, or empty\n\
       --import-environment     import all environment variables as macros\n\
   -I, --include=DIR            add DIR to include path after `.'\n\
@@ -128,13 +165,31 @@ Preprocessor features:\n\
 Limits control:\n\
   -g, --gnu                    override -G to re-enable GNU extensions\n\
   -G, --traditional, --posix   suppress all GNU extensions\n\
-  -L, --nesting-limit=NUMBER   change artificial nesting limit [1024]\n\
+  -L, --nesting-limit=NUMBER   change artificial nesting limit [0]\n\
+      --inline-threshold=NUMBER\n\
+                               copy macro arguments of up to NUMBER bytes\n\
+                                 when rescanning, rather than referring\n\
+                                 to them (0 adapts to the input) [0]\n\
 "), stdout);
       puts ("");
       fputs (_("\
 Frozen state files:\n\
   -F, --freeze-state=FILE      produce a frozen state on FILE at end\n\
-  -R, --reload-state=FILE      reload a frozen state from FILE at start\n\
+  -R, --reload-state=FILE      reload a frozen state from FILE at start;\n\
+                                 may be repeated to stack layers\n\
+      --freeze-base=FILE       reload FILE like -R, and make -F produce\n\
+                                 only a layer of changes on top of FILE\n\
+"), stdout);
+      puts ("");
+      fputs (_("\
+Dependency tracking:\n\
+  -M                           output a make rule instead of normal output\n\
+  -MD                          output a make rule as well, by default to the\n\
+                                 first FILE with its suffix changed to `.d'\n\
+  -MF FILE                     write the make rule to FILE\n\
+  -MP                          add a phony target for each dependency\n\
+  -MT TARGET                   set the target of the rule [first FILE\n\
+                                 without its suffix]\n\
 "), stdout);
       puts ("");
       fputs (_("\
@@ -147,11 +202,17 @@ Debugging:\n\
   -t, --trace=NAME, --traceon=NAME\n\
                                trace NAME when it is defined\n\
       --traceoff=NAME          no longer trace NAME\n\
+      --trace-format=FORMAT    write trace output as FORMAT, either `text'\n\
+                                 or `binary' for m4-trace-dump [text]\n\
+      --sample-profile=HZ      sample the stack of macro calls HZ times per\n\
+                                 second of CPU time, for a profile at exit\n\
+      --profile-file=FILE      write the profile to FILE [stderr]\n\
 "), stdout);
       puts ("");
       fputs (_("\
 FLAGS is any of:\n\
   a   show actual arguments in trace\n\
+  b   show the stack of macro calls after errors and warnings\n\
   c   show collection line in trace\n\
   d   warn when dereferencing undefined macros (default on unless -E)\n\
   e   show expansion in trace\n\
@@ -162,7 +223,7 @@ FLAGS is any of:\n\
       fputs (_("\
   m   show module information in trace, debug, and dumpdef\n\
   o   output dumpdef to stderr rather than debug file\n\
-  p   show results of path searches in debug\n\
+  p   show results of path searches and caches in debug\n\
   q   quote values in dumpdef and trace, useful with a or e\n\
   s   show full stack of pushdef values in dumpdef\n\
   t   trace all macro calls, regardless of per-macro traceon state\n\
@@ -191,15 +252,24 @@ mismatch, or whatever value was passed to the m4exit macro.\n\
 enum
 {
   ARGLENGTH_OPTION = CHAR_MAX + 1,      /* not quite -l, because of message */
+  CACHE_DIR_OPTION,                     /* no short opt */
+  CACHE_INCLUDES_OPTION,                /* no short opt */
   DEBUGFILE_OPTION,                     /* no short opt */
   ERROR_OUTPUT_OPTION,                  /* not quite -o, because of message */
+  ESYSCMD_CACHE_OPTION,                 /* no short opt */
+  FREEZE_BASE_OPTION,                   /* no short opt */
   HASHSIZE_OPTION,                      /* not quite -H, because of message */
   IMPORT_ENVIRONMENT_OPTION,            /* no short opt */
+  INLINE_THRESHOLD_OPTION,              /* no short opt */
   POPDEF_OPTION,                        /* no short opt */
   PREPEND_INCLUDE_OPTION,               /* not quite -B, because of message */
+  PROFILE_FILE_OPTION,                  /* no short opt */
   SAFER_OPTION,                         /* -S still has old no-op semantics */
+  SAMPLE_PROFILE_OPTION,                /* no short opt */
   SYNCOUTPUT_OPTION,                    /* not quite -s, because of opt arg */
+  TRACE_FORMAT_OPTION,                  /* no short opt */
   TRACEOFF_OPTION,                      /* no short opt */
+  UNDIVERT_FILE_OPTION,                 /* no short opt */
   WORD_REGEXP_OPTION,                   /* deprecated, used to be -W */
 
   HELP_OPTION,                          /* no short opt */
@@ -236,15 +306,24 @@ static const struct option long_options[] =
   {"warnings", no_argument, NULL, 'W'},
 
   {"arglength", required_argument, NULL, ARGLENGTH_OPTION},
+  {"cache-dir", required_argument, NULL, CACHE_DIR_OPTION},
+  {"cache-includes", no_argument, NULL, CACHE_INCLUDES_OPTION},
   {"debugfile", optional_argument, NULL, DEBUGFILE_OPTION},
   {"hashsize", required_argument, NULL, HASHSIZE_OPTION},
   {"error-output", required_argument, NULL, ERROR_OUTPUT_OPTION},
+  {"esyscmd-cache", required_argument, NULL, ESYSCMD_CACHE_OPTION},
+  {"freeze-base", required_argument, NULL, FREEZE_BASE_OPTION},
   {"import-environment", no_argument, NULL, IMPORT_ENVIRONMENT_OPTION},
+  {"inline-threshold", required_argument, NULL, INLINE_THRESHOLD_OPTION},
   {"popdef", required_argument, NULL, POPDEF_OPTION},
   {"prepend-include", required_argument, NULL, PREPEND_INCLUDE_OPTION},
+  {"profile-file", required_argument, NULL, PROFILE_FILE_OPTION},
   {"safer", no_argument, NULL, SAFER_OPTION},
+  {"sample-profile", required_argument, NULL, SAMPLE_PROFILE_OPTION},
   {"syncoutput", optional_argument, NULL, SYNCOUTPUT_OPTION},
+  {"trace-format", required_argument, NULL, TRACE_FORMAT_OPTION},
   {"traceoff", required_argument, NULL, TRACEOFF_OPTION},
+  {"undivert-file", required_argument, NULL, UNDIVERT_FILE_OPTION},
   {"word-regexp", required_argument, NULL, WORD_REGEXP_OPTION},
 
   {"help", no_argument, NULL, HELP_OPTION},
@@ -258,7 +337,7 @@ static const struct option long_options[] =
    behavior also handles -s between files.  Starting OPTSTRING with
    '-' forces getopt_long to hand back file names as arguments to opt
    '\1', rather than reordering the command line.  */
-#define OPTSTRING "-B:D:EF:GH:I:L:PQR:S:T:U:Wbcd::egil:o:p:r::st:"
+#define OPTSTRING "-B:D:EF:GH:I:L:M::PQR:S:T:U:Wbcd::egil:o:p:r::st:"
 
 /* For determining whether to be interactive.  */
 enum interactive_choice
@@ -282,6 +361,229 @@ size_opt (char const *opt, int oi, int optchar)
   return size;
 }
 
+/* Write NAME to the dependency rule being output, preceded by a
+   space or a line continuation as needed.  If ESCAPE, protect
+   characters special to make.  */
+static void
+dependency_write (dependency_info *info, const char *name, bool escape)
+{
+  size_t len = strlen (name);
+
+  if (info->column && info->column + len + 1 > DEPENDENCY_LINE_WIDTH)
+    {
+      fputs (" \\\n ", info->fp);
+      info->column = 1;
+    }
+  else if (info->column)
+    {
+      putc (' ', info->fp);
+      info->column++;
+    }
+  info->column += len;
+  if (!escape)
+    {
+      fputs (name, info->fp);
+      return;
+    }
+  for ( ; *name; name++)
+    {
+      if (*name == ' ' || *name == '\t' || *name == '#')
+        putc ('\\', info->fp);
+      else if (*name == '$')
+        putc ('$', info->fp);
+      putc (*name, info->fp);
+    }
+}
+
+/* Callback to add one dependency FILE to the rule.  */
+static void *
+dependency_write_CB (m4 *context M4_GNUC_UNUSED, const char *file,
+                     void *userdata)
+{
+  dependency_write ((dependency_info *) userdata, file, true);
+  return NULL;
+}
+
+/* Callback to output an empty rule for FILE, for -MP.  */
+static void *
+dependency_phony_CB (m4 *context M4_GNUC_UNUSED, const char *file,
+                     void *userdata)
+{
+  dependency_info *info = (dependency_info *) userdata;
+
+  putc ('\n', info->fp);
+  info->column = 0;
+  dependency_write (info, file, true);
+  fputs (":\n", info->fp);
+  return NULL;
+}
+
+/* Output the make rule requested by -M or -MD, naming every file read
+   so far, once the run is COMPLETE.  Like gcc, write no rule for a
+   run that failed, and remove any stale -MF file instead; but a
+   status requested by m4exit is not a failure of the run.  */
+static void
+dependency_finish (bool complete)
+{
+  dependency_info *info = &dependencies;
+  m4 *context = info->context;
+  size_t i;
+
+  if (!context)
+    return;
+  info->context = NULL;
+
+  if (!m4_get_exit_requested (context)
+      && (!complete || m4_get_exit_status (context)))
+    {
+      if (info->fp)
+        fclose (info->fp);
+      info->fp = NULL;
+      if (info->file && unlink (info->file) != 0 && errno != ENOENT)
+        m4_error (context, 0, errno, NULL,
+                  _("cannot remove dependency file %s"),
+                  quotearg_style (locale_quoting_style, info->file));
+    }
+  else if (info->file)
+    {
+      info->fp = fopen (info->file, "w");
+      if (!info->fp)
+        m4_error (context, 0, errno, NULL,
+                  _("cannot open dependency file %s"),
+                  quotearg_style (locale_quoting_style, info->file));
+    }
+
+  if (info->fp)
+    {
+      info->column = 0;
+      for (i = 0; i < info->target_count; i++)
+        dependency_write (info, info->targets[i], false);
+      putc (':', info->fp);
+      info->column++;
+      m4_dependencies_apply (context, dependency_write_CB, info);
+      putc ('\n', info->fp);
+      if (info->phony)
+        m4_dependencies_apply (context, dependency_phony_CB, info);
+
+      if (ferror (info->fp) | (fclose (info->fp) != 0))
+        m4_error (context, 0, errno, NULL,
+                  _("error writing dependency file %s"),
+                  quotearg_style (locale_quoting_style,
+                                  info->file ? info->file : _("stdout")));
+    }
+
+  free (info->target);
+  free (info->default_file);
+  free (info->targets);
+}
+
+/* Registered with atexit, so that m4exit still produces a rule when
+   it ends the run early, while a fatal error does not.  */
+static void
+dependency_exit (void)
+{
+  dependency_finish (false);
+}
+
+/* Complete the dependency settings once all options are known, using
+   CONTEXT to record dependencies.  The default target is the first
+   input file without its suffix, and -MD writes to that name plus
+   `.d' unless -MF was given.  */
+static void
+dependency_init (m4 *context)
+{
+  dependency_info *info = &dependencies;
+  const char *stem = info->first_input;
+
+  if (stem && STREQ (stem, "-"))
+    stem = NULL;
+  else if (stem)
+    {
+      const char *base = last_component (stem);
+      const char *dot = strrchr (base, '.');
+
+      if (dot && dot != base)
+        stem = info->target = xstrndup (stem, dot - stem);
+    }
+
+  if (!info->target_count)
+    {
+      if (!info->target)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("cannot determine dependency target, use -MT"));
+      info->targets[info->target_count++] = info->target;
+    }
+
+  if (!info->file && !info->only)
+    {
+      if (!stem)
+        m4_error (context, EXIT_FAILURE, 0, NULL,
+                  _("cannot determine dependency file, use -MF"));
+      info->file = info->default_file = xasprintf ("%s.d", stem);
+    }
+
+  if (info->only)
+    {
+      /* The rule takes the place of normal output.  */
+      if (!info->file)
+        {
+          int fd = dup (STDOUT_FILENO);
+          info->fp = fd < 0 ? NULL : fdopen (fd, "w");
+        }
+      if ((!info->file && !info->fp)
+          || !freopen ("/dev/null", "w", stdout))
+        m4_error (context, EXIT_FAILURE, errno, NULL,
+                  _("cannot redirect output for -M"));
+    }
+
+  m4_set_track_dependencies_opt (context, true);
+  info->context = context;
+  atexit (dependency_exit);
+}
+
+/* Write the profile collected for --sample-profile.  This is
+   registered with atexit, so that a profile is still produced when
+   m4exit ends the run early.  */
+static void
+profile_finish (void)
+{
+  profile_info *info = &profile;
+  m4 *context = info->context;
+  FILE *fp = stderr;
+
+  if (!context)
+    return;
+  info->context = NULL;
+
+  if (info->file)
+    {
+      fp = fopen (info->file, "w");
+      if (!fp)
+        {
+          m4_error (context, 0, errno, NULL,
+                    _("cannot open profile file %s"),
+                    quotearg_style (locale_quoting_style, info->file));
+          return;
+        }
+    }
+  m4_profile_dump (context, fp);
+  if (info->file ? ferror (fp) | (fclose (fp) != 0) : ferror (fp))
+    m4_error (context, 0, errno, NULL, _("error writing profile file %s"),
+              quotearg_style (locale_quoting_style,
+                              info->file ? info->file : _("stderr")));
+}
+
+/* Make this run uncacheable for --cache-dir, because of OPTION.  */
+static void
+run_cache_forbid (m4 *context, const char *option)
+{
+  m4_call_info info = {0};
+
+  info.name = option;
+  info.name_len = strlen (option);
+  m4_run_cache_forbid (context, &info);
+}
+
 /* Process a command line file NAME.  */
 static bool
 process_file (m4 *context, const char *name)
@@ -312,9 +614,14 @@ main (int argc, char *const *argv, char *const *envp)
   size_t size;                  /* for parsing numeric option arguments */
 
   bool import_environment = false; /* true to import environment */
+  bool track_dependencies = false; /* true for -MD */
   bool seen_file = false;
+  const char *cache_dir = NULL;
   const char *debugfile = NULL;
-  const char *frozen_file_to_read = NULL;
+  const char *esyscmd_cache = NULL;
+  const char **frozen_files_to_read = NULL;
+  size_t frozen_file_count = 0;
+  size_t frozen_base = SIZE_MAX; /* index of --freeze-base, if any */
   const char *frozen_file_to_write = NULL;
   enum interactive_choice interactive = INTERACTIVE_UNKNOWN;
 
@@ -332,10 +639,7 @@ main (int argc, char *const *argv, char *const *envp)
 #endif
 
   context = m4_create ();
-
-#ifdef USE_STACKOVF
-  setup_stackovf_trap (argv, envp, stackovf_handler);
-#endif
+  m4_module_preload (context, preloaded_modules);
 
   if (getenv ("POSIXLY_CORRECT"))
     {
@@ -412,6 +716,8 @@ main (int argc, char *const *argv, char *const *envp)
 
         case '\1':
           seen_file = true;
+          if (!dependencies.first_input)
+            dependencies.first_input = optarg;
           goto defer;
 
         case 'B':
@@ -467,8 +773,52 @@ main (int argc, char *const *argv, char *const *envp)
           m4_set_suppress_warnings_opt (context, true);
           break;
 
+        case 'M':
+          /* Mimic the gcc spellings -M, -MD, -MF FILE, -MP and
+             -MT TARGET, where FILE and TARGET may also be attached.  */
+          if (!dependencies.targets)
+            dependencies.targets = (const char **) xnmalloc (argc,
+                                                              sizeof (char *));
+          if (!optarg)
+            dependencies.only = true;
+          else if (STREQ (optarg, "D"))
+            track_dependencies = true;
+          else if (STREQ (optarg, "P"))
+            dependencies.phony = true;
+          else if (*optarg == 'F' || *optarg == 'T')
+            {
+              const char *arg = optarg + 1;
+
+              if (!*arg)
+                {
+                  if (optind == argc)
+                    {
+                      error (0, 0, _("option requires an argument -- '%s'"),
+                             optarg[0] == 'F' ? "MF" : "MT");
+                      usage (EXIT_FAILURE);
+                    }
+                  arg = argv[optind++];
+                }
+              if (*optarg == 'F')
+                dependencies.file = arg;
+              else
+                dependencies.targets[dependencies.target_count++] = arg;
+            }
+          else
+            {
+              error (0, 0, _("invalid option -- '%s'"), optarg - 1);
+              usage (EXIT_FAILURE);
+            }
+          break;
+
         case 'R':
-          frozen_file_to_read = optarg;
+        case FREEZE_BASE_OPTION:
+          if (!frozen_files_to_read)
+            frozen_files_to_read = (const char **) xnmalloc (argc,
+                                                             sizeof (char *));
+          if (optchar == FREEZE_BASE_OPTION)
+            frozen_base = frozen_file_count;
+          frozen_files_to_read[frozen_file_count++] = optarg;
           break;
 
         case 'W':
@@ -490,7 +840,7 @@ main (int argc, char *const *argv, char *const *envp)
           /* Staggered handling of 'd', since -dm is useful prior to
              first file and prior to reloading, but other -d must also
              have effect between files.  */
-          if (seen_file || frozen_file_to_read)
+          if (seen_file || frozen_file_count)
             goto defer;
           if (m4_debug_decode (context, optarg, SIZE_MAX) < 0)
             error (0, 0, _("bad debug flags: %s"),
@@ -524,7 +874,7 @@ main (int argc, char *const *argv, char *const *envp)
           /* Staggered handling of '--debugfile', since it is useful
              prior to first file and prior to reloading, but other
              uses must also have effect between files.  */
-          if (seen_file || frozen_file_to_read)
+          if (seen_file || frozen_file_count)
             goto defer;
           debugfile = optarg;
           break;
@@ -542,14 +892,75 @@ main (int argc, char *const *argv, char *const *envp)
           debugfile = optarg;
           break;
 
+        case CACHE_DIR_OPTION:
+          cache_dir = optarg;
+          break;
+
+        case CACHE_INCLUDES_OPTION:
+          m4_set_cache_includes_opt (context, true);
+          break;
+
+        case ESYSCMD_CACHE_OPTION:
+          esyscmd_cache = optarg;
+          break;
+
         case IMPORT_ENVIRONMENT_OPTION:
           import_environment = true;
           break;
 
+        case INLINE_THRESHOLD_OPTION:
+          m4_set_inline_threshold_opt (context, size_opt (optarg, oi,
+                                                          optchar));
+          break;
+
         case SAFER_OPTION:
           m4_set_safer_opt (context, true);
           break;
 
+        case SAMPLE_PROFILE_OPTION:
+          size = size_opt (optarg, oi, optchar);
+          if (size < 1 || PROFILE_MAX_HZ < size)
+            m4_error (context, EXIT_FAILURE, 0, NULL,
+                      _("invalid sampling rate: %s"),
+                      quotearg_style (locale_quoting_style, optarg));
+          profile.hz = size;
+          break;
+
+        case PROFILE_FILE_OPTION:
+          profile.file = optarg;
+          break;
+
+        case TRACE_FORMAT_OPTION:
+          if (STREQ (optarg, "text"))
+            m4_set_trace_binary_opt (context, false);
+          else if (STREQ (optarg, "binary"))
+            m4_set_trace_binary_opt (context, true);
+          else
+            m4_error (context, EXIT_FAILURE, 0, NULL,
+                      _("invalid trace format: %s"),
+                      quotearg_style (locale_quoting_style, optarg));
+          break;
+
+        case UNDIVERT_FILE_OPTION:
+          {
+            const char *file = strchr (optarg, '=');
+            char *end;
+            long int divnum = strtol (optarg, &end, 10);
+            if (!file || end != file || end == optarg
+                || !isdigit (to_uchar (*optarg)) || divnum <= 0
+                || INT_MAX < divnum || !file[1])
+              m4_error (context, EXIT_FAILURE, 0, NULL,
+                        _("invalid diversion file: %s"),
+                        quotearg_style (locale_quoting_style, optarg));
+            if (undivert_files_count == undivert_files_size)
+              undivert_files = (undivert_file *)
+                x2nrealloc (undivert_files, &undivert_files_size,
+                            sizeof *undivert_files);
+            undivert_files[undivert_files_count].divnum = divnum;
+            undivert_files[undivert_files_count++].file = file + 1;
+          }
+          break;
+
         case VERSION_OPTION:
           version_etc (stdout, PACKAGE, PACKAGE_NAME, VERSION, AUTHORS, NULL);
           exit (EXIT_SUCCESS);
@@ -562,21 +973,87 @@ main (int argc, char *const *argv, char *const *envp)
     }
 
   /* Do the basic initializations.  */
+  if (dependencies.only || track_dependencies)
+    {
+      if (!dependencies.first_input && optind < argc)
+        dependencies.first_input = argv[optind];
+      dependency_init (context);
+    }
   if (debugfile && !m4_debug_set_output (context, NULL, debugfile))
     m4_error (context, 0, errno, NULL, _("cannot set debug file %s"),
               quotearg_style (locale_quoting_style, debugfile));
+  if (esyscmd_cache && !m4_syscmd_cache_open (context, esyscmd_cache))
+    m4_error (context, EXIT_FAILURE, errno, NULL,
+              _("cannot use esyscmd cache directory %s"),
+              quotearg_style (locale_quoting_style, esyscmd_cache));
+  if (cache_dir)
+    {
+      int i;
+
+      if (!m4_run_cache_open (context, cache_dir, argc, argv,
+                              import_environment ? envp : NULL))
+        m4_error (context, EXIT_FAILURE, errno, NULL,
+                  _("cannot use cache directory %s"),
+                  quotearg_style (locale_quoting_style, cache_dir));
+
+      /* Only output can be replayed; options with other effects, and
+         input that cannot be checked again, rule out the cache.  */
+      if (frozen_file_to_write)
+        run_cache_forbid (context, "--freeze-state");
+      if (dependencies.only || track_dependencies)
+        run_cache_forbid (context, "-M");
+      if (undivert_files_count)
+        run_cache_forbid (context, "--undivert-file");
+      if (profile.hz)
+        run_cache_forbid (context, "--sample-profile");
+      if (interactive == INTERACTIVE_YES)
+        run_cache_forbid (context, "--interactive");
+      if (debugfile && *debugfile)
+        run_cache_forbid (context, "--debugfile");
+      for (defn = head; defn; defn = defn->next)
+        if (defn->code == DEBUGFILE_OPTION && defn->value && *defn->value)
+          run_cache_forbid (context, "--debugfile");
+        else if (defn->code == '\1' && STREQ (defn->value, "-"))
+          run_cache_forbid (context, _("stdin"));
+      for (i = optind; i < argc; i++)
+        if (STREQ (argv[i], "-"))
+          run_cache_forbid (context, _("stdin"));
+      if (optind == argc && !seen_file)
+        run_cache_forbid (context, _("stdin"));
+
+      if (m4_run_cache_replay (context, &exit_status))
+        exit (exit_status);
+    }
+  if (profile.hz)
+    {
+      if (!m4_profile_start (context, profile.hz))
+        m4_error (context, EXIT_FAILURE, errno, NULL,
+                  _("cannot start profiler"));
+      profile.context = context;
+      atexit (profile_finish);
+    }
   m4_input_init (context);
   m4_output_init (context);
 
-  if (frozen_file_to_read)
-    reload_frozen_state (context, frozen_file_to_read);
+  if (frozen_file_count)
+    {
+      size_t i;
+
+      for (i = 0; i < frozen_file_count; i++)
+        {
+          reload_frozen_state (context, frozen_files_to_read[i]);
+          if (i == frozen_base && frozen_file_to_write)
+            set_frozen_base (context, frozen_files_to_read[i]);
+        }
+      free (frozen_files_to_read);
+    }
   else
     {
       m4_module_load (context, "m4", NULL);
       if (m4_get_posixly_correct_opt (context))
-        m4_module_load (context, "traditional", NULL);
+        m4_module_autoload (context, "traditional", NULL);
       else
-        m4_module_load (context, "gnu", NULL);
+        m4_module_autoload (context, "gnu", NULL);
     }
 
   /* Import environment variables as macros.  The definition are
@@ -730,9 +1207,20 @@ main (int argc, char *const *argv, char *const *envp)
     produce_frozen_state (context, frozen_file_to_write);
   else
     {
+      size_t i;
+
       m4_make_diversion (context, 0);
+      for (i = 0; i < undivert_files_count; i++)
+        if (!m4_write_diversion (context, undivert_files[i].divnum,
+                                 undivert_files[i].file))
+          m4_error (context, 0, errno, NULL,
+                    _("cannot write diversion %d to %s"),
+                    undivert_files[i].divnum,
+                    quotearg_style (locale_quoting_style,
+                                    undivert_files[i].file));
       m4_undivert_all (context);
     }
+  free (undivert_files);
 
   /* The remaining cleanup functions systematically free all of the
      memory we still have pointers to.  By definition, if there is
@@ -742,6 +1230,9 @@ main (int argc, char *const *argv, char *const *envp)
 
   m4_output_exit ();
   m4_input_exit ();
+  frozen_state_exit ();
+  dependency_finish (true);
+  profile_finish ();
 
   /* Change debug stream back to stderr, to force flushing the debug
      stream and detect any errors it might have encountered.  The
@@ -749,14 +1240,11 @@ main (int argc, char *const *argv, char *const *envp)
   m4_debug_set_output (context, NULL, NULL);
 
   exit_status = m4_get_exit_status (context);
+  m4_run_cache_finish (context, exit_status);
   m4_delete (context);
 
   m4_hash_exit ();
   quotearg_free ();
 
-#ifdef USE_STACKOVF
-  stackovf_exit ();
-#endif
-
   exit (exit_status);
 }
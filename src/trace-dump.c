@@ -0,0 +1,534 @@
+/* GNU m4 -- A simple macro processor
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of GNU M4.
+
+   GNU M4 is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU M4 is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* m4-trace-dump reads the binary trace written by
+   `m4 --trace-format=binary', and prints it in the text form that m4
+   would have written without that option.  m4 only records the raw
+   text of arguments and expansions, so the quoting, truncation and
+   module names of the text form are applied here.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "m4/trace.h"
+
+#include "binary-io.h"
+#include "closeout.h"
+#include "error.h"
+#include "gettext.h"
+#include "getopt.h"
+#include "progname.h"
+#include "propername.h"
+#include "quotearg.h"
+#include "version-etc.h"
+#include "xalloc.h"
+
+#define _(msgid) gettext (msgid)
+
+#define AUTHORS proper_name ("Eric Blake")
+
+#define STREQ(a, b) (strcmp (a, b) == 0)
+
+/* A string defined by an M4_TRACE_STRING record.  */
+typedef struct {
+  char *str;
+  uint32_t len;
+} trace_string;
+
+/* Quotes and truncation length defined by an M4_TRACE_SETTINGS
+   record.  */
+typedef struct {
+  trace_string lquote;
+  trace_string rquote;
+  uint64_t max_len;
+  bool defined;
+} trace_settings;
+
+/* Strings seen since the last file header, indexed by id.  */
+static trace_string *strings;
+static size_t strings_count;
+
+/* Settings seen since the last file header, indexed by id.  */
+static trace_settings *settings;
+static size_t settings_count;
+
+/* Storage for the current record.  */
+static char *payload;
+static size_t payload_size;
+
+enum
+{
+  HELP_OPTION = CHAR_MAX + 1,
+  VERSION_OPTION
+};
+
+static const struct option long_options[] =
+{
+  {"help", no_argument, NULL, HELP_OPTION},
+  {"version", no_argument, NULL, VERSION_OPTION},
+  { NULL, 0, NULL, 0 },
+};
+
+/* Print a usage message and exit with STATUS.  */
+static void
+usage (int status)
+{
+  if (status != EXIT_SUCCESS)
+    fprintf (stderr, _("Try `%s --help' for more information.\n"),
+             program_name);
+  else
+    {
+      printf (_("Usage: %s [OPTION]... [FILE]...\n"), program_name);
+      fputs (_("\
+Print the binary trace in FILEs, as written by `m4 --trace-format=binary',\n\
+in the text form that m4 would otherwise have used.\n\
+If no FILE or if FILE is `-', standard input is read.\n\
+"), stdout);
+      puts ("");
+      fputs (_("\
+      --help                   display this help and exit\n\
+      --version                output version information and exit\n\
+"), stdout);
+      emit_bug_reporting_address ();
+    }
+  exit (status);
+}
+
+/* Report the problem MESSAGE with the trace FILE, including errno
+   value ERRNUM if it is non-zero, and exit.  */
+static void
+bad_trace (const char *file, int errnum, const char *message)
+{
+  error (EXIT_FAILURE, errnum, "%s: %s",
+         quotearg_style (locale_quoting_style, file), message);
+}
+
+/* Forget all strings and settings, at the start of a new stream.  */
+static void
+strings_reset (void)
+{
+  size_t i;
+
+  for (i = 0; i < strings_count; i++)
+    free (strings[i].str);
+  free (strings);
+  strings = NULL;
+  strings_count = 0;
+  for (i = 0; i < settings_count; i++)
+    {
+      free (settings[i].lquote.str);
+      free (settings[i].rquote.str);
+    }
+  free (settings);
+  settings = NULL;
+  settings_count = 0;
+}
+
+/* Return the string with id ID, which must have been defined earlier
+   in the trace FILE.  */
+static const trace_string *
+string_lookup (const char *file, uint32_t id)
+{
+  if (id == 0 || strings_count <= id || !strings[id].str)
+    error (EXIT_FAILURE, 0, _("%s: undefined string id %" PRIu32),
+           quotearg_style (locale_quoting_style, file), id);
+  return &strings[id];
+}
+
+/* Return the settings with id ID, which must have been defined earlier
+   in the trace FILE.  */
+static const trace_settings *
+settings_lookup (const char *file, uint32_t id)
+{
+  if (id == 0 || settings_count <= id || !settings[id].defined)
+    error (EXIT_FAILURE, 0, _("%s: undefined settings id %" PRIu32),
+           quotearg_style (locale_quoting_style, file), id);
+  return &settings[id];
+}
+
+/* Print LEN bytes of STR.  */
+static void
+print_mem (const char *str, size_t len)
+{
+  fwrite (str, 1, len, stdout);
+}
+
+/* Print ITEM of RECORD from FILE, whose bytes start at DATA, as
+   m4__symbol_value_print in m4/symtab.c would; if QUOTE, surround
+   text with the quotes in effect.  m4 stops recording arguments after
+   one that is truncated, so that need not be done here.  */
+static void
+print_item (const char *file, const m4_trace_record *record,
+            const m4_trace_item *item, const char *data, bool quote)
+{
+  const trace_settings *set;
+
+  switch (item->kind)
+    {
+    case M4_TRACE_TEXT:
+      set = settings_lookup (file, item->settings);
+      if (quote)
+        print_mem (set->lquote.str, set->lquote.len);
+      print_mem (data, item->size);
+      if (set->max_len <= item->len)
+        fputs ("...", stdout);
+      if (quote)
+        print_mem (set->rquote.str, set->rquote.len);
+      break;
+
+    case M4_TRACE_FUNC:
+      putchar ('<');
+      print_mem (data, item->size);
+      putchar ('>');
+      break;
+
+    case M4_TRACE_PLACEHOLDER:
+      fputs ("<<", stdout);
+      print_mem (data, item->size);
+      fputs (">>", stdout);
+      break;
+
+    case M4_TRACE_FORMATTED:
+      print_mem (data, item->size);
+      return;
+
+    default:
+      bad_trace (file, 0, _("corrupt trace record"));
+    }
+  if (item->module && (record->flags & M4_TRACE_SHOW_MODULE))
+    {
+      putchar ('{');
+      print_mem (data + item->size, item->module);
+      putchar ('}');
+    }
+}
+
+/* Print the header of a trace line for RECORD from FILE, as
+   trace_header in m4/macro.c does.  */
+static void
+print_trace_header (const char *file, const m4_trace_record *record)
+{
+  fputs ("m4trace:", stdout);
+  if (record->flags & M4_TRACE_SHOW_FILE)
+    {
+      const trace_string *name = string_lookup (file, record->file);
+      print_mem (name->str, name->len);
+      putchar (':');
+    }
+  if (record->flags & M4_TRACE_SHOW_LINE)
+    printf ("%" PRIu32 ":", record->line);
+  printf (" -%" PRIu32 "- ", record->level);
+  if (record->flags & M4_TRACE_SHOW_CALLID)
+    printf ("id %" PRIu64 ": ", record->call_id);
+}
+
+/* Check that ITEM lies within the SIZE bytes of its record in FILE.  */
+static void
+check_item (const char *file, const m4_trace_item *item, size_t size)
+{
+  if (size < item->offset || size - item->offset < item->size
+      || size - item->offset - item->size < item->module)
+    bad_trace (file, 0, _("corrupt trace record"));
+}
+
+/* Define the string in the record from FILE held in the first SIZE
+   bytes of PAYLOAD.  */
+static void
+define_string (const char *file, size_t size)
+{
+  m4_trace_string record;
+
+  if (size < sizeof record)
+    bad_trace (file, 0, _("corrupt trace record"));
+  memcpy (&record, payload, sizeof record);
+  if (record.id == 0 || size - sizeof record < record.len)
+    bad_trace (file, 0, _("corrupt trace record"));
+  if (strings_count <= record.id)
+    {
+      size_t old = strings_count;
+      strings_count = record.id + 1;
+      strings = xnrealloc (strings, strings_count, sizeof *strings);
+      memset (strings + old, 0, (strings_count - old) * sizeof *strings);
+    }
+  free (strings[record.id].str);
+  strings[record.id].str = xmemdup (payload + sizeof record, record.len);
+  strings[record.id].len = record.len;
+}
+
+/* Define the settings in the record from FILE held in the first SIZE
+   bytes of PAYLOAD.  */
+static void
+define_settings (const char *file, size_t size)
+{
+  m4_trace_settings record;
+  trace_settings *set;
+  const char *p = payload + sizeof record;
+
+  if (size < sizeof record)
+    bad_trace (file, 0, _("corrupt trace record"));
+  memcpy (&record, payload, sizeof record);
+  if (record.id == 0 || size - sizeof record < record.lquote_len
+      || size - sizeof record - record.lquote_len < record.rquote_len)
+    bad_trace (file, 0, _("corrupt trace record"));
+  if (settings_count <= record.id)
+    {
+      size_t old = settings_count;
+      settings_count = record.id + 1;
+      settings = xnrealloc (settings, settings_count, sizeof *settings);
+      memset (settings + old, 0, (settings_count - old) * sizeof *settings);
+    }
+  set = &settings[record.id];
+  free (set->lquote.str);
+  free (set->rquote.str);
+  set->lquote.str = xmemdup (p, record.lquote_len);
+  set->lquote.len = record.lquote_len;
+  set->rquote.str = xmemdup (p + record.lquote_len, record.rquote_len);
+  set->rquote.len = record.rquote_len;
+  set->max_len = record.max_len;
+  set->defined = true;
+}
+
+/* Print the record from FILE held in the first SIZE bytes of
+   PAYLOAD.  */
+static void
+print_record (const char *file, size_t size)
+{
+  m4_trace_record record;
+  m4_trace_item item;
+  const trace_string *name;
+  bool quote;
+  uint32_t i;
+
+  if (size < sizeof record)
+    bad_trace (file, 0, _("corrupt trace record"));
+  memcpy (&record, payload, sizeof record);
+  if ((size - sizeof record) / sizeof item < record.count)
+    bad_trace (file, 0, _("corrupt trace record"));
+  quote = (record.flags & M4_TRACE_SHOW_QUOTE) != 0;
+
+  switch (record.type)
+    {
+    case M4_TRACE_CALL:
+      name = string_lookup (file, record.id);
+      print_trace_header (file, &record);
+      print_mem (name->str, name->len);
+      if (record.count)
+        {
+          putchar ('(');
+          for (i = 0; i < record.count; i++)
+            {
+              memcpy (&item, payload + sizeof record + i * sizeof item,
+                      sizeof item);
+              check_item (file, &item, size);
+              if (i)
+                fputs (", ", stdout);
+              print_item (file, &record, &item, payload + item.offset, quote);
+            }
+          putchar (')');
+        }
+      if (record.flags & M4_TRACE_HAS_EXPANSION)
+        {
+          check_item (file, &record.expansion, size);
+          fputs (" -> ", stdout);
+          print_item (file, &record, &record.expansion,
+                      payload + record.expansion.offset, quote);
+        }
+      putchar ('\n');
+      break;
+
+    case M4_TRACE_COLLECT:
+      if (record.count != 1)
+        bad_trace (file, 0, _("corrupt trace record"));
+      memcpy (&item, payload + sizeof record, sizeof item);
+      check_item (file, &item, size);
+      name = string_lookup (file, record.id);
+      print_trace_header (file, &record);
+      print_mem (name->str, name->len);
+      fputs (" ... = ", stdout);
+      print_item (file, &record, &item, payload + item.offset, quote);
+      putchar ('\n');
+      break;
+
+    case M4_TRACE_MESSAGE:
+      if (record.count != 1)
+        bad_trace (file, 0, _("corrupt trace record"));
+      memcpy (&item, payload + sizeof record, sizeof item);
+      check_item (file, &item, size);
+      fputs ("m4debug:", stdout);
+      if (record.line)
+        {
+          if (record.flags & M4_TRACE_SHOW_FILE)
+            {
+              const trace_string *where = string_lookup (file, record.file);
+              print_mem (where->str, where->len);
+              putchar (':');
+            }
+          if (record.flags & M4_TRACE_SHOW_LINE)
+            printf ("%" PRIu32 ":", record.line);
+        }
+      putchar (' ');
+      print_mem (payload + item.offset, item.size);
+      putchar ('\n');
+      break;
+
+    default:
+      /* Records from a newer m4 are skipped.  */
+      break;
+    }
+}
+
+/* Check the file header of FILE, whose first bytes are already in
+   HEADER, after reading the rest of it from FP.  */
+static void
+read_header (const char *file, FILE *fp, m4_trace_file_header *header)
+{
+  if (fread (header->magic + M4_TRACE_MAGIC_LEN, 1,
+             sizeof *header - M4_TRACE_MAGIC_LEN, fp)
+      != sizeof *header - M4_TRACE_MAGIC_LEN)
+    bad_trace (file, 0, _("truncated trace"));
+  if (header->byte_order != M4_TRACE_BYTE_ORDER)
+    bad_trace (file, 0, _("trace has wrong byte order"));
+  if (M4_TRACE_VERSION < header->version)
+    error (EXIT_FAILURE, 0, _("%s: trace version %" PRIu32 " is too new"),
+           quotearg_style (locale_quoting_style, file), header->version);
+  if (header->version < M4_TRACE_VERSION)
+    error (EXIT_FAILURE, 0, _("%s: trace version %" PRIu32 " is too old"),
+           quotearg_style (locale_quoting_style, file), header->version);
+  strings_reset ();
+}
+
+/* Print the trace in FILE, opened as FP.  */
+static void
+dump_trace (const char *file, FILE *fp)
+{
+  union {
+    m4_trace_file_header header;
+    uint32_t prefix[2];
+  } u;
+  bool seen_header = false;
+
+  while (1)
+    {
+      size_t len = fread (&u, 1, M4_TRACE_MAGIC_LEN, fp);
+      size_t size;
+
+      if (len == 0 && !ferror (fp))
+        break;
+      if (len != M4_TRACE_MAGIC_LEN)
+        bad_trace (file, ferror (fp) ? errno : 0, _("truncated trace"));
+      if (memcmp (u.header.magic, M4_TRACE_MAGIC, M4_TRACE_MAGIC_LEN) == 0)
+        {
+          read_header (file, fp, &u.header);
+          seen_header = true;
+          continue;
+        }
+      if (!seen_header)
+        bad_trace (file, 0, _("not an m4 binary trace"));
+      size = u.prefix[1];
+      if (size < sizeof u.prefix || size % 8)
+        bad_trace (file, 0, _("corrupt trace record"));
+      if (payload_size < size)
+        {
+          payload_size = size;
+          payload = xrealloc (payload, payload_size);
+        }
+      memcpy (payload, u.prefix, sizeof u.prefix);
+      if (fread (payload + sizeof u.prefix, 1, size - sizeof u.prefix, fp)
+          != size - sizeof u.prefix)
+        bad_trace (file, ferror (fp) ? errno : 0, _("truncated trace"));
+      switch (u.prefix[0])
+        {
+        case M4_TRACE_STRING:
+          define_string (file, size);
+          break;
+        case M4_TRACE_SETTINGS:
+          define_settings (file, size);
+          break;
+        default:
+          print_record (file, size);
+          break;
+        }
+    }
+  strings_reset ();
+}
+
+int
+main (int argc, char *const *argv)
+{
+  int optchar;
+  int i;
+
+  set_program_name (argv[0]);
+  atexit (close_stdout);
+
+  setlocale (LC_ALL, "");
+#ifdef ENABLE_NLS
+  textdomain (PACKAGE);
+#endif
+
+  while ((optchar = getopt_long (argc, argv, "", long_options, NULL)) != -1)
+    switch (optchar)
+      {
+      case HELP_OPTION:
+        usage (EXIT_SUCCESS);
+
+      case VERSION_OPTION:
+        version_etc (stdout, "m4-trace-dump", PACKAGE_NAME, VERSION, AUTHORS,
+                     NULL);
+        exit (EXIT_SUCCESS);
+
+      default:
+        usage (EXIT_FAILURE);
+      }
+
+  if (optind == argc)
+    {
+      set_binary_mode (STDIN_FILENO, O_BINARY);
+      dump_trace ("-", stdin);
+    }
+  for (i = optind; i < argc; i++)
+    {
+      if (STREQ (argv[i], "-"))
+        {
+          set_binary_mode (STDIN_FILENO, O_BINARY);
+          dump_trace (argv[i], stdin);
+        }
+      else
+        {
+          FILE *fp = fopen (argv[i], "rb");
+          if (!fp)
+            error (EXIT_FAILURE, errno, "%s",
+                   quotearg_style (locale_quoting_style, argv[i]));
+          dump_trace (argv[i], fp);
+          fclose (fp);
+        }
+    }
+  free (payload);
+  return EXIT_SUCCESS;
+}